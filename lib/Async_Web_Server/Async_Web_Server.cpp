@@ -0,0 +1,1098 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    An event-driven web server for the ESP8266 with the same interface as
+    ESP8266WebServer, so handlers written for one work with the other.
+
+    ESP8266WebServer serves one client at a time and waits for it: a slow phone
+    reading a large file holds up loop() until the file has been sent. This
+    server keeps a state machine for up to ASYNC_CLIENTS_MAX clients, and each
+    call to handleClient() only does as much for each client as its connection
+    can take without waiting: read what has arrived, and write what fits in the
+    socket. Files given to streamFile() are sent a piece at a time this way,
+    and connections are kept alive between requests.
+
+    Handlers still run to the end when a request is complete. Their output is
+    held in a buffer of ASYNC_OUTPUT_MAX bytes per client, and a handler only
+    waits for the client if it prints more than that, so anything large should
+    be sent with streamFile(), or with streamContent(), which takes a function
+    that prints the body a piece at a time and calls it again each time the
+    client has read the piece before. Multipart uploads are passed to the
+    upload handler a buffer at a time as they arrive, one upload at a time.
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include "Async_Web_Server.h"
+#include "LittleFS.h"
+
+//Bytes read from a client's body or upload per call to handleClient()
+#define ASYNC_READ_SLICE 512
+
+//Placeholder for the size of a chunk printed by streamContent(), filled in once the chunk has been printed
+#define ASYNC_PIECE_HEAD "000000\r\n"
+#define ASYNC_PIECE_HEAD_LENGTH 8
+
+//Adds everything printed to it to a String
+class String_Print : public Print{
+    public:
+        String_Print(String& text) : text(text){}
+
+        size_t write(uint8_t c){
+            return text.concat((char)c) ? 1 : 0;
+        }
+
+        size_t write(const uint8_t* data, size_t size){
+            return text.concat((const char*)data, size) ? size : 0;
+        }
+
+    private:
+        String& text;
+};
+
+/*  (private) url_decode: Decode a URL-encoded string
+        text: Encoded string
+    RETURNS the decoded string
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static String url_decode(const String& text){
+    String decoded;
+    decoded.reserve(text.length());
+    for(unsigned i = 0; i < text.length(); i++){
+        char c = text[i];
+        if(c == '+'){
+            decoded += ' ';
+        }else if(c == '%' && i + 2 < text.length()){
+            char hex[3] = {text[i + 1], text[i + 2], '\0'};
+            decoded += (char)strtol(hex, NULL, 16);
+            i += 2;
+        }else{
+            decoded += c;
+        }
+    }
+    return decoded;
+}
+
+/*  (private) status_text: Get the reason phrase of an HTTP status code
+        code: HTTP status code
+    RETURNS reason phrase
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static const char* status_text(int code){
+    switch(code){
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+    }
+    return "";
+}
+
+/*  Async_Web_Server Constructor
+        port: TCP port to listen on
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+Async_Web_Server::Async_Web_Server(uint16_t port) : listener(port){
+    for(uint8_t i = 0; i < ASYNC_CLIENTS_MAX; i++){
+        clients[i].state = ASYNC_FREE;
+        clients[i].output = NULL;
+    }
+}
+
+/*  begin: Start listening for clients
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::begin(){
+    listener.begin();
+    listener.setNoDelay(true);
+}
+
+/*  on: Set the handler for a path
+        uri: Path
+        method: HTTP method, or HTTP_ANY
+        handler: Called once the request has been read
+        upload_handler: Called for each buffer of a multipart upload
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::on(const String& uri, HTTPMethod method, THandlerFunction handler, THandlerFunction upload_handler){
+    if(route_count == ASYNC_ROUTES_MAX) return;
+    routes[route_count++] = {uri, method, handler, upload_handler};
+}
+
+void Async_Web_Server::on(const String& uri, HTTPMethod method, THandlerFunction handler){
+    on(uri, method, handler, NULL);
+}
+
+void Async_Web_Server::on(const String& uri, THandlerFunction handler){
+    on(uri, HTTP_ANY, handler, NULL);
+}
+
+/*  onNotFound: Set the handler for paths without one
+        handler:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::onNotFound(THandlerFunction handler){
+    not_found = handler;
+}
+
+/*  collectHeaders: Set the request headers that can be read with header()
+        header_keys: Header names
+        count: Number of header names
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::collectHeaders(const char* header_keys[], size_t count){
+    header_key_count = 0;
+    for(size_t i = 0; i < count && i < ASYNC_HEADERS_MAX; i++){
+        this->header_keys[header_key_count++] = header_keys[i];
+    }
+}
+
+/*  handleClient: Make as much progress with each client as can be made without waiting for it.
+        Call every loop, or as often as possible.
+    read_only: If true, only GET and HEAD requests are handled. Any other request waits, with its
+        headers and body unread, for a pass that isn't read-only.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::handleClient(bool read_only){
+    //A handler that waits on something that calls this again mustn't start another request
+    if(current) return;
+
+    this->read_only = read_only;
+    accept();
+    for(uint8_t i = 0; i < ASYNC_CLIENTS_MAX; i++){
+        if(clients[i].state != ASYNC_FREE) process(clients[i]);
+    }
+}
+
+/*  (private) accept: Take a waiting client if there is room for it. If there isn't, the client that has
+        been idle the longest between requests is closed to make room.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::accept(){
+    if(!listener.hasClient()) return;
+
+    connection* slot = NULL;
+    connection* idle = NULL;
+    for(uint8_t i = 0; i < ASYNC_CLIENTS_MAX; i++){
+        if(clients[i].state == ASYNC_FREE){
+            slot = &clients[i];
+            break;
+        }
+        //Kept-alive clients waiting for their next request
+        if(clients[i].state == ASYNC_REQUEST_LINE && clients[i].line.length() == 0 && !clients[i].client.available()){
+            if(!idle || clients[i].millis < idle->millis) idle = &clients[i];
+        }
+    }
+    if(!slot && idle){
+        close(*idle);
+        slot = idle;
+    }
+    //If every client is busy, the new one waits until one is done
+    if(!slot) return;
+
+    slot->output = (uint8_t*)malloc(ASYNC_OUTPUT_MAX);
+    if(!slot->output) return;
+    slot->client = listener.available();
+    slot->client.setNoDelay(true);
+    slot->output_start = 0;
+    slot->output_end = 0;
+    slot->source_left = 0;
+    reset(*slot);
+}
+
+/*  (private) held: Check if a client's request has to wait for a pass that isn't read-only
+        client:
+    RETURNS true if the request is known and isn't a GET or HEAD request during a read-only pass
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Async_Web_Server::held(connection& client){
+    if(!read_only) return false;
+    if(client.state != ASYNC_HEADERS && client.state != ASYNC_BODY && client.state != ASYNC_UPLOAD) return false;
+    return client.method != HTTP_GET && client.method != HTTP_HEAD;
+}
+
+/*  (private) process: Make progress with a client without waiting for it
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::process(connection& client){
+    //If the client has gone, forget it
+    if(!client.client.connected() && !client.client.available()){
+        close(client);
+        return;
+    }
+
+    //A request that could change something is held, without timing out, until it can be handled
+    if(held(client)){
+        client.millis = millis();
+        return;
+    }
+
+    connection_state state = client.state;
+    if(state == ASYNC_REQUEST_LINE || state == ASYNC_HEADERS){
+        read_request(client);
+    }else if(state == ASYNC_BODY){
+        read_body(client);
+    }else if(state == ASYNC_UPLOAD){
+        read_upload(client);
+    }
+
+    //Start sending the response straight away
+    if(client.state == ASYNC_RESPONSE) write_response(client);
+
+    //If the client hasn't done anything for too long, close it
+    if(client.state != ASYNC_FREE && millis() - client.millis > ASYNC_TIMEOUT) close(client);
+}
+
+/*  (private) read_request: Read the request line and headers as they arrive
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::read_request(connection& client){
+    int budget = ASYNC_LINE_MAX;
+    while(budget-- > 0 && client.client.available() && (client.state == ASYNC_REQUEST_LINE || client.state == ASYNC_HEADERS) && !held(client)){
+        char c = client.client.read();
+        client.millis = millis();
+
+        if(c == '\r') continue;
+        if(c != '\n'){
+            if(client.line.length() == ASYNC_LINE_MAX){
+                error(client, 431, "431: Request Header Fields Too Large");
+                return;
+            }
+            client.line += c;
+            continue;
+        }
+
+        //A whole line has arrived
+        if(client.state == ASYNC_REQUEST_LINE){
+            //Blank lines between requests are skipped
+            if(client.line.length()) parse_request_line(client);
+        }else if(client.line.length() == 0){
+            headers_done(client);
+        }else{
+            parse_header(client);
+        }
+        client.line = "";
+    }
+}
+
+/*  (private) parse_request_line: Read the method, path and version of a request
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::parse_request_line(connection& client){
+    int first_space = client.line.indexOf(' ');
+    int second_space = client.line.indexOf(' ', first_space + 1);
+    if(first_space < 0 || second_space < 0){
+        error(client, 400, "400: Bad Request");
+        return;
+    }
+
+    String method = client.line.substring(0, first_space);
+    String url = client.line.substring(first_space + 1, second_space);
+    client.http_1_1 = client.line.substring(second_space + 1) == "HTTP/1.1";
+    client.keep_alive = client.http_1_1;
+
+    if(method == "GET") client.method = HTTP_GET;
+    else if(method == "POST") client.method = HTTP_POST;
+    else if(method == "PUT") client.method = HTTP_PUT;
+    else if(method == "PATCH") client.method = HTTP_PATCH;
+    else if(method == "DELETE") client.method = HTTP_DELETE;
+    else if(method == "HEAD") client.method = HTTP_HEAD;
+    else if(method == "OPTIONS") client.method = HTTP_OPTIONS;
+    else{
+        error(client, 501, "501: Not Implemented");
+        return;
+    }
+
+    //Split the query from the path
+    int question = url.indexOf('?');
+    if(question >= 0){
+        client.query = url.substring(question + 1);
+        url = url.substring(0, question);
+    }
+    client.uri = url_decode(url);
+    client.state = ASYNC_HEADERS;
+}
+
+/*  (private) parse_header: Read a request header, keeping the ones the server needs and the ones
+        set with collectHeaders()
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::parse_header(connection& client){
+    int colon = client.line.indexOf(':');
+    if(colon < 0) return;
+    String name = client.line.substring(0, colon);
+    String value = client.line.substring(colon + 1);
+    value.trim();
+
+    if(name.equalsIgnoreCase("Content-Length")){
+        client.content_length = value.toInt();
+    }else if(name.equalsIgnoreCase("Content-Type")){
+        client.content_type = value;
+    }else if(name.equalsIgnoreCase("Connection")){
+        value.toLowerCase();
+        if(value.indexOf("close") >= 0) client.keep_alive = false;
+        if(value.indexOf("keep-alive") >= 0) client.keep_alive = true;
+    }
+
+    for(uint8_t i = 0; i < header_key_count; i++){
+        if(name.equalsIgnoreCase(header_keys[i])) client.headers[i] = value;
+    }
+}
+
+/*  (private) headers_done: Decide how to read the body once the headers have been read
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::headers_done(connection& client){
+    if(client.content_length == 0){
+        dispatch(client);
+        return;
+    }
+
+    //Forms are read whole, uploads are handed to the upload handler as they arrive
+    if(!client.content_type.startsWith("multipart/form-data")){
+        if(client.content_length > ASYNC_BODY_MAX){
+            error(client, 413, "413: Payload Too Large");
+            return;
+        }
+        client.state = ASYNC_BODY;
+        return;
+    }
+
+    route* handler = find_route(client);
+    if(!handler || !handler->upload_handler){
+        error(client, 404, "404: Not Found");
+        return;
+    }
+    if(uploader){
+        error(client, 503, "503: Another Upload Is In Progress");
+        return;
+    }
+    current_upload = new HTTPUpload();
+    if(!current_upload){
+        error(client, 503, "503: Out Of Memory");
+        return;
+    }
+
+    //The boundary is only ever found after a line break, so the first one is matched as if it follows one
+    int position = client.content_type.indexOf("boundary=");
+    String name = position < 0 ? String("") : client.content_type.substring(position + 9);
+    if(name.startsWith("\"")) name = name.substring(1, name.length() - 1);
+    boundary = "\r\n--" + name;
+    boundary_match = 2;
+    boundary_line = false;
+    upload_is_file = false;
+    upload_stage = UPLOAD_PREAMBLE;
+    uploader = &client;
+    upload_route = handler;
+    client.state = ASYNC_UPLOAD;
+}
+
+/*  (private) read_body: Read a form body as it arrives, and handle the request once it's all there
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::read_body(connection& client){
+    char buffer[64];
+    int budget = ASYNC_READ_SLICE;
+    while(budget > 0 && client.received < client.content_length && client.client.available()){
+        size_t length = client.content_length - client.received;
+        if(length > sizeof(buffer)) length = sizeof(buffer);
+        length = client.client.read((uint8_t*)buffer, length);
+        if(!length) break;
+        client.body.concat(buffer, length);
+        client.received += length;
+        budget -= length;
+        client.millis = millis();
+    }
+
+    if(client.received == client.content_length) dispatch(client);
+}
+
+/*  (private) read_upload: Pass a multipart upload to the upload handler as it arrives, and handle the
+        request once it's all there
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::read_upload(connection& client){
+    uint8_t buffer[128];
+    int budget = ASYNC_READ_SLICE * 4;
+    while(budget > 0 && client.received < client.content_length && client.client.available()){
+        size_t length = client.content_length - client.received;
+        if(length > sizeof(buffer)) length = sizeof(buffer);
+        length = client.client.read(buffer, length);
+        if(!length) break;
+        for(size_t i = 0; i < length; i++) upload_byte(client, buffer[i]);
+        client.received += length;
+        budget -= length;
+        client.millis = millis();
+    }
+
+    if(client.received < client.content_length) return;
+
+    //If the upload ended early, let the handler know
+    if(upload_stage != UPLOAD_DONE && upload_is_file){
+        current_upload->status = UPLOAD_FILE_ABORTED;
+        current = &client;
+        upload_route->upload_handler();
+        current = NULL;
+    }
+    dispatch(client);
+}
+
+/*  (private) upload_byte: Add a byte of a multipart upload to the upload buffer, looking for the
+        boundary between parts
+        client:
+        c: Byte
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::upload_byte(connection& client, uint8_t c){
+    //Headers of a part, including the rest of the line after the boundary
+    if(upload_stage == UPLOAD_PART_HEADERS){
+        if(c == '\r') return;
+        if(c != '\n'){
+            if(client.line.length() < ASYNC_LINE_MAX) client.line += (char)c;
+            return;
+        }
+        if(boundary_line){
+            //"--" after the boundary means it was the last one
+            boundary_line = false;
+            if(client.line == "--") upload_stage = UPLOAD_DONE;
+        }else if(client.line.length() == 0){
+            //The data of the part starts after a blank line
+            upload_stage = UPLOAD_PART_DATA;
+            boundary_match = 0;
+            if(upload_is_file){
+                //Let the handler read the query as it starts, as it can with ESP8266WebServer. The arguments
+                //are read again for the request handler, since other requests can be handled during the upload.
+                argument_count = 0;
+                parse_args(client.query);
+                current_upload->status = UPLOAD_FILE_START;
+                current_upload->totalSize = 0;
+                current_upload->currentSize = 0;
+                current = &client;
+                upload_route->upload_handler();
+                current = NULL;
+            }
+        }else{
+            upload_part_header(client);
+        }
+        client.line = "";
+        return;
+    }
+
+    if(upload_stage == UPLOAD_DONE) return;
+
+    //Look for the boundary. None of its characters after the first are line breaks, so when a byte doesn't
+    //match, the boundary can only start again at that byte.
+    if(c == (uint8_t)boundary[boundary_match]){
+        boundary_match++;
+        if(boundary_match < boundary.length()) return;
+
+        //The boundary ends the current part
+        if(upload_stage == UPLOAD_PART_DATA && upload_is_file){
+            upload_flush(client);
+            current_upload->status = UPLOAD_FILE_END;
+            current = &client;
+            upload_route->upload_handler();
+            current = NULL;
+        }
+        upload_stage = UPLOAD_PART_HEADERS;
+        upload_is_file = false;
+        boundary_line = true;
+        boundary_match = 0;
+        client.line = "";
+        return;
+    }
+
+    //Bytes that looked like the start of the boundary are data after all
+    uint8_t matched = boundary_match;
+    boundary_match = c == (uint8_t)boundary[0] ? 1 : 0;
+    if(upload_stage != UPLOAD_PART_DATA || !upload_is_file) return;
+
+    for(uint8_t i = 0; i <= matched; i++){
+        //The byte that didn't match is data too, unless it starts the boundary again
+        if(i == matched && boundary_match) break;
+        current_upload->buf[current_upload->currentSize++] = i < matched ? boundary[i] : c;
+        if(current_upload->currentSize == HTTP_UPLOAD_BUFLEN) upload_flush(client);
+    }
+}
+
+/*  (private) upload_part_header: Read a header of a part of a multipart upload
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::upload_part_header(connection& client){
+    String& line = client.line;
+    if(line.startsWith("Content-Disposition") || line.startsWith("content-disposition")){
+        //Only parts with a filename are files
+        int name = line.indexOf(" name=\"");
+        int filename = line.indexOf("filename=\"");
+        if(name >= 0){
+            current_upload->name = line.substring(name + 7, line.indexOf('"', name + 7));
+        }
+        if(filename >= 0){
+            current_upload->filename = line.substring(filename + 10, line.indexOf('"', filename + 10));
+            upload_is_file = true;
+        }
+    }else if(line.startsWith("Content-Type") || line.startsWith("content-type")){
+        current_upload->type = line.substring(line.indexOf(':') + 1);
+        current_upload->type.trim();
+    }
+}
+
+/*  (private) upload_flush: Pass the bytes in the upload buffer to the upload handler
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::upload_flush(connection& client){
+    if(!current_upload->currentSize) return;
+    current_upload->status = UPLOAD_FILE_WRITE;
+    current_upload->totalSize += current_upload->currentSize;
+    current = &client;
+    upload_route->upload_handler();
+    current = NULL;
+    current_upload->currentSize = 0;
+}
+
+/*  (private) find_route: Find the handler for a client's request
+        client:
+    RETURNS the route, or NULL if there isn't one
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+Async_Web_Server::route* Async_Web_Server::find_route(connection& client){
+    for(uint8_t i = 0; i < route_count; i++){
+        if(routes[i].uri == client.uri && (routes[i].method == HTTP_ANY || routes[i].method == client.method)){
+            return &routes[i];
+        }
+    }
+    return NULL;
+}
+
+/*  (private) parse_args: Add the arguments in a query or form body to the arguments of the request
+        text: URL-encoded arguments
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::parse_args(const String& text){
+    unsigned start = 0;
+    while(start < text.length() && argument_count < ASYNC_ARGS_MAX){
+        int end = text.indexOf('&', start);
+        if(end < 0) end = text.length();
+
+        String pair = text.substring(start, end);
+        int equals = pair.indexOf('=');
+        argument& arg = arguments[argument_count++];
+        if(equals < 0){
+            arg.name = url_decode(pair);
+            arg.value = "";
+        }else{
+            arg.name = url_decode(pair.substring(0, equals));
+            arg.value = url_decode(pair.substring(equals + 1));
+        }
+        start = end + 1;
+    }
+}
+
+/*  (private) dispatch: Call the handler for a request that has been read
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::dispatch(connection& client){
+    //Read the arguments from the query, and from the body if it's a form
+    argument_count = 0;
+    parse_args(client.query);
+    if(client.body.length()){
+        if(client.content_type.startsWith("application/x-www-form-urlencoded")){
+            parse_args(client.body);
+        }else if(argument_count < ASYNC_ARGS_MAX){
+            arguments[argument_count++] = {"plain", client.body};
+        }
+    }
+
+    client.state = ASYNC_RESPONSE;
+    current = &client;
+    route* handler = find_route(client);
+    if(handler){
+        handler->handler();
+    }else if(not_found){
+        not_found();
+    }else{
+        send(404, "text/plain", "404: Not Found");
+    }
+
+    //If the handler didn't reply, or didn't finish a chunked reply that it isn't streaming, finish it for it
+    if(!client.started){
+        send(500, "text/plain", "500: No Response");
+    }else if(client.chunked && !client.finished && !client.content){
+        sendContent("");
+    }
+    current = NULL;
+
+    //The upload, if there was one, is over
+    if(uploader == &client){
+        delete current_upload;
+        current_upload = NULL;
+        uploader = NULL;
+    }
+
+    //The request's memory isn't needed while the response is sent
+    client.query = String();
+    client.body = String();
+    client.content_type = String();
+    for(uint8_t i = 0; i < header_key_count; i++) client.headers[i] = String();
+    for(uint8_t i = 0; i < argument_count; i++) arguments[i] = {String(), String()};
+    argument_count = 0;
+}
+
+/*  (private) error: Reply to a request that can't be handled and close the connection once the reply has
+        been sent, without reading the rest of the request
+        client:
+        code: HTTP status code
+        message: Text of the reply
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::error(connection& client, int code, const char* message){
+    client.keep_alive = false;
+    client.response_headers = "";
+    client.response_length = ASYNC_LENGTH_NOT_SET;
+    client.state = ASYNC_RESPONSE;
+    start_response(client, code, "text/plain", strlen(message));
+    queue(client, message, strlen(message));
+}
+
+/*  (private) start_response: Queue the status line and headers of a response
+        client:
+        code: HTTP status code
+        content_type:
+        length: Length of the body, or CONTENT_LENGTH_UNKNOWN to send it in chunks
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::start_response(connection& client, int code, const String& content_type, size_t length){
+    String head = "HTTP/1.1 " + String(code) + " " + status_text(code) + "\r\n";
+    if(content_type.length()) head += "Content-Type: " + content_type + "\r\n";
+
+    if(length == CONTENT_LENGTH_UNKNOWN){
+        //Without chunks, the end of the body can only be shown by closing the connection
+        if(client.http_1_1){
+            head += "Transfer-Encoding: chunked\r\n";
+            client.chunked = true;
+        }else{
+            client.keep_alive = false;
+        }
+    }else{
+        head += "Content-Length: " + String((unsigned long)length) + "\r\n";
+    }
+    head += client.keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    head += client.response_headers;
+    head += "\r\n";
+    client.response_headers = "";
+
+    client.started = true;
+    queue(client, head.c_str(), head.length());
+}
+
+/*  send: Send a response to the request being handled. Only the first response is sent.
+        code: HTTP status code
+        content_type:
+        content: Body of the response
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::send(int code, const char* content_type, const String& content){
+    if(!current || current->started) return;
+
+    size_t length = current->response_length == ASYNC_LENGTH_NOT_SET ? content.length() : current->response_length;
+    start_response(*current, code, content_type ? content_type : "", length);
+    if(content.length()) sendContent(content);
+}
+
+void Async_Web_Server::send(int code, const String& content_type, const String& content){
+    send(code, content_type.c_str(), content);
+}
+
+/*  sendHeader: Add a header to the response to the request being handled
+        name:
+        value:
+        first: True to put the header before the others
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::sendHeader(const String& name, const String& value, bool first){
+    if(!current) return;
+    String header = name + ": " + value + "\r\n";
+    if(first){
+        current->response_headers = header + current->response_headers;
+    }else{
+        current->response_headers += header;
+    }
+}
+
+/*  setContentLength: Set the length of the body of the response to the request being handled
+        length: Length in bytes, or CONTENT_LENGTH_UNKNOWN to send it in chunks with sendContent()
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::setContentLength(size_t length){
+    if(current) current->response_length = length;
+}
+
+/*  sendContent: Send more of the body of the response to the request being handled. In a chunked
+        response, sending nothing ends the response.
+        content: Bytes to send
+        length: Number of bytes
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::sendContent(const char* content, size_t length){
+    if(!current || !current->started || current->finished) return;
+
+    if(!current->chunked){
+        queue(*current, content, length);
+        return;
+    }
+
+    if(length == 0){
+        queue(*current, "0\r\n\r\n", 5);
+        current->finished = true;
+        return;
+    }
+
+    char size[12];
+    snprintf(size, sizeof(size), "%x\r\n", (unsigned)length);
+    queue(*current, size, strlen(size));
+    queue(*current, content, length);
+    queue(*current, "\r\n", 2);
+}
+
+void Async_Web_Server::sendContent(const String& content){
+    sendContent(content.c_str(), content.length());
+}
+
+/*  streamContent: Send a response to the request being handled whose body is printed a piece at a
+        time, each time the client has read the piece before. Nothing waits for the client, so the
+        response can be as long as it needs to be.
+        code: HTTP status code
+        content_type:
+        content: Called with a Print to print the next piece to. It should print a few hundred bytes or
+            so and keep track of where to carry on from, returning true while there's more to print and
+            false once it has printed the last piece. It's called after the handler has returned, so it
+            can't use arg() or header().
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::streamContent(int code, const String& content_type, TContentFunction content){
+    if(!current || current->started) return;
+
+    setContentLength(CONTENT_LENGTH_UNKNOWN);
+    send(code, content_type.c_str(), "");
+    current->content = content;
+}
+
+/*  streamFile: Send a file as the response to the request being handled, a piece at a time as the
+        client reads it. Compressed files ending in .gz are sent with gzip encoding.
+        file: Open file. It can be closed as soon as this returns.
+        content_type:
+    RETURNS the size of the file
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+size_t Async_Web_Server::streamFile(File& file, const String& content_type){
+    if(!current) return 0;
+
+    //The caller closes its file when this returns, so the server needs its own
+    File own = LittleFS.open(file.fullName(), "r");
+    if(String(file.name()).endsWith(".gz") && content_type != "application/x-gzip" && content_type != "application/octet-stream"){
+        sendHeader("Content-Encoding", "gzip");
+    }
+    return streamFile(own, content_type, 0, own.size());
+}
+
+/*  streamFile: Send part of a file as the response to the request being handled, a piece at a time as
+        the client reads it.
+        file: Open file, which must stay open until the response has been sent. Other responses can
+            read from it at the same time.
+        content_type:
+        offset: Position of the first byte to send
+        length: Number of bytes to send
+    RETURNS the number of bytes to send
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+size_t Async_Web_Server::streamFile(File& file, const String& content_type, uint32_t offset, uint32_t length){
+    if(!current || current->started) return 0;
+
+    setContentLength(length);
+    send(200, content_type.c_str(), "");
+    current->source = file;
+    current->source_position = offset;
+    current->source_left = length;
+    return length;
+}
+
+/*  (private) queue: Add bytes to a client's response. If the buffer is full, wait for the client to read
+        some of it.
+        client:
+        data:
+        length: Number of bytes
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::queue(connection& client, const char* data, size_t length){
+    while(length && !client.broken){
+        //Move what's left to the start of the buffer to make room
+        if(client.output_end == ASYNC_OUTPUT_MAX && client.output_start){
+            memmove(client.output, client.output + client.output_start, client.output_end - client.output_start);
+            client.output_end -= client.output_start;
+            client.output_start = 0;
+        }
+        if(client.output_end == ASYNC_OUTPUT_MAX){
+            drain(client);
+            continue;
+        }
+
+        size_t room = ASYNC_OUTPUT_MAX - client.output_end;
+        size_t part = length < room ? length : room;
+        memcpy(client.output + client.output_end, data, part);
+        client.output_end += part;
+        data += part;
+        length -= part;
+    }
+}
+
+/*  (private) drain: Wait for a client to read everything in its buffer, from a handler that has printed
+        more than fits. If it takes too long, the rest of the response is dropped.
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::drain(connection& client){
+    uint32_t start = millis();
+    while(client.output_start < client.output_end){
+        if(write_output(client)){
+            start = millis();
+        }else if(!client.client.connected() || millis() - start > ASYNC_TIMEOUT){
+            client.broken = true;
+            client.keep_alive = false;
+            break;
+        }else{
+            yield();
+        }
+    }
+    client.output_start = 0;
+    client.output_end = 0;
+}
+
+/*  (private) write_output: Send as much of a client's buffer as its connection will take without waiting
+        client:
+    RETURNS the number of bytes sent
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+size_t Async_Web_Server::write_output(connection& client){
+    size_t pending = client.output_end - client.output_start;
+    if(!pending) return 0;
+    size_t room = client.client.availableForWrite();
+    if(!room) return 0;
+
+    size_t written = client.client.write(client.output + client.output_start, pending < room ? pending : room);
+    client.output_start += written;
+    if(client.output_start == client.output_end){
+        client.output_start = 0;
+        client.output_end = 0;
+    }
+    if(written) client.millis = millis();
+    return written;
+}
+
+/*  (private) fill_output: Read the next piece of the file being sent into a client's empty buffer
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::fill_output(connection& client){
+    size_t length = client.source_left < ASYNC_OUTPUT_MAX ? client.source_left : ASYNC_OUTPUT_MAX;
+
+    //The file may be shared with other clients, so always seek to this client's position first
+    client.source.seek(client.source_position);
+    length = client.source.read(client.output, length);
+    if(!length){
+        //The file is shorter than it should be, so the response can't be finished
+        client.source_left = 0;
+        client.keep_alive = false;
+        return;
+    }
+    client.output_start = 0;
+    client.output_end = length;
+    client.source_position += length;
+    client.source_left -= length;
+}
+
+/*  (private) fill_piece: Move the next part of the piece printed by streamContent() into a client's empty
+        buffer
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::fill_piece(connection& client){
+    size_t left = client.piece.length() - client.piece_sent;
+    size_t length = left < ASYNC_OUTPUT_MAX ? left : ASYNC_OUTPUT_MAX;
+    memcpy(client.output, client.piece.c_str() + client.piece_sent, length);
+    client.output_start = 0;
+    client.output_end = length;
+    client.piece_sent += length;
+}
+
+/*  (private) next_piece: Print the next piece of a body sent with streamContent(), as a chunk if the
+        response is chunked. After the last piece, the response is finished.
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::next_piece(connection& client){
+    //The chunk size goes before the piece, and is only known once it has been printed
+    client.piece = client.chunked ? ASYNC_PIECE_HEAD : "";
+    client.piece_sent = 0;
+    String_Print output(client.piece);
+    bool more = client.content(output);
+    client.millis = millis();
+
+    size_t length = client.piece.length() - (client.chunked ? ASYNC_PIECE_HEAD_LENGTH : 0);
+    if(client.chunked){
+        if(length){
+            char size[ASYNC_PIECE_HEAD_LENGTH + 1];
+            snprintf(size, sizeof(size), "%06x\r\n", (unsigned)length & 0xFFFFFF); //A piece is never near 16MB
+            for(uint8_t i = 0; i < ASYNC_PIECE_HEAD_LENGTH; i++) client.piece[i] = size[i];
+            client.piece += "\r\n";
+        }else{
+            client.piece = "";
+        }
+        if(!more) client.piece += "0\r\n\r\n";
+    }
+
+    if(!more){
+        client.content = NULL;
+        client.finished = true;
+    }
+}
+
+/*  (private) write_response: Send as much of a response as the client's connection will take without
+        waiting, and get ready for the next request once it's all been sent
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::write_response(connection& client){
+    while(true){
+        if(client.output_start == client.output_end && !client.broken){
+            if(client.source_left){
+                fill_output(client);
+            }else if(client.piece_sent < client.piece.length()){
+                fill_piece(client);
+            }else if(client.content){
+                next_piece(client);
+                fill_piece(client);
+            }
+        }
+        if(client.output_start == client.output_end){
+            //A piece with nothing in it, there may be more on the next pass
+            if(client.content && !client.broken) return;
+            break;
+        }
+        if(!write_output(client)) return;
+    }
+
+    //The whole response has been sent
+    client.source = File();
+    client.content = NULL;
+    client.piece = String();
+    if(client.keep_alive && !client.broken){
+        reset(client);
+    }else{
+        close(client);
+    }
+}
+
+/*  (private) reset: Get ready for the next request from a client
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::reset(connection& client){
+    client.state = ASYNC_REQUEST_LINE;
+    client.millis = millis();
+    client.line = "";
+    client.uri = "";
+    client.query = String();
+    client.body = String();
+    client.content_type = String();
+    client.content_length = 0;
+    client.received = 0;
+    client.http_1_1 = false;
+    client.keep_alive = false;
+    for(uint8_t i = 0; i < ASYNC_HEADERS_MAX; i++) client.headers[i] = String();
+
+    client.response_headers = "";
+    client.response_length = ASYNC_LENGTH_NOT_SET;
+    client.started = false;
+    client.chunked = false;
+    client.finished = false;
+    client.broken = false;
+    client.content = NULL;
+    client.piece = String();
+    client.piece_sent = 0;
+}
+
+/*  (private) close: Disconnect a client and free its memory
+        client:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Async_Web_Server::close(connection& client){
+    //If the client was uploading a file, let the handler know it won't be finished
+    if(uploader == &client){
+        if(upload_stage == UPLOAD_PART_DATA && upload_is_file){
+            current_upload->status = UPLOAD_FILE_ABORTED;
+            current = &client;
+            upload_route->upload_handler();
+            current = NULL;
+        }
+        delete current_upload;
+        current_upload = NULL;
+        uploader = NULL;
+    }
+
+    client.client.stop();
+    client.source = File();
+    client.source_left = 0;
+    client.content = NULL;
+    client.piece = String();
+    free(client.output);
+    client.output = NULL;
+    reset(client);
+    client.uri = String();
+    client.line = String();
+    client.response_headers = String();
+    client.state = ASYNC_FREE;
+}
+
+/*  uri: Get the path of the request being handled
+    RETURNS path, without the query
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+String Async_Web_Server::uri(){
+    return current ? current->uri : String();
+}
+
+/*  method: Get the method of the request being handled
+    RETURNS HTTP method
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+HTTPMethod Async_Web_Server::method(){
+    return current ? current->method : HTTP_ANY;
+}
+
+/*  arg: Get an argument of the request being handled, from its query or form body
+        name: Argument name
+    RETURNS value, or "" if there's no such argument
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+String Async_Web_Server::arg(const String& name){
+    for(uint8_t i = 0; i < argument_count; i++){
+        if(arguments[i].name == name) return arguments[i].value;
+    }
+    return "";
+}
+
+String Async_Web_Server::arg(int i){
+    return i < argument_count ? arguments[i].value : String();
+}
+
+String Async_Web_Server::argName(int i){
+    return i < argument_count ? arguments[i].name : String();
+}
+
+int Async_Web_Server::args(){
+    return argument_count;
+}
+
+bool Async_Web_Server::hasArg(const String& name){
+    for(uint8_t i = 0; i < argument_count; i++){
+        if(arguments[i].name == name) return true;
+    }
+    return false;
+}
+
+/*  header: Get a header of the request being handled, if it was set with collectHeaders()
+        name: Header name
+    RETURNS value, or "" if it wasn't sent
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+String Async_Web_Server::header(const String& name){
+    if(!current) return "";
+    for(uint8_t i = 0; i < header_key_count; i++){
+        if(name.equalsIgnoreCase(header_keys[i])) return current->headers[i];
+    }
+    return "";
+}
+
+bool Async_Web_Server::hasHeader(const String& name){
+    return header(name).length() > 0;
+}
+
+/*  upload: Get the upload being handled, from an upload handler
+    RETURNS upload
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+HTTPUpload& Async_Web_Server::upload(){
+    return *current_upload;
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include "Arduino.h"
+#include "ESP8266WiFi.h" //WiFi Library
+#include "ESP8266WebServer.h" //For HTTPMethod, HTTPUpload and CONTENT_LENGTH_UNKNOWN
+#include "FS.h"
+
+//Number of clients served at once
+#define ASYNC_CLIENTS_MAX 4
+//Number of paths that can have a handler
+#define ASYNC_ROUTES_MAX 16
+//Number of arguments read from the query and the body of a request
+#define ASYNC_ARGS_MAX 32
+//Number of request headers that can be collected with collectHeaders()
+#define ASYNC_HEADERS_MAX 4
+//Longest request line or header that is read
+#define ASYNC_LINE_MAX 512
+//Largest form body that is read into arguments
+#define ASYNC_BODY_MAX 2048
+//Bytes of a response held for a client before a handler has to wait for the client to read them
+#define ASYNC_OUTPUT_MAX 1460
+//Time a client can go without sending or reading anything before it's closed (ms)
+#define ASYNC_TIMEOUT 5000
+//Content length before setContentLength() is called
+#define ASYNC_LENGTH_NOT_SET ((size_t) -2)
+
+class Async_Web_Server{
+
+    public:
+
+        typedef std::function<void(void)> THandlerFunction;
+        typedef std::function<bool(Print& output)> TContentFunction;
+
+        Async_Web_Server(uint16_t port);
+
+        void
+            begin(),
+            handleClient(bool read_only = false),
+            on(const String& uri, THandlerFunction handler),
+            on(const String& uri, HTTPMethod method, THandlerFunction handler),
+            on(const String& uri, HTTPMethod method, THandlerFunction handler, THandlerFunction upload_handler),
+            onNotFound(THandlerFunction handler),
+            collectHeaders(const char* header_keys[], size_t count),
+            send(int code, const char* content_type = NULL, const String& content = String()),
+            send(int code, const String& content_type, const String& content),
+            sendHeader(const String& name, const String& value, bool first = false),
+            setContentLength(size_t length),
+            sendContent(const String& content),
+            sendContent(const char* content, size_t length),
+            streamContent(int code, const String& content_type, TContentFunction content);
+
+        size_t
+            streamFile(File& file, const String& content_type),
+            streamFile(File& file, const String& content_type, uint32_t offset, uint32_t length);
+
+        String
+            uri(),
+            arg(const String& name),
+            arg(int i),
+            argName(int i),
+            header(const String& name);
+
+        bool
+            hasArg(const String& name),
+            hasHeader(const String& name);
+
+        int
+            args();
+
+        HTTPMethod
+            method();
+
+        HTTPUpload&
+            upload();
+
+    private:
+
+        //A path with a handler
+        struct route{
+            String uri;
+            HTTPMethod method;
+            THandlerFunction handler;
+            THandlerFunction upload_handler;
+        };
+
+        //An argument from the query or the body of a request
+        struct argument{
+            String name;
+            String value;
+        };
+
+        //State of a client's connection
+        enum connection_state : uint8_t{
+            ASYNC_FREE, //No client
+            ASYNC_REQUEST_LINE, //Waiting for the request line
+            ASYNC_HEADERS, //Reading headers
+            ASYNC_BODY, //Reading a form body
+            ASYNC_UPLOAD, //Reading a multipart upload, a buffer at a time
+            ASYNC_RESPONSE //Sending the response
+        };
+
+        //State of a multipart upload
+        enum upload_state : uint8_t{
+            UPLOAD_PREAMBLE, //Before the first boundary
+            UPLOAD_PART_HEADERS, //Reading the headers of a part
+            UPLOAD_PART_DATA, //Reading the data of a part
+            UPLOAD_DONE //After the last boundary
+        };
+
+        //A client, from when it connects until it disconnects. With keep-alive, it can make several requests.
+        struct connection{
+            WiFiClient client;
+            connection_state state;
+            uint32_t millis; //Time of the last progress
+
+            //Request
+            String line; //Line being read
+            HTTPMethod method;
+            String uri;
+            bool http_1_1; //True if the client speaks HTTP/1.1
+            bool keep_alive; //True if the connection stays open after the response
+            uint32_t content_length; //Length of the body
+            uint32_t received; //Bytes of the body read so far
+            String content_type;
+            String headers[ASYNC_HEADERS_MAX]; //Values of the collected headers
+            String query; //Query of the URI
+            String body; //Form body
+
+            //Response
+            uint8_t* output; //Bytes waiting to be sent, ASYNC_OUTPUT_MAX long while the client is connected
+            uint16_t output_start; //Position of the first byte not sent yet
+            uint16_t output_end; //Position after the last byte
+            String response_headers; //Headers added with sendHeader() for the next response
+            size_t response_length; //Content length set with setContentLength(), or ASYNC_LENGTH_NOT_SET
+            bool started; //True once the status line has been queued
+            bool chunked; //True if the body is being sent in chunks
+            bool finished; //True once the last chunk has been queued
+            bool broken; //True if the client stopped reading, so the rest of the response is dropped
+            File source; //File the rest of the body is sent from, which may be shared with other clients
+            uint32_t source_position; //Position in the file of the next byte to send
+            uint32_t source_left; //Bytes of the file still to be sent
+            TContentFunction content; //Prints the next piece of the body, until it returns false
+            String piece; //Piece of the body printed by content, with its chunk size
+            uint32_t piece_sent; //Bytes of the piece moved to the buffer so far
+        };
+
+        void
+            accept(),
+            process(connection& client),
+            read_request(connection& client),
+            read_body(connection& client),
+            read_upload(connection& client),
+            write_response(connection& client),
+            parse_request_line(connection& client),
+            parse_header(connection& client),
+            headers_done(connection& client),
+            parse_args(const String& text),
+            upload_byte(connection& client, uint8_t c),
+            upload_part_header(connection& client),
+            upload_flush(connection& client),
+            dispatch(connection& client),
+            reset(connection& client),
+            close(connection& client),
+            error(connection& client, int code, const char* message),
+            start_response(connection& client, int code, const String& content_type, size_t length),
+            queue(connection& client, const char* data, size_t length),
+            drain(connection& client),
+            fill_output(connection& client),
+            fill_piece(connection& client),
+            next_piece(connection& client);
+
+        size_t
+            write_output(connection& client);
+
+        bool
+            held(connection& client);
+
+        route*
+            find_route(connection& client);
+
+        WiFiServer listener;
+
+        route routes[ASYNC_ROUTES_MAX];
+        uint8_t route_count = 0;
+        THandlerFunction not_found = NULL;
+
+        String header_keys[ASYNC_HEADERS_MAX]; //Names of the headers that are collected
+        uint8_t header_key_count = 0;
+
+        connection clients[ASYNC_CLIENTS_MAX];
+        connection* current = NULL; //Client whose request is being handled
+        bool read_only = false; //True during a handleClient() pass that only serves GET and HEAD requests
+
+        //Arguments of the request being handled. Requests are handled one at a time, so they're only read then.
+        argument arguments[ASYNC_ARGS_MAX];
+        uint8_t argument_count = 0;
+
+        //Only one upload at a time, because the buffer is large. It's only allocated during the upload.
+        HTTPUpload* current_upload = NULL;
+        connection* uploader = NULL; //Client whose upload is using current_upload
+        route* upload_route = NULL; //Handler of the upload
+        upload_state upload_stage = UPLOAD_PREAMBLE;
+        String boundary; //"\r\n--" followed by the boundary of the upload
+        uint8_t boundary_match = 0; //Bytes of the boundary matched so far
+        bool boundary_line = false; //True until the rest of the line after a boundary has been read
+        bool upload_is_file = false; //True if the current part is a file
+};
@@ -0,0 +1,160 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    Converts UTF-8 text to the bytes a thermal printer prints in one of its
+    built-in code pages (selected with ESC t), in place and without allocating
+    memory.
+
+    Each character is looked up in the code page's table. If it isn't there,
+    an ASCII stand-in is used (such as "e" for "ė" or "..." for "…"), and if
+    there isn't one, the code page's unknown character. Every character is at
+    least as long in UTF-8 as what replaces it, so the text only ever shrinks.
+
+    The tables are generated by scripts/code_page_tables.py, and are kept in
+    flash.
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include "Code_Page.h"
+#include "Code_Page_Tables.h"
+
+/*  (private) find_code_page: Find a code page
+        number: Number selected with ESC t
+    RETURNS The code page, or NULL if it isn't supported
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static const code_page* find_code_page(uint8_t number){
+    for(uint8_t i = 0; i < sizeof(CODE_PAGES) / sizeof(code_page); i++){
+        if(CODE_PAGES[i].number == number) return &CODE_PAGES[i];
+    }
+    return NULL;
+}
+
+/*  (private) find_byte: Find the byte a code page prints for a character
+        page: Code page
+        code_point: Character
+    RETURNS The byte, or 0 if it isn't in the code page
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static uint8_t find_byte(const code_page* page, uint32_t code_point){
+    uint8_t low = 0;
+    uint8_t high = page->count;
+    while(low < high){
+        uint8_t middle = (low + high) / 2;
+        uint16_t entry = pgm_read_word(&page->table[middle].code_point);
+        if(entry == code_point) return pgm_read_byte(&page->table[middle].byte);
+        if(entry < code_point) low = middle + 1;
+        else high = middle;
+    }
+    return 0;
+}
+
+/*  (private) find_transliteration: Find the ASCII stand-in for a character
+        code_point: Character
+        text: Holds the stand-in
+    RETURNS Length of the stand-in, or 0 if there isn't one
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static uint8_t find_transliteration(uint32_t code_point, char* text){
+    uint16_t low = 0;
+    uint16_t high = sizeof(TRANSLITERATIONS) / sizeof(transliteration);
+    while(low < high){
+        uint16_t middle = (low + high) / 2;
+        uint16_t entry = pgm_read_word(&TRANSLITERATIONS[middle].code_point);
+        if(entry == code_point){
+            uint8_t length = 0;
+            while(length < sizeof(TRANSLITERATIONS[0].text) && (text[length] = pgm_read_byte(&TRANSLITERATIONS[middle].text[length]))) length++;
+            return length;
+        }
+        if(entry < code_point) low = middle + 1;
+        else high = middle;
+    }
+    return 0;
+}
+
+/*  code_page_supported: Check if text can be converted to a code page
+        number: Number selected with ESC t
+    RETURNS True if it can, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool code_page_supported(uint8_t number){
+    return find_code_page(number) != NULL;
+}
+
+/*  transcode_utf8: Convert UTF-8 text to a code page, in place. Sequences that aren't valid UTF-8,
+        including one cut off by the end of the text, are printed as the unknown character.
+        text: Text to convert
+        length: Length of the text in bytes
+        number: Number of the code page, selected with ESC t. PC437 is used if it isn't supported.
+    RETURNS The length of the converted text, no longer than it was
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint16_t transcode_utf8(char* text, uint16_t length, uint8_t number){
+    const code_page* page = find_code_page(number);
+    if(!page) page = &CODE_PAGES[0];
+
+    uint16_t read = 0;
+    uint16_t written = 0;
+
+    //ASCII is left as it is, so skip straight past it
+    while(read < length && (uint8_t)text[read] < 0x80) read++;
+    written = read;
+
+    while(read < length){
+        uint8_t lead = text[read];
+
+        //ASCII
+        if(lead < 0x80){
+            text[written++] = lead;
+            read++;
+            continue;
+        }
+
+        //The lead byte gives the length of the sequence and the first bits of the code point
+        uint8_t sequence;
+        uint32_t code_point;
+        if(lead >= 0xC2 && lead <= 0xDF){
+            sequence = 2;
+            code_point = lead & 0x1F;
+        }else if(lead >= 0xE0 && lead <= 0xEF){
+            sequence = 3;
+            code_point = lead & 0x0F;
+        }else if(lead >= 0xF0 && lead <= 0xF4){
+            sequence = 4;
+            code_point = lead & 0x07;
+        }else{
+            //A stray continuation byte, or a lead byte that can't start a valid sequence
+            text[written++] = page->unknown;
+            read++;
+            continue;
+        }
+
+        //Add the rest of the bits from the continuation bytes, stopping at the end of the text or a byte that isn't one
+        uint8_t i = 1;
+        while(i < sequence && read + i < length && ((uint8_t)text[read + i] & 0xC0) == 0x80){
+            code_point = (code_point << 6) | (text[read + i] & 0x3F);
+            i++;
+        }
+        read += i;
+
+        //Cut short, overlong, a surrogate or past the end of Unicode
+        if(i < sequence || code_point < (sequence == 3 ? 0x800UL : sequence == 4 ? 0x10000UL : 0x80UL) ||
+           (code_point >= 0xD800 && code_point <= 0xDFFF) || code_point > 0x10FFFF){
+            text[written++] = page->unknown;
+            continue;
+        }
+
+        //The code page's own character, then a stand-in, then the unknown character
+        uint8_t byte = code_point <= 0xFFFF ? find_byte(page, code_point) : 0;
+        if(byte){
+            text[written++] = byte;
+            continue;
+        }
+        char stand_in[sizeof(TRANSLITERATIONS[0].text)];
+        uint8_t stand_in_length = code_point <= 0xFFFF ? find_transliteration(code_point, stand_in) : 0;
+        if(stand_in_length){
+            memcpy(text + written, stand_in, stand_in_length);
+            written += stand_in_length;
+        }else{
+            text[written++] = page->unknown;
+        }
+    }
+
+    return written;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Arduino.h"
+
+//Code pages the printer can be switched to with ESC t
+#define CODE_PAGE_PC437 0 //USA, Standard Europe (the printer's default)
+#define CODE_PAGE_PC850 2 //Multilingual
+#define CODE_PAGE_WPC1252 16 //Western Europe (Windows)
+
+//A character in a code page
+struct code_page_entry{
+    uint16_t code_point; //Unicode code point
+    uint8_t byte; //Byte the printer prints it for
+};
+
+//An ASCII stand-in for a character
+struct transliteration{
+    uint16_t code_point; //Unicode code point
+    char text[4]; //Stand-in, no longer than the character is in UTF-8
+};
+
+//A code page and its table
+struct code_page{
+    uint8_t number; //Number selected with ESC t
+    const code_page_entry* table; //Characters from 0x80 to 0xFF, in code point order (PROGMEM)
+    uint8_t count; //Number of characters in the table
+    uint8_t unknown; //Byte printed for characters that aren't in the code page and have no stand-in
+};
+
+/*  entries_sorted: Check at compile time that a code page table can be searched
+        table: Table
+        count: Number of entries
+    RETURNS True if the code points are in order, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+constexpr bool entries_sorted(const code_page_entry* table, size_t count){
+    return count < 2 || (table[0].code_point < table[1].code_point && entries_sorted(table + 1, count - 1));
+}
+
+/*  transliterations_sorted: Check at compile time that the stand-ins can be searched
+        table: Table
+        count: Number of entries
+    RETURNS True if the code points are in order, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+constexpr bool transliterations_sorted(const transliteration* table, size_t count){
+    return count < 2 || (table[0].code_point < table[1].code_point && transliterations_sorted(table + 1, count - 1));
+}
+
+/*  utf8_length: Get the length of a code point in UTF-8
+        code_point: Code point
+    RETURNS Length in bytes
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+constexpr size_t utf8_length(uint32_t code_point){
+    return code_point < 0x80 ? 1 : code_point < 0x800 ? 2 : code_point < 0x10000 ? 3 : 4;
+}
+
+/*  text_length: Get the length of a NULL terminated string at compile time
+        text: String
+    RETURNS Length in bytes
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+constexpr size_t text_length(const char* text){
+    return *text ? 1 + text_length(text + 1) : 0;
+}
+
+/*  transliterations_fit: Check at compile time that no stand-in is longer than its character in UTF-8,
+        so text can be converted in place
+        table: Table
+        count: Number of entries
+    RETURNS True if they all fit, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+constexpr bool transliterations_fit(const transliteration* table, size_t count){
+    return count == 0 || (text_length(table[0].text) <= utf8_length(table[0].code_point) && transliterations_fit(table + 1, count - 1));
+}
+
+bool
+    code_page_supported(uint8_t number);
+
+uint16_t
+    transcode_utf8(char* text, uint16_t length, uint8_t number);
@@ -0,0 +1,155 @@
+// Generated by scripts/code_page_tables.py, don't edit by hand
+#pragma once
+
+#include "Code_Page.h"
+
+//PC437 (ESC t 0): code point of each character from 0x80 to 0xFF, in code point order
+static constexpr code_page_entry PC437_TABLE[] PROGMEM = {
+    {0x00A0, 0xFF}, {0x00A1, 0xAD}, {0x00A2, 0x9B}, {0x00A3, 0x9C}, {0x00A5, 0x9D}, {0x00AA, 0xA6},
+    {0x00AB, 0xAE}, {0x00AC, 0xAA}, {0x00B0, 0xF8}, {0x00B1, 0xF1}, {0x00B2, 0xFD}, {0x00B5, 0xE6},
+    {0x00B7, 0xFA}, {0x00BA, 0xA7}, {0x00BB, 0xAF}, {0x00BC, 0xAC}, {0x00BD, 0xAB}, {0x00BF, 0xA8},
+    {0x00C4, 0x8E}, {0x00C5, 0x8F}, {0x00C6, 0x92}, {0x00C7, 0x80}, {0x00C9, 0x90}, {0x00D1, 0xA5},
+    {0x00D6, 0x99}, {0x00DC, 0x9A}, {0x00DF, 0xE1}, {0x00E0, 0x85}, {0x00E1, 0xA0}, {0x00E2, 0x83},
+    {0x00E4, 0x84}, {0x00E5, 0x86}, {0x00E6, 0x91}, {0x00E7, 0x87}, {0x00E8, 0x8A}, {0x00E9, 0x82},
+    {0x00EA, 0x88}, {0x00EB, 0x89}, {0x00EC, 0x8D}, {0x00ED, 0xA1}, {0x00EE, 0x8C}, {0x00EF, 0x8B},
+    {0x00F1, 0xA4}, {0x00F2, 0x95}, {0x00F3, 0xA2}, {0x00F4, 0x93}, {0x00F6, 0x94}, {0x00F7, 0xF6},
+    {0x00F9, 0x97}, {0x00FA, 0xA3}, {0x00FB, 0x96}, {0x00FC, 0x81}, {0x00FF, 0x98}, {0x0192, 0x9F},
+    {0x0393, 0xE2}, {0x0398, 0xE9}, {0x03A3, 0xE4}, {0x03A6, 0xE8}, {0x03A9, 0xEA}, {0x03B1, 0xE0},
+    {0x03B4, 0xEB}, {0x03B5, 0xEE}, {0x03C0, 0xE3}, {0x03C3, 0xE5}, {0x03C4, 0xE7}, {0x03C6, 0xED},
+    {0x207F, 0xFC}, {0x20A7, 0x9E}, {0x2219, 0xF9}, {0x221A, 0xFB}, {0x221E, 0xEC}, {0x2229, 0xEF},
+    {0x2248, 0xF7}, {0x2261, 0xF0}, {0x2264, 0xF3}, {0x2265, 0xF2}, {0x2310, 0xA9}, {0x2320, 0xF4},
+    {0x2321, 0xF5}, {0x2500, 0xC4}, {0x2502, 0xB3}, {0x250C, 0xDA}, {0x2510, 0xBF}, {0x2514, 0xC0},
+    {0x2518, 0xD9}, {0x251C, 0xC3}, {0x2524, 0xB4}, {0x252C, 0xC2}, {0x2534, 0xC1}, {0x253C, 0xC5},
+    {0x2550, 0xCD}, {0x2551, 0xBA}, {0x2552, 0xD5}, {0x2553, 0xD6}, {0x2554, 0xC9}, {0x2555, 0xB8},
+    {0x2556, 0xB7}, {0x2557, 0xBB}, {0x2558, 0xD4}, {0x2559, 0xD3}, {0x255A, 0xC8}, {0x255B, 0xBE},
+    {0x255C, 0xBD}, {0x255D, 0xBC}, {0x255E, 0xC6}, {0x255F, 0xC7}, {0x2560, 0xCC}, {0x2561, 0xB5},
+    {0x2562, 0xB6}, {0x2563, 0xB9}, {0x2564, 0xD1}, {0x2565, 0xD2}, {0x2566, 0xCB}, {0x2567, 0xCF},
+    {0x2568, 0xD0}, {0x2569, 0xCA}, {0x256A, 0xD8}, {0x256B, 0xD7}, {0x256C, 0xCE}, {0x2580, 0xDF},
+    {0x2584, 0xDC}, {0x2588, 0xDB}, {0x258C, 0xDD}, {0x2590, 0xDE}, {0x2591, 0xB0}, {0x2592, 0xB1},
+    {0x2593, 0xB2}, {0x25A0, 0xFE},
+};
+static_assert(entries_sorted(PC437_TABLE, sizeof(PC437_TABLE) / sizeof(code_page_entry)), "PC437 table is out of order");
+
+//PC850 (ESC t 2): code point of each character from 0x80 to 0xFF, in code point order
+static constexpr code_page_entry PC850_TABLE[] PROGMEM = {
+    {0x00A0, 0xFF}, {0x00A1, 0xAD}, {0x00A2, 0xBD}, {0x00A3, 0x9C}, {0x00A4, 0xCF}, {0x00A5, 0xBE},
+    {0x00A6, 0xDD}, {0x00A7, 0xF5}, {0x00A8, 0xF9}, {0x00A9, 0xB8}, {0x00AA, 0xA6}, {0x00AB, 0xAE},
+    {0x00AC, 0xAA}, {0x00AD, 0xF0}, {0x00AE, 0xA9}, {0x00AF, 0xEE}, {0x00B0, 0xF8}, {0x00B1, 0xF1},
+    {0x00B2, 0xFD}, {0x00B3, 0xFC}, {0x00B4, 0xEF}, {0x00B5, 0xE6}, {0x00B6, 0xF4}, {0x00B7, 0xFA},
+    {0x00B8, 0xF7}, {0x00B9, 0xFB}, {0x00BA, 0xA7}, {0x00BB, 0xAF}, {0x00BC, 0xAC}, {0x00BD, 0xAB},
+    {0x00BE, 0xF3}, {0x00BF, 0xA8}, {0x00C0, 0xB7}, {0x00C1, 0xB5}, {0x00C2, 0xB6}, {0x00C3, 0xC7},
+    {0x00C4, 0x8E}, {0x00C5, 0x8F}, {0x00C6, 0x92}, {0x00C7, 0x80}, {0x00C8, 0xD4}, {0x00C9, 0x90},
+    {0x00CA, 0xD2}, {0x00CB, 0xD3}, {0x00CC, 0xDE}, {0x00CD, 0xD6}, {0x00CE, 0xD7}, {0x00CF, 0xD8},
+    {0x00D0, 0xD1}, {0x00D1, 0xA5}, {0x00D2, 0xE3}, {0x00D3, 0xE0}, {0x00D4, 0xE2}, {0x00D5, 0xE5},
+    {0x00D6, 0x99}, {0x00D7, 0x9E}, {0x00D8, 0x9D}, {0x00D9, 0xEB}, {0x00DA, 0xE9}, {0x00DB, 0xEA},
+    {0x00DC, 0x9A}, {0x00DD, 0xED}, {0x00DE, 0xE8}, {0x00DF, 0xE1}, {0x00E0, 0x85}, {0x00E1, 0xA0},
+    {0x00E2, 0x83}, {0x00E3, 0xC6}, {0x00E4, 0x84}, {0x00E5, 0x86}, {0x00E6, 0x91}, {0x00E7, 0x87},
+    {0x00E8, 0x8A}, {0x00E9, 0x82}, {0x00EA, 0x88}, {0x00EB, 0x89}, {0x00EC, 0x8D}, {0x00ED, 0xA1},
+    {0x00EE, 0x8C}, {0x00EF, 0x8B}, {0x00F0, 0xD0}, {0x00F1, 0xA4}, {0x00F2, 0x95}, {0x00F3, 0xA2},
+    {0x00F4, 0x93}, {0x00F5, 0xE4}, {0x00F6, 0x94}, {0x00F7, 0xF6}, {0x00F8, 0x9B}, {0x00F9, 0x97},
+    {0x00FA, 0xA3}, {0x00FB, 0x96}, {0x00FC, 0x81}, {0x00FD, 0xEC}, {0x00FE, 0xE7}, {0x00FF, 0x98},
+    {0x0131, 0xD5}, {0x0192, 0x9F}, {0x2017, 0xF2}, {0x2500, 0xC4}, {0x2502, 0xB3}, {0x250C, 0xDA},
+    {0x2510, 0xBF}, {0x2514, 0xC0}, {0x2518, 0xD9}, {0x251C, 0xC3}, {0x2524, 0xB4}, {0x252C, 0xC2},
+    {0x2534, 0xC1}, {0x253C, 0xC5}, {0x2550, 0xCD}, {0x2551, 0xBA}, {0x2554, 0xC9}, {0x2557, 0xBB},
+    {0x255A, 0xC8}, {0x255D, 0xBC}, {0x2560, 0xCC}, {0x2563, 0xB9}, {0x2566, 0xCB}, {0x2569, 0xCA},
+    {0x256C, 0xCE}, {0x2580, 0xDF}, {0x2584, 0xDC}, {0x2588, 0xDB}, {0x2591, 0xB0}, {0x2592, 0xB1},
+    {0x2593, 0xB2}, {0x25A0, 0xFE},
+};
+static_assert(entries_sorted(PC850_TABLE, sizeof(PC850_TABLE) / sizeof(code_page_entry)), "PC850 table is out of order");
+
+//WPC1252 (ESC t 16): code point of each character from 0x80 to 0xFF, in code point order
+static constexpr code_page_entry WPC1252_TABLE[] PROGMEM = {
+    {0x00A0, 0xA0}, {0x00A1, 0xA1}, {0x00A2, 0xA2}, {0x00A3, 0xA3}, {0x00A4, 0xA4}, {0x00A5, 0xA5},
+    {0x00A6, 0xA6}, {0x00A7, 0xA7}, {0x00A8, 0xA8}, {0x00A9, 0xA9}, {0x00AA, 0xAA}, {0x00AB, 0xAB},
+    {0x00AC, 0xAC}, {0x00AD, 0xAD}, {0x00AE, 0xAE}, {0x00AF, 0xAF}, {0x00B0, 0xB0}, {0x00B1, 0xB1},
+    {0x00B2, 0xB2}, {0x00B3, 0xB3}, {0x00B4, 0xB4}, {0x00B5, 0xB5}, {0x00B6, 0xB6}, {0x00B7, 0xB7},
+    {0x00B8, 0xB8}, {0x00B9, 0xB9}, {0x00BA, 0xBA}, {0x00BB, 0xBB}, {0x00BC, 0xBC}, {0x00BD, 0xBD},
+    {0x00BE, 0xBE}, {0x00BF, 0xBF}, {0x00C0, 0xC0}, {0x00C1, 0xC1}, {0x00C2, 0xC2}, {0x00C3, 0xC3},
+    {0x00C4, 0xC4}, {0x00C5, 0xC5}, {0x00C6, 0xC6}, {0x00C7, 0xC7}, {0x00C8, 0xC8}, {0x00C9, 0xC9},
+    {0x00CA, 0xCA}, {0x00CB, 0xCB}, {0x00CC, 0xCC}, {0x00CD, 0xCD}, {0x00CE, 0xCE}, {0x00CF, 0xCF},
+    {0x00D0, 0xD0}, {0x00D1, 0xD1}, {0x00D2, 0xD2}, {0x00D3, 0xD3}, {0x00D4, 0xD4}, {0x00D5, 0xD5},
+    {0x00D6, 0xD6}, {0x00D7, 0xD7}, {0x00D8, 0xD8}, {0x00D9, 0xD9}, {0x00DA, 0xDA}, {0x00DB, 0xDB},
+    {0x00DC, 0xDC}, {0x00DD, 0xDD}, {0x00DE, 0xDE}, {0x00DF, 0xDF}, {0x00E0, 0xE0}, {0x00E1, 0xE1},
+    {0x00E2, 0xE2}, {0x00E3, 0xE3}, {0x00E4, 0xE4}, {0x00E5, 0xE5}, {0x00E6, 0xE6}, {0x00E7, 0xE7},
+    {0x00E8, 0xE8}, {0x00E9, 0xE9}, {0x00EA, 0xEA}, {0x00EB, 0xEB}, {0x00EC, 0xEC}, {0x00ED, 0xED},
+    {0x00EE, 0xEE}, {0x00EF, 0xEF}, {0x00F0, 0xF0}, {0x00F1, 0xF1}, {0x00F2, 0xF2}, {0x00F3, 0xF3},
+    {0x00F4, 0xF4}, {0x00F5, 0xF5}, {0x00F6, 0xF6}, {0x00F7, 0xF7}, {0x00F8, 0xF8}, {0x00F9, 0xF9},
+    {0x00FA, 0xFA}, {0x00FB, 0xFB}, {0x00FC, 0xFC}, {0x00FD, 0xFD}, {0x00FE, 0xFE}, {0x00FF, 0xFF},
+    {0x0152, 0x8C}, {0x0153, 0x9C}, {0x0160, 0x8A}, {0x0161, 0x9A}, {0x0178, 0x9F}, {0x017D, 0x8E},
+    {0x017E, 0x9E}, {0x0192, 0x83}, {0x02C6, 0x88}, {0x02DC, 0x98}, {0x2013, 0x96}, {0x2014, 0x97},
+    {0x2018, 0x91}, {0x2019, 0x92}, {0x201A, 0x82}, {0x201C, 0x93}, {0x201D, 0x94}, {0x201E, 0x84},
+    {0x2020, 0x86}, {0x2021, 0x87}, {0x2022, 0x95}, {0x2026, 0x85}, {0x2030, 0x89}, {0x2039, 0x8B},
+    {0x203A, 0x9B}, {0x20AC, 0x80}, {0x2122, 0x99},
+};
+static_assert(entries_sorted(WPC1252_TABLE, sizeof(WPC1252_TABLE) / sizeof(code_page_entry)), "WPC1252 table is out of order");
+
+//ASCII stand-ins for characters that aren't in the selected code page, in code point order. None is
+//longer than the character in UTF-8, so text can be converted in place.
+static constexpr transliteration TRANSLITERATIONS[] PROGMEM = {
+    {0x00A0, " "}, {0x00A1, "!"}, {0x00A2, "c"}, {0x00A3, "L"}, {0x00A5, "Y"}, {0x00A6, "|"},
+    {0x00A7, "S"}, {0x00A8, "\""}, {0x00A9, "C"}, {0x00AA, "a"}, {0x00AB, "<<"}, {0x00AC, "-"},
+    {0x00AD, "-"}, {0x00AE, "R"}, {0x00AF, "-"}, {0x00B0, "o"}, {0x00B1, "+-"}, {0x00B2, "2"},
+    {0x00B3, "3"}, {0x00B4, "'"}, {0x00B5, "u"}, {0x00B6, "P"}, {0x00B7, "."}, {0x00B8, ","},
+    {0x00B9, "1"}, {0x00BA, "o"}, {0x00BB, ">>"}, {0x00BF, "?"}, {0x00C0, "A"}, {0x00C1, "A"},
+    {0x00C2, "A"}, {0x00C3, "A"}, {0x00C4, "A"}, {0x00C5, "A"}, {0x00C6, "AE"}, {0x00C7, "C"},
+    {0x00C8, "E"}, {0x00C9, "E"}, {0x00CA, "E"}, {0x00CB, "E"}, {0x00CC, "I"}, {0x00CD, "I"},
+    {0x00CE, "I"}, {0x00CF, "I"}, {0x00D0, "D"}, {0x00D1, "N"}, {0x00D2, "O"}, {0x00D3, "O"},
+    {0x00D4, "O"}, {0x00D5, "O"}, {0x00D6, "O"}, {0x00D7, "x"}, {0x00D8, "O"}, {0x00D9, "U"},
+    {0x00DA, "U"}, {0x00DB, "U"}, {0x00DC, "U"}, {0x00DD, "Y"}, {0x00DE, "TH"}, {0x00DF, "ss"},
+    {0x00E0, "a"}, {0x00E1, "a"}, {0x00E2, "a"}, {0x00E3, "a"}, {0x00E4, "a"}, {0x00E5, "a"},
+    {0x00E6, "ae"}, {0x00E7, "c"}, {0x00E8, "e"}, {0x00E9, "e"}, {0x00EA, "e"}, {0x00EB, "e"},
+    {0x00EC, "i"}, {0x00ED, "i"}, {0x00EE, "i"}, {0x00EF, "i"}, {0x00F0, "d"}, {0x00F1, "n"},
+    {0x00F2, "o"}, {0x00F3, "o"}, {0x00F4, "o"}, {0x00F5, "o"}, {0x00F6, "o"}, {0x00F7, "/"},
+    {0x00F8, "o"}, {0x00F9, "u"}, {0x00FA, "u"}, {0x00FB, "u"}, {0x00FC, "u"}, {0x00FD, "y"},
+    {0x00FE, "th"}, {0x00FF, "y"}, {0x0100, "A"}, {0x0101, "a"}, {0x0102, "A"}, {0x0103, "a"},
+    {0x0104, "A"}, {0x0105, "a"}, {0x0106, "C"}, {0x0107, "c"}, {0x0108, "C"}, {0x0109, "c"},
+    {0x010A, "C"}, {0x010B, "c"}, {0x010C, "C"}, {0x010D, "c"}, {0x010E, "D"}, {0x010F, "d"},
+    {0x0110, "D"}, {0x0111, "d"}, {0x0112, "E"}, {0x0113, "e"}, {0x0114, "E"}, {0x0115, "e"},
+    {0x0116, "E"}, {0x0117, "e"}, {0x0118, "E"}, {0x0119, "e"}, {0x011A, "E"}, {0x011B, "e"},
+    {0x011C, "G"}, {0x011D, "g"}, {0x011E, "G"}, {0x011F, "g"}, {0x0120, "G"}, {0x0121, "g"},
+    {0x0122, "G"}, {0x0123, "g"}, {0x0124, "H"}, {0x0125, "h"}, {0x0126, "H"}, {0x0127, "h"},
+    {0x0128, "I"}, {0x0129, "i"}, {0x012A, "I"}, {0x012B, "i"}, {0x012C, "I"}, {0x012D, "i"},
+    {0x012E, "I"}, {0x012F, "i"}, {0x0130, "I"}, {0x0131, "i"}, {0x0132, "IJ"}, {0x0133, "ij"},
+    {0x0134, "J"}, {0x0135, "j"}, {0x0136, "K"}, {0x0137, "k"}, {0x0138, "k"}, {0x0139, "L"},
+    {0x013A, "l"}, {0x013B, "L"}, {0x013C, "l"}, {0x013D, "L"}, {0x013E, "l"}, {0x0141, "L"},
+    {0x0142, "l"}, {0x0143, "N"}, {0x0144, "n"}, {0x0145, "N"}, {0x0146, "n"}, {0x0147, "N"},
+    {0x0148, "n"}, {0x014A, "N"}, {0x014B, "n"}, {0x014C, "O"}, {0x014D, "o"}, {0x014E, "O"},
+    {0x014F, "o"}, {0x0150, "O"}, {0x0151, "o"}, {0x0152, "OE"}, {0x0153, "oe"}, {0x0154, "R"},
+    {0x0155, "r"}, {0x0156, "R"}, {0x0157, "r"}, {0x0158, "R"}, {0x0159, "r"}, {0x015A, "S"},
+    {0x015B, "s"}, {0x015C, "S"}, {0x015D, "s"}, {0x015E, "S"}, {0x015F, "s"}, {0x0160, "S"},
+    {0x0161, "s"}, {0x0162, "T"}, {0x0163, "t"}, {0x0164, "T"}, {0x0165, "t"}, {0x0166, "T"},
+    {0x0167, "t"}, {0x0168, "U"}, {0x0169, "u"}, {0x016A, "U"}, {0x016B, "u"}, {0x016C, "U"},
+    {0x016D, "u"}, {0x016E, "U"}, {0x016F, "u"}, {0x0170, "U"}, {0x0171, "u"}, {0x0172, "U"},
+    {0x0173, "u"}, {0x0174, "W"}, {0x0175, "w"}, {0x0176, "Y"}, {0x0177, "y"}, {0x0178, "Y"},
+    {0x0179, "Z"}, {0x017A, "z"}, {0x017B, "Z"}, {0x017C, "z"}, {0x017D, "Z"}, {0x017E, "z"},
+    {0x017F, "s"}, {0x0192, "f"}, {0x01A0, "O"}, {0x01A1, "o"}, {0x01AF, "U"}, {0x01B0, "u"},
+    {0x01C4, "DZ"}, {0x01C5, "Dz"}, {0x01C6, "dz"}, {0x01C7, "LJ"}, {0x01C8, "Lj"}, {0x01C9, "lj"},
+    {0x01CA, "NJ"}, {0x01CB, "Nj"}, {0x01CC, "nj"}, {0x01CD, "A"}, {0x01CE, "a"}, {0x01CF, "I"},
+    {0x01D0, "i"}, {0x01D1, "O"}, {0x01D2, "o"}, {0x01D3, "U"}, {0x01D4, "u"}, {0x01D5, "U"},
+    {0x01D6, "u"}, {0x01D7, "U"}, {0x01D8, "u"}, {0x01D9, "U"}, {0x01DA, "u"}, {0x01DB, "U"},
+    {0x01DC, "u"}, {0x01DE, "A"}, {0x01DF, "a"}, {0x01E0, "A"}, {0x01E1, "a"}, {0x01E6, "G"},
+    {0x01E7, "g"}, {0x01E8, "K"}, {0x01E9, "k"}, {0x01EA, "O"}, {0x01EB, "o"}, {0x01EC, "O"},
+    {0x01ED, "o"}, {0x01F0, "j"}, {0x01F1, "DZ"}, {0x01F2, "Dz"}, {0x01F3, "dz"}, {0x01F4, "G"},
+    {0x01F5, "g"}, {0x01F8, "N"}, {0x01F9, "n"}, {0x01FA, "A"}, {0x01FB, "a"}, {0x0200, "A"},
+    {0x0201, "a"}, {0x0202, "A"}, {0x0203, "a"}, {0x0204, "E"}, {0x0205, "e"}, {0x0206, "E"},
+    {0x0207, "e"}, {0x0208, "I"}, {0x0209, "i"}, {0x020A, "I"}, {0x020B, "i"}, {0x020C, "O"},
+    {0x020D, "o"}, {0x020E, "O"}, {0x020F, "o"}, {0x0210, "R"}, {0x0211, "r"}, {0x0212, "R"},
+    {0x0213, "r"}, {0x0214, "U"}, {0x0215, "u"}, {0x0216, "U"}, {0x0217, "u"}, {0x0218, "S"},
+    {0x0219, "s"}, {0x021A, "T"}, {0x021B, "t"}, {0x021E, "H"}, {0x021F, "h"}, {0x0226, "A"},
+    {0x0227, "a"}, {0x0228, "E"}, {0x0229, "e"}, {0x022A, "O"}, {0x022B, "o"}, {0x022C, "O"},
+    {0x022D, "o"}, {0x022E, "O"}, {0x022F, "o"}, {0x0230, "O"}, {0x0231, "o"}, {0x0232, "Y"},
+    {0x0233, "y"}, {0x2010, "-"}, {0x2011, "-"}, {0x2012, "-"}, {0x2013, "-"}, {0x2014, "-"},
+    {0x2015, "-"}, {0x2018, "'"}, {0x2019, "'"}, {0x201A, ","}, {0x201B, "'"}, {0x201C, "\""},
+    {0x201D, "\""}, {0x201E, ",,"}, {0x201F, "\""}, {0x2020, "+"}, {0x2022, "*"}, {0x2026, "..."},
+    {0x2030, "%"}, {0x2032, "'"}, {0x2033, "\""}, {0x2039, "<"}, {0x203A, ">"}, {0x20AC, "EUR"},
+    {0x2122, "TM"}, {0x2212, "-"},
+};
+static_assert(transliterations_sorted(TRANSLITERATIONS, sizeof(TRANSLITERATIONS) / sizeof(transliteration)), "Stand-ins are out of order");
+static_assert(transliterations_fit(TRANSLITERATIONS, sizeof(TRANSLITERATIONS) / sizeof(transliteration)), "A stand-in is longer than its character");
+
+//Every supported code page
+static constexpr code_page CODE_PAGES[] = {
+    {0, PC437_TABLE, sizeof(PC437_TABLE) / sizeof(code_page_entry), 0xB2},
+    {2, PC850_TABLE, sizeof(PC850_TABLE) / sizeof(code_page_entry), 0xB2},
+    {16, WPC1252_TABLE, sizeof(WPC1252_TABLE) / sizeof(code_page_entry), 0x3F},
+};
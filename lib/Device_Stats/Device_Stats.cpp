@@ -0,0 +1,261 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    A library for keeping track of how the TAG Machine is running: how long each
+    loop takes, how many messages arrive and get printed, how fast the printer
+    takes bytes, how long replies take to send and how old the time is.
+
+    To use, call device_stats.record_loop() at the start of every loop, and the
+    other record_...() functions where those things happen. Call
+    record_boot_start() at the start of setup(), record_boot_step() after each
+    step that could use a lot of memory, and record_boot_done() at the end, for
+    the time setup() took and the lowest free heap seen on the way. They only add to a few
+    counters, so they can be called on every byte or every loop. print_metrics()
+    prints the totals in Prometheus text format, along with the free heap and the
+    Wi-Fi signal strength.
+
+    Loop times are counted in buckets, two per power of two, over the last one to
+    two minutes. Percentiles are the top of the bucket they fall in, so they can
+    be up to a third higher than the real time, never lower.
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include "Device_Stats.h"
+
+//Percentiles of the loop time printed by print_metrics()
+static const uint8_t loop_percentiles[] = {50, 90, 99};
+
+Device_Stats device_stats;
+
+/*  Device_Stats Constructor
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+Device_Stats::Device_Stats(){
+    memset(loop_counts, 0, sizeof(loop_counts));
+    memset(window_bytes, 0, sizeof(window_bytes));
+    memset(window_millis, 0, sizeof(window_millis));
+}
+
+/*  record_boot_start: Note that setup() has started. Call at the start of setup().
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::record_boot_start(){
+    boot_start_millis = millis();
+    record_boot_step();
+}
+
+/*  record_boot_step: Note the free heap during setup(), keeping the lowest. The heap is only
+        looked at when this is called, so call it after each step that could use a lot of it.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::record_boot_step(){
+    uint32_t free_heap = ESP.getFreeHeap();
+    if(free_heap < boot_min_heap) boot_min_heap = free_heap;
+}
+
+/*  record_boot_done: Note that setup() is over, and how long it took. Call at the end of setup().
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::record_boot_done(){
+    record_boot_step();
+    boot_millis = millis() - boot_start_millis;
+    booted = true;
+}
+
+/*  record_loop: Count the time since the last loop started. Call at the start of every loop.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::record_loop(){
+    uint32_t now = micros();
+    if(last_loop_micros){
+        uint32_t elapsed = now - last_loop_micros;
+        advance();
+        loop_counts[window][loop_bucket(elapsed)]++;
+        if(elapsed > max_loop_micros) max_loop_micros = elapsed;
+    }
+    last_loop_micros = now ? now : 1;
+}
+
+/*  record_message_received: Count a message received from the message server
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::record_message_received(){
+    messages_received++;
+}
+
+/*  record_message_printed: Count a message that has been printed
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::record_message_printed(){
+    messages_printed++;
+}
+
+/*  record_MQTT_connect: Count a connection to the message server
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::record_MQTT_connect(){
+    MQTT_connects++;
+}
+
+/*  record_print: Count bytes sent to the printer
+        bytes: Number of bytes
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::record_print(uint32_t bytes){
+    //The window is moved on by the loop, this is called too often to check the time
+    printed_bytes += bytes;
+    window_bytes[window] += bytes;
+}
+
+/*  record_printer_stall: Count time spent waiting for the printer
+        micros: Time waited in µs
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::record_printer_stall(uint32_t micros){
+    stall_micros += micros;
+    if(micros > max_stall_micros) max_stall_micros = micros;
+}
+
+/*  record_twilio_send: Count a reply sent through Twilio
+        micros: Time taken in µs
+        sent: True if it was sent, false if it couldn't be
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::record_twilio_send(uint32_t micros, bool sent){
+    twilio_sends++;
+    if(!sent) twilio_failures++;
+    twilio_micros += micros;
+    if(micros > max_twilio_micros) max_twilio_micros = micros;
+}
+
+/*  record_clock_sync: Note that the clock has just been set
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::record_clock_sync(){
+    clock_sync_millis = millis();
+    clock_synced = true;
+}
+
+/*  get_loop_percentile: Get a percentile of the time between loops, over the last one to two minutes
+        percentile: Percentile to get, from 1 to 100
+    RETURNS Time in µs, or 0 if there haven't been any loops
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint32_t Device_Stats::get_loop_percentile(uint8_t percentile){
+    advance();
+    uint64_t total = 0;
+    for(uint8_t i = 0; i < LOOP_BUCKETS; i++) total += loop_counts[0][i] + loop_counts[1][i];
+    if(total == 0) return 0;
+
+    //Find the bucket the loop at that rank falls in
+    uint64_t rank = (total * percentile + 99) / 100;
+    uint64_t counted = 0;
+    for(uint8_t i = 0; i < LOOP_BUCKETS; i++){
+        counted += loop_counts[0][i] + loop_counts[1][i];
+        if(counted >= rank){
+            //No loop was longer than the longest one, so that's a closer limit for the top bucket
+            uint32_t limit = bucket_limit(i);
+            return limit < max_loop_micros ? limit : max_loop_micros;
+        }
+    }
+    return max_loop_micros;
+}
+
+/*  print_metrics: Print the totals in Prometheus text format
+        output: Where to print the metrics
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::print_metrics(Print& output){
+    output.print("# TYPE uptime_seconds counter\n");
+    output.printf("uptime_seconds %lu\n", (unsigned long)(millis() / 1000));
+
+    output.print("# TYPE heap_free_bytes gauge\n");
+    output.printf("heap_free_bytes %lu\n", (unsigned long)ESP.getFreeHeap());
+    output.print("# TYPE heap_max_free_block_bytes gauge\n");
+    output.printf("heap_max_free_block_bytes %lu\n", (unsigned long)ESP.getMaxFreeBlockSize());
+    output.print("# TYPE heap_fragmentation_percent gauge\n");
+    output.printf("heap_fragmentation_percent %u\n", (unsigned)ESP.getHeapFragmentation());
+
+    output.print("# TYPE loop_duration_micros gauge\n");
+    for(uint8_t i = 0; i < sizeof(loop_percentiles); i++){
+        output.printf("loop_duration_micros{quantile=\"0.%u\"} %lu\n", (unsigned)loop_percentiles[i], (unsigned long)get_loop_percentile(loop_percentiles[i]));
+    }
+    output.print("# TYPE loop_max_duration_micros gauge\n");
+    output.printf("loop_max_duration_micros %lu\n", (unsigned long)max_loop_micros);
+
+    output.print("# TYPE messages_received_total counter\n");
+    output.printf("messages_received_total %lu\n", (unsigned long)messages_received);
+    output.print("# TYPE messages_printed_total counter\n");
+    output.printf("messages_printed_total %lu\n", (unsigned long)messages_printed);
+    //The first connection after boot isn't a reconnect
+    output.print("# TYPE mqtt_reconnects_total counter\n");
+    output.printf("mqtt_reconnects_total %lu\n", (unsigned long)(MQTT_connects ? MQTT_connects - 1 : 0));
+
+    //Bytes per second over the last one to two minutes
+    uint32_t elapsed = millis() - window_millis[window ^ 1];
+    uint64_t recent_bytes = (uint64_t)window_bytes[0] + window_bytes[1];
+    output.print("# TYPE printer_written_bytes_total counter\n");
+    output.printf("printer_written_bytes_total %lu\n", (unsigned long)printed_bytes);
+    output.print("# TYPE printer_bytes_per_second gauge\n");
+    output.printf("printer_bytes_per_second %lu\n", (unsigned long)(elapsed ? recent_bytes * 1000 / elapsed : 0));
+    output.print("# TYPE printer_stall_millis_total counter\n");
+    output.printf("printer_stall_millis_total %lu\n", (unsigned long)(stall_micros / 1000));
+    output.print("# TYPE printer_max_stall_micros gauge\n");
+    output.printf("printer_max_stall_micros %lu\n", (unsigned long)max_stall_micros);
+
+    output.print("# TYPE twilio_sends_total counter\n");
+    output.printf("twilio_sends_total %lu\n", (unsigned long)twilio_sends);
+    output.print("# TYPE twilio_send_failures_total counter\n");
+    output.printf("twilio_send_failures_total %lu\n", (unsigned long)twilio_failures);
+    output.print("# TYPE twilio_send_millis_total counter\n");
+    output.printf("twilio_send_millis_total %lu\n", (unsigned long)(twilio_micros / 1000));
+    output.print("# TYPE twilio_max_send_micros gauge\n");
+    output.printf("twilio_max_send_micros %lu\n", (unsigned long)max_twilio_micros);
+
+    //Leave out what isn't known yet, rather than report a misleading 0
+    if(booted){
+        output.print("# TYPE boot_duration_millis gauge\n");
+        output.printf("boot_duration_millis %lu\n", (unsigned long)boot_millis);
+        output.print("# TYPE boot_min_heap_free_bytes gauge\n");
+        output.printf("boot_min_heap_free_bytes %lu\n", (unsigned long)boot_min_heap);
+    }
+    if(clock_synced){
+        output.print("# TYPE clock_sync_age_seconds gauge\n");
+        output.printf("clock_sync_age_seconds %lu\n", (unsigned long)((millis() - clock_sync_millis) / 1000));
+    }
+    if(WiFi.status() == WL_CONNECTED){
+        output.print("# TYPE wifi_rssi_dbm gauge\n");
+        output.printf("wifi_rssi_dbm %d\n", (int)WiFi.RSSI());
+    }
+}
+
+/*  (private) advance: Start a new window if the current one has ended, clearing
+        the counts of the window it replaces
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Device_Stats::advance(){
+    uint32_t now = millis();
+    uint32_t elapsed = now - window_millis[window];
+    if(elapsed < STATS_WINDOW) return;
+
+    window ^= 1;
+    memset(loop_counts[window], 0, sizeof(loop_counts[window]));
+    window_bytes[window] = 0;
+    window_millis[window] = now;
+
+    //If nothing has been counted for a whole window, the last window is over too
+    if(elapsed >= 2 * STATS_WINDOW){
+        memset(loop_counts[window ^ 1], 0, sizeof(loop_counts[window ^ 1]));
+        window_bytes[window ^ 1] = 0;
+        window_millis[window ^ 1] = now - STATS_WINDOW;
+    }
+}
+
+/*  (private) loop_bucket: Get the bucket a loop time is counted in
+        micros: Loop time in µs
+    RETURNS Bucket, from 0 to LOOP_BUCKETS - 1
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint8_t Device_Stats::loop_bucket(uint32_t micros){
+    if(micros < 2) return micros;
+    //Two buckets per power of two: the bit below the highest one picks the lower or upper half
+    uint8_t power = 31 - __builtin_clz(micros);
+    if(power >= LOOP_BUCKETS / 2) return LOOP_BUCKETS - 1;
+    return power * 2 + ((micros >> (power - 1)) & 1);
+}
+
+/*  (private) bucket_limit: Get the longest loop time counted in a bucket
+        bucket: Bucket, from 0 to LOOP_BUCKETS - 1
+    RETURNS Time in µs
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint32_t Device_Stats::bucket_limit(uint8_t bucket){
+    if(bucket < 2) return bucket;
+    if(bucket == LOOP_BUCKETS - 1) return UINT32_MAX;
+    uint8_t power = bucket / 2;
+    return ((2 + (bucket & 1)) << (power - 1)) + (1 << (power - 1)) - 1;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Arduino.h"
+#include "ESP8266WiFi.h" //WiFi Library, for the signal strength
+
+//Number of buckets loop times are counted in, two per power of two from 1µs to 16s
+#define LOOP_BUCKETS 48
+//Length of each window loop times and printed bytes are counted over (ms)
+#define STATS_WINDOW 60000
+
+class Device_Stats{
+
+    public:
+
+        Device_Stats();
+
+        void
+            record_boot_start(),
+            record_boot_step(),
+            record_boot_done(),
+            record_loop(),
+            record_message_received(),
+            record_message_printed(),
+            record_MQTT_connect(),
+            record_print(uint32_t bytes),
+            record_printer_stall(uint32_t micros),
+            record_twilio_send(uint32_t micros, bool sent),
+            record_clock_sync(),
+            print_metrics(Print& output);
+
+        uint32_t
+            get_loop_percentile(uint8_t percentile);
+
+    private:
+
+        void
+            advance();
+
+        uint8_t
+            loop_bucket(uint32_t micros);
+
+        uint32_t
+            bucket_limit(uint8_t bucket);
+
+        //Loop times are counted in two windows, the current one and the last one, so percentiles always cover at least one full window
+        uint32_t loop_counts[2][LOOP_BUCKETS]; //Number of loops that took each bucket's time, in each window
+        uint32_t window_bytes[2]; //Bytes sent to the printer in each window
+        uint32_t window_millis[2]; //Time each window started
+        uint8_t window = 0; //Current window
+        uint32_t last_loop_micros = 0; //Time the last loop started, or 0 before the first loop
+        uint32_t max_loop_micros = 0; //Longest loop since boot
+
+        uint32_t messages_received = 0; //Messages received from the message server
+        uint32_t messages_printed = 0; //Messages printed
+        uint32_t MQTT_connects = 0; //Times the message server has been connected to
+
+        uint32_t printed_bytes = 0; //Bytes sent to the printer
+        uint64_t stall_micros = 0; //Time spent waiting for the printer to be ready (DTR high)
+        uint32_t max_stall_micros = 0; //Longest wait for the printer
+
+        uint32_t twilio_sends = 0; //Replies sent through Twilio
+        uint32_t twilio_failures = 0; //Replies that couldn't be sent
+        uint64_t twilio_micros = 0; //Time spent sending replies
+        uint32_t max_twilio_micros = 0; //Longest time spent sending a reply
+
+        uint32_t boot_start_millis = 0; //Time setup() started
+        uint32_t boot_millis = 0; //Time setup() took
+        uint32_t boot_min_heap = UINT32_MAX; //Lowest free heap seen during setup()
+        bool booted = false; //True once setup() is over
+
+        uint32_t clock_sync_millis = 0; //Time the clock was last set, or 0 if it never has been
+        bool clock_synced = false; //True once the clock has been set
+
+};
+
+extern Device_Stats device_stats;
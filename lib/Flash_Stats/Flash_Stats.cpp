@@ -0,0 +1,175 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    A library for keeping track of how much, and how often, the ESP8266 writes to
+    flash through LittleFS.
+
+    To use, call flash_stats.record() after writing to a file, with the position
+    the write started at and the number of bytes written. The bytes and the
+    number of flash blocks written to are added up per subsystem and per file,
+    and over a rolling hour. print_metrics() prints the totals in Prometheus
+    text format, along with an estimate of how long the flash will last at the
+    current rate.
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include "Flash_Stats.h"
+
+//Size of a LittleFS block, used if the filesystem doesn't report one
+#define FLASH_BLOCK_SIZE 4096
+//Number of times each block can be erased before it's likely to wear out
+#define FLASH_ENDURANCE 100000
+
+//Names of the subsystems, in order
+static const char* subsystem_names[FLASH_SUBSYSTEMS] = {"contacts", "settings", "upload", "journal"};
+
+Flash_Stats flash_stats;
+
+/*  Flash_Stats Constructor
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+Flash_Stats::Flash_Stats(){
+    memset(bytes, 0, sizeof(bytes));
+    memset(blocks, 0, sizeof(blocks));
+    memset(rate_bytes, 0, sizeof(rate_bytes));
+    memset(rate_blocks, 0, sizeof(rate_blocks));
+}
+
+/*  record: Add a write to the totals
+        subsystem: FLASH_CONTACTS, FLASH_SETTINGS or FLASH_UPLOAD
+        path: Path of the file written to
+        position: Position in the file the write started at
+        bytes: Number of bytes written
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Flash_Stats::record(uint8_t subsystem, const char* path, uint32_t position, size_t bytes){
+    if(subsystem >= FLASH_SUBSYSTEMS || bytes == 0) return;
+
+    //Count every block the write touches, each one has to be programmed
+    uint32_t written_blocks = (position + bytes - 1) / FLASH_BLOCK_SIZE - position / FLASH_BLOCK_SIZE + 1;
+
+    this->bytes[subsystem] += bytes;
+    blocks[subsystem] += written_blocks;
+
+    //Find the file, or add it. Once the list is full, the last entry holds everything else.
+    uint8_t i = 0;
+    while(i < file_count && strcmp(files[i].path, path) != 0 && strcmp(files[i].path, "*") != 0) i++;
+    if(i == file_count){
+        if(file_count == FLASH_FILES){
+            i = FLASH_FILES - 1;
+            strcpy(files[i].path, "*");
+        }else{
+            strncpy(files[i].path, path, sizeof(files[i].path) - 1);
+            files[i].path[sizeof(files[i].path) - 1] = '\0';
+            files[i].bytes = 0;
+            files[i].blocks = 0;
+            file_count++;
+        }
+    }
+    files[i].subsystem = subsystem;
+    files[i].bytes += bytes;
+    files[i].blocks += written_blocks;
+
+    //Add it to the current minute
+    advance();
+    rate_bytes[current_minute % FLASH_RATE_BUCKETS] += bytes;
+    rate_blocks[current_minute % FLASH_RATE_BUCKETS] += written_blocks;
+}
+
+/*  get_bytes: Get the bytes written by a subsystem
+        subsystem: FLASH_CONTACTS, FLASH_SETTINGS or FLASH_UPLOAD
+    RETURNS Bytes written since boot
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint32_t Flash_Stats::get_bytes(uint8_t subsystem){
+    return subsystem < FLASH_SUBSYSTEMS ? bytes[subsystem] : 0;
+}
+
+/*  get_blocks: Get the blocks written by a subsystem
+        subsystem: FLASH_CONTACTS, FLASH_SETTINGS or FLASH_UPLOAD
+    RETURNS Blocks written since boot
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint32_t Flash_Stats::get_blocks(uint8_t subsystem){
+    return subsystem < FLASH_SUBSYSTEMS ? blocks[subsystem] : 0;
+}
+
+/*  get_bytes_per_hour: Get the rate bytes are being written at, over the last hour
+        (or since boot, if that was less than an hour ago)
+    RETURNS Bytes per hour
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint32_t Flash_Stats::get_bytes_per_hour(){
+    advance();
+    uint32_t minutes = current_minute + 1 < FLASH_RATE_BUCKETS ? current_minute + 1 : FLASH_RATE_BUCKETS;
+    uint64_t total = 0;
+    for(uint8_t i = 0; i < FLASH_RATE_BUCKETS; i++) total += rate_bytes[i];
+    return total * 60 / minutes;
+}
+
+/*  get_blocks_per_hour: Get the rate blocks are being written at, over the last hour
+        (or since boot, if that was less than an hour ago)
+    RETURNS Blocks per hour
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint32_t Flash_Stats::get_blocks_per_hour(){
+    advance();
+    uint32_t minutes = current_minute + 1 < FLASH_RATE_BUCKETS ? current_minute + 1 : FLASH_RATE_BUCKETS;
+    uint64_t total = 0;
+    for(uint8_t i = 0; i < FLASH_RATE_BUCKETS; i++) total += rate_blocks[i];
+    return total * 60 / minutes;
+}
+
+/*  print_metrics: Print the totals in Prometheus text format
+        output: Where to print the metrics
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Flash_Stats::print_metrics(Print& output){
+    output.print("# TYPE flash_written_bytes_total counter\n");
+    for(uint8_t i = 0; i < FLASH_SUBSYSTEMS; i++){
+        output.printf("flash_written_bytes_total{subsystem=\"%s\"} %lu\n", subsystem_names[i], (unsigned long)bytes[i]);
+    }
+    output.print("# TYPE flash_written_blocks_total counter\n");
+    for(uint8_t i = 0; i < FLASH_SUBSYSTEMS; i++){
+        output.printf("flash_written_blocks_total{subsystem=\"%s\"} %lu\n", subsystem_names[i], (unsigned long)blocks[i]);
+    }
+
+    output.print("# TYPE flash_file_written_bytes_total counter\n");
+    for(uint8_t i = 0; i < file_count; i++){
+        output.printf("flash_file_written_bytes_total{path=\"%s\",subsystem=\"%s\"} %lu\n", files[i].path, subsystem_names[files[i].subsystem], (unsigned long)files[i].bytes);
+    }
+    output.print("# TYPE flash_file_written_blocks_total counter\n");
+    for(uint8_t i = 0; i < file_count; i++){
+        output.printf("flash_file_written_blocks_total{path=\"%s\",subsystem=\"%s\"} %lu\n", files[i].path, subsystem_names[files[i].subsystem], (unsigned long)files[i].blocks);
+    }
+
+    uint32_t blocks_per_hour = get_blocks_per_hour();
+    output.print("# TYPE flash_write_rate_bytes_per_hour gauge\n");
+    output.printf("flash_write_rate_bytes_per_hour %lu\n", (unsigned long)get_bytes_per_hour());
+    output.print("# TYPE flash_write_rate_blocks_per_hour gauge\n");
+    output.printf("flash_write_rate_blocks_per_hour %lu\n", (unsigned long)blocks_per_hour);
+
+    //LittleFS spreads writes over every block, so the flash lasts until all of them have been erased FLASH_ENDURANCE times
+    FSInfo info;
+    if(!LittleFS.info(info)) return;
+    uint32_t block_size = info.blockSize ? info.blockSize : FLASH_BLOCK_SIZE;
+    output.print("# TYPE flash_estimated_lifetime_days gauge\n");
+    if(blocks_per_hour == 0){
+        output.print("flash_estimated_lifetime_days +Inf\n");
+    }else{
+        uint64_t erases = (uint64_t)(info.totalBytes / block_size) * FLASH_ENDURANCE;
+        output.printf("flash_estimated_lifetime_days %lu\n", (unsigned long)(erases / blocks_per_hour / 24));
+    }
+}
+
+/*  (private) advance: Move the rolling window up to the current minute, clearing
+        the buckets for any minutes that have passed
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Flash_Stats::advance(){
+    uint32_t minute = millis() / 60000;
+    if(minute - current_minute >= FLASH_RATE_BUCKETS){
+        memset(rate_bytes, 0, sizeof(rate_bytes));
+        memset(rate_blocks, 0, sizeof(rate_blocks));
+        current_minute = minute;
+        return;
+    }
+    while(current_minute != minute){
+        current_minute++;
+        rate_bytes[current_minute % FLASH_RATE_BUCKETS] = 0;
+        rate_blocks[current_minute % FLASH_RATE_BUCKETS] = 0;
+    }
+}
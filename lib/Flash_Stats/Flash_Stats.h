@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Arduino.h"
+#include "LittleFS.h"
+
+//Subsystems that write to flash
+#define FLASH_CONTACTS 0 //Contact storage
+#define FLASH_SETTINGS 1 //Settings file
+#define FLASH_UPLOAD 2 //Files uploaded through the web interface
+#define FLASH_JOURNAL 3 //Message journal
+#define FLASH_SUBSYSTEMS 4
+
+//Number of files tracked individually, writes to any others are added to the last entry
+#define FLASH_FILES 12
+//Number of one-minute buckets used for the rolling write rate
+#define FLASH_RATE_BUCKETS 60
+
+//Bytes and blocks written to one file
+struct flash_file_stats{
+    char path[32]; //Path of the file, "*" for files that didn't fit
+    uint8_t subsystem; //Subsystem that last wrote to the file
+    uint32_t bytes; //Bytes written
+    uint32_t blocks; //Flash blocks written to, counted once per write
+};
+
+class Flash_Stats{
+
+    public:
+
+        Flash_Stats();
+
+        void
+            record(uint8_t subsystem, const char* path, uint32_t position, size_t bytes),
+            print_metrics(Print& output);
+
+        uint32_t
+            get_bytes(uint8_t subsystem),
+            get_blocks(uint8_t subsystem),
+            get_bytes_per_hour(),
+            get_blocks_per_hour();
+
+    private:
+
+        void
+            advance();
+
+        uint32_t bytes[FLASH_SUBSYSTEMS]; //Bytes written by each subsystem since boot
+        uint32_t blocks[FLASH_SUBSYSTEMS]; //Blocks written by each subsystem since boot
+
+        flash_file_stats files[FLASH_FILES]; //Writes to each file since boot
+        uint8_t file_count = 0; //Number of files tracked
+
+        uint32_t rate_bytes[FLASH_RATE_BUCKETS]; //Bytes written in each of the last few minutes
+        uint32_t rate_blocks[FLASH_RATE_BUCKETS]; //Blocks written in each of the last few minutes
+        uint32_t current_minute = 0; //Minute since boot of the newest bucket
+
+};
+
+extern Flash_Stats flash_stats;
@@ -0,0 +1,452 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    A journal of received messages for ESP8266, kept in LittleFS.
+
+    To use, initialize an object with the name of the folder you'd like to use.
+    Call append() with each message as it's received, and export_range() to print
+    the messages received since a time, or after an ID, as JSON, all at once or a
+    piece at a time. Call end() before LittleFS goes offline.
+
+    Messages are appended to segment files of up to JOURNAL_SEGMENT_SIZE bytes,
+    each with a sequential ID and a CRC32, so a power cut can only ever lose the
+    message being written. When a segment is full, the next one is started, and
+    once there are JOURNAL_SEGMENTS the oldest is deleted. Appending a message is
+    one write to the end of the newest segment, however many there are.
+
+    The first ID, and the earliest and latest time, of every segment are kept in
+    RAM, and the full segments' are saved in an index file so they don't have to
+    be read at startup. A query skips every segment that can't hold a match, and
+    only reads the ones that can.
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include "Message_Journal.h"
+#include "Flash_Stats.h" //Flash write accounting
+
+//Marks the start of a message in a segment
+#define MESSAGE_MAGIC 0x4D
+//Bytes after the header of a message that aren't its number, body or media: the CRC32
+#define MESSAGE_CRC 4
+
+/*  (private) crc32_update: Add bytes to a running CRC-32 (start with 0xFFFFFFFF
+        and invert the result)
+        crc: CRC so far
+        data: Bytes to add
+        length: Number of bytes
+    RETURNS The updated CRC
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t length){
+    while(length--){
+        crc ^= *data++;
+        for(uint8_t bit = 0; bit < 8; bit++){
+            crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+        }
+    }
+    return crc;
+}
+
+/*  (private) print_json_file: Print bytes read from a file as a quoted, escaped JSON string
+        output: Where to print
+        file: File, at the first byte
+        length: Number of bytes
+    RETURNS True if they were all read, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static bool print_json_file(Print& output, File& file, uint16_t length){
+    output.print('"');
+    uint8_t buffer[64];
+    while(length){
+        size_t size = file.read(buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+        if(!size) break;
+        length -= size;
+        for(size_t i = 0; i < size; i++){
+            char c = buffer[i];
+            if(c == '"' || c == '\\'){
+                output.print('\\');
+                output.print(c);
+            }else if((uint8_t)c < 0x20){
+                char escaped[7];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                output.print(escaped);
+            }else{
+                output.print(c);
+            }
+        }
+    }
+    output.print('"');
+    return length == 0;
+}
+
+/*  Message_Journal Constructor
+        name: The name of the folder the journal is kept in
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+Message_Journal::Message_Journal(String name){
+    folder = "/" + name;
+    index_path = folder + "/index";
+}
+
+/*  append: Add a message to the end of the journal
+        time: UNIX time the message was received
+        from: Phone number the message is from
+        body: Message body
+        media: Media files (if any), separated by ","
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Message_Journal::append(uint32_t time, const String& from, const String& body, const String& media){
+    if(!loaded && !load()) return false;
+
+    message_header header;
+    header.magic = MESSAGE_MAGIC;
+    header.from_length = from.length() < 255 ? from.length() : 255;
+    header.body_length = body.length() < 65535 ? body.length() : 65535;
+    header.seq = seq + 1;
+    header.time = time;
+    header.media_length = media.length() < 65535 ? media.length() : 65535;
+    header.reserved = 0;
+    uint32_t size = sizeof(header) + header.from_length + header.body_length + header.media_length + MESSAGE_CRC;
+
+    //Start a new segment if this one is full. An empty one takes any message, however long.
+    journal_segment* segment = &segments[segment_count - 1];
+    if(segment->size && segment->size + size > JOURNAL_SEGMENT_SIZE){
+        if(!start_segment()) return false;
+        segment = &segments[segment_count - 1];
+    }
+
+    uint32_t crc = crc32_update(0xFFFFFFFF, (const uint8_t*)&header, sizeof(header));
+    crc = crc32_update(crc, (const uint8_t*)from.c_str(), header.from_length);
+    crc = crc32_update(crc, (const uint8_t*)body.c_str(), header.body_length);
+    crc = crc32_update(crc, (const uint8_t*)media.c_str(), header.media_length);
+    crc = ~crc;
+
+    //Write it to the end of the segment, and make sure it's in flash before carrying on
+    size_t written = active_file.write((const uint8_t*)&header, sizeof(header));
+    written += active_file.write((const uint8_t*)from.c_str(), header.from_length);
+    written += active_file.write((const uint8_t*)body.c_str(), header.body_length);
+    written += active_file.write((const uint8_t*)media.c_str(), header.media_length);
+    written += active_file.write((const uint8_t*)&crc, MESSAGE_CRC);
+    active_file.flush();
+    flash_stats.record(FLASH_JOURNAL, segment_path(segment->number).c_str(), segment->size, written);
+
+    //If it was cut short, the segment is read again at the next load and the partial message cut off
+    if(written != size){
+        end();
+        return false;
+    }
+
+    seq = header.seq;
+    if(!segment->count || time < segment->first_time) segment->first_time = time;
+    if(!segment->count || time > segment->last_time) segment->last_time = time;
+    segment->count++;
+    segment->size += size;
+    return true;
+}
+
+/*  export_range: Print the messages received since a time, after an ID, as JSON:
+        {"messages":[{"id":1,"time":0,"from":"","body":"","media":""}],"more":false,"last":1}
+        "more" is true if there are more messages after the last one printed, and "last" is the ID of
+        the newest message in the journal, to ask for the messages after it later.
+        output: Where to print the JSON
+        since: Earliest UNIX time to print messages from, 0 for all of them
+        after: Only print messages with a higher ID than this, 0 for all of them
+        limit: Most messages to print
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Message_Journal::export_range(Print& output, uint32_t since, uint32_t after, uint16_t limit){
+    if(!loaded && !load()) return false;
+
+    journal_position position = {after, 0, false, false};
+    while(export_range(output, &position, since, limit, UINT16_MAX));
+    return !position.failed;
+}
+
+/*  export_range: Print the next piece of the messages received since a time, after an ID,
+        as export_range() above. Each piece carries on after the last message printed, so
+        messages can arrive between pieces.
+        output: Where to print the piece
+        position: Where the export is up to, {after, 0, false, false} to start
+        since: Earliest UNIX time to print messages from, 0 for all of them
+        limit: Most messages to print in all
+        count: Most messages to print in this piece
+    RETURNS True if there is more to print, false once the end has been printed
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Message_Journal::export_range(Print& output, journal_position* position, uint32_t since, uint16_t limit, uint16_t count){
+    if(!position->started) output.print("{\"messages\":[");
+    position->started = true;
+
+    uint16_t printed = 0;
+    bool ok = loaded || load();
+
+    for(uint8_t i = 0; i < segment_count && printed < count && position->printed < limit && ok; i++){
+        journal_segment* segment = &segments[i];
+
+        //Skip segments with no message late enough
+        if(!segment->count || segment->last_time < since || segment->first_seq + segment->count - 1 <= position->after) continue;
+
+        File file = LittleFS.open(segment_path(segment->number), "r");
+        if(!file){
+            ok = false;
+            break;
+        }
+
+        message_header header;
+        uint32_t read = 0;
+        while(read < segment->count && printed < count && position->printed < limit){
+            if(file.read((uint8_t*)&header, sizeof(header)) != sizeof(header) || header.magic != MESSAGE_MAGIC){
+                ok = false;
+                break;
+            }
+            read++;
+
+            //Skip messages that don't match without reading them
+            uint32_t payload = header.from_length + header.body_length + header.media_length + MESSAGE_CRC;
+            if(header.time < since || header.seq <= position->after){
+                file.seek(payload, SeekCur);
+                continue;
+            }
+
+            if(position->printed) output.print(',');
+            output.printf("{\"id\":%lu,\"time\":%lu,\"from\":", (unsigned long)header.seq, (unsigned long)header.time);
+            ok = print_json_file(output, file, header.from_length);
+            output.print(",\"body\":");
+            ok = ok && print_json_file(output, file, header.body_length);
+            output.print(",\"media\":");
+            ok = ok && print_json_file(output, file, header.media_length);
+            output.print('}');
+            file.seek(MESSAGE_CRC, SeekCur);
+
+            printed++;
+            position->printed++;
+            position->after = header.seq;
+            if(!ok) break;
+        }
+        file.close();
+    }
+
+    if(ok && printed == count && position->printed < limit) return true;
+
+    position->failed = !ok;
+    uint32_t last_printed = position->printed ? position->after : 0;
+    output.printf("],\"more\":%s,\"last\":%lu}", position->printed == limit && last_printed < seq ? "true" : "false", (unsigned long)seq);
+    return false;
+}
+
+/*  clear: Delete every message
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Message_Journal::clear(){
+    if(!loaded && !load()) return false;
+
+    end();
+    bool ok = true;
+    for(uint8_t i = 0; i < segment_count; i++){
+        ok = LittleFS.remove(segment_path(segments[i].number)) && ok;
+    }
+    if(LittleFS.exists(index_path)) ok = LittleFS.remove(index_path) && ok;
+    segment_count = 0;
+    seq = 0;
+    return ok;
+}
+
+/*  get_count: Get the number of messages in the journal
+    RETURNS Number of messages
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint32_t Message_Journal::get_count(){
+    if(!loaded && !load()) return 0;
+
+    uint32_t count = 0;
+    for(uint8_t i = 0; i < segment_count; i++) count += segments[i].count;
+    return count;
+}
+
+/*  get_last_id: Get the ID of the newest message
+    RETURNS ID, or 0 if there have been no messages
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint32_t Message_Journal::get_last_id(){
+    if(!loaded && !load()) return 0;
+    return seq;
+}
+
+/*  end: Close the journal. It's opened again when it's next used.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Message_Journal::end(){
+    if(active_file) active_file.close();
+    loaded = false;
+}
+
+/*  (private) load: Index the segments, and open the newest one for appending
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Message_Journal::load(){
+    end();
+    segment_count = 0;
+    seq = 0;
+    if(!LittleFS.exists(folder) && !LittleFS.mkdir(folder)) return false;
+
+    //Find the segments, keeping the newest JOURNAL_SEGMENTS in order
+    Dir dir = LittleFS.openDir(folder);
+    while(dir.next()){
+        String name = dir.fileName();
+        if(!name.endsWith(".seg")) continue;
+        add_segment(strtoul(name.c_str(), NULL, 16));
+    }
+
+    //Full segments are in the index, as long as they haven't changed since it was written
+    File index = LittleFS.open(index_path, "r");
+    bool indexed[JOURNAL_SEGMENTS] = {false};
+    journal_segment entry;
+    while(index && index.read((uint8_t*)&entry, sizeof(entry)) == sizeof(entry)){
+        for(uint8_t i = 0; i + 1 < segment_count; i++){
+            if(segments[i].number == entry.number && segments[i].size == entry.size){
+                segments[i] = entry;
+                indexed[i] = true;
+            }
+        }
+    }
+    if(index) index.close();
+
+    //Read the rest, which is usually only the newest segment, and cut off a message interrupted by a power cut
+    for(uint8_t i = 0; i < segment_count; i++){
+        if(!indexed[i]){
+            segments[i].first_seq = seq + 1;
+            scan_segment(&segments[i]);
+        }
+        if(segments[i].count) seq = segments[i].first_seq + segments[i].count - 1;
+    }
+
+    if(segment_count == 0){
+        if(!start_segment()) return false;
+    }else{
+        active_file = LittleFS.open(segment_path(segments[segment_count - 1].number), "a");
+        if(!active_file) return false;
+    }
+
+    loaded = true;
+    return true;
+}
+
+/*  (private) start_segment: Start a new segment for messages to be appended to, deleting the oldest
+        segment if there are too many
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Message_Journal::start_segment(){
+    if(active_file) active_file.close();
+
+    uint32_t number = segment_count ? segments[segment_count - 1].number + 1 : 1;
+    add_segment(number);
+
+    journal_segment* segment = &segments[segment_count - 1];
+    segment->first_seq = seq + 1;
+    active_file = LittleFS.open(segment_path(number), "a");
+    if(!active_file) return false;
+
+    //The segment before this one is full, so it won't change again
+    return write_index();
+}
+
+/*  (private) write_index: Save the index of every full segment, so they don't have to be read at startup
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Message_Journal::write_index(){
+    File index = LittleFS.open(index_path, "w");
+    if(!index) return false;
+    size_t size = (segment_count - 1) * sizeof(journal_segment);
+    size_t written = index.write((const uint8_t*)segments, size);
+    index.close();
+    flash_stats.record(FLASH_JOURNAL, index_path.c_str(), 0, written);
+    return written == size;
+}
+
+/*  (private) read_message: Read a message's header, and move to the next message
+        file: Segment, at the start of the message
+        header: Holds the header
+        check: True to check the message against its CRC
+    RETURNS True if there is a whole message, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Message_Journal::read_message(File& file, message_header* header, bool check){
+    if(file.read((uint8_t*)header, sizeof(message_header)) != sizeof(message_header)) return false;
+    if(header->magic != MESSAGE_MAGIC) return false;
+
+    uint32_t length = header->from_length + header->body_length + header->media_length;
+    if(!check) return file.seek(length + MESSAGE_CRC, SeekCur) && file.position() <= file.size();
+
+    uint32_t crc = crc32_update(0xFFFFFFFF, (const uint8_t*)header, sizeof(message_header));
+    uint8_t buffer[64];
+    while(length){
+        size_t size = file.read(buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+        if(!size) return false;
+        crc = crc32_update(crc, buffer, size);
+        length -= size;
+    }
+
+    uint32_t stored_crc;
+    if(file.read((uint8_t*)&stored_crc, MESSAGE_CRC) != MESSAGE_CRC) return false;
+    return stored_crc == ~crc;
+}
+
+/*  (private) add_segment: Add a segment to the index in RAM, in order. If there are already
+        JOURNAL_SEGMENTS, the oldest is deleted.
+        number: Number in the segment's file name
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Message_Journal::add_segment(uint32_t number){
+    //If it's older than every segment and there's no room, it's the one to delete
+    if(segment_count == JOURNAL_SEGMENTS && number < segments[0].number){
+        LittleFS.remove(segment_path(number));
+        return;
+    }
+    if(segment_count == JOURNAL_SEGMENTS) drop_segment();
+
+    uint8_t i = segment_count;
+    while(i > 0 && segments[i - 1].number > number){
+        segments[i] = segments[i - 1];
+        i--;
+    }
+    segments[i] = {number, seq + 1, 0, 0, 0, 0};
+    segment_count++;
+}
+
+/*  (private) drop_segment: Delete the oldest segment
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Message_Journal::drop_segment(){
+    LittleFS.remove(segment_path(segments[0].number));
+    segment_count--;
+    memmove(segments, segments + 1, segment_count * sizeof(journal_segment));
+}
+
+/*  (private) scan_segment: Read every message in a segment to index it, and cut off anything after
+        the last whole message
+        segment: Segment, with first_seq set to the ID its first message should have
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Message_Journal::scan_segment(journal_segment* segment){
+    String path = segment_path(segment->number);
+    File file = LittleFS.open(path, "r+");
+    if(!file) return;
+
+    message_header header;
+    uint32_t good_size = 0;
+    while(file.position() < file.size() && read_message(file, &header, true)){
+        //Stop at a message that's out of sequence
+        if(segment->count == 0) segment->first_seq = header.seq;
+        else if(header.seq != segment->first_seq + segment->count) break;
+
+        if(!segment->count || header.time < segment->first_time) segment->first_time = header.time;
+        if(!segment->count || header.time > segment->last_time) segment->last_time = header.time;
+        segment->count++;
+        good_size = file.position();
+    }
+
+    //Cut off anything after the last good message, such as a write interrupted by a power cut
+    if(good_size < file.size()) file.truncate(good_size);
+    file.close();
+    segment->size = good_size;
+}
+
+/*  (private) segment_path: Get the path of a segment
+        number: Number of the segment
+    RETURNS Path
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+String Message_Journal::segment_path(uint32_t number){
+    char name[16];
+    snprintf(name, sizeof(name), "/%08lx.seg", (unsigned long)number);
+    return folder + name;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Arduino.h"
+#include "LittleFS.h"
+
+//Size a segment grows to before the next message starts a new one
+#define JOURNAL_SEGMENT_SIZE 16384
+//Number of segments kept, the oldest is dropped when another is started
+#define JOURNAL_SEGMENTS 8
+
+//A segment of the journal, as indexed in RAM
+struct journal_segment{
+    uint32_t number; //Number in the segment's file name
+    uint32_t first_seq; //ID of the first message, or of the next message if it's empty
+    uint32_t count; //Number of messages
+    uint32_t first_time; //UNIX time of the earliest message
+    uint32_t last_time; //UNIX time of the latest message
+    uint32_t size; //Size of the file in bytes
+};
+
+//Where an export printed a piece at a time is up to
+struct journal_position{
+    uint32_t after; //ID of the last message printed, or the one to print messages after at first
+    uint16_t printed; //Messages printed so far
+    bool started; //True once the start of the export has been printed
+    bool failed; //True if a segment couldn't be read, so the export ended early
+};
+
+class Message_Journal{
+
+    public:
+
+        Message_Journal(String name);
+
+        bool
+            append(uint32_t time, const String& from, const String& body, const String& media),
+            export_range(Print& output, uint32_t since, uint32_t after, uint16_t limit),
+            export_range(Print& output, journal_position* position, uint32_t since, uint16_t limit, uint16_t count),
+            clear();
+
+        uint32_t
+            get_count(),
+            get_last_id();
+
+        void
+            end();
+
+    private:
+
+        //Header of a message in a segment, followed by the number, body and media, then a CRC32 of all of it
+        struct message_header{
+            uint8_t magic;
+            uint8_t from_length;
+            uint16_t body_length;
+            uint32_t seq; //ID of the message
+            uint32_t time; //UNIX time the message was received
+            uint16_t media_length;
+            uint16_t reserved;
+        };
+
+        bool
+            load(),
+            start_segment(),
+            read_message(File& file, message_header* header, bool check),
+            write_index();
+
+        void
+            add_segment(uint32_t number),
+            drop_segment(),
+            scan_segment(journal_segment* segment);
+
+        String
+            segment_path(uint32_t number);
+
+        String folder; //The folder the segments are kept in
+        String index_path; //The path of the index of full segments
+
+        File active_file; //Newest segment, open for appending
+
+        journal_segment segments[JOURNAL_SEGMENTS]; //Every segment, oldest first. The last one is the active segment.
+        uint8_t segment_count = 0; //Number of segments
+
+        uint32_t seq = 0; //ID of the last message
+        bool loaded = false; //True if the segments are indexed and the active segment is open
+
+};
@@ -0,0 +1,196 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    Parser for the messages TAG_Bridge sends over MQTT.
+
+    parse_message() reads the payload once and points each text field at its
+    place in the payload, without copying anything or allocating memory. The
+    payload has to stay in place for as long as the fields are used.
+
+    Version 2 messages are binary, with every number little-endian:
+        0   magic (MESSAGE_V2_MAGIC)
+        1   version (MESSAGE_V2_VERSION)
+        2   time (4 bytes, UNIX UTC)
+        6   id length
+        7   from length
+        8   body length (2 bytes)
+        10  media count
+        11  media numbers (1 byte each, MEDIA_UNSUPPORTED for an unsupported attachment)
+        then the id, from and body, one after the other
+    Only the first MESSAGE_MEDIA_MAX media numbers are kept, the rest are skipped.
+    Every field is at a fixed offset or follows from the lengths before it, so
+    nothing is searched for.
+
+    Version 1 messages are text. The bridge still sends them for older firmware,
+    and they're still understood here, since messages left with the broker from
+    before an update arrive in this form:
+        id:<id>\nfrom:<number>\nbody:<body>\nmedia:<media>\ntime:<time>
+    The body can hold anything, including lines that look like other fields, so
+    id and from are taken from the lines before the body, and media and time from
+    the last lines after it. A field that's missing is left NULL with a length of 0.
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include "Message_Parser.h"
+
+/*  (private) starts_with: Check if a line starts with a label
+        line: First character of the line
+        end: Character after the end of the payload
+        label: Label, such as "id:"
+        label_length: Length of the label
+    RETURNS True if it does, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static inline bool starts_with(const char* line, const char* end, const char* label, uint8_t label_length){
+    return end - line >= label_length && memcmp(line, label, label_length) == 0;
+}
+
+/*  (private) set_field: Point a field at the value of a line
+        field: Field to set
+        value: First character after the label
+        line_end: Character after the end of the line
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static inline void set_field(field_view* field, const char* value, const char* line_end){
+    field->data = value;
+    field->length = line_end - value;
+}
+
+/*  (private) parse_media: Read a v1 list of media numbers, separated by ",", "NS" for an unsupported
+        attachment and "0" for none
+        media: Media field
+        fields: Holds the media numbers
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void parse_media(const field_view& media, message_fields* fields){
+    if(!media.length || field_equals(media, "0")) return;
+
+    const char* item = media.data;
+    const char* end = media.data + media.length;
+    while(item <= end && fields->media_count < MESSAGE_MEDIA_MAX){
+        const char* item_end = (const char*)memchr(item, ',', end - item);
+        if(!item_end) item_end = end;
+        field_view number = {item, (uint16_t)(item_end - item)};
+        fields->media[fields->media_count++] = field_equals(number, "NS") ? MEDIA_UNSUPPORTED : field_to_uint(number);
+        item = item_end + 1;
+    }
+}
+
+/*  (private) parse_message_v1: Find the fields of a v1 (text) message in its payload
+        payload: Payload of the message, as received
+        length: Length of the payload
+        fields: Holds the fields, which point into the payload
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void parse_message_v1(const uint8_t* payload, uint16_t length, message_fields* fields){
+    const char* line = (const char*)payload;
+    const char* end = line + length;
+    const char* media_line = NULL; //Start of the last media line after the body
+    const char* time_line = NULL; //Start of the last time line after the body
+    field_view media = {NULL, 0};
+    field_view time = {NULL, 0};
+
+    //Look at the start of each line once
+    while(line < end){
+        const char* line_end = (const char*)memchr(line, '\n', end - line);
+        if(!line_end) line_end = end;
+
+        if(!fields->body.data){
+            //Before the body, the first of each field counts
+            if(!fields->id.data && starts_with(line, end, "id:", 3)) set_field(&fields->id, line + 3, line_end);
+            else if(!fields->from.data && starts_with(line, end, "from:", 5)) set_field(&fields->from, line + 5, line_end);
+            else if(starts_with(line, end, "body:", 5)) set_field(&fields->body, line + 5, line_end);
+        }else{
+            //After the body, the last of each field counts, the rest are part of the body
+            if(starts_with(line, end, "media:", 6)){
+                set_field(&media, line + 6, line_end);
+                media_line = line;
+            }else if(starts_with(line, end, "time:", 5)){
+                set_field(&time, line + 5, line_end);
+                time_line = line;
+            }
+        }
+
+        line = line_end + 1;
+    }
+
+    //The body runs up to the media line, or the time line if there's no media
+    if(fields->body.data){
+        const char* body_end = media_line ? media_line : time_line ? time_line : end + 1;
+        fields->body.length = body_end - 1 - fields->body.data;
+    }
+
+    parse_media(media, fields);
+    fields->time = field_to_uint(time);
+}
+
+/*  (private) parse_message_v2: Read the fields of a v2 (binary) message from their offsets
+        payload: Payload of the message, as received
+        length: Length of the payload
+        fields: Holds the fields, which point into the payload
+    RETURNS True if the message is whole, false if it's cut short or from a later version
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static bool parse_message_v2(const uint8_t* payload, uint16_t length, message_fields* fields){
+    if(length < MESSAGE_V2_HEADER || payload[1] != MESSAGE_V2_VERSION) return false;
+
+    uint8_t id_length = payload[6];
+    uint8_t from_length = payload[7];
+    uint16_t body_length = payload[8] | (payload[9] << 8);
+    uint8_t media_count = payload[10];
+    uint32_t text = MESSAGE_V2_HEADER + media_count;
+    if((uint32_t)length < text + id_length + from_length + body_length) return false;
+
+    //Keep as many media numbers as fit, the text still starts after all of them
+    fields->time = payload[2] | (payload[3] << 8) | (payload[4] << 16) | ((uint32_t)payload[5] << 24);
+    fields->media_count = media_count < MESSAGE_MEDIA_MAX ? media_count : MESSAGE_MEDIA_MAX;
+    memcpy(fields->media, payload + MESSAGE_V2_HEADER, fields->media_count);
+
+    const char* data = (const char*)payload + text;
+    fields->id = {id_length ? data : NULL, id_length};
+    fields->from = {from_length ? data + id_length : NULL, from_length};
+    fields->body = {data + id_length + from_length, body_length};
+    return true;
+}
+
+/*  parse_message: Find the fields of a message in its payload
+        payload: Payload of the message, as received
+        length: Length of the payload
+        fields: Holds the fields, which point into the payload
+    RETURNS True if it could be read, false if it's a v2 message that's cut short or from a later version
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool parse_message(const uint8_t* payload, uint16_t length, message_fields* fields){
+    memset(fields, 0, sizeof(message_fields));
+
+    if(length && payload[0] == MESSAGE_V2_MAGIC) return parse_message_v2(payload, length, fields);
+    parse_message_v1(payload, length, fields);
+    return true;
+}
+
+/*  field_equals: Check if a field holds some text
+        field: Field to check
+        text: Text, NULL terminated
+    RETURNS True if it's the same, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool field_equals(const field_view& field, const char* text){
+    size_t length = strlen(text);
+    return field.length == length && (length == 0 || memcmp(field.data, text, length) == 0);
+}
+
+/*  field_to_uint: Read a field as a number
+        field: Field to read
+    RETURNS The number, stopping at the first character that isn't a digit
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint32_t field_to_uint(const field_view& field){
+    uint32_t value = 0;
+    for(uint16_t i = 0; i < field.length && field.data[i] >= '0' && field.data[i] <= '9'; i++){
+        value = value * 10 + (field.data[i] - '0');
+    }
+    return value;
+}
+
+/*  field_to_string: Copy a field into a String
+        field: Field to copy
+    RETURNS The String
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+String field_to_string(const field_view& field){
+    String output;
+    if(field.length) output.concat(field.data, field.length);
+    return output;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Arduino.h"
+
+//Most media files in a message
+#define MESSAGE_MEDIA_MAX 10
+//Media number of an attachment in a format that isn't supported
+#define MEDIA_UNSUPPORTED 0
+
+//First byte of a v2 message, which can't start a v1 message
+#define MESSAGE_V2_MAGIC 0xFA
+//Version byte of a v2 message
+#define MESSAGE_V2_VERSION 2
+//Size of the fixed part of a v2 message, before the media numbers
+#define MESSAGE_V2_HEADER 11
+
+//Part of a payload, not copied or terminated
+struct field_view{
+    const char* data; //First character, or NULL if the field is missing
+    uint16_t length; //Length in bytes
+};
+
+//Fields of a message from the bridge, pointing into its payload
+struct message_fields{
+    field_view id; //Twilio ID of the message
+    field_view from; //Phone number the message is from, with + removed
+    field_view body; //Message body
+    uint8_t media[MESSAGE_MEDIA_MAX]; //Number of each media file, or MEDIA_UNSUPPORTED
+    uint8_t media_count; //Number of media files
+    uint32_t time; //UNIX UTC time the message was received by the bridge, or 0 if it's missing
+};
+
+bool
+    parse_message(const uint8_t* payload, uint16_t length, message_fields* fields),
+    field_equals(const field_view& field, const char* text);
+
+uint32_t
+    field_to_uint(const field_view& field);
+
+String
+    field_to_string(const field_view& field);
@@ -1,10 +1,43 @@
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    A persistent storage library for ESP8266. Allows storage of key:value pairs of
-    Strings. 
+    A persistent contact storage library for ESP8266. Stores a name, or a
+    pending name request with the time it expires, for each phone number.
 
     To use, initialize an object with the path you'd like to use. Use set() to
-    store or change a key:value pair, and get() to retrieve a value based on the
-    key. Use remove() to delete a key:value pair. 
+    store or change a name and set_pending() to store a name request, and get()
+    to retrieve the name and kind of contact. Use remove() to delete a contact.
+    Keys are phone numbers (digits only). Call set_time() whenever the current
+    time is known so expired requests are treated as removed, handle() every
+    loop so the storage can tidy itself up while idle, and end() before LittleFS
+    goes offline.
+
+    Contacts are stored in a table of 16-byte records sorted by number, followed
+    by a pool of names. The table stays in flash, and only the first number of
+    each page of records is kept in RAM, so get() is a binary search over the
+    page numbers followed by a binary search within a single page read from
+    flash. 10,000 contacts need 2.5KB of RAM for the page numbers.
+
+    Changes are appended to a log with a sequence number and a CRC, so a power
+    cut can only ever lose the record being written. The contacts changed since
+    the table was written are kept in RAM (the overlay) and take priority over
+    the table. Once the overlay or log grows large enough, handle() merges them
+    into a new table which atomically replaces the old one. handle() also checks
+    one page of the table at a time for expired requests, and merges once enough
+    are found so they are dropped from flash.
+
+    In write-back mode (set_write_back()), changes are held in RAM and written to
+    the log together: after a few seconds, once DIRTY_MAX changes are waiting,
+    or when flush() or end() is called. Repeated changes to the same contact
+    before then only cost one write. get() always sees the latest change.
+
+    Names are limited to 255 bytes. A JSON file from older firmware (ie.
+    contacts.txt) is converted automatically, and import_json()/export_json()
+    convert between the two formats. In JSON, a pending request is stored as
+    "_REQ" followed by the UNIX time it was made.
+
+    import_begin(), import_line() and import_end() merge in CSV or JSON lines a
+    line at a time, and export_csv() prints CSV, so large address books can be
+    streamed in and out. export_page() prints one page of the contacts whose
+    number or name starts with a search, for browsing them.
 
     Created by Silviu Toderita in 2020.
     silviu.toderita@gmail.com
@@ -12,107 +45,1969 @@
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 #include "Persistent_Storage.h"
+#include "Flash_Stats.h" //Flash write accounting
+
+//Log record layout: magic, reserved, seq (4 bytes), contact_record (16 bytes), name, CRC32 (4 bytes)
+#define LOG_MAGIC 0xA6
+#define LOG_HEADER 22
+#define LOG_OVERHEAD 26
+
+//Table layout: records, name pool, table_footer
+#define TABLE_MAGIC 0x43474154
+#define PAGE_RECORDS 32
+
+//Merge the overlay into the table while idle once it holds this many contacts, or once the log is this large
+#define OVERLAY_COMPACT 32
+#define LOG_COMPACT 4096
+
+#define NAME_MAX 255
+
+//Write changes held in RAM to flash once the oldest is this old (ms)
+#define FLUSH_INTERVAL 5000
+
+//Check one page of the table for expired requests this often (ms), and merge once at least SWEEP_MIN
+//requests and 1/SWEEP_RATIO of the table have expired
+#define SWEEP_INTERVAL 1000
+#define SWEEP_MIN 8
+#define SWEEP_RATIO 16
+
+//Last 16 bytes of the table
+struct table_footer{
+    uint32_t magic;
+    uint32_t count; //Number of records
+    uint32_t pool_size; //Size of the name pool in bytes
+    uint32_t seq; //Sequence number of the last log record included in the table
+};
+
+//Contacts and bytes of names imported at a time. Each chunk is sorted in RAM and either appended to the new
+//table or written as a run to be merged in at the end.
+#define IMPORT_CHUNK 128
+#define IMPORT_POOL 2048
+
+//Next contact of a sorted run of imported contacts, while the runs are merged
+struct import_run{
+    contact_record record; //The contact
+    uint32_t position; //Position after the contact in the file of runs, where its name is
+    uint32_t end; //Position of the end of the run
+};
+
+//Runs merged at a time, as many as fit in the memory of one chunk
+#define IMPORT_RUNS (IMPORT_CHUNK * sizeof(import_entry) / sizeof(import_run))
+
+//Reads key:value pairs from a JSON object one at a time, without loading the whole document
+struct json_reader{
+    Stream* stream;
+    bool started; //True once the opening brace has been read
+    int pending; //A character read too far, or -1
+};
+
+/*  (private) parse_number: Convert a phone number to an integer
+        key: Phone number, digits only with no leading zero
+        number: Receives the integer
+    RETURNS True if the key is a valid phone number, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static bool parse_number(const char* key, uint64_t* number){
+    size_t length = strlen(key);
+    //Leading zeros would be lost, and 19 digits is the most that fits
+    if(length == 0 || length > 19 || key[0] == '0') return false;
+
+    uint64_t result = 0;
+    for(size_t i = 0; i < length; i++){
+        if(key[i] < '0' || key[i] > '9') return false;
+        result = result * 10 + (key[i] - '0');
+    }
+
+    *number = result;
+    return true;
+}
+
+/*  (private) format_number: Convert an integer back to a phone number
+        number:
+        text: Buffer of at least 21 bytes
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void format_number(uint64_t number, char* text){
+    char digits[20];
+    uint8_t length = 0;
+    do{
+        digits[length++] = '0' + number % 10;
+        number /= 10;
+    }while(number);
+
+    for(uint8_t i = 0; i < length; i++){
+        text[i] = digits[length - 1 - i];
+    }
+    text[length] = '\0';
+}
+
+/*  (private) make_record: Convert a value to a contact record
+        number: Phone number
+        value: Name, or "_REQ" followed by the time of a name request (JSON files only)
+    RETURNS Contact record. For a name, data is left at 0.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static contact_record make_record(uint64_t number, const char* value){
+    contact_record record = {number, 0, 0, CONTACT_NAME, 0};
+
+    if(strncmp(value, "_REQ", 4) == 0){
+        record.kind = CONTACT_PENDING;
+        record.data = strtoul(value + 4, NULL, 10) + PENDING_TTL;
+    }else{
+        size_t length = strlen(value);
+        record.length = length > NAME_MAX ? NAME_MAX : length;
+    }
+
+    return record;
+}
+
+/*  (private) compare_import: qsort comparator, orders import entries by number, then
+        by their position in the file
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static int compare_import(const void* a, const void* b){
+    const import_entry* entry_a = (const import_entry*)a;
+    const import_entry* entry_b = (const import_entry*)b;
+    if(entry_a->number != entry_b->number) return entry_a->number < entry_b->number ? -1 : 1;
+    if(entry_a->order != entry_b->order) return entry_a->order < entry_b->order ? -1 : 1;
+    return 0;
+}
+
+/*  (private) read_run: Read the next contact of a sorted run of imported contacts
+        runs: File of runs
+        run: The run, receives the contact and the position of its name
+    RETURNS 1 if a contact was read, 0 at the end of the run, or -1 if reading failed
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static int read_run(File& runs, import_run* run){
+    if(run->position >= run->end) return 0;
+    if(!runs.seek(run->position)) return -1;
+    if(runs.read((uint8_t*)&run->record, sizeof(contact_record)) != sizeof(contact_record)) return -1;
+    run->position += sizeof(contact_record);
+    return 1;
+}
+
+/*  (private) sift_run: Move a run down the heap of runs until the runs below it come
+        after it. The run with the lowest number is at the top, and of runs with the
+        same number, the latest one (furthest into the file).
+        heads: Heap of runs
+        count: Number of runs in the heap
+        i: Position of the run to move
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void sift_run(import_run* heads, uint16_t count, uint16_t i){
+    while(true){
+        uint16_t first = i;
+        for(uint16_t child = 2 * i + 1; child <= 2 * i + 2 && child < count; child++){
+            const contact_record& a = heads[child].record;
+            const contact_record& b = heads[first].record;
+            if(a.number < b.number || (a.number == b.number && heads[child].position > heads[first].position)) first = child;
+        }
+        if(first == i) return;
+        import_run run = heads[i];
+        heads[i] = heads[first];
+        heads[first] = run;
+        i = first;
+    }
+}
+
+/*  (private) json_read: Read the next character
+        reader: JSON reader
+    RETURNS The character, or -1 at the end of the stream
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static int json_read(json_reader* reader){
+    if(reader->pending >= 0){
+        int c = reader->pending;
+        reader->pending = -1;
+        return c;
+    }
+    return reader->stream->read();
+}
+
+/*  (private) json_next: Read the next character that isn't whitespace
+        reader: JSON reader
+    RETURNS The character, or -1 at the end of the stream
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static int json_next(json_reader* reader){
+    int c;
+    do{
+        c = json_read(reader);
+    }while(c == ' ' || c == '\t' || c == '\r' || c == '\n');
+    return c;
+}
+
+/*  (private) json_read_string: Read a JSON string after its opening quote, decoding
+        escapes. Anything that doesn't fit in the buffer is skipped.
+        reader: JSON reader
+        text: Receives the string
+        size: Size of the buffer
+    RETURNS True if successful, false if the string isn't complete
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static bool json_read_string(json_reader* reader, char* text, size_t size){
+    size_t length = 0;
+    while(true){
+        int c = json_read(reader);
+        if(c < 0) return false;
+        if(c == '"') break;
+
+        //Decode escapes, \u escapes become UTF-8
+        uint8_t bytes[4];
+        uint8_t count = 1;
+        bytes[0] = c;
+        if(c == '\\'){
+            c = json_read(reader);
+            if(c == 'b') bytes[0] = '\b';
+            else if(c == 'f') bytes[0] = '\f';
+            else if(c == 'n') bytes[0] = '\n';
+            else if(c == 'r') bytes[0] = '\r';
+            else if(c == 't') bytes[0] = '\t';
+            else if(c == 'u'){
+                uint32_t code = 0;
+                for(uint8_t i = 0; i < 4; i++){
+                    c = json_read(reader);
+                    if(c < 0) return false;
+                    code = code * 16 + (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10) & 0x0F);
+                }
+                if(code < 0x80){
+                    bytes[0] = code;
+                }else if(code < 0x800){
+                    bytes[0] = 0xC0 | (code >> 6);
+                    bytes[1] = 0x80 | (code & 0x3F);
+                    count = 2;
+                }else{
+                    bytes[0] = 0xE0 | (code >> 12);
+                    bytes[1] = 0x80 | ((code >> 6) & 0x3F);
+                    bytes[2] = 0x80 | (code & 0x3F);
+                    count = 3;
+                }
+            }else if(c < 0){
+                return false;
+            }else{
+                bytes[0] = c;
+            }
+        }
+
+        if(length + count < size){
+            memcpy(text + length, bytes, count);
+            length += count;
+        }
+    }
+
+    text[length] = '\0';
+    return true;
+}
+
+/*  (private) read_json_pair: Read the next key:value pair of a JSON object. Values
+        that aren't strings are read as "".
+        reader: JSON reader, start with {stream, false, -1}
+        key: Receives the key
+        key_size: Size of the key buffer
+        value: Receives the value
+        value_size: Size of the value buffer
+    RETURNS 1 if a pair was read, 0 at the end of the object, -1 if the JSON is invalid
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static int read_json_pair(json_reader* reader, char* key, size_t key_size, char* value, size_t value_size){
+    int c = json_next(reader);
+
+    //The first pair comes after the opening brace, the rest after a comma
+    if(!reader->started){
+        if(c != '{') return -1;
+        reader->started = true;
+        c = json_next(reader);
+        if(c == '}') return 0;
+    }else{
+        if(c == '}') return 0;
+        if(c != ',') return -1;
+        c = json_next(reader);
+    }
+
+    if(c != '"' || !json_read_string(reader, key, key_size)) return -1;
+    if(json_next(reader) != ':') return -1;
+
+    c = json_next(reader);
+    if(c == '"') return json_read_string(reader, value, value_size) ? 1 : -1;
+
+    //Objects and arrays aren't expected, skip numbers, true, false and null
+    if(c < 0 || c == '{' || c == '[') return -1;
+    while(c >= 0 && c != ',' && c != '}' && c != ' ' && c != '\t' && c != '\r' && c != '\n'){
+        c = json_read(reader);
+    }
+    reader->pending = c;
+    value[0] = '\0';
+    return 1;
+}
+
+/*  (private) Buffer_Stream: Reads from a string in RAM, so a single line can be
+        parsed with read_json_pair()
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+class Buffer_Stream : public Stream{
+    public:
+        Buffer_Stream(const char* text, size_t length) : text(text), length(length){}
+
+        int available(){
+            return length - position;
+        }
+
+        int read(){
+            return position < length ? (uint8_t)text[position++] : -1;
+        }
+
+        int peek(){
+            return position < length ? (uint8_t)text[position] : -1;
+        }
+
+        size_t write(uint8_t){
+            return 0;
+        }
+
+    private:
+        const char* text;
+        size_t length;
+        size_t position = 0;
+};
+
+/*  (private) parse_csv_value: Remove the quotes from a CSV value, if it has them
+        text: The value, changed in place
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void parse_csv_value(char* text){
+    if(text[0] != '"') return;
+
+    //Copy everything up to the closing quote, "" is an escaped quote
+    char* from = text + 1;
+    char* to = text;
+    while(*from){
+        if(*from == '"'){
+            if(from[1] != '"') break;
+            from++;
+        }
+        *to++ = *from++;
+    }
+    *to = '\0';
+}
+
+/*  (private) print_csv_string: Print a string as a CSV value, quoted if needed
+        output: Where to print
+        text: Null-terminated string
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void print_csv_string(Print& output, const char* text){
+    if(!strpbrk(text, ",\"\r\n")){
+        output.print(text);
+        return;
+    }
+
+    output.print('"');
+    while(*text){
+        if(*text == '"') output.print('"');
+        output.print(*text++);
+    }
+    output.print('"');
+}
+
+/*  (private) crc32_update: Add bytes to a running CRC-32 (start with 0xFFFFFFFF
+        and invert the result)
+        crc: CRC so far
+        data: Bytes to add
+        length: Number of bytes
+    RETURNS Updated CRC
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t length){
+    while(length--){
+        crc ^= *data++;
+        for(uint8_t bit = 0; bit < 8; bit++){
+            crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+        }
+    }
+    return crc;
+}
+
+/*  (private) print_json_string: Print a string as a quoted, escaped JSON string
+        output: Where to print
+        text: Null-terminated string
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void print_json_string(Print& output, const char* text){
+    output.print('"');
+    while(*text){
+        char c = *text++;
+        if(c == '"' || c == '\\'){
+            output.print('\\');
+            output.print(c);
+        }else if((uint8_t)c < 0x20){
+            char escaped[7];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            output.print(escaped);
+        }else{
+            output.print(c);
+        }
+    }
+    output.print('"');
+}
 
 /*  Persistent_Storage Constructor
         name: The name of this storage object
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 Persistent_Storage::Persistent_Storage(String name){
-    path = "/" + name + ".txt";
+    path = "/" + name + ".log";
+    table_path = "/" + name + ".tbl";
+    temp_path = "/" + name + ".tmp";
+    temp_pool_path = "/" + name + ".tpl";
+    run_path = "/" + name + ".run";
+    merge_path = "/" + name + ".mrg";
+    merge_pool_path = "/" + name + ".mpl";
+    legacy_path = "/" + name + ".txt";
     LittleFS.begin();
 }
 
-/*  put: Add a new key:value pair to storage, or modify the value of an existing key
-        key:
-        value:
+/*  set: Add a new contact to storage, or change the name of an existing contact
+        key: Phone number
+        value: Name
     RETURNS True if successful, false if not
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-bool Persistent_Storage::set(String key, String value){ 
-    //If the key is blank, it can't be stored
-    if(key == "") return false;
+bool Persistent_Storage::set(String key, String value){
+    //If the key isn't a phone number, it can't be stored
+    uint64_t number;
+    if(!parse_number(key.c_str(), &number)) return false;
 
-    //Open the file for reading
-    File file = LittleFS.open(path, "r");
-    //Set aside enough memory for a JSON document
-    DynamicJsonDocument doc(file.size() * 2 + 256);
-
-    //Parse JSON from file
-    deserializeJson(doc, file);
-    
-    //Close the file for reading
-    file.close();
-    
-    //Add/change the value in the file
-    doc[key] = value;
-
-    //Open the file for writing
-    file = LittleFS.open(path, "w");
+    contact_record record = make_record(number, value.c_str());
+    const char* name = record.kind == CONTACT_NAME ? value.c_str() : "";
+    return store(record, name, key.length() + value.length());
+}
 
-    bool status = false;
-    //Export the JSON to the file
-    if(serializeJson(doc, file)){
-        status = true;
-    } 
+/*  set_pending: Store a pending name request for a contact
+        key: Phone number
+        expires: UNIX time the request expires
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::set_pending(String key, uint32_t expires){
+    //If the key isn't a phone number, it can't be stored
+    uint64_t number;
+    if(!parse_number(key.c_str(), &number)) return false;
 
-    file.close();
-    return status;
+    contact_record record = {number, expires, 0, CONTACT_PENDING, 0};
+    return store(record, "", key.length() + sizeof(expires));
 }
 
-/*  get_value: Get the value of a specific key 
-        key:
-    RETURNS Value of the key. If the key is not found, returns "".
+/*  get: Get the name of a contact
+        key: Phone number
+    RETURNS Name of the contact. If the contact is not found or doesn't have a name
+        yet, returns "".
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 String Persistent_Storage::get(String key){
-    //Open the file for reading
-    File file = LittleFS.open(path, "r");
-    //Set aside enough memory for a JSON document
-    DynamicJsonDocument doc(file.size() * 2);
+    return String(get(key.c_str()));
+}
 
-    //Parse JSON from file
-    DeserializationError error = deserializeJson(doc, file);
+/*  get: Get the name of a contact without allocating
+        key: Phone number
+    RETURNS Pointer to the name, valid until the next call to this object. If the
+        contact is not found or doesn't have a name yet, returns "".
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+const char* Persistent_Storage::get(const char* key){
+    uint8_t kind;
+    return get(key, &kind);
+}
 
-    //Close the file
-    file.close();
+/*  get: Get the name and kind of a contact without allocating
+        key: Phone number
+        kind: Receives CONTACT_NAME, CONTACT_PENDING (a name request that hasn't
+            expired) or CONTACT_NONE
+    RETURNS Pointer to the name, valid until the next call to this object. If the
+        contact is not found or doesn't have a name yet, returns "".
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+const char* Persistent_Storage::get(const char* key, uint8_t* kind){
+    *kind = CONTACT_NONE;
 
-    //If there are any issues, return a blank string
-    if(error){
-        return "";
-    } 
+    //If the key isn't a phone number, it can't be stored
+    uint64_t number;
+    if(!parse_number(key, &number)) return "";
+    //Make sure the table and log are open and indexed. If that fails, return a blank string
+    if(!loaded && !load()) return "";
 
-    //Return the value corresponding to the key. If the key doesn't exist, return a blank string
-    return doc[key] | "";
+    //Return the name if the contact exists, or a blank string if it doesn't
+    contact_record record;
+    if(!lookup(number, &record, value_buffer)) return "";
+    *kind = record.kind;
+    return value_buffer;
 }
 
-/*  remove: Delete a key:value pair
-        key: Key to delete
+/*  remove: Delete a contact
+        key: Phone number to delete
     RETURNS True if successful, false if not
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-bool Persistent_Storage::remove(String key){ 
-    //If the key is blank, there is nothing to remove
-    if(key == "") return false;
+bool Persistent_Storage::remove(String key){
+    //If the key isn't a phone number, there is nothing to remove
+    uint64_t number;
+    if(!parse_number(key.c_str(), &number)) return false;
+    //Make sure the table and log are open and indexed
+    if(!loaded && !load()) return false;
+
+    uint32_t start = micros();
+
+    //If the key doesn't exist, there is nothing to write
+    contact_record record;
+    if(!lookup(number, &record, value_buffer)) return true;
+
+    //Write the removal, or hold it in RAM in write-back mode
+    contact_record removed = {number, 0, 0, CONTACT_REMOVED, 0};
+    if(!write_change(removed, "")) return false;
+
+    //Record the cost of this write
+    uint32_t elapsed = micros() - start;
+    if(elapsed > stats.max_write_micros) stats.max_write_micros = elapsed;
+    stats.writes++;
+    stats.logical_bytes += key.length();
+
+    return true;
+}
 
+/*  import_json: Replace the contents of the storage with a JSON file of key:value
+        pairs, then delete the JSON file. Keys that aren't phone numbers are skipped,
+        and so are name requests that have expired. The file is read a chunk at a time,
+        so memory use doesn't depend on its size. Files in number order, like the ones
+        from export_json(), are imported in a single pass.
+        import_path: Path of the JSON file
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::import_json(String import_path){
     //Open the file for reading
-    File file = LittleFS.open(path, "r");
-    //Set aside enough memory for a JSON document
-    DynamicJsonDocument doc(file.size() * 2);
-
-    //Parse JSON from file
-    deserializeJson(doc, file);
-    
-    //Close the file for reading
+    File file = LittleFS.open(import_path, "r");
+    if(!file) return false;
+
+    if(!import_begin(false)){
+        file.close();
+        return false;
+    }
+
+    //Add each pair until the end of the object
+    json_reader reader = {&file, false, -1};
+    char key[32];
+    int result;
+    while((result = read_json_pair(&reader, key, sizeof(key), value_buffer, sizeof(value_buffer))) > 0){
+        import_add(key, value_buffer);
+    }
     file.close();
-    
-    //Add/change the value in the file
-    doc.remove(key);
 
-    //Open the file for writing
-    file = LittleFS.open(path, "w");
+    //If there are any issues, leave the storage as it is
+    if(result < 0){
+        import_abort();
+        return false;
+    }
+    if(!import_end()) return false;
 
-    bool status = false;
-    //Export the JSON to the file
-    if(serializeJson(doc, file)){
-        status = true;
-    } 
+    LittleFS.remove(import_path);
+    return true;
+}
 
-    file.close();
-    return status;
-}
\ No newline at end of file
+/*  import_begin: Start importing contacts one at a time with import_add() or
+        import_line(). Nothing changes until import_end() is called, and changes
+        made with set() in the meantime take priority over the imported contacts.
+        The table can't be compacted during an import, so once the overlay is full,
+        changes to new contacts are held in RAM, and set() fails once that fills up too.
+        merge: If true, the imported contacts are merged into the existing ones. If
+            false, they replace them.
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::import_begin(bool merge){
+    //Only one import at a time
+    import_abort();
+
+    //Make sure the table and log are open and indexed
+    if(!loaded && !load()) return false;
+
+    //Changes made before the import are written first, so the ones held in RAM from now on were made during it.
+    //When merging, the existing table is read alongside the imported contacts, so bring it up to date as well.
+    if(!flush() || (merge && overlay_count && !compact())) return false;
+
+    //Set aside memory for one chunk of contacts
+    import_entries = (import_entry*)allocate(IMPORT_CHUNK * sizeof(import_entry));
+    import_pool = (char*)allocate(IMPORT_POOL);
+    if(!import_entries || !import_pool || !build_begin(merge)){
+        import_abort();
+        return false;
+    }
+
+    import_count = 0;
+    import_pool_used = 0;
+    import_order = 0;
+    importing = true;
+    return true;
+}
+
+/*  import_add: Add a contact to the import started by import_begin()
+        key: Phone number
+        value: Name, or "_REQ" followed by the time of a name request
+    RETURNS True if the contact was added, false if it was skipped. If writing
+        fails, the import is abandoned and import_end() returns false.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::import_add(const char* key, const char* value){
+    if(!importing) return false;
+
+    //Skip keys that aren't phone numbers and requests that have expired
+    uint64_t number;
+    if(!parse_number(key, &number)) return false;
+    contact_record record = make_record(number, value);
+    if(expired(&record)) return false;
+
+    import_entries[import_count] = {number, record.data, import_pool_used, record.length, record.kind, import_order++};
+    memcpy(import_pool + import_pool_used, value, record.length);
+    import_pool_used += record.length;
+    import_count++;
+
+    //Once the chunk is full, merge it into the new table
+    if(import_count == IMPORT_CHUNK || import_pool_used + NAME_MAX > IMPORT_POOL){
+        if(!build_chunk()){
+            import_abort();
+            return false;
+        }
+    }
+    return true;
+}
+
+/*  import_line: Add the contacts in one line of a CSV or JSON lines file to the
+        import started by import_begin()
+        line: The line, which may be changed by this function
+        format: IMPORT_CSV (number,name with optional quotes) or IMPORT_JSON_LINES
+            (a JSON object of key:value pairs)
+    RETURNS Number of contacts added
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint16_t Persistent_Storage::import_line(char* line, uint8_t format){
+    //Remove the end of the line
+    size_t length = strlen(line);
+    while(length && (line[length - 1] == '\r' || line[length - 1] == '\n')) line[--length] = '\0';
+    if(length == 0) return 0;
+
+    if(format == IMPORT_CSV){
+        //Split at the first comma. Lines without one are skipped, and so is the header because it isn't a number.
+        char* value = strchr(line, ',');
+        if(!value) return 0;
+        *value++ = '\0';
+        parse_csv_value(value);
+        return import_add(line, value) ? 1 : 0;
+    }
+
+    //Read each pair of the object
+    Buffer_Stream stream(line, length);
+    json_reader reader = {&stream, false, -1};
+    char key[32];
+    uint16_t added = 0;
+    while(read_json_pair(&reader, key, sizeof(key), value_buffer, sizeof(value_buffer)) > 0){
+        if(import_add(key, value_buffer)) added++;
+    }
+    return added;
+}
+
+/*  import_end: Finish the import started by import_begin() and replace the table
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::import_end(){
+    if(!importing) return false;
+
+    //Merge the last chunk and finish the table
+    bool success = build_chunk() && build_end();
+    release(import_entries, IMPORT_CHUNK * sizeof(import_entry));
+    release(import_pool, IMPORT_POOL);
+    import_entries = NULL;
+    import_pool = NULL;
+    importing = false;
+
+    //If there are any issues, leave the storage as it is
+    if(!success){
+        build_discard();
+        return false;
+    }
+
+    //Atomically replace the table. The log is kept: the new table only includes it up to where the import
+    //started, so changes made during the import are replayed on top of it, and the ones still held in RAM
+    //are written after them.
+    invalidate();
+    if(!LittleFS.rename(temp_path, table_path)){
+        LittleFS.remove(temp_path);
+        return false;
+    }
+    return true;
+}
+
+/*  import_abort: Abandon the import started by import_begin(), leaving the storage
+        as it was
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Persistent_Storage::import_abort(){
+    release(import_entries, IMPORT_CHUNK * sizeof(import_entry));
+    release(import_pool, IMPORT_POOL);
+    import_entries = NULL;
+    import_pool = NULL;
+    if(importing) build_discard();
+    importing = false;
+}
+
+/*  export_json: Print every contact as a JSON object of key:value pairs, in number order
+        output: Where to print the JSON
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::export_json(Print& output){
+    //Make sure the table and log are open, indexed and up to date
+    if(!flush()) return false;
+
+    export_position position = {0, 0, false};
+    while(export_json(output, &position, UINT16_MAX));
+    return true;
+}
+
+/*  export_json: Print the next piece of an export of every contact as a JSON object of
+        key:value pairs, in number order. Each piece carries on from the number after the
+        last one read, so contacts can change between pieces.
+        output: Where to print the piece
+        position: Where the export is up to, {0, 0, false} to start
+        count: Most contacts to read
+    RETURNS True if there is more to print, false once the end has been printed
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::export_json(Print& output, export_position* position, uint16_t count){
+    if(!position->started) output.print('{');
+    position->started = true;
+
+    merge_cursor cursor;
+    contact_record record;
+    bool from_log;
+    char key[21];
+    uint16_t read = 0;
+
+    if(merge_seek(&cursor, position->next)){
+        while(read < count && merge_next(&cursor, &record, &from_log)){
+            read++;
+            position->next = record.number + 1;
+            if(!read_name(&record, from_log, value_buffer)) continue;
+            format_number(record.number, key);
+
+            if(position->count) output.print(',');
+            position->count++;
+            print_json_string(output, key);
+            output.print(':');
+            print_json_string(output, format_value(&record, value_buffer));
+        }
+        if(read == count) return true;
+    }
+    output.print('}');
+
+    return false;
+}
+
+/*  export_csv: Print every contact as CSV lines of number,name, in number order
+        output: Where to print the CSV
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::export_csv(Print& output){
+    //Make sure the table and log are open, indexed and up to date
+    if(!flush()) return false;
+
+    export_position position = {0, 0, false};
+    while(export_csv(output, &position, UINT16_MAX));
+    return true;
+}
+
+/*  export_csv: Print the next piece of an export of every contact as CSV lines of
+        number,name, in number order. Each piece carries on from the number after the
+        last one read, so contacts can change between pieces.
+        output: Where to print the piece
+        position: Where the export is up to, {0, 0, false} to start
+        count: Most contacts to read
+    RETURNS True if there is more to print, false once the end has been printed
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::export_csv(Print& output, export_position* position, uint16_t count){
+    if(!position->started) output.print("number,name\n");
+    position->started = true;
+
+    merge_cursor cursor;
+    contact_record record;
+    bool from_log;
+    char key[21];
+    uint16_t read = 0;
+
+    if(!merge_seek(&cursor, position->next)) return false;
+    while(read < count && merge_next(&cursor, &record, &from_log)){
+        read++;
+        position->next = record.number + 1;
+        if(!read_name(&record, from_log, value_buffer)) continue;
+        format_number(record.number, key);
+
+        position->count++;
+        output.print(key);
+        output.print(',');
+        print_csv_string(output, format_value(&record, value_buffer));
+        output.print('\n');
+    }
+
+    return read == count;
+}
+
+/*  export_page: Print a page of the contacts that match a search as a JSON object, in number order:
+        {"offset":0,"limit":50,"contacts":[{"number":"","name":"","pending":false},...],"total":0}
+        The contacts are printed as they're read, and the total number that match comes last.
+        output: Where to print the JSON
+        offset: Number of matching contacts to skip
+        limit: Largest number of contacts to print
+        prefix: Only contacts whose number or name starts with this (ignoring case) match, or "" for all
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::export_page(Print& output, uint32_t offset, uint16_t limit, const char* prefix){
+    //Make sure the table and log are open, indexed and up to date
+    if(!flush()) return false;
+
+    export_position position = {0, 0, false};
+    while(export_page(output, &position, UINT16_MAX, offset, limit, prefix));
+    return true;
+}
+
+/*  export_page: Print the next piece of a page of the contacts that match a search, as
+        export_page() above. Each piece carries on from the number after the last one read,
+        so contacts can change between pieces.
+        output: Where to print the piece
+        position: Where the page is up to, {0, 0, false} to start. count is the number of
+            contacts that have matched so far.
+        count: Most contacts to read
+        offset: Number of matching contacts to skip
+        limit: Largest number of contacts to print
+        prefix: Only contacts whose number or name starts with this (ignoring case) match, or "" for all
+    RETURNS True if there is more to print, false once the end has been printed
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::export_page(Print& output, export_position* position, uint16_t count, uint32_t offset, uint16_t limit, const char* prefix){
+    if(!position->started){
+        output.print("{\"offset\":");
+        output.print(offset);
+        output.print(",\"limit\":");
+        output.print(limit);
+        output.print(",\"contacts\":[");
+    }
+    position->started = true;
+
+    merge_cursor cursor;
+    contact_record record;
+    bool from_log;
+    char key[21];
+    size_t prefix_length = strlen(prefix);
+    uint16_t read = 0;
+
+    if(merge_seek(&cursor, position->next)){
+        while(read < count && merge_next(&cursor, &record, &from_log)){
+            read++;
+            position->next = record.number + 1;
+            format_number(record.number, key);
+
+            //Only read the name if it's needed to match the search or to print the contact
+            uint32_t total = position->count;
+            bool match = strncmp(key, prefix, prefix_length) == 0;
+            bool shown = total >= offset && total - offset < limit;
+            bool has_name = false;
+            if(!match || shown){
+                if(!read_name(&record, from_log, value_buffer)) continue;
+                has_name = true;
+                if(!match) match = strncasecmp(value_buffer, prefix, prefix_length) == 0;
+            }
+            if(!match) continue;
+
+            if(shown && has_name){
+                if(total > offset) output.print(',');
+                output.print("{\"number\":");
+                print_json_string(output, key);
+                output.print(",\"name\":");
+                print_json_string(output, value_buffer);
+                output.print(record.kind == CONTACT_PENDING ? ",\"pending\":true}" : ",\"pending\":false}");
+            }
+            position->count++;
+        }
+        if(read == count) return true;
+    }
+    output.print("],\"total\":");
+    output.print(position->count);
+    output.print('}');
+
+    return false;
+}
+
+/*  handle: Merge the changes into the table if enough have built up, and sweep for
+        expired name requests. Call every loop.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Persistent_Storage::handle(){
+    //Write changes held in RAM once the oldest has waited long enough
+    if(dirty_count && millis() - dirty_millis >= FLUSH_INTERVAL) flush();
+
+    //The table can't change under an import
+    if(!loaded || dirty_count || importing) return;
+    if(overlay_count >= OVERLAY_COMPACT || log_file.size() >= LOG_COMPACT){
+        compact();
+        return;
+    }
+
+    if(millis() - sweep_millis >= SWEEP_INTERVAL){
+        sweep_millis = millis();
+        sweep();
+    }
+}
+
+/*  set_time: Set the current time, so name requests that have expired are treated
+        as removed
+        time: Current UNIX time
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Persistent_Storage::set_time(uint32_t time){
+    if(time > now) now = time;
+}
+
+/*  set_write_back: Turn write-back mode on or off
+        on: If true, changes are held in RAM and written to flash together. If false,
+            every change is written to flash straight away.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Persistent_Storage::set_write_back(bool on){
+    if(!on) flush();
+    write_back = on;
+}
+
+/*  flush: Write any changes held in RAM to flash
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::flush(){
+    //Make sure the table and log are open and indexed
+    if(!loaded && !load()) return false;
+    if(dirty_count == 0) return true;
+
+    uint32_t start = micros();
+
+    //Append the changes in the order they were made
+    uint8_t written = 0;
+    while(written < dirty_count){
+        const char* name = dirty[written].name ? dirty[written].name : "";
+        if(!append(dirty[written].record, name)) break;
+        release(dirty[written].name, dirty[written].record.length + 1);
+        written++;
+    }
+    log_file.flush();
+
+    //Keep anything that couldn't be written for next time
+    memmove(dirty, dirty + written, (dirty_count - written) * sizeof(dirty_contact));
+    dirty_count -= written;
+
+    //Record the cost of this flush
+    uint32_t elapsed = micros() - start;
+    if(elapsed > stats.max_flush_micros) stats.max_flush_micros = elapsed;
+    stats.flushes++;
+
+    return dirty_count == 0;
+}
+
+/*  invalidate: Close the table and log and discard the index held in RAM, so it
+        is reloaded the next time it is needed. Changes not yet written to flash
+        are kept, and an import in progress is abandoned.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Persistent_Storage::invalidate(){
+    //An import reads the table, so it can't continue once the table is closed
+    import_abort();
+
+    if(log_file) log_file.close();
+    if(table_file) table_file.close();
+    release(pages, page_count * sizeof(uint64_t));
+    pages = NULL;
+    page_count = 0;
+    table_count = 0;
+    table_seq = 0;
+    overlay_count = 0;
+    sweep_page = 0;
+    sweep_expired = 0;
+    seq = 0;
+    loaded = false;
+}
+
+/*  end: Write any changes held in RAM and close the storage before LittleFS is
+        taken offline
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Persistent_Storage::end(){
+    flush();
+    invalidate();
+}
+
+/*  get_stats: Get counters for the cost of writes
+    RETURNS Counters since boot
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+storage_stats Persistent_Storage::get_stats(){
+    return stats;
+}
+
+/*  (private) load: Open the table and the log, and replay the log into the overlay
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::load(){
+    invalidate();
+
+    //Temporary files left over from an interrupted compaction or import are incomplete, the table and log are still intact
+    if(LittleFS.exists(temp_path)) LittleFS.remove(temp_path);
+    if(LittleFS.exists(temp_pool_path)) LittleFS.remove(temp_pool_path);
+    if(LittleFS.exists(run_path)) LittleFS.remove(run_path);
+    if(LittleFS.exists(merge_path)) LittleFS.remove(merge_path);
+    if(LittleFS.exists(merge_pool_path)) LittleFS.remove(merge_pool_path);
+
+    if(!load_table()){
+        invalidate();
+        return false;
+    }
+
+    log_file = LittleFS.open(path, "a+");
+    if(!log_file){
+        invalidate();
+        return false;
+    }
+
+    seq = table_seq;
+
+    contact_record record;
+    uint32_t record_seq;
+    uint32_t good_size = 0;
+
+    //Replay every record in order
+    log_file.seek(0);
+    while(log_file.position() < log_file.size()){
+        uint32_t offset = log_file.position();
+
+        //Stop at the first record that is torn
+        if(!read_log_record(&record_seq, &record, value_buffer)) break;
+
+        //Skip records already in the table. These are left over if power was cut between replacing the table and deleting the log.
+        if(record_seq <= table_seq){
+            good_size = log_file.position();
+            continue;
+        }
+
+        //Stop at the first record that is out of sequence
+        if(record_seq <= seq) break;
+
+        //Names stay in the log, the overlay points at them
+        if(record.kind == CONTACT_NAME) record.data = offset + LOG_HEADER;
+
+        //The log is always merged before the overlay fills up, so this only fails if the log is damaged
+        if(!overlay_put(record)) break;
+
+        seq = record_seq;
+        good_size = log_file.position();
+    }
+
+    //Cut off anything after the last good record, such as a write interrupted by a power cut
+    if(good_size < log_file.size()) log_file.truncate(good_size);
+
+    loaded = true;
+
+    //If there is a JSON file from older firmware, convert it and start again. An empty one has nothing to convert.
+    if(LittleFS.exists(legacy_path)){
+        File legacy_file = LittleFS.open(legacy_path, "r");
+        bool empty = legacy_file && legacy_file.size() == 0;
+        legacy_file.close();
+        if(empty) LittleFS.remove(legacy_path);
+        else if(import_json(legacy_path)) return load();
+    }
+
+    return true;
+}
+
+/*  (private) load_table: Open the table and read the first number of each page
+    RETURNS True if successful or if there is no table yet, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::load_table(){
+    //If there is no table, start with an empty one
+    if(!LittleFS.exists(table_path)) return true;
+
+    table_file = LittleFS.open(table_path, "r");
+    //An empty file holds no contacts, so treat it like a missing one rather than failing every time the storage is used
+    if(table_file && table_file.size() == 0){
+        table_file.close();
+        return true;
+    }
+    if(!table_file || table_file.size() < sizeof(table_footer)) return false;
+
+    //Check the footer matches the size of the file
+    table_footer footer;
+    table_file.seek(table_file.size() - sizeof(table_footer));
+    if(table_file.read((uint8_t*)&footer, sizeof(footer)) != sizeof(footer)) return false;
+    if(footer.magic != TABLE_MAGIC) return false;
+    if(table_file.size() != footer.count * sizeof(contact_record) + footer.pool_size + sizeof(footer)) return false;
+
+    table_count = footer.count;
+    table_seq = footer.seq;
+
+    //Read the first number of each page
+    uint32_t pages_needed = (table_count + PAGE_RECORDS - 1) / PAGE_RECORDS;
+    if(pages_needed > UINT16_MAX) return false;
+    if(pages_needed == 0) return true;
+
+    pages = (uint64_t*)allocate(pages_needed * sizeof(uint64_t));
+    if(!pages) return false;
+    page_count = pages_needed;
+
+    for(uint16_t page = 0; page < page_count; page++){
+        table_file.seek(page * PAGE_RECORDS * sizeof(contact_record));
+        if(table_file.read((uint8_t*)&pages[page], sizeof(uint64_t)) != sizeof(uint64_t)) return false;
+    }
+
+    return true;
+}
+
+/*  (private) store: Store a contact unless it's unchanged, and record the cost
+        record: Contact record
+        name: Name for CONTACT_NAME records, otherwise ""
+        logical_bytes: Size of the key and value being stored
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::store(contact_record record, const char* name, uint32_t logical_bytes){
+    //Make sure the table and log are open and indexed
+    if(!loaded && !load()) return false;
+
+    uint32_t start = micros();
+
+    //If the contact isn't changing, there is nothing to write
+    contact_record current;
+    if(lookup(record.number, &current, value_buffer) && current.kind == record.kind){
+        if(record.kind == CONTACT_PENDING && current.data == record.data) return true;
+        if(record.kind == CONTACT_NAME && current.length == record.length && memcmp(value_buffer, name, record.length) == 0) return true;
+    }
+
+    //Write the change, or hold it in RAM in write-back mode
+    if(!write_change(record, name)) return false;
+
+    //Record the cost of this write
+    uint32_t elapsed = micros() - start;
+    if(elapsed > stats.max_write_micros) stats.max_write_micros = elapsed;
+    stats.writes++;
+    stats.logical_bytes += logical_bytes;
+
+    return true;
+}
+
+/*  (private) write_change: Write a change to the log, or hold it in RAM in write-back mode
+        record: Contact record
+        name: Name for CONTACT_NAME records, otherwise ""
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::write_change(contact_record record, const char* name){
+    //Copy the name so it can be held until the next flush
+    char* copy = NULL;
+    if(write_back && record.kind == CONTACT_NAME){
+        copy = (char*)allocate(record.length + 1);
+        if(copy){
+            memcpy(copy, name, record.length);
+            copy[record.length] = '\0';
+        }
+    }
+
+    //If write-back is off or there is no memory for the name, write straight away
+    if(!write_back || (record.kind == CONTACT_NAME && !copy)){
+        if(!append(record, name)) return false;
+        log_file.flush();
+        return true;
+    }
+
+    //If there is already a change waiting for this contact, replace it
+    for(uint8_t i = 0; i < dirty_count; i++){
+        if(dirty[i].record.number == record.number){
+            release(dirty[i].name, dirty[i].record.length + 1);
+            dirty[i].record = record;
+            dirty[i].name = copy;
+            stats.coalesced++;
+            return true;
+        }
+    }
+
+    //If changes couldn't be written last time (such as during an import), try again to make room
+    if(dirty_count == DIRTY_MAX && !flush() && dirty_count == DIRTY_MAX){
+        release(copy, record.length + 1);
+        return false;
+    }
+
+    //Otherwise add it, and write everything once enough changes are waiting
+    if(dirty_count == 0) dirty_millis = millis();
+    dirty[dirty_count].record = record;
+    dirty[dirty_count].name = copy;
+    dirty_count++;
+
+    if(dirty_count == DIRTY_MAX) flush();
+    return true;
+}
+
+/*  (private) append: Append a change to the end of the log and apply it to the overlay
+        record: Contact record
+        name: Name for CONTACT_NAME records, otherwise ""
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::append(contact_record record, const char* name){
+    //If this is a new number and the overlay is full, merge it into the table first. During an import the
+    //table can't change and the new one is being built at temp_path, so the change has to wait until the end.
+    uint16_t i = overlay_bound(record.number);
+    bool in_overlay = i < overlay_count && overlay[i].number == record.number;
+    if(!in_overlay && overlay_count == OVERLAY_MAX && (importing || !compact())) return false;
+
+    //Build the log record
+    uint8_t buffer[LOG_OVERHEAD + NAME_MAX];
+    uint32_t record_seq = seq + 1;
+    buffer[0] = LOG_MAGIC;
+    buffer[1] = 0;
+    memcpy(buffer + 2, &record_seq, 4);
+    memcpy(buffer + 6, &record, sizeof(record));
+    memcpy(buffer + LOG_HEADER, name, record.length);
+
+    size_t size = LOG_HEADER + record.length;
+    uint32_t crc = ~crc32_update(0xFFFFFFFF, buffer, size);
+    memcpy(buffer + size, &crc, 4);
+    size += 4;
+
+    //Write it to the end of the log
+    uint32_t offset = log_file.size();
+    if(log_file.write(buffer, size) != size) return false;
+
+    seq = record_seq;
+    stats.flash_bytes += size;
+    flash_stats.record(FLASH_CONTACTS, path.c_str(), offset, size);
+
+    //Names stay in the log, the overlay points at them
+    if(record.kind == CONTACT_NAME) record.data = offset + LOG_HEADER;
+    return overlay_put(record);
+}
+
+/*  (private) overlay_put: Add or replace a contact in the overlay
+        record: Contact record
+    RETURNS True if successful, false if the overlay is full
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::overlay_put(contact_record record){
+    uint16_t i = overlay_bound(record.number);
+
+    //Replace the contact if it's already in the overlay
+    if(i < overlay_count && overlay[i].number == record.number){
+        overlay[i] = record;
+        return true;
+    }
+
+    if(overlay_count == OVERLAY_MAX) return false;
+
+    //Otherwise insert it in number order
+    memmove(overlay + i + 1, overlay + i, (overlay_count - i) * sizeof(contact_record));
+    overlay[i] = record;
+    overlay_count++;
+    return true;
+}
+
+/*  (private) overlay_bound: Find where a number is, or would go, in the overlay
+        number: Phone number
+    RETURNS Position of the first contact in the overlay with a number not less than number
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint16_t Persistent_Storage::overlay_bound(uint64_t number){
+    uint16_t low = 0;
+    uint16_t high = overlay_count;
+    while(low < high){
+        uint16_t mid = (low + high) / 2;
+        if(overlay[mid].number < number){
+            low = mid + 1;
+        }else{
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*  (private) lookup: Find a contact in the overlay or the table
+        number: Phone number
+        record: Receives the contact record
+        name: Buffer of NAME_MAX + 1 bytes, receives the name (blank if there isn't one)
+    RETURNS True if the contact exists, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::lookup(uint64_t number, contact_record* record, char* name){
+    //Changes not yet written to flash take priority over everything
+    for(uint8_t i = 0; i < dirty_count; i++){
+        if(dirty[i].record.number != number) continue;
+        if(dirty[i].record.kind == CONTACT_REMOVED || expired(&dirty[i].record)) return false;
+        *record = dirty[i].record;
+        name[0] = '\0';
+        if(dirty[i].name) strcpy(name, dirty[i].name);
+        return true;
+    }
+
+    //Changes since the last compaction take priority over the table
+    uint16_t i = overlay_bound(number);
+    if(i < overlay_count && overlay[i].number == number){
+        if(overlay[i].kind == CONTACT_REMOVED || expired(&overlay[i])) return false;
+        *record = overlay[i];
+        return read_name(record, true, name);
+    }
+
+    if(page_count == 0 || number < pages[0]) return false;
+
+    //Binary search for the last page starting at or before the number
+    uint16_t low = 0;
+    uint16_t high = page_count;
+    while(low < high){
+        uint16_t mid = (low + high) / 2;
+        if(pages[mid] <= number){
+            low = mid + 1;
+        }else{
+            high = mid;
+        }
+    }
+    uint32_t first = (uint32_t)(low - 1) * PAGE_RECORDS;
+
+    //Read that page from flash
+    contact_record page[PAGE_RECORDS];
+    uint16_t page_records = table_count - first < PAGE_RECORDS ? table_count - first : PAGE_RECORDS;
+    table_file.seek(first * sizeof(contact_record));
+    if(table_file.read((uint8_t*)page, page_records * sizeof(contact_record)) != page_records * sizeof(contact_record)) return false;
+
+    //Binary search within the page
+    low = 0;
+    high = page_records;
+    while(low < high){
+        uint16_t mid = (low + high) / 2;
+        if(page[mid].number < number){
+            low = mid + 1;
+        }else{
+            high = mid;
+        }
+    }
+    if(low == page_records || page[low].number != number || expired(&page[low])) return false;
+
+    *record = page[low];
+    return read_name(record, false, name);
+}
+
+/*  (private) expired: Check if a contact is a name request that has expired
+        record: Contact record
+    RETURNS True if the record is a pending request that expired, false if not or if
+        the time isn't known yet
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::expired(const contact_record* record){
+    return record->kind == CONTACT_PENDING && now && record->data <= now;
+}
+
+/*  (private) read_name: Read the name of a contact from the table or the log
+        record: Contact record
+        from_log: True if the record is from the overlay, false if it's from the table
+        name: Buffer of NAME_MAX + 1 bytes, receives the name (blank if there isn't one)
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::read_name(const contact_record* record, bool from_log, char* name){
+    name[0] = '\0';
+    if(record->kind != CONTACT_NAME) return true;
+
+    File& file = from_log ? log_file : table_file;
+    uint32_t position = record->data;
+    if(!from_log) position += table_count * sizeof(contact_record);
+
+    file.seek(position);
+    if(file.read((uint8_t*)name, record->length) != record->length) return false;
+    name[record->length] = '\0';
+    return true;
+}
+
+/*  (private) format_value: Convert a contact to its value in a JSON file
+        record: Contact record
+        name: Name read by read_name()
+    RETURNS The name, or "_REQ" followed by the time of the name request
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+const char* Persistent_Storage::format_value(const contact_record* record, const char* name){
+    if(record->kind == CONTACT_PENDING){
+        snprintf(value_buffer, sizeof(value_buffer), "_REQ%lu", (unsigned long)(record->data - PENDING_TTL));
+        return value_buffer;
+    }
+    return name;
+}
+
+/*  (private) merge_seek: Start a merge of the table and the overlay at a number, once the
+        table and log are open, indexed and up to date
+        cursor: Receives the position of the merge
+        number: Lowest number the merge returns
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::merge_seek(merge_cursor* cursor, uint64_t number){
+    if(!flush()) return false;
+    cursor->table_position = table_bound(number);
+    cursor->overlay_position = overlay_bound(number);
+    return true;
+}
+
+/*  (private) table_bound: Find where a number is, or would go, in the table
+        number: Phone number
+    RETURNS Position of the first record with that number or a higher one
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint32_t Persistent_Storage::table_bound(uint64_t number){
+    if(page_count == 0 || number <= pages[0]) return 0;
+
+    //Binary search for the last page starting before the number
+    uint16_t low = 0;
+    uint16_t high = page_count;
+    while(low < high){
+        uint16_t mid = (low + high) / 2;
+        if(pages[mid] < number){
+            low = mid + 1;
+        }else{
+            high = mid;
+        }
+    }
+    uint32_t first = (uint32_t)(low - 1) * PAGE_RECORDS;
+
+    //Read that page from flash
+    contact_record page[PAGE_RECORDS];
+    uint16_t page_records = table_count - first < PAGE_RECORDS ? table_count - first : PAGE_RECORDS;
+    table_file.seek(first * sizeof(contact_record));
+    if(table_file.read((uint8_t*)page, page_records * sizeof(contact_record)) != page_records * sizeof(contact_record)) return table_count;
+
+    //Binary search within the page
+    low = 0;
+    high = page_records;
+    while(low < high){
+        uint16_t mid = (low + high) / 2;
+        if(page[mid].number < number){
+            low = mid + 1;
+        }else{
+            high = mid;
+        }
+    }
+    return first + low;
+}
+
+/*  (private) merge_next: Get the next contact from the table and overlay combined,
+        in number order, skipping removed contacts and expired name requests
+        cursor: Merge position, start at {0, 0}
+        record: Receives the contact record
+        from_log: Receives true if the record is from the overlay
+    RETURNS True if there was a contact, false if the end has been reached
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::merge_next(merge_cursor* cursor, contact_record* record, bool* from_log){
+    while(true){
+        bool table_left = cursor->table_position < table_count;
+        bool overlay_left = cursor->overlay_position < overlay_count;
+
+        //Read the next record from the table
+        contact_record table_record;
+        if(table_left){
+            table_file.seek(cursor->table_position * sizeof(contact_record));
+            if(table_file.read((uint8_t*)&table_record, sizeof(table_record)) != sizeof(table_record)){
+                cursor->table_position = table_count;
+                table_left = false;
+            }
+        }
+
+        if(!table_left && !overlay_left) return false;
+
+        //The overlay goes first if its number is lower, and replaces the table record if it's the same
+        if(overlay_left && (!table_left || overlay[cursor->overlay_position].number <= table_record.number)){
+            if(table_left && overlay[cursor->overlay_position].number == table_record.number) cursor->table_position++;
+            *record = overlay[cursor->overlay_position++];
+            if(record->kind == CONTACT_REMOVED || expired(record)) continue;
+            *from_log = true;
+            return true;
+        }
+
+        *record = table_record;
+        cursor->table_position++;
+        if(expired(record)) continue;
+        *from_log = false;
+        return true;
+    }
+}
+
+/*  (private) sweep: Count the expired name requests in the next page of the table,
+        and merge once a full pass has found enough of them
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Persistent_Storage::sweep(){
+    //Without the time, nothing can expire
+    if(!now) return;
+
+    //Check one page of the table
+    if(sweep_page < page_count){
+        uint32_t first = (uint32_t)sweep_page * PAGE_RECORDS;
+        uint16_t page_records = table_count - first < PAGE_RECORDS ? table_count - first : PAGE_RECORDS;
+        contact_record page[PAGE_RECORDS];
+        table_file.seek(first * sizeof(contact_record));
+        if(table_file.read((uint8_t*)page, page_records * sizeof(contact_record)) == page_records * sizeof(contact_record)){
+            for(uint16_t i = 0; i < page_records; i++){
+                if(expired(&page[i])) sweep_expired++;
+            }
+        }
+        sweep_page++;
+        return;
+    }
+
+    //At the end of a pass, add the overlay and start again
+    for(uint16_t i = 0; i < overlay_count; i++){
+        if(expired(&overlay[i])) sweep_expired++;
+    }
+    uint32_t found = sweep_expired;
+    sweep_page = 0;
+    sweep_expired = 0;
+
+    //Merging drops expired requests, but rewrites the whole table, so wait until there are enough to be worth it
+    if(found >= SWEEP_MIN && found * SWEEP_RATIO >= table_count) compact();
+}
+
+/*  (private) compact: Merge the overlay into a new table, then atomically replace
+        the old table with it and discard the log
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::compact(){
+    File temp = LittleFS.open(temp_path, "w");
+    if(!temp) return false;
+
+    merge_cursor cursor = {0, 0};
+    contact_record record;
+    bool from_log;
+    uint32_t new_count = 0;
+    uint32_t pool_size = 0;
+    uint32_t written = 0;
+
+    //First pass: write the records, with each name's position in the new pool
+    while(merge_next(&cursor, &record, &from_log)){
+        contact_record stored = record;
+        if(record.kind == CONTACT_NAME){
+            stored.data = pool_size;
+            pool_size += record.length;
+        }
+        written += temp.write((uint8_t*)&stored, sizeof(stored));
+        new_count++;
+    }
+
+    //Second pass: write the names in the same order
+    cursor = {0, 0};
+    while(merge_next(&cursor, &record, &from_log)){
+        if(record.kind != CONTACT_NAME) continue;
+        if(!read_name(&record, from_log, value_buffer)) break;
+        written += temp.write((uint8_t*)value_buffer, record.length);
+    }
+
+    table_footer footer = {TABLE_MAGIC, new_count, pool_size, seq};
+    written += temp.write((uint8_t*)&footer, sizeof(footer));
+    temp.close();
+
+    stats.flash_bytes += written;
+    flash_stats.record(FLASH_CONTACTS, temp_path.c_str(), 0, written);
+
+    //If anything failed, keep the old table and log
+    if(written != new_count * sizeof(contact_record) + pool_size + sizeof(footer)){
+        LittleFS.remove(temp_path);
+        return false;
+    }
+
+    //Replace the table. If power is cut before this, the old table and log are still complete. If it's cut
+    //after, the log is skipped on the next replay because the new table includes its sequence numbers.
+    table_file.close();
+    log_file.close();
+    if(!LittleFS.rename(temp_path, table_path)){
+        LittleFS.remove(temp_path);
+        invalidate();
+        return false;
+    }
+    LittleFS.remove(path);
+
+    stats.compactions++;
+
+    //Reopen the new table with an empty log
+    return load();
+}
+
+/*  (private) build_begin: Start building a new table from imported contacts
+        merge: If true, the new table starts with the contacts in the current table
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::build_begin(bool merge){
+    build.count = 0;
+    build.pool_size = 0;
+    build.last = 0;
+    build.merge = merge;
+    build.base_position = 0;
+    build.seq = seq;
+    build.run_count = 0;
+    build.runs_size = 0;
+    build.records = LittleFS.open(temp_path, "w");
+    build.names = LittleFS.open(temp_pool_path, "w");
+    build.runs = LittleFS.open(run_path, "w");
+    return build.records && build.names && build.runs;
+}
+
+/*  (private) build_chunk: Add the chunk of imported contacts to the new table. While
+        every chunk has come after the one before, they are appended to the new table
+        along with any contacts from the current table up to the end of the chunk (when
+        merging). After that, each chunk is written as a sorted run and the runs are
+        merged into the new table by build_end(), so each contact is written a fixed
+        number of times however the file is ordered.
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::build_chunk(){
+    uint16_t count = import_count;
+    import_count = 0;
+    import_pool_used = 0;
+    if(count == 0) return true;
+
+    //Sort by number, and keep only the last of any duplicates
+    import_entry* entries = import_entries;
+    qsort(entries, count, sizeof(import_entry), compare_import);
+    uint16_t unique = 0;
+    for(uint16_t i = 0; i < count; i++){
+        if(unique && entries[unique - 1].number == entries[i].number) unique--;
+        entries[unique++] = entries[i];
+    }
+    count = unique;
+
+    uint32_t written = 0;
+    uint32_t expected = 0;
+
+    //Once a chunk is out of order, later chunks are runs too, so they still replace the contacts of earlier ones
+    if(build.run_count || (build.count && entries[0].number <= build.last)){
+        uint32_t start = build.runs_size;
+        for(uint16_t i = 0; i < count; i++){
+            contact_record record = {entries[i].number, entries[i].data, entries[i].length, entries[i].kind, 0};
+            written += build.runs.write((uint8_t*)&record, sizeof(record));
+            expected += sizeof(record);
+            if(record.kind == CONTACT_NAME){
+                written += build.runs.write((uint8_t*)(import_pool + entries[i].name), record.length);
+                expected += record.length;
+            }
+        }
+
+        //Each run ends with its size, so they can be found from the end of the file
+        uint32_t size = expected;
+        written += build.runs.write((uint8_t*)&size, sizeof(size));
+        expected += sizeof(size);
+
+        build.runs_size += written;
+        build.run_count++;
+        stats.flash_bytes += written;
+        flash_stats.record(FLASH_CONTACTS, run_path.c_str(), start, written);
+        if(written != expected) return false;
+
+        //Fold the runs into one once there are as many as can be merged at a time
+        return build.run_count < IMPORT_RUNS || build_merge(false);
+    }
+
+    uint32_t records_start = build.count * sizeof(contact_record);
+    uint32_t names_start = build.pool_size;
+    uint32_t records_written = 0;
+    uint16_t i = 0;
+    contact_record base_record;
+    bool base_left = build_base(&base_record, entries[count - 1].number);
+
+    //Add the chunk, and the current table up to the end of the chunk. The chunk replaces any contact with the same number.
+    while(base_left || i < count){
+        contact_record record;
+        const char* name = NULL;
+
+        if(i < count && (!base_left || entries[i].number <= base_record.number)){
+            record = {entries[i].number, entries[i].data, entries[i].length, entries[i].kind, 0};
+            if(record.kind == CONTACT_NAME) name = import_pool + entries[i].name;
+            if(base_left && base_record.number == record.number){
+                build.base_position++;
+                base_left = build_base(&base_record, entries[count - 1].number);
+            }
+            i++;
+        }else{
+            record = base_record;
+            if(!read_name(&record, false, value_buffer)) return false;
+            if(record.kind == CONTACT_NAME) name = value_buffer;
+            build.base_position++;
+            base_left = build_base(&base_record, entries[count - 1].number);
+        }
+
+        if(name){
+            record.data = build.pool_size;
+            build.pool_size += record.length;
+            written += build.names.write((uint8_t*)name, record.length);
+            expected += record.length;
+        }
+        records_written += build.records.write((uint8_t*)&record, sizeof(record));
+        expected += sizeof(record);
+        build.count++;
+        build.last = record.number;
+    }
+
+    written += records_written;
+    stats.flash_bytes += written;
+    flash_stats.record(FLASH_CONTACTS, temp_path.c_str(), records_start, records_written);
+    flash_stats.record(FLASH_CONTACTS, temp_pool_path.c_str(), names_start, written - records_written);
+    return written == expected;
+}
+
+/*  (private) build_merge: Merge the sorted runs in a single pass, using the memory of
+        the chunk to track them. Where runs have the same number, the latest one wins.
+        final: If true, the runs are merged with the new table so far and the rest of
+            the current table (when merging), and the result becomes the new table. If
+            false, the runs are merged into a single run.
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::build_merge(bool final){
+    build.runs.close();
+    File runs = LittleFS.open(run_path, "r");
+    File records = LittleFS.open(merge_path, "w");
+    File names;
+    File old_records;
+    File old_names;
+    if(final){
+        build.records.close();
+        build.names.close();
+        names = LittleFS.open(merge_pool_path, "w");
+        old_records = LittleFS.open(temp_path, "r");
+        old_names = LittleFS.open(temp_pool_path, "r");
+        if(!names || !old_records || !old_names) return false;
+    }
+    if(!runs || !records) return false;
+
+    //Find each run from the size at its end, and read its first contact
+    import_run* heads = (import_run*)import_entries;
+    uint16_t run_count = build.run_count;
+    uint32_t end = build.runs_size;
+    for(int r = run_count - 1; r >= 0; r--){
+        uint32_t size;
+        if(end < sizeof(size) || !runs.seek(end - sizeof(size))) return false;
+        if(runs.read((uint8_t*)&size, sizeof(size)) != sizeof(size) || size > end - sizeof(size)) return false;
+        heads[r].end = end - sizeof(size);
+        heads[r].position = heads[r].end - size;
+        end = heads[r].position;
+        if(read_run(runs, &heads[r]) <= 0) return false;
+    }
+    for(int i = run_count / 2 - 1; i >= 0; i--) sift_run(heads, run_count, i);
+
+    uint32_t old_count = final ? build.count : 0;
+    uint32_t old_position = 0;
+    uint32_t count = 0;
+    uint32_t pool_size = 0;
+    uint32_t records_written = 0;
+    uint32_t names_written = 0;
+    uint32_t expected = 0;
+    contact_record old_record;
+    contact_record base_record;
+    bool old_left = old_position < old_count && old_records.read((uint8_t*)&old_record, sizeof(old_record)) == sizeof(old_record);
+    bool base_left = final && build_base(&base_record, UINT64_MAX);
+
+    //The runs replace any contact with the same number, and the current table only has numbers after the new table so far
+    while(run_count || old_left || base_left){
+        uint64_t lowest = UINT64_MAX;
+        if(run_count) lowest = heads[0].record.number;
+        if(old_left && old_record.number < lowest) lowest = old_record.number;
+        if(base_left && base_record.number < lowest) lowest = base_record.number;
+
+        contact_record record;
+        const char* name = NULL;
+
+        if(run_count && heads[0].record.number == lowest){
+            record = heads[0].record;
+            uint32_t name_position = heads[0].position;
+
+            //Skip the contacts it replaces
+            while(run_count && heads[0].record.number == lowest){
+                if(heads[0].record.kind == CONTACT_NAME) heads[0].position += heads[0].record.length;
+                int result = read_run(runs, &heads[0]);
+                if(result < 0) return false;
+                if(result == 0) heads[0] = heads[--run_count];
+                sift_run(heads, run_count, 0);
+            }
+            if(old_left && old_record.number == lowest){
+                if(old_record.kind == CONTACT_NAME && old_names.read((uint8_t*)value_buffer, old_record.length) != old_record.length) return false;
+                old_position++;
+                old_left = old_position < old_count && old_records.read((uint8_t*)&old_record, sizeof(old_record)) == sizeof(old_record);
+            }
+            if(base_left && base_record.number == lowest){
+                build.base_position++;
+                base_left = build_base(&base_record, UINT64_MAX);
+            }
+
+            if(record.kind == CONTACT_NAME){
+                if(!runs.seek(name_position) || runs.read((uint8_t*)value_buffer, record.length) != record.length) return false;
+                name = value_buffer;
+            }
+        }else if(old_left && old_record.number == lowest){
+            record = old_record;
+            if(record.kind == CONTACT_NAME){
+                if(old_names.read((uint8_t*)value_buffer, record.length) != record.length) return false;
+                name = value_buffer;
+            }
+            old_position++;
+            old_left = old_position < old_count && old_records.read((uint8_t*)&old_record, sizeof(old_record)) == sizeof(old_record);
+        }else{
+            record = base_record;
+            if(!read_name(&record, false, value_buffer)) return false;
+            if(record.kind == CONTACT_NAME) name = value_buffer;
+            build.base_position++;
+            base_left = build_base(&base_record, UINT64_MAX);
+        }
+
+        //A table keeps the names apart from the records, a run keeps each name after its record
+        if(final && name) record.data = pool_size;
+        records_written += records.write((uint8_t*)&record, sizeof(record));
+        expected += sizeof(record);
+        if(name){
+            pool_size += record.length;
+            if(final) names_written += names.write((uint8_t*)name, record.length);
+            else records_written += records.write((uint8_t*)name, record.length);
+            expected += record.length;
+        }
+        count++;
+    }
+
+    if(!final){
+        uint32_t size = expected;
+        records_written += records.write((uint8_t*)&size, sizeof(size));
+        expected += sizeof(size);
+    }
+    stats.flash_bytes += records_written + names_written;
+    flash_stats.record(FLASH_CONTACTS, merge_path.c_str(), 0, records_written);
+    if(final) flash_stats.record(FLASH_CONTACTS, merge_pool_path.c_str(), 0, names_written);
+    if(records_written + names_written != expected) return false;
+
+    runs.close();
+    records.close();
+    LittleFS.remove(run_path);
+
+    if(!final){
+        //Continue with the single run
+        if(!LittleFS.rename(merge_path, run_path)) return false;
+        build.run_count = 1;
+        build.runs_size = expected;
+        build.runs = LittleFS.open(run_path, "a");
+        return build.runs;
+    }
+
+    //Replace the new table so far with the merged one, and reopen it for appending
+    old_records.close();
+    old_names.close();
+    names.close();
+    build.count = count;
+    build.pool_size = pool_size;
+    build.run_count = 0;
+    build.runs_size = 0;
+    LittleFS.remove(temp_path);
+    LittleFS.remove(temp_pool_path);
+    if(!LittleFS.rename(merge_path, temp_path) || !LittleFS.rename(merge_pool_path, temp_pool_path)) return false;
+    build.records = LittleFS.open(temp_path, "a");
+    build.names = LittleFS.open(temp_pool_path, "a");
+    return build.records && build.names;
+}
+
+/*  (private) build_base: When merging, read the next contact from the current table
+        that hasn't been added to the new table yet, skipping expired name requests
+        record: Receives the contact record
+        limit: Highest number to read
+    RETURNS True if there was a contact up to the limit, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::build_base(contact_record* record, uint64_t limit){
+    if(!build.merge) return false;
+
+    while(build.base_position < table_count){
+        table_file.seek(build.base_position * sizeof(contact_record));
+        if(table_file.read((uint8_t*)record, sizeof(contact_record)) != sizeof(contact_record)) return false;
+        if(record->number > limit) return false;
+        if(!expired(record)) return true;
+        build.base_position++;
+    }
+    return false;
+}
+
+/*  (private) build_end: Finish the new table by merging in the runs and adding the rest
+        of the current table (when merging), copying the names after the records and
+        adding the footer. The table is left at temp_path.
+    RETURNS True if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::build_end(){
+    //The runs are merged with the rest of the current table, otherwise it comes after everything in the new table
+    if(build.run_count){
+        if(!build_merge(true)) return false;
+    }else{
+        build.runs.close();
+        LittleFS.remove(run_path);
+
+        uint32_t records_start = build.count * sizeof(contact_record);
+        uint32_t names_start = build.pool_size;
+        uint32_t records_written = 0;
+        uint32_t names_written = 0;
+        uint32_t expected = 0;
+        contact_record record;
+        while(build_base(&record, UINT64_MAX)){
+            build.base_position++;
+            if(!read_name(&record, false, value_buffer)) return false;
+            if(record.kind == CONTACT_NAME){
+                record.data = build.pool_size;
+                build.pool_size += record.length;
+                names_written += build.names.write((uint8_t*)value_buffer, record.length);
+                expected += record.length;
+            }
+            records_written += build.records.write((uint8_t*)&record, sizeof(record));
+            expected += sizeof(record);
+            build.count++;
+        }
+        stats.flash_bytes += records_written + names_written;
+        flash_stats.record(FLASH_CONTACTS, temp_path.c_str(), records_start, records_written);
+        flash_stats.record(FLASH_CONTACTS, temp_pool_path.c_str(), names_start, names_written);
+        if(records_written + names_written != expected) return false;
+    }
+
+    build.names.close();
+    File names = LittleFS.open(temp_pool_path, "r");
+    if(!names) return false;
+
+    //Copy the names a buffer at a time
+    uint32_t written = 0;
+    while(names.available()){
+        size_t size = names.read((uint8_t*)value_buffer, sizeof(value_buffer));
+        if(size == 0) break;
+        written += build.records.write((uint8_t*)value_buffer, size);
+    }
+    names.close();
+    LittleFS.remove(temp_pool_path);
+
+    //The log is kept, so the table only includes it up to where the import started
+    table_footer footer = {TABLE_MAGIC, build.count, build.pool_size, build.seq};
+    written += build.records.write((uint8_t*)&footer, sizeof(footer));
+    build.records.close();
+
+    stats.flash_bytes += written;
+    flash_stats.record(FLASH_CONTACTS, temp_path.c_str(), build.count * sizeof(contact_record), written);
+    return written == build.pool_size + sizeof(footer);
+}
+
+/*  (private) build_discard: Close and delete the files of a new table that won't be used
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Persistent_Storage::build_discard(){
+    if(build.records) build.records.close();
+    if(build.names) build.names.close();
+    if(build.runs) build.runs.close();
+    LittleFS.remove(temp_path);
+    LittleFS.remove(temp_pool_path);
+    LittleFS.remove(run_path);
+    LittleFS.remove(merge_path);
+    LittleFS.remove(merge_pool_path);
+}
+
+/*  (private) read_log_record: Read and verify the record at the current position in the log
+        record_seq: Receives the sequence number
+        record: Receives the contact record
+        name: Buffer of NAME_MAX + 1 bytes, receives the name
+    RETURNS True if the record is complete and its CRC matches, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool Persistent_Storage::read_log_record(uint32_t* record_seq, contact_record* record, char* name){
+    uint8_t header[LOG_HEADER];
+    if(log_file.read(header, LOG_HEADER) != LOG_HEADER) return false;
+    if(header[0] != LOG_MAGIC) return false;
+    memcpy(record, header + 6, sizeof(contact_record));
+
+    if(log_file.read((uint8_t*)name, record->length) != record->length) return false;
+
+    uint32_t stored_crc;
+    if(log_file.read((uint8_t*)&stored_crc, 4) != 4) return false;
+
+    uint32_t crc = crc32_update(0xFFFFFFFF, header, LOG_HEADER);
+    crc = crc32_update(crc, (uint8_t*)name, record->length);
+    if(~crc != stored_crc) return false;
+
+    name[record->length] = '\0';
+    memcpy(record_seq, header + 2, 4);
+
+    return true;
+}
+
+/*  (private) allocate: Allocate memory from the heap, counting it in the stats
+        size: Bytes to allocate
+    RETURNS The memory, or NULL if there isn't enough
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void* Persistent_Storage::allocate(size_t size){
+    void* memory = malloc(size);
+    if(!memory) return NULL;
+    stats.heap_bytes += size;
+    if(stats.heap_bytes > stats.max_heap_bytes) stats.max_heap_bytes = stats.heap_bytes;
+    return memory;
+}
+
+/*  (private) release: Free memory from allocate()
+        memory: The memory, or NULL
+        size: Bytes that were allocated
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Persistent_Storage::release(void* memory, size_t size){
+    if(!memory) return;
+    free(memory);
+    stats.heap_bytes -= size;
+}
@@ -1,22 +1,221 @@
+#pragma once
+
 #include "Arduino.h"
 #include "LittleFS.h"
-#include "ArduinoJson.h" //Arduino JavaScript Object Notation Library
+
+//Kinds of contact records
+#define CONTACT_NONE 0 //No contact, returned by get() when a number isn't found
+#define CONTACT_NAME 1 //The record holds a name
+#define CONTACT_PENDING 2 //The record holds the time a name request expires
+#define CONTACT_REMOVED 3 //The record marks a removed contact (log and RAM only)
+
+//Seconds a name request is pending for
+#define PENDING_TTL 86400
+
+//Formats of lines for import_line()
+#define IMPORT_CSV 0 //number,name
+#define IMPORT_JSON_LINES 1 //{"number":"name"}
+
+//A contact as stored in the table, the log and RAM (16 bytes)
+struct contact_record{
+    uint64_t number; //Phone number as an integer of its E.164 digits
+    uint32_t data; //CONTACT_NAME: position of the name, CONTACT_PENDING: UNIX time the request expires
+    uint8_t length; //Length of the name in bytes
+    uint8_t kind; //CONTACT_NAME, CONTACT_PENDING or CONTACT_REMOVED
+    uint16_t reserved;
+};
+
+//A contact read from an import file, waiting to be merged into a new table
+struct import_entry{
+    uint64_t number;
+    uint32_t data; //CONTACT_PENDING: UNIX time the request expires
+    uint16_t name; //Position of the name in the chunk's name pool
+    uint8_t length; //Length of the name in bytes
+    uint8_t kind; //CONTACT_NAME or CONTACT_PENDING
+    uint32_t order; //Position in the import file, so the last duplicate wins
+};
+
+//Counters for measuring the cost of writes
+struct storage_stats{
+    uint32_t writes; //Number of set() and remove() calls that changed a contact
+    uint32_t logical_bytes; //Bytes of keys and values written by those calls
+    uint32_t flash_bytes; //Bytes actually written to flash, including compaction
+    uint32_t max_write_micros; //Worst-case latency of a single set() or remove()
+    uint32_t compactions; //Number of times the log has been merged into the table
+    uint32_t flushes; //Number of times write-back changes have been written to flash
+    uint32_t coalesced; //Number of changes that replaced an unflushed change, saving a flash write
+    uint32_t max_flush_micros; //Worst-case latency of a single flush
+    uint32_t heap_bytes; //Bytes of heap held by the storage now
+    uint32_t max_heap_bytes; //Most bytes of heap held by the storage at once
+};
+
+//Where an export printed a piece at a time is up to
+struct export_position{
+    uint64_t next; //Lowest number not read yet
+    uint32_t count; //Contacts printed so far, or for export_page(), contacts that matched
+    bool started; //True once the start of the export has been printed
+};
+
+//Number of contacts changed since the last compaction that can be held in RAM
+#define OVERLAY_MAX 64
+//Number of changes held in RAM in write-back mode before they are written to flash
+#define DIRTY_MAX 8
 
 class Persistent_Storage{
-    
+
     public:
 
         Persistent_Storage(String name);
-    
+
         bool
             set(String key, String value),
-            remove(String key);
+            set_pending(String key, uint32_t expires),
+            remove(String key),
+            import_json(String import_path),
+            import_begin(bool merge),
+            import_add(const char* key, const char* value),
+            import_end(),
+            export_json(Print& output),
+            export_csv(Print& output),
+            export_page(Print& output, uint32_t offset, uint16_t limit, const char* prefix),
+            export_json(Print& output, export_position* position, uint16_t count),
+            export_csv(Print& output, export_position* position, uint16_t count),
+            export_page(Print& output, export_position* position, uint16_t count, uint32_t offset, uint16_t limit, const char* prefix),
+            flush();
 
-        String 
+        String
             get(String key);
 
+        const char*
+            get(const char* key);
+
+        const char*
+            get(const char* key, uint8_t* kind);
+
+        uint16_t
+            import_line(char* line, uint8_t format);
+
+        void
+            import_abort(),
+            set_write_back(bool on),
+            set_time(uint32_t time),
+            handle(),
+            invalidate(),
+            end();
+
+        storage_stats
+            get_stats();
+
     private:
 
-        String path; //The path for this object
+        //Position of a merge of the table and the overlay, in number order
+        struct merge_cursor{
+            uint32_t table_position;
+            uint16_t overlay_position;
+        };
+
+        //A new table being built from imported contacts. The records and names are kept in
+        //separate files until it's finished, so contacts that arrive in order can be appended.
+        struct table_build{
+            File records;
+            File names;
+            uint32_t count; //Number of records so far
+            uint32_t pool_size; //Size of the names so far in bytes
+            uint64_t last; //Highest number so far
+            bool merge; //True if the current table is being merged in
+            uint32_t base_position; //Next record of the current table to merge in
+            uint32_t seq; //Sequence number when the import started
+            File runs; //Sorted runs of the chunks that didn't come after the new table so far
+            uint16_t run_count; //Number of runs
+            uint32_t runs_size; //Size of the file of runs in bytes
+        };
+
+        //A change held in RAM in write-back mode
+        struct dirty_contact{
+            contact_record record;
+            char* name; //Name for CONTACT_NAME records, otherwise NULL
+        };
+
+        bool
+            load(),
+            load_table(),
+            store(contact_record record, const char* name, uint32_t logical_bytes),
+            write_change(contact_record record, const char* name),
+            append(contact_record record, const char* name),
+            overlay_put(contact_record record),
+            compact(),
+            lookup(uint64_t number, contact_record* record, char* name),
+            merge_seek(merge_cursor* cursor, uint64_t number),
+            merge_next(merge_cursor* cursor, contact_record* record, bool* from_log),
+            read_name(const contact_record* record, bool from_log, char* name),
+            read_log_record(uint32_t* record_seq, contact_record* record, char* name),
+            expired(const contact_record* record),
+            build_begin(bool merge),
+            build_chunk(),
+            build_merge(bool final),
+            build_base(contact_record* record, uint64_t limit),
+            build_end();
+
+        void
+            sweep(),
+            build_discard(),
+            release(void* memory, size_t size);
+
+        void*
+            allocate(size_t size);
+
+        uint16_t
+            overlay_bound(uint64_t number);
+
+        uint32_t
+            table_bound(uint64_t number);
+
+        const char*
+            format_value(const contact_record* record, const char* name);
+
+        String path; //The path of the log of changes since the last compaction
+        String table_path; //The path of the sorted table of contacts
+        String temp_path; //The path used to build a new table before replacing the old one
+        String temp_pool_path; //The path used to hold the names of a table being imported
+        String run_path; //The path of the sorted runs of a table being imported
+        String merge_path; //The path used to merge the runs into the records, or into a single run
+        String merge_pool_path; //The path used to merge the runs into the names
+        String legacy_path; //The path of the JSON file used by older firmware
+
+        File log_file; //Log file, open for reading and appending
+        File table_file; //Table file, open for reading
+
+        uint64_t* pages = NULL; //First number of each page of the table, the only part of the table in RAM
+        uint16_t page_count = 0; //Number of pages in the table
+        uint32_t table_count = 0; //Number of records in the table
+        uint32_t table_seq = 0; //Sequence number of the last log record merged into the table
+
+        contact_record overlay[OVERLAY_MAX]; //Contacts changed since the last compaction, sorted by number
+        uint16_t overlay_count = 0; //Number of contacts in the overlay
+
+        dirty_contact dirty[DIRTY_MAX]; //Changes not yet written to flash, in the order they were made
+        uint8_t dirty_count = 0; //Number of changes not yet written to flash
+        uint32_t dirty_millis = 0; //Time of the oldest change not yet written to flash
+        bool write_back = false; //True if changes are held in RAM before being written to flash
+
+        uint32_t now = 0; //Current UNIX time, or 0 if it isn't known yet
+        uint16_t sweep_page = 0; //Next page of the table to check for expired name requests
+        uint32_t sweep_expired = 0; //Expired name requests found so far in this pass over the table
+        uint32_t sweep_millis = 0; //Time the last page was checked
+
+        table_build build; //New table being built by an import
+        import_entry* import_entries = NULL; //Chunk of imported contacts waiting to be added to the new table
+        char* import_pool = NULL; //Names of the imported contacts in the chunk
+        uint16_t import_count = 0; //Number of contacts in the chunk
+        uint16_t import_pool_used = 0; //Bytes of names in the chunk
+        uint32_t import_order = 0; //Number of contacts imported so far
+        bool importing = false; //True if an import has been started and not finished
+
+        uint32_t seq = 0; //Sequence number of the last record
+        bool loaded = false; //True if the table and log are open and indexed
+
+        char value_buffer[256]; //Holds the value returned by get()
+
+        storage_stats stats = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
-};
\ No newline at end of file
+};
@@ -2,7 +2,8 @@
     ESP8266 library for thermal printers such as the Adafruit Mini Thermal Receipt
     Printer or the Sparkfun Thermal Printer. Supports printing text with different
     fonts, printing bitmaps from a custom file type obtained via HTTP or stored
-    locally as a file.
+    locally as a file. Text is UTF-8, and is printed in the code page chosen with
+    set_code_page().
 
     Hardware requirements:
                 -RX pin of printer connected to GPIO2
@@ -48,6 +49,8 @@ void Thermal_Printer::begin() {
     delay(100);
     wake();
     write_bytes(ASCII_ESC, '@');
+    code_page = next_code_page;
+    write_bytes(ASCII_ESC, 't', code_page);
 
     // Set default printing parameters
     set_printing_parameters(11, 120, 60);
@@ -73,6 +76,14 @@ void Thermal_Printer::set_printing_parameters(uint8_t heating_dots, uint8_t heat
     write_bytes(heating_dots, heating_time, heating_interval);
 }
 
+/*	set_code_page: Choose the code page text is printed in. Takes effect at the next begin().
+                number: Code page selected with ESC t: CODE_PAGE_PC437 (default), CODE_PAGE_PC850 or
+                        CODE_PAGE_WPC1252. Anything else is ignored.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Thermal_Printer::set_code_page(uint8_t number) {
+    if (code_page_supported(number)) next_code_page = number;
+}
+
 /*	offline: Turns off the printer, to be called before a function that might spit
         out serial garbage like the start of an OTA update.
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
@@ -104,6 +115,7 @@ void Thermal_Printer::feed(uint8_t feed_amount) {
                 feed_amount: Amount to feed after text
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void Thermal_Printer::print_status(String text, uint8_t feed_amount) {
+    transcode(text);
     wake();
     font_center(false);
     font_inverse(false);
@@ -121,6 +133,7 @@ void Thermal_Printer::print_status(String text, uint8_t feed_amount) {
                 feed_amount: Amount to feed after text
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void Thermal_Printer::print_title(String text, uint8_t feed_amount) {
+    transcode(text);
     wake();
     font_center(true);
     font_inverse(true);
@@ -144,6 +157,7 @@ void Thermal_Printer::print_title(String text, uint8_t feed_amount) {
                 feed_amount: Amount to feed after text
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void Thermal_Printer::print_heading(String text, uint8_t feed_amount) {
+    transcode(text);
     wake();
     font_center(true);
     font_inverse(false);
@@ -161,6 +175,7 @@ void Thermal_Printer::print_heading(String text, uint8_t feed_amount) {
                 feed_amount: Amount to feed after text
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void Thermal_Printer::print_message(String text, uint8_t feed_amount) {
+    transcode(text);
     wake();
     font_center(false);
     font_inverse(false);
@@ -179,6 +194,7 @@ void Thermal_Printer::print_message(String text, uint8_t feed_amount) {
                 feed_amount: Amount to feed after text
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void Thermal_Printer::print_error(String text, uint8_t feed_amount) {
+    transcode(text);
     wake();
     font_center(false);
     font_inverse(true);
@@ -344,11 +360,25 @@ void Thermal_Printer::sleep() {
     write_bytes(ASCII_ESC, '8', 1, 1 >> 8);
 }
 
+/*	set_idle_callback: Set a function to call while waiting for the printer, so other work can carry on
+        while a message prints.
+        idle_in: Function to call. It must not print.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Thermal_Printer::set_idle_callback(idle_function_pointer idle_in) {
+    idle = idle_in;
+}
+
 /*	(private) wait: Check the printer buffer and wait while it's full.
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void Thermal_Printer::wait() {
-    if(!debugMode) 
-        while (digitalRead(DTR_pin) == HIGH) yield();
+    if (debugMode || digitalRead(DTR_pin) == LOW) return;
+
+    uint32_t start = micros();
+    while (digitalRead(DTR_pin) == HIGH) {
+        if (idle) idle();
+        yield();
+    }
+    device_stats.record_printer_stall(micros() - start);
 }
 
 /*	(private) write_bytes: Write instructions as bytes to the printer.
@@ -358,6 +388,7 @@ void Thermal_Printer::write_bytes(uint8_t a) {
     if (!debugMode) {
         wait();
         Serial.write(a);
+        device_stats.record_print(1);
     }
 }
 void Thermal_Printer::write_bytes(uint8_t a, uint8_t b) {
@@ -365,6 +396,7 @@ void Thermal_Printer::write_bytes(uint8_t a, uint8_t b) {
         wait();
         Serial.write(a);
         Serial.write(b);
+        device_stats.record_print(2);
     }
 }
 void Thermal_Printer::write_bytes(uint8_t a, uint8_t b, uint8_t c) {
@@ -374,6 +406,7 @@ void Thermal_Printer::write_bytes(uint8_t a, uint8_t b, uint8_t c) {
         Serial.write(b);
         wait();
         Serial.write(c);
+        device_stats.record_print(3);
     }
 }
 void Thermal_Printer::write_bytes(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
@@ -384,6 +417,7 @@ void Thermal_Printer::write_bytes(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
         wait();
         Serial.write(c);
         Serial.write(d);
+        device_stats.record_print(4);
     }
 }
 void Thermal_Printer::write_bytes(uint8_t a, uint8_t b, uint8_t c, uint8_t d, uint8_t e) {
@@ -396,6 +430,7 @@ void Thermal_Printer::write_bytes(uint8_t a, uint8_t b, uint8_t c, uint8_t d, ui
         Serial.write(d);
         wait();
         Serial.write(e);
+        device_stats.record_print(5);
     }
 }
 void Thermal_Printer::write_bytes(uint8_t a, uint8_t b, uint8_t c, uint8_t d, uint8_t e, uint8_t f) {
@@ -409,6 +444,7 @@ void Thermal_Printer::write_bytes(uint8_t a, uint8_t b, uint8_t c, uint8_t d, ui
         wait();
         Serial.write(e);
         Serial.write(f);
+        device_stats.record_print(6);
     }
 }
 
@@ -417,7 +453,15 @@ void Thermal_Printer::write_bytes(uint8_t a, uint8_t b, uint8_t c, uint8_t d, ui
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void Thermal_Printer::output(String text) {
     wait();
-    Serial.println(text);
+    device_stats.record_print(Serial.println(text));
+}
+
+/*	(private) transcode: Convert UTF-8 text to the code page, in place. Each character becomes one byte,
+        so it can be wrapped by length.
+        text: Text to convert.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Thermal_Printer::transcode(String& text) {
+    text.remove(transcode_utf8(text.begin(), text.length(), code_page));
 }
 
 /*	(private) wrap: Wrap text.
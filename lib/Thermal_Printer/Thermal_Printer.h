@@ -2,6 +2,8 @@
 #include "FS.h"
 #include "WiFiClient.h"
 #include "ESP8266HTTPClient.h"
+#include "Device_Stats.h" //Counters for /metrics
+#include "Code_Page.h" //UTF-8 to the printer's code pages
 
 //Define control characters
 #define ASCII_TAB '\t'
@@ -9,6 +11,9 @@
 #define ASCII_ESC  27
 #define ASCII_GS   29 
 
+//Callback function type (no args)
+typedef void (*idle_function_pointer)();
+
 class Thermal_Printer{
     public:
 
@@ -18,6 +23,8 @@ class Thermal_Printer{
             config(uint32_t, uint8_t, bool),
             begin(),
             set_printing_parameters(uint8_t, uint8_t, uint8_t),
+            set_code_page(uint8_t),
+            set_idle_callback(idle_function_pointer),
             offline(),
             
             print_status(String, uint8_t),
@@ -48,6 +55,7 @@ class Thermal_Printer{
             font_bold(bool),
             font_write_print_mode(),
             output(String),
+            transcode(String&),
             wait();
 
         String  
@@ -57,8 +65,11 @@ class Thermal_Printer{
 
         uint32_t baud_rate = 0; //Baud rate of printer
         uint8_t DTR_pin = 0; //ESP8266 pin to use to detect DTR
+        idle_function_pointer idle = NULL; //Called while waiting for the printer
 
         uint8_t printMode = 0; //printMode byte holds inverse, double height, double width, and bold font status
+        uint8_t code_page = CODE_PAGE_PC437; //Code page text is printed in, selected with ESC t
+        uint8_t next_code_page = CODE_PAGE_PC437; //Code page selected by the next begin()
         
         bool 
             debugMode,
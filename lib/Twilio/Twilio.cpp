@@ -40,6 +40,8 @@ bool Twilio::send_message(String to, String from, String message)
 {
     // Check the body is less than 1600 characters in length
     if (message.length() > 1600) return false;
+    // Time the send for /metrics, the TLS handshake makes it the slowest thing the TAG Machine does
+    uint32_t start = micros();
     // URL encode the message body to escape special chars such as '&' and '='
     String encoded_message = urlencode(message);
 
@@ -50,7 +52,10 @@ bool Twilio::send_message(String to, String from, String message)
     client.setTimeout(2000);
     
     // Connect to Twilio's REST API
-    if (!client.connect(host, httpsPort)) return false;
+    if (!client.connect(host, httpsPort)) {
+        device_stats.record_twilio_send(micros() - start, false);
+        return false;
+    }
 
     //Create the post data String
     String post_data = "To=" + urlencode(to) + "&From=" + urlencode(from) + \
@@ -69,6 +74,7 @@ bool Twilio::send_message(String to, String from, String message)
     //Sent the request to Twilio
     client.println(http_request);
     client.stop();
+    device_stats.record_twilio_send(micros() - start, true);
     return true;
 }
 
@@ -2,6 +2,7 @@
 #include "WiFiClientSecure.h"
 #include "base64.h"
 #include "url_coding.h"
+#include "Device_Stats.h" //Counters for /metrics
 
 class Twilio {
 
@@ -88,6 +88,7 @@ void WTA_Clock::handle(){
             time_at_last_response = unix_time.toInt() + timezone_offset;
             //Store the internal time at which the current time was last received 
             last_response_millis = millis();
+            device_stats.record_clock_sync();
         }
     }
 
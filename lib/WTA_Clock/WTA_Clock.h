@@ -16,6 +16,7 @@
 #include "Arduino.h"
 #include "ESP8266WiFi.h" //WiFi Library for hostname resolution
 #include "WiFiClient.h" //Web Client Library
+#include "Device_Stats.h" //Counters for /metrics
 
 class WTA_Clock{
     public:
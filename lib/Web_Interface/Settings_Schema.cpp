@@ -0,0 +1,150 @@
+//Generated from data/settings_def.txt by scripts/settings_schema.py, edit settings_def.txt instead of this file
+#include "Settings_Schema.h"
+
+static const char setting_0_id[] PROGMEM = "phone_number";
+static const char setting_0_name[] PROGMEM = "Phone Number*";
+static const char setting_0_desc[] PROGMEM = "";
+static const char setting_0_val[] PROGMEM = "";
+static const char setting_0_opt[] PROGMEM = "";
+static const char setting_1_id[] PROGMEM = "owner_name";
+static const char setting_1_name[] PROGMEM = "Owner Name*";
+static const char setting_1_desc[] PROGMEM = "";
+static const char setting_1_val[] PROGMEM = "User";
+static const char setting_1_opt[] PROGMEM = "";
+static const char setting_2_id[] PROGMEM = "Twilio_account_SID";
+static const char setting_2_name[] PROGMEM = "Twilio Account SID";
+static const char setting_2_desc[] PROGMEM = "The SID for your Twilio account. Required for SMS replies only.";
+static const char setting_2_val[] PROGMEM = "";
+static const char setting_2_opt[] PROGMEM = "";
+static const char setting_3_id[] PROGMEM = "Twilio_auth_token";
+static const char setting_3_name[] PROGMEM = "Twilio Auth Token";
+static const char setting_3_desc[] PROGMEM = "The Auth Token for your Twilio account. Required for SMS replies only.";
+static const char setting_3_val[] PROGMEM = "";
+static const char setting_3_opt[] PROGMEM = "";
+static const char setting_4_id[] PROGMEM = "bridge_URL";
+static const char setting_4_name[] PROGMEM = "Bridge URL*";
+static const char setting_4_desc[] PROGMEM = "The URL of the Twilio-MQTT bridge used to relay messages.";
+static const char setting_4_val[] PROGMEM = "silviutoderita.com";
+static const char setting_4_opt[] PROGMEM = "";
+static const char setting_5_id[] PROGMEM = "send_replies";
+static const char setting_5_name[] PROGMEM = "Send SMS Replies*";
+static const char setting_5_desc[] PROGMEM = "Send SMS replies requesting a name for the phone book.";
+static const char setting_5_val[] PROGMEM = "true";
+static const char setting_5_opt[] PROGMEM = "";
+static const char setting_6_id[] PROGMEM = "img_photos";
+static const char setting_6_name[] PROGMEM = "Print Images*";
+static const char setting_6_desc[] PROGMEM = "";
+static const char setting_6_val[] PROGMEM = "true";
+static const char setting_6_opt[] PROGMEM = "";
+static const char setting_7_id[] PROGMEM = "printer_baud";
+static const char setting_7_name[] PROGMEM = "Printer Baud Rate*";
+static const char setting_7_desc[] PROGMEM = "The baud rate of the thermal printer. To get this, start the printer while holding down the button on the printer panel.";
+static const char setting_7_val[] PROGMEM = "9600";
+static const char setting_7_opt[] PROGMEM = "9600,19200,28800,38400,57600,76800,115200";
+static const char setting_8_id[] PROGMEM = "printer_code_page";
+static const char setting_8_name[] PROGMEM = "Printer Code Page*";
+static const char setting_8_desc[] PROGMEM = "The character set used to print accented letters and symbols: 0 = PC437 (USA), 2 = PC850 (Multilingual), 16 = WPC1252 (Western Europe). Characters the code page doesn't have are printed without their accents.";
+static const char setting_8_val[] PROGMEM = "0";
+static const char setting_8_opt[] PROGMEM = "0,2,16";
+static const char setting_9_id[] PROGMEM = "OTA_password";
+static const char setting_9_name[] PROGMEM = "OTA Password";
+static const char setting_9_desc[] PROGMEM = "Over-The-Air Updates password.";
+static const char setting_9_val[] PROGMEM = "12345678";
+static const char setting_9_opt[] PROGMEM = "";
+static const char setting_10_id[] PROGMEM = "printer_heating_dots";
+static const char setting_10_name[] PROGMEM = "Printer Heating Dots*";
+static const char setting_10_desc[] PROGMEM = "Maximum number of heating dots to use simultaneously (0-47). Higher = faster print speed, but higher current draw and possible crashing.";
+static const char setting_10_val[] PROGMEM = "11";
+static const char setting_10_opt[] PROGMEM = "";
+static const char setting_11_id[] PROGMEM = "printer_heating_time";
+static const char setting_11_name[] PROGMEM = "Printer Heating Time*";
+static const char setting_11_desc[] PROGMEM = "Amount of time to heat each line in 10us increments (3-255). Higher = darker print, but slower print speed and possible sticking paper.";
+static const char setting_11_val[] PROGMEM = "120";
+static const char setting_11_opt[] PROGMEM = "";
+static const char setting_12_id[] PROGMEM = "printer_heating_interval";
+static const char setting_12_name[] PROGMEM = "Printer Heating Interval*";
+static const char setting_12_desc[] PROGMEM = "Amount of time between heating each line in 10us increments (0-255). Higher = Clearer print, but slower print speed.";
+static const char setting_12_val[] PROGMEM = "60";
+static const char setting_12_opt[] PROGMEM = "";
+static const char setting_13_id[] PROGMEM = "printer_DTR_pin";
+static const char setting_13_name[] PROGMEM = "Printer DTR Pin*";
+static const char setting_13_desc[] PROGMEM = "The ESP pin used for the printer DTR (Data Terminal Ready).";
+static const char setting_13_val[] PROGMEM = "13";
+static const char setting_13_opt[] PROGMEM = "0,1,2,3,4,5,9,10,12,13,14,15,16";
+static const char setting_14_id[] PROGMEM = "button_pin";
+static const char setting_14_name[] PROGMEM = "Button Pin*";
+static const char setting_14_desc[] PROGMEM = "The ESP pin used for the button ground.";
+static const char setting_14_val[] PROGMEM = "5";
+static const char setting_14_opt[] PROGMEM = "0,1,2,3,4,5,9,10,12,13,14,15,16";
+static const char setting_15_id[] PROGMEM = "LED_pin";
+static const char setting_15_name[] PROGMEM = "LED Pin*";
+static const char setting_15_desc[] PROGMEM = "The ESP pin used for the LED ground.";
+static const char setting_15_val[] PROGMEM = "4";
+static const char setting_15_opt[] PROGMEM = "0,1,2,3,4,5,9,10,12,13,14,15,16";
+static const char setting_16_id[] PROGMEM = "hotspot_SSID";
+static const char setting_16_name[] PROGMEM = "Hotspot Name*";
+static const char setting_16_desc[] PROGMEM = "";
+static const char setting_16_val[] PROGMEM = "tagmachine";
+static const char setting_16_opt[] PROGMEM = "";
+static const char setting_17_id[] PROGMEM = "hotspot_password";
+static const char setting_17_name[] PROGMEM = "Hotspot Password";
+static const char setting_17_desc[] PROGMEM = "";
+static const char setting_17_val[] PROGMEM = "12345678";
+static const char setting_17_opt[] PROGMEM = "";
+static const char setting_18_id[] PROGMEM = "wifi_SSID_1";
+static const char setting_18_name[] PROGMEM = "WiFi Network Name 1*";
+static const char setting_18_desc[] PROGMEM = "";
+static const char setting_18_val[] PROGMEM = "";
+static const char setting_18_opt[] PROGMEM = "";
+static const char setting_19_id[] PROGMEM = "wifi_password_1";
+static const char setting_19_name[] PROGMEM = "WiFi Network Password 1";
+static const char setting_19_desc[] PROGMEM = "";
+static const char setting_19_val[] PROGMEM = "";
+static const char setting_19_opt[] PROGMEM = "";
+static const char setting_20_id[] PROGMEM = "wifi_SSID_2";
+static const char setting_20_name[] PROGMEM = "WiFi Network Name 2";
+static const char setting_20_desc[] PROGMEM = "";
+static const char setting_20_val[] PROGMEM = "";
+static const char setting_20_opt[] PROGMEM = "";
+static const char setting_21_id[] PROGMEM = "wifi_password_2";
+static const char setting_21_name[] PROGMEM = "WiFi Network Password 2";
+static const char setting_21_desc[] PROGMEM = "";
+static const char setting_21_val[] PROGMEM = "";
+static const char setting_21_opt[] PROGMEM = "";
+static const char setting_22_id[] PROGMEM = "wifi_SSID_3";
+static const char setting_22_name[] PROGMEM = "WiFi Network Name 3";
+static const char setting_22_desc[] PROGMEM = "";
+static const char setting_22_val[] PROGMEM = "";
+static const char setting_22_opt[] PROGMEM = "";
+static const char setting_23_id[] PROGMEM = "wifi_password_3";
+static const char setting_23_name[] PROGMEM = "WiFi Network Password 3";
+static const char setting_23_desc[] PROGMEM = "";
+static const char setting_23_val[] PROGMEM = "";
+static const char setting_23_opt[] PROGMEM = "";
+
+const setting_def settings_schema[SETTING_COUNT] PROGMEM = {
+    {setting_0_id, setting_0_name, setting_0_desc, setting_0_val, setting_0_opt, SETTING_GENERAL, SETTING_TEXT, true}, //SETTING_PHONE_NUMBER
+    {setting_1_id, setting_1_name, setting_1_desc, setting_1_val, setting_1_opt, SETTING_GENERAL, SETTING_TEXT, true}, //SETTING_OWNER_NAME
+    {setting_2_id, setting_2_name, setting_2_desc, setting_2_val, setting_2_opt, SETTING_GENERAL, SETTING_TEXT, false}, //SETTING_TWILIO_ACCOUNT_SID
+    {setting_3_id, setting_3_name, setting_3_desc, setting_3_val, setting_3_opt, SETTING_GENERAL, SETTING_TEXT, false}, //SETTING_TWILIO_AUTH_TOKEN
+    {setting_4_id, setting_4_name, setting_4_desc, setting_4_val, setting_4_opt, SETTING_GENERAL, SETTING_TEXT, true}, //SETTING_BRIDGE_URL
+    {setting_5_id, setting_5_name, setting_5_desc, setting_5_val, setting_5_opt, SETTING_GENERAL, SETTING_BOOL, true}, //SETTING_SEND_REPLIES
+    {setting_6_id, setting_6_name, setting_6_desc, setting_6_val, setting_6_opt, SETTING_GENERAL, SETTING_BOOL, true}, //SETTING_IMG_PHOTOS
+    {setting_7_id, setting_7_name, setting_7_desc, setting_7_val, setting_7_opt, SETTING_ADVANCED, SETTING_MULTI, true}, //SETTING_PRINTER_BAUD
+    {setting_8_id, setting_8_name, setting_8_desc, setting_8_val, setting_8_opt, SETTING_ADVANCED, SETTING_MULTI, true}, //SETTING_PRINTER_CODE_PAGE
+    {setting_9_id, setting_9_name, setting_9_desc, setting_9_val, setting_9_opt, SETTING_ADVANCED, SETTING_PASS, false}, //SETTING_OTA_PASSWORD
+    {setting_10_id, setting_10_name, setting_10_desc, setting_10_val, setting_10_opt, SETTING_ADVANCED, SETTING_NUM, true}, //SETTING_PRINTER_HEATING_DOTS
+    {setting_11_id, setting_11_name, setting_11_desc, setting_11_val, setting_11_opt, SETTING_ADVANCED, SETTING_NUM, true}, //SETTING_PRINTER_HEATING_TIME
+    {setting_12_id, setting_12_name, setting_12_desc, setting_12_val, setting_12_opt, SETTING_ADVANCED, SETTING_NUM, true}, //SETTING_PRINTER_HEATING_INTERVAL
+    {setting_13_id, setting_13_name, setting_13_desc, setting_13_val, setting_13_opt, SETTING_ADVANCED, SETTING_MULTI, true}, //SETTING_PRINTER_DTR_PIN
+    {setting_14_id, setting_14_name, setting_14_desc, setting_14_val, setting_14_opt, SETTING_ADVANCED, SETTING_MULTI, true}, //SETTING_BUTTON_PIN
+    {setting_15_id, setting_15_name, setting_15_desc, setting_15_val, setting_15_opt, SETTING_ADVANCED, SETTING_MULTI, true}, //SETTING_LED_PIN
+    {setting_16_id, setting_16_name, setting_16_desc, setting_16_val, setting_16_opt, SETTING_WIFI, SETTING_TEXT, true}, //SETTING_HOTSPOT_SSID
+    {setting_17_id, setting_17_name, setting_17_desc, setting_17_val, setting_17_opt, SETTING_WIFI, SETTING_PASS, false}, //SETTING_HOTSPOT_PASSWORD
+    {setting_18_id, setting_18_name, setting_18_desc, setting_18_val, setting_18_opt, SETTING_WIFI, SETTING_TEXT, true}, //SETTING_WIFI_SSID_1
+    {setting_19_id, setting_19_name, setting_19_desc, setting_19_val, setting_19_opt, SETTING_WIFI, SETTING_PASS, false}, //SETTING_WIFI_PASSWORD_1
+    {setting_20_id, setting_20_name, setting_20_desc, setting_20_val, setting_20_opt, SETTING_WIFI, SETTING_TEXT, false}, //SETTING_WIFI_SSID_2
+    {setting_21_id, setting_21_name, setting_21_desc, setting_21_val, setting_21_opt, SETTING_WIFI, SETTING_PASS, false}, //SETTING_WIFI_PASSWORD_2
+    {setting_22_id, setting_22_name, setting_22_desc, setting_22_val, setting_22_opt, SETTING_WIFI, SETTING_TEXT, false}, //SETTING_WIFI_SSID_3
+    {setting_23_id, setting_23_name, setting_23_desc, setting_23_val, setting_23_opt, SETTING_WIFI, SETTING_PASS, false}, //SETTING_WIFI_PASSWORD_3
+};
@@ -0,0 +1,61 @@
+//Generated from data/settings_def.txt by scripts/settings_schema.py, edit settings_def.txt instead of this file
+#pragma once
+
+#include "Arduino.h"
+
+//Setting categories, in the order they're shown
+#define SETTING_GENERAL 0
+#define SETTING_ADVANCED 1
+#define SETTING_WIFI 2
+#define SETTING_CATEGORIES 3
+
+//Setting types
+#define SETTING_TEXT 0
+#define SETTING_NUM 1
+#define SETTING_PASS 2
+#define SETTING_BOOL 3
+#define SETTING_MULTI 4
+
+//Index of each setting in settings_schema
+enum setting_id : uint8_t{
+    SETTING_PHONE_NUMBER,
+    SETTING_OWNER_NAME,
+    SETTING_TWILIO_ACCOUNT_SID,
+    SETTING_TWILIO_AUTH_TOKEN,
+    SETTING_BRIDGE_URL,
+    SETTING_SEND_REPLIES,
+    SETTING_IMG_PHOTOS,
+    SETTING_PRINTER_BAUD,
+    SETTING_PRINTER_CODE_PAGE,
+    SETTING_OTA_PASSWORD,
+    SETTING_PRINTER_HEATING_DOTS,
+    SETTING_PRINTER_HEATING_TIME,
+    SETTING_PRINTER_HEATING_INTERVAL,
+    SETTING_PRINTER_DTR_PIN,
+    SETTING_BUTTON_PIN,
+    SETTING_LED_PIN,
+    SETTING_HOTSPOT_SSID,
+    SETTING_HOTSPOT_PASSWORD,
+    SETTING_WIFI_SSID_1,
+    SETTING_WIFI_PASSWORD_1,
+    SETTING_WIFI_SSID_2,
+    SETTING_WIFI_PASSWORD_2,
+    SETTING_WIFI_SSID_3,
+    SETTING_WIFI_PASSWORD_3,
+    SETTING_COUNT
+};
+
+//A setting as defined in settings_def.txt. The strings are in flash, so read them with the _P functions.
+struct setting_def{
+    const char* id;
+    const char* name;
+    const char* desc; //Help text, or ""
+    const char* val; //Default value as text, or ""
+    const char* opt; //Options of a SETTING_MULTI setting, separated by commas
+    uint8_t category;
+    uint8_t type;
+    bool req; //True if the setting can't be blank
+};
+
+//Every setting, in flash. Copy an entry to RAM with memcpy_P() before reading it.
+extern const setting_def settings_schema[SETTING_COUNT];
@@ -7,11 +7,18 @@
     often as possible. Call console_print() to output a line to the console. Place
     files for server in /www/ folder in LittleFS. 
 
-    To use the settings function, place a settings.txt file in the root 
-    of the LittleFS. Settings must be in the following JSON format ("advanced" is
-    an optional category, while "basic" and "wifi" are required and can have any
-    number of settings):
-    {"basic":[
+    The console keeps the last CONSOLE_BUFFER bytes printed in a ring buffer in RAM,
+    so it never writes to flash. New text is sent to the browsers connected to the
+    websockets server on port 81 together, every CONSOLE_BATCH_INTERVAL, and a
+    browser that connects is sent what's in the buffer first.
+
+    The settings are defined in data/settings_def.txt, which is compiled into
+    settings_schema (Settings_Schema.h/.cpp) by scripts/settings_schema.py before
+    each build. Only their values are kept in settings.txt in the root of the
+    LittleFS, as {"id":"val",...}. settings_def.txt must be in the following JSON
+    format ("advanced" is an optional category, while "general" and "wifi" are
+    required and can have any number of settings):
+    {"general":[
         {"id":"",
         "type":"",
         "name":"",
@@ -39,7 +46,63 @@
     
 
     begin() will return false if there are any required settings that are missing.
-    load_setting() allows you to load a setting based on its id. 
+    The settings file is only parsed once by begin(), after which setting() returns
+    a setting's value as text, a number or a bool based on its setting_id, and
+    load_setting() returns it as text based on its id as text.
+
+    GET /api/settings streams every setting's definition and value as JSON, and the
+    settings page builds its form from that in the browser. PATCH /api/settings
+    takes only the settings that changed, as {"id":"val",...}. Every value is
+    checked against its setting's type before any of them are changed.
+
+    When settings are saved or a settings.txt is uploaded, the settings that changed
+    are passed to the callback set with set_settings_callback() to apply while
+    running. The ESP only restarts if there's no callback, the callback can't apply
+    them, or a required setting is blank, and then not until the browser has its
+    response.
+
+    Files POSTed to /upload are written to a .part file next to the one they
+    replace, a flash block at a time. Once the upload is complete, it's checked
+    against the crc32 (hex) or md5 argument if there is one, and renamed over the
+    old file. An upload that's interrupted leaves its .part file, so GET
+    /upload?name= returns how much of it was saved as {"offset":n}, and POSTing the
+    rest to /upload?offset=n carries on from there. web/lib/upload.js does this.
+
+    Firmware images POSTed to /update (with the password set by
+    set_update_password() as the password argument) are written to flash as they
+    upload. Before the update starts, the offline callback takes the tag machine
+    offline, and it restarts once the update is over. The image can be gzip-compressed
+    (firmware.bin.gz), which the bootloader decompresses when it installs it. The md5
+    argument (hex) is required, and the image is checked against it before it's
+    installed. The password is never sent back by GET /api/settings, or in the
+    settings file exported from /settings.txt, so it can't be read from the
+    interface.
+
+    If a Persistent_Storage object is attached with set_contacts(), it is served
+    as a JSON file at /contacts.txt and a CSV file at /contacts.csv for exporting.
+    CSV (.csv) or JSON lines files POSTed to /contacts/merge are merged into it
+    a line at a time as they upload. GET /api/contacts?offset=&limit=&q= streams a page
+    of the contacts whose number or name starts with q as JSON, and PUT and DELETE
+    /api/contacts with a number (and a name) change or delete one contact.
+
+    If a Message_Journal object is attached with set_messages(), GET
+    /api/messages?since=&after=&limit= streams the messages received since a UNIX
+    time, or after a message ID, as JSON.
+
+    Counters for flash writes, the free heap, loop times, messages, the printer,
+    replies, the clock and Wi-Fi (and the contacts storage, if attached) are
+    served at /metrics in Prometheus text format.
+
+    The pages in web/ are packed into www.pack by scripts/www_pack.py before
+    each build, with a hash in the path of every file the pages link to so
+    browsers can keep them forever. begin() reads the index of the pack, and
+    files are sent straight from it. Files under /www are also served, so a page
+    can be replaced by uploading it there. Every file is sent with an ETag so
+    browsers that already have it get a 304 response instead.
+
+    Dynamic pages are printed into a 256 byte buffer and sent in chunks as it fills,
+    so they never need the whole page in RAM. The lowest free heap seen while
+    sending them is served at /metrics.
 
     Created by Silviu Toderita in 2020.
     silviu.toderita@gmail.com
@@ -48,23 +111,177 @@
 
 #include "Web_Interface.h"
 
+#ifdef WEB_INTERFACE_ASYNC
+Async_Web_Server server(80); //Create a web server listening on port 80, serving several clients at once
+#else
 ESP8266WebServer server(80); //Create a web server listening on port 80
-// WebSocketsServer websockets_server = WebSocketsServer(81); //Create a websockets server listening on port 81
+#endif
+WebSocketsServer websockets_server = WebSocketsServer(81); //Create a websockets server listening on port 81
 
 static void_function_pointer _offline; //Callback function when connected
+static upload_function_pointer _uploaded = NULL; //Callback function when a file upload finishes
+static Persistent_Storage* _contacts = NULL; //Contacts storage for exporting
+static Message_Journal* _messages = NULL; //Journal of received messages
+static settings_function_pointer _settings_applied = NULL; //Callback function to apply changed settings while running
 
-// int8_t websockets_client = -1; //Current websockets client number connected to (-1 is none)
+#define RESTART_DELAY 500 //Time given to the browser to get its response before restarting (ms)
+uint32_t restart_requested = 0; //millis() when a restart was requested, or 0 if none was
+
+#define CONSOLE_BUFFER 4096 //Bytes of the console kept in RAM
+#define CONSOLE_BATCH_INTERVAL 200 //Time between sending new console text to the browsers (ms)
+char console_buffer[CONSOLE_BUFFER]; //The last bytes printed to the console, byte n of all that's been printed at n % CONSOLE_BUFFER
+uint32_t console_written = 0; //Bytes printed to the console since startup
+uint32_t console_sent = 0; //Bytes of the console sent to the browsers so far
+uint32_t console_sent_millis = 0; //Time console text was last sent to the browsers
 
 const String settings_path = "/settings.txt"; //Path to settings file
 
+setting_value settings_values[SETTING_COUNT]; //Current value of every setting, indexed by setting_id
+
+//Uploads are written to path + UPLOAD_SUFFIX, and only renamed to path once they're complete and checked
+#define UPLOAD_SUFFIX ".part"
 File upload_file; //Holds file currently uploading
+String upload_path; //Path the upload is renamed to once it's complete, or "" if no upload has started
+uint8_t* upload_buffer = NULL; //Bytes not written to the file yet, so writes fill whole flash blocks
+size_t upload_block = 0; //Size of a flash block, or 0 if there's no buffer and every chunk is written as it comes
+size_t upload_buffered = 0; //Bytes in upload_buffer
+uint32_t upload_position = 0; //Position in the file of the first byte in upload_buffer
+uint32_t upload_crc = 0; //CRC32 of the bytes uploaded so far, before the final XOR
+MD5Builder upload_md5; //MD5 of the bytes uploaded so far
+int upload_error = 0; //HTTP status code of a problem with the upload, or 0 if there's none
+
+String update_password = ""; //Password needed to update the firmware through /update, or "" if none is
+bool update_started = false; //True once a firmware update has taken the tag machine offline
+int update_error = 0; //HTTP status code of a problem with the firmware update, or 0 if there's none
+
+//A file in the pack or under /www, found once by begin() so requests don't have to search LittleFS
+struct www_file{
+    String path; //Path as requested, without /www or .gz
+    String etag; //Entity tag sent with the file, or "" until it's first needed
+    uint32_t size; //Size of the file served
+    uint32_t time; //Time the file was last written, or 0 if it isn't known
+    uint32_t offset; //Position of the file in the pack
+    bool gz; //True if the compressed file is served
+    bool packed; //True if the file is in the pack rather than under /www
+    bool immutable; //True if the path has a hash of the file in it, so it never changes
+};
+
+//Pack of the web interface made by scripts/www_pack.py
+#define PACK_MAGIC 0x50474154 //"TAGP"
+#define PACK_PATH_LENGTH 48
+#define PACK_GZ 1
+#define PACK_IMMUTABLE 2
+
+//An entry in the index of the pack
+struct pack_entry{
+    char path[PACK_PATH_LENGTH];
+    uint32_t offset;
+    uint32_t size;
+    uint32_t hash;
+    uint8_t flags;
+    uint8_t reserved[3];
+};
+
+const char* pack_path = "/www.pack"; //Path to the pack
+File www_pack; //Pack, kept open for serving files from
+
+#define WWW_FILES_MAX 32
+www_file www_files[WWW_FILES_MAX]; //Every file under /www
+uint8_t www_file_count = 0; //Number of files under /www
+bool www_files_full = false; //True if there are more files than fit, so the rest are searched for on each request
+
+char merge_line[320]; //Holds the line of the contacts file currently merging
+size_t merge_line_length = 0; //Length of the line so far
+bool merge_line_overflow = false; //True if the line is too long to be a contact
+uint8_t merge_format = IMPORT_CSV; //Format of the contacts file currently merging
+uint32_t merge_added = 0; //Number of contacts merged so far
+bool merge_success = false; //True if the merge is going well
 
 //settings
 const bool settings_page = true;
-const bool console_page = false;
+const bool console_page = true;
 const String custom_page_path = "/contacts/";
 const String custom_page_name = "Contacts";
 
+uint32_t response_min_heap = UINT32_MAX; //Lowest free heap seen while sending a chunked response
+
+#define CONTACTS_PAGE 50 //Contacts sent by /api/contacts if no limit is given
+#define CONTACTS_PAGE_MAX 200 //Most contacts sent by /api/contacts at once
+#define MESSAGES_PAGE 50 //Messages sent by /api/messages if no limit is given
+#define MESSAGES_PAGE_MAX 200 //Most messages sent by /api/messages at once
+#define EXPORT_PIECE 16 //Contacts or messages printed at a time by a streamed response
+
+/*  (private) Chunked_Print: Collects printed output into a small buffer and sends
+        it to the client as a chunk each time the buffer fills up, so a dynamic page
+        never needs more than the buffer in RAM. Call begin() to start the response
+        with an unknown content length and end() to finish it, or start it yourself
+        and only call flush(). Used by stream_content() without the async server.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+class Chunked_Print : public Print{
+    public:
+        size_t write(uint8_t c){
+            buffer[length++] = c;
+            if(length == sizeof(buffer)) flush();
+            return 1;
+        }
+
+        size_t write(const uint8_t* data, size_t size){
+            for(size_t i = 0; i < size; i++) write(data[i]);
+            return size;
+        }
+
+        void begin(int code, const char* content_type){
+            server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+            server.send(code, content_type, "");
+        }
+
+        void flush(){
+            //Keep track of the worst case for /metrics
+            uint32_t heap = ESP.getFreeHeap();
+            if(heap < response_min_heap) response_min_heap = heap;
+
+            if(length) server.sendContent(buffer, length);
+            length = 0;
+        }
+
+        void end(){
+            flush();
+            server.sendContent("");
+        }
+
+    private:
+        char buffer[256];
+        size_t length = 0;
+};
+
+typedef std::function<bool(Print& output)> content_function;
+
+/*  (private) stream_content: Send a dynamic page that's printed a piece at a time. With the
+        async server, each piece is printed once the browser has read the one before, so a
+        long page never holds up loop() waiting for a slow browser.
+        code: HTTP status code
+        content_type: HTTP content type
+        content: Prints the next piece, and returns true until it has printed the last one.
+            It's called after the handler has returned, so it keeps its own copy of anything
+            it needs from the request.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void stream_content(int code, const char* content_type, content_function content){
+#ifdef WEB_INTERFACE_ASYNC
+    server.streamContent(code, content_type, [content](Print& output){
+        //Keep track of the worst case for /metrics
+        uint32_t heap = ESP.getFreeHeap();
+        if(heap < response_min_heap) response_min_heap = heap;
+
+        return content(output);
+    });
+#else
+    Chunked_Print output;
+    output.begin(code, content_type);
+    while(content(output));
+    output.end();
+#endif
+}
+
 /*  (private) get_content_type: Returns the HTTP content type based on the extension
         filename: 
     RETURNS HTTP content type as a string
@@ -86,14 +303,157 @@ String get_content_type(String filename){
     return "text/plain"; //If none of the above, assume file is plain text
 }
 
-/*  (private)handle_file_read: Read a file from LittleFS and serve it when requested.
+/*  (private)add_www_files: Add every file in a folder under /www, and its subfolders, to www_files
+        folder: Folder path starting with /www and ending in /
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void add_www_files(String folder){
+    Dir dir = LittleFS.openDir(folder);
+    while(dir.next()){
+        if(dir.isDirectory()){
+            add_www_files(folder + dir.fileName() + "/");
+            continue;
+        }
+
+        //Files are requested without /www, and without .gz if they're compressed
+        String path = folder.substring(4) + dir.fileName();
+        bool gz = path.endsWith(".gz");
+        if(gz) path = path.substring(0, path.length() - 3);
+
+        //A file here replaces the one in the pack with the same path. If both the compressed and uncompressed
+        //file exist, the compressed one is served.
+        uint8_t i = 0;
+        while(i < www_file_count && www_files[i].path != path) i++;
+        if(i < www_file_count && !www_files[i].packed && !gz) continue;
+        if(i == WWW_FILES_MAX){
+            www_files_full = true;
+            continue;
+        }
+        if(i == www_file_count) www_file_count++;
+
+        www_files[i].path = path;
+        www_files[i].etag = "";
+        www_files[i].size = dir.fileSize();
+        www_files[i].time = dir.fileTime();
+        www_files[i].offset = 0;
+        www_files[i].gz = gz;
+        www_files[i].packed = false;
+        www_files[i].immutable = false;
+    }
+}
+
+/*  (private)add_pack_files: Open the pack of the web interface and add the files in its index to www_files
+    RETURNS true if there is a pack, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool add_pack_files(){
+    if(www_pack) www_pack.close();
+    www_pack = LittleFS.open(pack_path, "r");
+    if(!www_pack) return false;
+
+    //Check the header
+    uint32_t header[2];
+    if(www_pack.read((uint8_t*)header, sizeof(header)) != sizeof(header) || header[0] != PACK_MAGIC){
+        www_pack.close();
+        return false;
+    }
+
+    //Read the index one entry at a time
+    uint16_t count = header[1] & 0xFFFF;
+    for(uint16_t n = 0; n < count; n++){
+        pack_entry entry;
+        if(www_pack.read((uint8_t*)&entry, sizeof(entry)) != sizeof(entry)) break;
+        if(www_file_count == WWW_FILES_MAX){
+            www_files_full = true;
+            break;
+        }
+        entry.path[PACK_PATH_LENGTH - 1] = '\0';
+
+        //The hash of the file never changes while it's in the pack, so the entity tag can be made now
+        char etag[20];
+        snprintf(etag, sizeof(etag), "\"%lx-%lx\"", (unsigned long)entry.size, (unsigned long)entry.hash);
+
+        www_file& file = www_files[www_file_count++];
+        file.path = entry.path;
+        file.etag = etag;
+        file.size = entry.size;
+        file.time = 0;
+        file.offset = entry.offset;
+        file.gz = entry.flags & PACK_GZ;
+        file.packed = true;
+        file.immutable = entry.flags & PACK_IMMUTABLE;
+    }
+
+    return true;
+}
+
+/*  (private)load_www_files: Find every file in the pack and under /www
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void load_www_files(){
+    www_file_count = 0;
+    www_files_full = false;
+    add_pack_files();
+    add_www_files("/www/");
+}
+
+/*  (private)stream_packed_file: Send a file from the pack to the browser
+        file: File from www_files that's in the pack
+        content_type: HTTP content type
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void stream_packed_file(const www_file& file, const String& content_type){
+    if(file.gz) server.sendHeader("Content-Encoding", "gzip");
+#ifdef WEB_INTERFACE_ASYNC
+    //The server sends it from the pack a piece at a time as the browser reads it
+    server.streamFile(www_pack, content_type, file.offset, file.size);
+#else
+    server.setContentLength(file.size);
+    server.send(200, content_type, "");
+
+    //Send the file straight from the pack, a buffer at a time
+    www_pack.seek(file.offset);
+    uint8_t buffer[512];
+    uint32_t left = file.size;
+    while(left){
+        size_t length = www_pack.read(buffer, left < sizeof(buffer) ? left : sizeof(buffer));
+        if(!length) break;
+        server.sendContent((const char*)buffer, length);
+        left -= length;
+    }
+#endif
+}
+
+/*  (private)get_etag: Get the entity tag of a file under /www, which changes whenever the file does.
+        It's made from the size and the time the file was written, or from a hash of the file if
+        LittleFS doesn't know the time, in which case the file is read once the first time.
+        file: File from www_files
+    RETURNS Entity tag, in quotes
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+const String& get_etag(www_file& file){
+    if(file.etag != "") return file.etag;
+
+    uint32_t tag = file.time;
+    if(!tag){
+        //FNV-1a hash of the file
+        tag = 2166136261UL;
+        File content = LittleFS.open("/www" + file.path + (file.gz ? ".gz" : ""), "r");
+        uint8_t buffer[128];
+        size_t length;
+        while((length = content.read(buffer, sizeof(buffer))) > 0){
+            for(size_t i = 0; i < length; i++) tag = (tag ^ buffer[i]) * 16777619UL;
+        }
+        content.close();
+    }
+
+    char etag[20];
+    snprintf(etag, sizeof(etag), "\"%lx-%lx\"", (unsigned long)file.size, (unsigned long)tag);
+    file.etag = etag;
+    return file.etag;
+}
+
+/*  (private)handle_file_read: Read a file from LittleFS and serve it when requested. Files under
+        /www are looked up in www_files, and aren't sent again if the browser already has them.
         path: The requested URI
     RETURNS true if the file exists, false if it does not exist
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 bool handle_file_read(String path){  
-    //Append /www to the beginning of the path
-    path = "/www" + path;
-
     //If only a folder is specified, attempt to return index.html
     if(path.endsWith("/")) path += "index.html"; 
 
@@ -105,27 +465,62 @@ bool handle_file_read(String path){
         cache = true;
     } 
 
-    //If the compressed file exists, stream it to the client
-    if(LittleFS.exists(path + ".gz")){
-        File file = LittleFS.open(path + ".gz", "r"); 
-        if(cache) server.sendHeader("Cache-Control", "max-age=2592000");          
-        server.streamFile(file, content_type);
-        file.close();                                    
+    //Find the file under /www
+    uint8_t i = 0;
+    while(i < www_file_count && www_files[i].path != path) i++;
+
+    if(i < www_file_count){
+        www_file& file = www_files[i];
+        const String& etag = get_etag(file);
+
+        //Files with a hash in their path can be kept forever. Other files may change, so the browser has to check them each time.
+        if(file.immutable){
+            server.sendHeader("Cache-Control", "max-age=31536000, immutable");
+        }else{
+            server.sendHeader("Cache-Control", cache ? "max-age=2592000" : "no-cache");
+        }
+        server.sendHeader("ETag", etag);
+
+        //If the browser already has this version of the file, don't send it again
+        if(server.header("If-None-Match") == etag){
+            server.send(304);
+            return true;
+        }
+
+        if(file.packed){
+            stream_packed_file(file, content_type);
+            return true;
+        }
+
+        File content = LittleFS.open("/www" + path + (file.gz ? ".gz" : ""), "r");
+        server.streamFile(content, content_type);
+        content.close();
         return true;
     }
 
-    //If the file exists, stream it to the client
-    if(LittleFS.exists(path)){
-        File file = LittleFS.open(path, "r");
-        if(cache) server.sendHeader("Cache-Control", "max-age=2592000"); 
-        server.streamFile(file, content_type);
-        file.close();                                    
-        return true;
+    //If there were too many files to remember, look for the rest each time
+    if(www_files_full){
+        if(LittleFS.exists("/www" + path + ".gz")){
+            File file = LittleFS.open("/www" + path + ".gz", "r"); 
+            if(cache) server.sendHeader("Cache-Control", "max-age=2592000");          
+            server.streamFile(file, content_type);
+            file.close();                                    
+            return true;
+        }
+
+        if(LittleFS.exists("/www" + path)){
+            File file = LittleFS.open("/www" + path, "r");
+            if(cache) server.sendHeader("Cache-Control", "max-age=2592000"); 
+            server.streamFile(file, content_type);
+            file.close();                                    
+            return true;
+        }
     }
 
-    //If the file exists in the root folder instead of the /www/ folder, stream it to the client (this is for debugging non-server files)
-    if(LittleFS.exists(path.substring(4))){
-        File file = LittleFS.open(path.substring(4), "r");                
+    //If the file exists in the root folder instead of the /www/ folder, stream it to the client (this is for debugging non-server files).
+    //The settings file, and any upload of it, hold the passwords, so it's only sent through handle_settings_export.
+    if(!path.startsWith(settings_path) && LittleFS.exists(path)){
+        File file = LittleFS.open(path, "r");                
         server.streamFile(file, content_type);
         file.close();                                    
         return true;
@@ -134,327 +529,506 @@ bool handle_file_read(String path){
     return false;                                         
 }
 
+/*  (private)console_send: Send part of the console to a browser, or to every browser
+        num: client number, or -1 for every browser
+        from: Position of the first byte to send, counted from startup. Bytes that are no longer in the buffer are skipped.
+        to: Position after the last byte to send
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void console_send(int16_t num, uint32_t from, uint32_t to){
+    if(to - from > CONSOLE_BUFFER) from = to - CONSOLE_BUFFER;
+    //Text messages must be whole UTF-8, so skip the rest of a character the buffer has cut in half
+    while(from < to && (console_buffer[from % CONSOLE_BUFFER] & 0xC0) == 0x80) from++;
+    if(from == to) return;
+
+    //The buffer wraps around, so copy the text out of it in order
+    size_t length = to - from;
+    uint8_t* text = (uint8_t*)malloc(length);
+    if(!text) return;
+    size_t start = from % CONSOLE_BUFFER;
+    size_t first = length < CONSOLE_BUFFER - start ? length : CONSOLE_BUFFER - start;
+    memcpy(text, console_buffer + start, first);
+    memcpy(text + first, console_buffer, length - first);
+
+    if(num < 0){
+        websockets_server.broadcastTXT(text, length);
+    }else{
+        websockets_server.sendTXT(num, text, length);
+    }
+    free(text);
+}
+
 /*  (private)websockets_event: Called when a new websockets event happens
         num: client number
         type: event type
         payload: message payload
         length: message length
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-/* void websockets_event(uint8_t num, WStype_t type, uint8_t * payload, size_t length) { // When a WebSocket message is received
+void websockets_event(uint8_t num, WStype_t type, uint8_t * payload, size_t length) {
+    //When a browser connects, send it what's in the console so far. Anything newer is sent to every browser with the next batch.
+    if(type == WStype_CONNECTED) console_send(num, 0, console_sent);
+}
 
-    //Take different action based on the type of event
-    switch (type) {
-        //When the websockets client disconnects...
-        case WStype_DISCONNECTED:  
-            //Erase the client number           
-            websockets_client = -1;
-            break;
+/*  (private)get_setting_def: Copy a setting's definition out of flash
+        index: Setting id
+    RETURNS the setting's definition
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+setting_def get_setting_def(uint8_t index){
+    setting_def def;
+    memcpy_P(&def, &settings_schema[index], sizeof(setting_def));
+    return def;
+}
 
-        //When the websockets client connects...
-        case WStype_CONNECTED:
-            //Store the client number
-            websockets_client = num;
-
-            //If the console file exists...
-            if(LittleFS.exists("/www/console.txt")){
-                //Open the console.txt file in read mode and send it to the client
-                File console = LittleFS.open("/www/console.txt", "r");
-                String console_text = console.readString();
-                websockets_server.sendTXT(num, console_text);
-                //Close the file
-                console.close();
-            }
+/*  (private)find_setting: Find a setting by its id
+        id: Setting id as text
+    RETURNS the setting's index, or SETTING_COUNT if there is no such setting
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint8_t find_setting(const char* id){
+    for(uint8_t i = 0; i < SETTING_COUNT; i++){
+        if(strcmp_P(id, get_setting_def(i).id) == 0) return i;
+    }
+    return SETTING_COUNT;
+}
 
-            break;
+/*  (private)set_setting_value: Store a setting's value as each type it can be read as
+        index: Setting id
+        text: Value as text
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void set_setting_value(uint8_t index, String text){
+    settings_values[index].text = text;
+    settings_values[index].number = text.toInt();
+    settings_values[index].on = text == "true";
+}
 
-        //For all other cases, do nothing
-        default:           
-            break;
+/*  (private)print_json_string: Print a string as a quoted, escaped JSON string
+        output: Response to print to
+        text: Null-terminated string
+        in_flash: True if the string is in flash (PROGMEM)
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void print_json_string(Print& output, const char* text, bool in_flash){
+    output.print('"');
+    while(true){
+        char c = in_flash ? pgm_read_byte(text++) : *text++;
+        if(!c) break;
+        if(c == '"' || c == '\\'){
+            output.print('\\');
+            output.print(c);
+        }else if((uint8_t)c < 0x20){
+            char escaped[7];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            output.print(escaped);
+        }else{
+            output.print(c);
+        }
     }
+    output.print('"');
+}
 
-} */
+/*  (private)handle_settings_api_get: Send every setting's definition and value to the browser as JSON,
+        for the settings page to build its form from. Passwords are never sent, only whether they're set.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void handle_settings_api_get(){
+    //One setting is printed at a time
+    uint8_t next = 0;
+    stream_content(200, "application/json", [next](Print& output) mutable{
+        //Names of the categories and types, as they're written in settings_def.txt
+        static const char* const category_names[SETTING_CATEGORIES] = {"general", "advanced", "wifi"};
+        static const char* const type_names[] = {"text", "num", "pass", "bool", "multi"};
+
+        if(next == 0) output.print("{\"settings\":[");
+        if(next == SETTING_COUNT){
+            output.print("]}");
+            return false;
+        }
 
-/*  (private)text_input_HTML: Create the html for a text form input
-        id: setting id
-        val: current or default setting value
-        type: Setting type, valid inputs are "num", "pass", or "text". Anything else defaults to "text"
-    RETURNS complete HTML
+        setting_def def = get_setting_def(next);
+        if(next) output.print(',');
+
+        output.print("{\"id\":");
+        print_json_string(output, def.id, true);
+        output.printf(",\"cat\":\"%s\",\"type\":\"%s\",\"name\":", category_names[def.category], type_names[def.type]);
+        print_json_string(output, def.name, true);
+        output.print(",\"desc\":");
+        print_json_string(output, def.desc, true);
+        if(def.type == SETTING_MULTI){
+            output.print(",\"opt\":");
+            print_json_string(output, def.opt, true);
+        }
+        output.print(def.req ? ",\"req\":true" : ",\"req\":false");
+        if(def.type == SETTING_PASS){
+            output.print(settings_values[next].text.length() ? ",\"val\":\"\",\"set\":true" : ",\"val\":\"\",\"set\":false");
+        }else{
+            output.print(",\"val\":");
+            print_json_string(output, settings_values[next].text.c_str(), false);
+        }
+        output.print('}');
+
+        next++;
+        return true;
+    });
+}
+
+/*  (private)handle_settings_export: Send the value of every setting but the passwords as a settings file
+        ({"id":"val",...}), which can be uploaded again to import them
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-String text_input_HTML(String id, String val, String type, bool req){
-    //Create the string that will hold the response
-    String response = "<input type=\"";
+void handle_settings_export(){
+    //One setting is printed at a time
+    uint8_t next = 0;
+    bool first = true;
+    stream_content(200, "text/plain", [next, first](Print& output) mutable{
+        if(next == 0) output.print('{');
+        while(next < SETTING_COUNT && get_setting_def(next).type == SETTING_PASS) next++;
+        if(next == SETTING_COUNT){
+            output.print('}');
+            return false;
+        }
 
-    //Specify the type
-    if(type == "num"){
-        response += "number";
-    }else if(type == "pass"){
-        response += "password";
-    }else{
-        response += "text";
+        if(!first) output.print(',');
+        first = false;
+        print_json_string(output, get_setting_def(next).id, true);
+        output.print(':');
+        print_json_string(output, settings_values[next].text.c_str(), false);
+
+        next++;
+        return true;
+    });
+}
+
+/*  (private)write_settings_file: Save the value of every setting to the settings file
+    RETURNS true if successful, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool write_settings_file(){
+    //Set aside enough memory for every id and value
+    size_t capacity = JSON_OBJECT_SIZE(SETTING_COUNT);
+    for(uint8_t i = 0; i < SETTING_COUNT; i++){
+        capacity += strlen_P(get_setting_def(i).id) + settings_values[i].text.length() + 2;
     }
-    
-    //Create the input field
-    response += "\" class=\"form-control\" id=\"" + id + "\" name=\"" + id + "\" aria-describedby=\"" + id +"help\" value=\"" + val + "\"";
-    //If this setting is required, make it a required field 
-    if(req){
-        response += "required";
+    DynamicJsonDocument doc(capacity);
+
+    //Only the values are saved, everything else about the settings is in settings_schema
+    for(uint8_t i = 0; i < SETTING_COUNT; i++){
+        doc[String(FPSTR(get_setting_def(i).id))] = settings_values[i].text;
+    }
+
+    //Open the file for writing
+    File file = LittleFS.open(settings_path, "w");
+    if(!file) return false;
+    //Encode the JSON in the file
+    size_t written = serializeJson(doc, file);
+    //Close the file
+    file.close();
+    flash_stats.record(FLASH_SETTINGS, settings_path.c_str(), 0, written);
+
+    return written > 0;
+}
+
+/*  (private)request_restart: Take the tag machine offline and restart once the browser has had time to
+        get its response
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void request_restart(){
+    restart_requested = millis() | 1;
+}
+
+/*  (private)settings_valid: Check that no required setting is blank
+    RETURNS true if there is no blank parameter that's required, false if there is a blank parameter that's required
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool settings_valid(){
+    for(uint8_t i = 0; i < SETTING_COUNT; i++){
+        if(get_setting_def(i).req && settings_values[i].text == "") return false;
     }
+    return true;
+}
 
-    response += ">";
+/*  (private)settings_changed: Apply the settings that changed while running if the callback can, or restart
+        changed: True for each setting_id that changed
+    RETURNS true if the tag machine will restart, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool settings_changed(const bool* changed){
+    bool any_changed = false;
+    for(uint8_t i = 0; i < SETTING_COUNT; i++){
+        if(changed[i]) any_changed = true;
+    }
+    if(!any_changed) return false;
 
-    return response;
+    //A blank required setting is only dealt with at startup, where the settings page is offered instead
+    if(settings_valid() && _settings_applied && _settings_applied(changed)) return false;
+
+    request_restart();
+    return true;
 }
 
-/*  (private)multi_input_HTML: Create the html for a multiple choice input
-        id: setting id
-        val: current or default setting value
-        type: Setting type, valid inputs are "multi" or "bool"
-        opt: a JsonArray of possible options, only required for "multi" type
-    RETURNS complete HTML
+/*  (private)setting_value_valid: Check that a value can be given to a setting
+        def: Definition of the setting
+        val: Value as text
+    RETURNS true if the value suits the setting's type and isn't blank if it's required
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-String multi_input_html(String id, String val, String type, JsonArray opt){
+bool setting_value_valid(const setting_def& def, const String& val){
+    if(val == "") return !def.req;
 
-    //Create the string that will hold the response
-    String response = "<select class=\"form-control\" id=\"" + id + "\" name=\"" + id + "\" aria-describedby=\"" + id +"help\">";
+    if(def.type == SETTING_BOOL) return val == "true" || val == "false";
 
-    //If this is a multiple-choice setting...
-    if(type == "multi"){
-        
-        //For each option...
-        for(int i = 0; i < opt.size(); i++){
-            
-            //This string holds the option name
-            String this_option = opt[i];
-            response += "<option value=\"" + this_option + "\"";
-            //If the current option is the current value or default, pre-select it on the form 
-            if(this_option == val) response += "selected";
-            response +=">" + this_option + "</option>"; 
-        }
-    //Otherwise, this is a boolean setting...
-    }else{
-        //Create the On option
-        response += "<option value=\"true\"";
-        //If the current value is true, pre-select the Yes option
-        if(val){
-            response += " selected";
+    if(def.type == SETTING_NUM){
+        for(unsigned i = 0; i < val.length(); i++){
+            if(!isdigit(val[i]) && !(i == 0 && val[i] == '-' && val.length() > 1)) return false;
         }
-        response +=">On</option>";
+        return true;
+    }
 
-        //Create the Off option
-        response += "<option value=\"false\"";
-        //If the current value is false, pre-select the No option
-        if(!val){
-            response += " selected";
+    if(def.type == SETTING_MULTI){
+        //The value has to be one of the options
+        String opt = FPSTR(def.opt);
+        int start = 0;
+        while(start <= (int)opt.length()){
+            int end = opt.indexOf(',', start);
+            if(end < 0) end = opt.length();
+            if(opt.substring(start, end) == val) return true;
+            start = end + 1;
         }
-        response +=">Off</option>";
-    
+        return false;
     }
 
-    response += "</select>";
-
-    return response;
+    return true;
 }
 
-/*  (private)multi_input_HTML: Create the html for all inputs in a category
-        settings: JsonArray of settings in this category
-    RETURNS complete HTML
+/*  (private)handle_settings_api_patch: Receive the settings that changed from the browser as JSON
+        ({"id":"val",...}), apply them and tell the browser whether the tag machine is restarting
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-String input_html(JsonArray settings){
-    String response = "";
-    //For each setting...
-    for(int i = 0; i < settings.size(); i++){
-        //Save the setting attributes
-        String id = settings[i]["id"];
-        String type = settings[i]["type"];
-        String name = settings[i]["name"];
-        String desc = "";
-        if(settings[i].containsKey("desc")) desc = settings[i]["desc"].as<String>();
-        String val = "";
-        if(settings[i].containsKey("val")) val = settings[i]["val"].as<String>();
-        bool req = settings[i]["req"];
-
-        //Form the HTML response
-        response += "<div class=\"form-group\">";
-        response += "<label for=\"" + id + "\">" + name + "</label>";
+void handle_settings_api_patch(){
+    const String& body = server.arg("plain");
+    DynamicJsonDocument doc(JSON_OBJECT_SIZE(SETTING_COUNT) + body.length() * 2);
+    if(deserializeJson(doc, body) || !doc.is<JsonObject>()){
+        server.send(400, "text/plain", "400: Not JSON");
+        return;
+    }
 
-        //Based on the type of setting, get the HTML
-        if(type == "multi" || type == "bool"){
-            response += multi_input_html(id, val, type, settings[i]["opt"]);
-        }else{
-            response += text_input_HTML(id, val, type, req);
+    //Check every value before changing any, so a bad one doesn't leave the settings half changed
+    JsonObject values = doc.as<JsonObject>();
+    for(JsonPair pair : values){
+        uint8_t index = find_setting(pair.key().c_str());
+        if(index == SETTING_COUNT){
+            server.send(400, "text/plain", "400: Unknown Setting " + String(pair.key().c_str()));
+            return;
         }
-        
-        //Add help text if the description is defined
-        response +=     "<small id=\"" + id + "help\" class=\"form-text text-muted\">" + desc + "</small>";
-        response += "</div>";
+        if(!setting_value_valid(get_setting_def(index), pair.value().as<String>())){
+            server.send(400, "text/plain", "400: Invalid Value for " + String(pair.key().c_str()));
+            return;
+        }
+    }
 
+    //Copy each value to the setting, and note which ones changed
+    bool changed[SETTING_COUNT] = {false};
+    bool any_changed = false;
+    for(JsonPair pair : values){
+        uint8_t index = find_setting(pair.key().c_str());
+        String val = pair.value().as<String>();
+        if(val == settings_values[index].text) continue;
+        set_setting_value(index, val);
+        changed[index] = true;
+        any_changed = true;
     }
 
-    
+    //The file is only written if something changed
+    if(any_changed) write_settings_file();
 
-    return response;
+    server.send(200, "text/plain", settings_changed(changed) ? "restart" : "applied");
 }
 
-/*  (private)handle_settings_get: Send the settings to the browser as an HTML form
+/*  (private)handle_contacts_export: Stream the contacts to the browser as a JSON or
+        CSV file, depending on the extension requested
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-void handle_settings_get(){
-    //Open the settings file
-    File file = LittleFS.open(settings_path, "r");
-    //Set aside enough memory for a JSON document
-    DynamicJsonDocument doc(file.size() * 2);
+void handle_contacts_export(){
+    //If there is no contacts storage, there is nothing to export
+    if(!_contacts){
+        server.send(404, "text/plain", "404: Not Found");
+        return;
+    }
 
-    //Parse JSON from file
-    DeserializationError error = deserializeJson(doc, file);
+    bool csv = server.uri().endsWith(".csv");
 
-    //Close the file
-    file.close();
+    //A few contacts are printed at a time, carrying on from the last one printed
+    export_position position = {0, 0, false};
+    stream_content(200, csv ? "text/csv" : "application/json", [position, csv](Print& output) mutable{
+        if(csv) return _contacts->export_csv(output, &position, EXPORT_PIECE);
+        return _contacts->export_json(output, &position, EXPORT_PIECE);
+    });
+}
 
-    //If there is an error, send the response to the browser and exit the function
-    if(error){
-        server.send(200, "text/html", "<h3>Invalid settings file or no settings defined!</h3>");
+/*  (private)handle_contacts_api_get: Stream a page of the contacts that match a search to the browser as JSON.
+        Arguments: offset (default 0), limit (default CONTACTS_PAGE, at most CONTACTS_PAGE_MAX) and q (a prefix
+        of the number or name, default all)
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void handle_contacts_api_get(){
+    if(!_contacts){
+        server.send(404, "text/plain", "404: Not Found");
         return;
-    } 
+    }
 
-    //Store whether the settings category exists or not
-    bool advanced = doc.containsKey("advanced");
-
-    //This will hold the HTML response to the browser
-    String response;
-    //Create the tabs
-    response = "<ul class=\"nav nav-tabs\" id=\"settings_nav\" role=\"tablist\">";
-    //Tab for general settings
-    response +=     "<li class=\"nav-item\">";
-    response +=         "<a class=\"nav-link active\" id=\"category-general-tab\" data-toggle=\"tab\" href=\"#category-general\" role\"tab\" aria-controls=\"category-general\" aria-selected=\"true;\">General</a>";
-    response +=     "</li>";
-    //Tab for advanced settings
-    if(advanced){
-        response += "<li class=\"nav-item\">";
-        response +=     "<a class=\"nav-link\" id=\"category-advanced-tab\" data-toggle=\"tab\" href=\"#category-advanced\" role\"tab\" aria-controls=\"category-advanced\" aria-selected=\"false;\">Advanced</a>";
-        response += "</li>";
-    }
-    //Tab for WiFi settings
-    response +=     "<li class=\"nav-item\">";
-    response +=         "<a class=\"nav-link\" id=\"category-wifi-tab\" data-toggle=\"tab\" href=\"#category-wifi\" role\"tab\" aria-controls=\"category-wifi\" aria-selected=\"false;\">Wi-Fi</a>";
-    response +=     "</li>";
-    //End the tabs
-    response += "</ul>";
-    response += "<br>";
-
-    //Tab contents for general settings
-    response += "<div class=\"tab-content\" id=\"settings_nav_content\">";
-    response +=     "<div class=\"tab-pane fade show active\" id=\"category-general\" role=\"tabpanel\" aria-labelledby=\"category-general-tab\">";
-    response +=         input_html(doc["general"]);
-    response +=     "</div>";
-
-    //Tab contents for advanced settings
-    if(advanced){
-        response += "<div class=\"tab-pane fade\" id=\"category-advanced\" role=\"tabpanel\" aria-labelledby=\"category-advanced-tab\">";
-        response +=     input_html(doc["advanced"]);
-        response += "</div>";
-    }
-    //Tab contents for wifi settings
-    response +=     "<div class=\"tab-pane fade\" id=\"category-wifi\" role=\"tabpanel\" aria-labelledby=\"category-wifi-tab\">";
-    response +=         input_html(doc["wifi"]);
-    response +=     "</div>";
-
-    //End the settings form
-    response += "</div>";
-
-    //Send the response to the browser
-    server.send(200, "text/html", response);
-}
-
-/*  (private)handle_settings_post: Receive new settings from the browser
-~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-void handle_settings_post(){
-    //Confirm that the settings have been received
-    server.send(200);
-
-    //Open the file for reading
-    File file = LittleFS.open(settings_path, "r");
-    //Set aside enough memory for a JSON document
-    DynamicJsonDocument doc(file.size() * 2);
-
-    //Parse JSON from file 
-    deserializeJson(doc, file);
-    //Close the file
-    file.close();
+    long offset = server.arg("offset").toInt();
+    long limit = server.hasArg("limit") ? server.arg("limit").toInt() : CONTACTS_PAGE;
+    if(offset < 0) offset = 0;
+    if(limit < 0) limit = 0;
+    if(limit > CONTACTS_PAGE_MAX) limit = CONTACTS_PAGE_MAX;
+
+    //A few contacts are read at a time, carrying on from the last one read
+    export_position position = {0, 0, false};
+    String prefix = server.arg("q");
+    stream_content(200, "application/json", [position, offset, limit, prefix](Print& output) mutable{
+        return _contacts->export_page(output, &position, EXPORT_PIECE, offset, limit, prefix.c_str());
+    });
+}
 
-    //Store whether the settings category exists or not
-    bool advanced = doc.containsKey("advanced");
+/*  (private)handle_messages_api_get: Stream the messages that match a query to the browser as JSON.
+        Arguments: since (UNIX time, default 0), after (message ID, default 0) and limit (default
+        MESSAGES_PAGE, at most MESSAGES_PAGE_MAX)
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void handle_messages_api_get(){
+    if(!_messages){
+        server.send(404, "text/plain", "404: Not Found");
+        return;
+    }
 
-    //The current server argument being processed
-    uint8_t current_server_arg = 0;
+    long since = server.arg("since").toInt();
+    long after = server.arg("after").toInt();
+    long limit = server.hasArg("limit") ? server.arg("limit").toInt() : MESSAGES_PAGE;
+    if(since < 0) since = 0;
+    if(after < 0) after = 0;
+    if(limit < 0) limit = 0;
+    if(limit > MESSAGES_PAGE_MAX) limit = MESSAGES_PAGE_MAX;
+
+    //A few messages are printed at a time, carrying on from the last one printed
+    journal_position position = {(uint32_t)after, 0, false, false};
+    stream_content(200, "application/json", [position, since, limit](Print& output) mutable{
+        return _messages->export_range(output, &position, since, limit, EXPORT_PIECE);
+    });
+}
 
-    //This array holds the settings for the current category
-    JsonArray settings;
+/*  (private)handle_contacts_api_put: Add a contact or change its name. Arguments: number and name
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void handle_contacts_api_put(){
+    if(!_contacts){
+        server.send(404, "text/plain", "404: Not Found");
+        return;
+    }
 
-    //Cycle through each setting category
-    for(int i = 0; i < doc.size(); i++){
-        //Load the correct category depending on the current loop
-        if(i == 0){
-            settings = doc["general"];
-        }else if(advanced && i == 1){
-            settings = doc["advanced"];
-        }else{
-            settings = doc["wifi"];
-        }
+    String number = server.arg("number");
+    String name = server.arg("name");
+    name.trim();
+    if(name == ""){
+        server.send(400, "text/plain", "400: Name Required");
+        return;
+    }
+    //Only the one contact is written, and set() refuses anything that isn't a phone number
+    if(!_contacts->set(number, name)){
+        server.send(400, "text/plain", "400: Invalid Number");
+        return;
+    }
+    server.send(200, "text/plain", "OK");
+}
 
-        //For each setting...
-        for(int x = 0; x < settings.size(); x++){
-            //Copy the server argument to the current value and increment the server argument
-            settings[x]["val"] = server.arg(current_server_arg);
-            current_server_arg++;
-        }
+/*  (private)handle_contacts_api_delete: Delete a contact. Arguments: number
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void handle_contacts_api_delete(){
+    if(!_contacts){
+        server.send(404, "text/plain", "404: Not Found");
+        return;
+    }
 
+    String number = server.arg("number");
+    uint8_t kind;
+    _contacts->get(number.c_str(), &kind);
+    if(kind == CONTACT_NONE){
+        server.send(404, "text/plain", "404: Not Found");
+        return;
+    }
+    if(!_contacts->remove(number)){
+        server.send(500, "text/plain", "500: Not Deleted");
+        return;
     }
+    server.send(200, "text/plain", "OK");
+}
 
+/*  (private)handle_metrics: Send the counters in Prometheus text format
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void handle_metrics(){
+    //Each group of counters is printed as a piece
+    uint8_t next = 0;
+    stream_content(200, "text/plain; version=0.0.4", [next](Print& output) mutable{
+        if(next == 0){
+            device_stats.print_metrics(output);
+        }else if(next == 1){
+            flash_stats.print_metrics(output);
+        }
+        if(next++ < 2) return true;
 
-    //Open the file for writing
-    file = LittleFS.open(settings_path, "w");
-    //Encode the JSON in the file
-    serializeJson(doc, file);
-    //Close the file
-    file.close();
+        //Add the lowest free heap seen while sending a page, once one has been sent
+        if(response_min_heap != UINT32_MAX){
+            output.print("# TYPE web_response_min_free_heap_bytes gauge\n");
+            output.printf("web_response_min_free_heap_bytes %lu\n", (unsigned long)response_min_heap);
+        }
 
-    //Take the tag machine offline and restart
-    _offline();
-    ESP.restart();
+        //Add the cost of contact writes, if there is a contacts storage
+        if(_contacts){
+            storage_stats stats = _contacts->get_stats();
+            output.print("# TYPE contacts_writes_total counter\n");
+            output.printf("contacts_writes_total %lu\n", (unsigned long)stats.writes);
+            output.print("# TYPE contacts_logical_bytes_total counter\n");
+            output.printf("contacts_logical_bytes_total %lu\n", (unsigned long)stats.logical_bytes);
+            output.print("# TYPE contacts_flash_bytes_total counter\n");
+            output.printf("contacts_flash_bytes_total %lu\n", (unsigned long)stats.flash_bytes);
+            output.print("# TYPE contacts_compactions_total counter\n");
+            output.printf("contacts_compactions_total %lu\n", (unsigned long)stats.compactions);
+            output.print("# TYPE contacts_coalesced_writes_total counter\n");
+            output.printf("contacts_coalesced_writes_total %lu\n", (unsigned long)stats.coalesced);
+            output.print("# TYPE contacts_max_write_micros gauge\n");
+            output.printf("contacts_max_write_micros %lu\n", (unsigned long)stats.max_write_micros);
+            output.print("# TYPE contacts_max_flush_micros gauge\n");
+            output.printf("contacts_max_flush_micros %lu\n", (unsigned long)stats.max_flush_micros);
+            output.print("# TYPE contacts_heap_bytes gauge\n");
+            output.printf("contacts_heap_bytes %lu\n", (unsigned long)stats.heap_bytes);
+            output.print("# TYPE contacts_max_heap_bytes gauge\n");
+            output.printf("contacts_max_heap_bytes %lu\n", (unsigned long)stats.max_heap_bytes);
+        }
+        return false;
+    });
 }
 
 /*  (private)handle_nav: Send the navigation bar to the browser as a dynamically-generated navbar
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void handle_nav(){
-    String response;
-    response = "<nav class=\"navbar navbar-expand-md navbar-dark bg-dark mb-4\">";
-    response +=     "<a class=\"navbar-brand\" href=\"/index.html\">TAG Machine</a>";
-    response +=     "<button class=\"navbar-toggler\" type=\"button\" data-toggle=\"collapse\" data-target=\"#navbarCollapse\" aria-controls=\"navbarCollapse\" aria-expanded=\"false\" aria-label=\"Toggle navigation\">";
-    response +=         "<span class=\"navbar-toggler-icon\"></span>";
-    response +=     "</button>";
-    response +=     "<div class=\"collapse navbar-collapse\" id=\"navbarCollapse\">";
-    response +=         "<ul class=\"navbar-nav\">";
-
-    response +=         "<li class=\"nav-item\">";
-    response +=             "<a class=\"nav-link\" href=\"" + custom_page_path + "\">" + custom_page_name + "</a>";
-    response +=         "</li>";
-
-    if(settings_page){
-        response +=         "<li class=\"nav-item\">";
-        response +=             "<a class=\"nav-link\" href=\"/settings/\">Settings</a>";
-        response +=         "</li>";
-    }
-    if(console_page){
-        response +=         "<li class=\"nav-item\">";
-        response +=             "<a class=\"nav-link\" href=\"/console/\">Console</a>";
-        response +=         "</li>";
-    }
-
-    response +=         "</ul>";
-    response +=     "</div>";
-    response += "</nav>";
-
+    //The whole bar is printed as one piece
     server.sendHeader("Cache-Control", "max-age=2592000");    
-    server.send(200, "text/html", response);
+    stream_content(200, "text/html", [](Print& output){
+        output.print("<nav class=\"navbar navbar-expand-md navbar-dark bg-dark mb-4\">");
+        output.print(    "<a class=\"navbar-brand\" href=\"/index.html\">TAG Machine</a>");
+        output.print(    "<button class=\"navbar-toggler\" type=\"button\" data-toggle=\"collapse\" data-target=\"#navbarCollapse\" aria-controls=\"navbarCollapse\" aria-expanded=\"false\" aria-label=\"Toggle navigation\">");
+        output.print(        "<span class=\"navbar-toggler-icon\"></span>");
+        output.print(    "</button>");
+        output.print(    "<div class=\"collapse navbar-collapse\" id=\"navbarCollapse\">");
+        output.print(        "<ul class=\"navbar-nav\">");
+
+        output.print(        "<li class=\"nav-item\">");
+        output.print(            "<a class=\"nav-link\" href=\"");
+        output.print(custom_page_path);
+        output.print("\">");
+        output.print(custom_page_name);
+        output.print("</a>");
+        output.print(        "</li>");
+
+        if(settings_page){
+            output.print(        "<li class=\"nav-item\">");
+            output.print(            "<a class=\"nav-link\" href=\"/settings/\">Settings</a>");
+            output.print(        "</li>");
+        }
+        if(console_page){
+            output.print(        "<li class=\"nav-item\">");
+            output.print(            "<a class=\"nav-link\" href=\"/console/\">Console</a>");
+            output.print(        "</li>");
+        }
+
+        output.print(        "</ul>");
+        output.print(    "</div>");
+        output.print("</nav>");
+        return false;
+    });
 }
 
 /*  Web_Interface Constructor (with defaults)
@@ -470,103 +1044,470 @@ void Web_Interface::set_callback(void_function_pointer offline){
     _offline = offline;
 }
 
-/*  (private)check_settings_file: Check the settings file to ensure all the required parameters are present
+/*  set_upload_callback: Set the callback function called after a file has been uploaded
+        uploaded: upload function, receives the uploaded filename
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Web_Interface::set_upload_callback(upload_function_pointer uploaded){
+    _uploaded = uploaded;
+}
+
+/*  set_contacts: Attach the contacts storage so it can be exported
+        contacts: Contacts storage object
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Web_Interface::set_contacts(Persistent_Storage* contacts){
+    _contacts = contacts;
+}
+
+/*  set_messages: Attach the message journal so it can be queried
+        messages: Message journal object
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Web_Interface::set_messages(Message_Journal* messages){
+    _messages = messages;
+}
+
+/*  set_update_password: Set the password needed to update the firmware through /update
+        password: Password, or "" to not need one
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Web_Interface::set_update_password(String password){
+    update_password = password;
+}
+
+/*  set_settings_callback: Set the callback function to apply changed settings without restarting
+        applied: settings function, receives true for each setting_id that changed and returns false if
+            the tag machine has to restart to apply them
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void Web_Interface::set_settings_callback(settings_function_pointer applied){
+    _settings_applied = applied;
+}
+
+/*  (private)check_settings_file: Read the values in the settings file into settings_values and check
+        that all the required parameters are present. Settings files from older firmware, which hold
+        the whole definition of each setting, are read too.
+        keep_passwords: If true, passwords the file leaves out keep their values instead of their defaults
     RETURNS true if there is no blank parameter that's required, false if there is a blank parameter that's required
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-bool check_settings_file(){
+bool check_settings_file(bool keep_passwords){
 
-    // If the settings file does not exist, copy it from the default settings file
-    if(!LittleFS.exists(settings_path)){
-        File settings_def = LittleFS.open("/settings_def.txt", "r");
-        File settings = LittleFS.open(settings_path, "w");
-        while(settings_def.available()){
-            settings.write(settings_def.read());
-        }
-        settings_def.close();
-        settings.close();
+    //Start every setting at its default value
+    for(uint8_t i = 0; i < SETTING_COUNT; i++){
+        if(keep_passwords && get_setting_def(i).type == SETTING_PASS) continue;
+        set_setting_value(i, FPSTR(get_setting_def(i).val));
     }
 
-    //Open the file
-    File file = LittleFS.open(settings_path, "r");
-    //Set aside enough memory for a JSON document
-    DynamicJsonDocument doc(file.size() * 2);
+    //If the settings file does not exist, create it from the defaults
+    if(!LittleFS.exists(settings_path)){
+        write_settings_file();
+    }else{
+        //Open the file
+        File file = LittleFS.open(settings_path, "r");
+        //Set aside enough memory for a JSON document
+        DynamicJsonDocument doc(file.size() * 2);
 
-    //Parse JSON from file
-    DeserializationError error = deserializeJson(doc, file);
+        //Parse JSON from file
+        DeserializationError error = deserializeJson(doc, file);
 
-    //Close the file
-    file.close();
+        //Close the file
+        file.close();
 
-    //If there is an error, return false
-    if(error){
-        return false;
-    } 
-    
-    //Store whether the settings category exists or not
-    bool advanced = doc.containsKey("advanced");
-
-    //This array holds the settings for the current category
-    JsonArray settings;
-    //Cycle through each setting category
-    for(int i = 0; i < doc.size(); i++){
-        //Load the correct category based on the current loop
-        if(i == 0){
-            settings = doc["general"];
-        }else if(advanced && i == 1){
-            settings = doc["advanced"];
-        }else{
-            settings = doc["wifi"];
-        }
-
-        //For each setting...
-        for(int i = 0; i < settings.size(); i++){
-            //If this setting is required...
-            if(settings[i]["req"] == true){
-                //If this setting has a value...
-                if(settings[i].containsKey("val")){
-                    //If this setting has a blank value, return false
-                    if(settings[i]["val"] == "") return false;
-                //If this setting doesn't have a value, return false
-                }else{
-                    return false;
+        //If there is an error, return false
+        if(error){
+            return false;
+        } 
+
+        //For each key in the file...
+        for(JsonPair pair : doc.as<JsonObject>()){
+            //Older files hold an array of setting definitions for each category
+            if(pair.value().is<JsonArray>()){
+                for(JsonObject setting : pair.value().as<JsonArray>()){
+                    uint8_t index = find_setting(setting["id"] | "");
+                    if(index < SETTING_COUNT && setting.containsKey("val")){
+                        set_setting_value(index, setting["val"].as<String>());
+                    }
                 }
+            //Otherwise the key is a setting id, and the value its value
+            }else{
+                uint8_t index = find_setting(pair.key().c_str());
+                if(index < SETTING_COUNT) set_setting_value(index, pair.value().as<String>());
             }
         }
     }
 
-    return true;
+    //If a required setting is blank, return false
+    return settings_valid();
+}
+
+/*  (private)crc32_update: Add bytes to a CRC32 (the one used by zip and PNG)
+        crc: CRC32 so far, starting at 0xFFFFFFFF
+        data: Bytes to add
+        length: Number of bytes
+    RETURNS CRC32 so far. XOR it with 0xFFFFFFFF once all the bytes have been added.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t length){
+    while(length--){
+        crc ^= *data++;
+        for(uint8_t bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return crc;
+}
+
+/*  (private)upload_target: Get the path an uploaded file is saved to
+        filename: Name of the file, as sent by the browser
+    RETURNS Path, starting with /
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+String upload_target(String filename){
+    //Add a / prefix if it's not part of the filename already
+    if(!filename.startsWith("/")) filename = "/" + filename;
+    return filename;
+}
+
+/*  (private)upload_flush: Write the buffered bytes of the upload to the file
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void upload_flush(){
+    if(!upload_buffered) return;
+    size_t written = upload_file.write(upload_buffer, upload_buffered);
+    flash_stats.record(FLASH_UPLOAD, upload_path.c_str(), upload_position, written);
+    //If the flash is full, the rest of the upload is ignored
+    if(written != upload_buffered) upload_error = 507;
+    upload_position += written;
+    upload_buffered = 0;
+}
+
+/*  (private)upload_write: Add bytes to the upload, writing them to the file a flash block at a time
+        data: Bytes to add
+        length: Number of bytes
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void upload_write(const uint8_t* data, size_t length){
+    upload_crc = crc32_update(upload_crc, data, length);
+    upload_md5.add(data, length);
+
+    //Without a buffer, write the chunk as it is
+    if(!upload_block){
+        size_t written = upload_file.write(data, length);
+        flash_stats.record(FLASH_UPLOAD, upload_path.c_str(), upload_position, written);
+        if(written != length) upload_error = 507;
+        upload_position += written;
+        return;
+    }
+
+    while(length){
+        //Fill the buffer up to the end of the block. After a resume, the first write finishes the block it started in.
+        size_t take = upload_block - (upload_position + upload_buffered) % upload_block;
+        if(take > length) take = length;
+        memcpy(upload_buffer + upload_buffered, data, take);
+        upload_buffered += take;
+        data += take;
+        length -= take;
+        if((upload_position + upload_buffered) % upload_block == 0) upload_flush();
+    }
+}
+
+/*  (private)upload_end: Write what's left of the upload, close the file and free the buffer
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void upload_end(){
+    if(upload_file){
+        upload_flush();
+        upload_file.close();
+    }
+    free(upload_buffer);
+    upload_buffer = NULL;
+    upload_block = 0;
+}
+
+/*  (private)upload_begin: Open the file an upload is written to, reading back what's already there if
+        it carries on from an earlier upload that was interrupted
+        filename: Name of the file, as sent by the browser
+        offset: Bytes of the file that were uploaded before, 0 to start from the beginning
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void upload_begin(String filename, uint32_t offset){
+    upload_end();
+    upload_path = upload_target(filename);
+    upload_error = 0;
+    upload_buffered = 0;
+    upload_position = 0;
+    upload_crc = 0xFFFFFFFF;
+    upload_md5.begin();
+
+    //Buffer a flash block at a time, or write each chunk as it comes if there isn't enough memory for that
+    FSInfo info;
+    upload_block = LittleFS.info(info) && info.blockSize ? info.blockSize : 4096;
+    upload_buffer = (uint8_t*)malloc(upload_block);
+    if(!upload_buffer) upload_block = 0;
+
+    String part_path = upload_path + UPLOAD_SUFFIX;
+    if(offset == 0){
+        upload_file = LittleFS.open(part_path, "w");
+    }else{
+        //Carry on from the end of what's there, which can't be less than the offset
+        upload_file = LittleFS.open(part_path, "r+");
+        if(!upload_file || upload_file.size() < offset){
+            if(upload_file) upload_file.close();
+            upload_error = 416;
+            return;
+        }
+
+        //The checksums cover the whole file, so add the part that's already there
+        uint8_t chunk[256];
+        uint8_t* read_buffer = upload_buffer ? upload_buffer : chunk;
+        size_t read_size = upload_buffer ? upload_block : sizeof(chunk);
+        while(upload_position < offset){
+            size_t length = offset - upload_position < read_size ? offset - upload_position : read_size;
+            length = upload_file.read(read_buffer, length);
+            if(!length) break;
+            upload_crc = crc32_update(upload_crc, read_buffer, length);
+            upload_md5.add(read_buffer, length);
+            upload_position += length;
+        }
+        if(upload_position != offset || !upload_file.truncate(offset) || !upload_file.seek(offset)){
+            upload_file.close();
+            upload_error = 500;
+            return;
+        }
+    }
+    if(!upload_file) upload_error = 500;
 }
 
-/*  (private)handle_file_upload: Processes file upload and saves it to LittleFS
+/*  (private)handle_file_upload: Processes a file upload, writing it to a temporary file in LittleFS.
+        handle_file_upload_done() puts it in place once it's complete and checked.
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void handle_file_upload(){
     //Holds current upload
     HTTPUpload& upload = server.upload();
-    //If the upload is starting...
+    //If the upload is starting, open the temporary file at the offset it carries on from
     if(upload.status == UPLOAD_FILE_START){
-        //Get the filename
-        String filename = upload.filename;
-        //Add a / prefix if it's not part of the filename already
-        if(!filename.startsWith("/")) filename = "/" + filename;
-        //Open the file for writing
-        upload_file = LittleFS.open(filename, "w");   
-    //If the upload is in progress, write the buffer to the file        
-    }else if(upload.status == UPLOAD_FILE_WRITE && upload_file){
-        upload_file.write(upload.buf, upload.currentSize);
-    
-    //If the upload is over, send server status 201 and close the file
-    }else if(upload.status == UPLOAD_FILE_END){
+        upload_begin(upload.filename, server.arg("offset").toInt());
+    //If the upload is in progress, add the buffer to the file
+    }else if(upload.status == UPLOAD_FILE_WRITE && upload_file && !upload_error){
+        upload_write(upload.buf, upload.currentSize);
+    //If the upload is over, or ended early, write what's left. An upload that ended early can be carried on from here.
+    }else if(upload.status == UPLOAD_FILE_END || upload.status == UPLOAD_FILE_ABORTED){
+        upload_end();
+    }
+}
+
+/*  (private)handle_file_upload_done: Check an upload against the CRC32 or MD5 in the crc32 or md5 argument,
+        if there is one, and replace the file with it
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void handle_file_upload_done(){
+    //The upload may not have been finished, if the request had no file
+    upload_end();
+    String path = upload_path;
+    upload_path = "";
+    if(!path.length()){
+        server.send(400, "text/plain", "400: No File");
+        return;
+    }
+
+    String part_path = path + UPLOAD_SUFFIX;
+    if(upload_error == 416){
+        server.send(416, "text/plain", "416: Offset Past End of Upload");
+        return;
+    }
+    if(upload_error){
+        LittleFS.remove(part_path);
+        server.send(upload_error, "text/plain", upload_error == 507 ? "507: Not Enough Space" : "500: Not Saved");
+        return;
+    }
+
+    //A file that doesn't match its checksum is thrown away, so the one it would replace is kept
+    bool matches = true;
+    if(server.hasArg("crc32")){
+        matches = strtoul(server.arg("crc32").c_str(), NULL, 16) == (upload_crc ^ 0xFFFFFFFF);
+    }
+    if(server.hasArg("md5")){
+        upload_md5.calculate();
+        matches = matches && server.arg("md5").equalsIgnoreCase(upload_md5.toString());
+    }
+    if(!matches){
+        LittleFS.remove(part_path);
+        server.send(400, "text/plain", "400: Checksum Mismatch");
+        return;
+    }
+
+    //If the pack is being replaced, stop serving from it. LittleFS replaces the file in one step, so there's
+    //never a moment with no file or part of one.
+    if(path == pack_path) www_pack.close();
+    if(!LittleFS.rename(part_path, path)){
+        LittleFS.remove(part_path);
+        if(path == pack_path) load_www_files();
+        server.send(500, "text/plain", "500: Not Saved");
+        return;
+    }
+
+    //Let the owner of the file know that it has changed
+    String filename = path.substring(1);
+    if(_uploaded) _uploaded(filename);
+    //If a new pack was uploaded, serve from it
+    if(path == pack_path) load_www_files();
+    //If the settings file was uploaded, read it and apply the settings that changed
+    if(path == settings_path){
+        String previous[SETTING_COUNT];
+        for(uint8_t i = 0; i < SETTING_COUNT; i++) previous[i] = settings_values[i].text;
+
+        //Exported settings files leave the passwords out, so the ones that are left out stay as they are,
+        //and are written back into the file
+        bool restart = true;
+        if(check_settings_file(true)){
+            write_settings_file();
+            bool changed[SETTING_COUNT];
+            for(uint8_t i = 0; i < SETTING_COUNT; i++) changed[i] = settings_values[i].text != previous[i];
+            restart = settings_changed(changed);
+        }else{
+            //A file that can't be read or has blank required settings is dealt with at startup
+            request_restart();
+        }
+        server.send(201, "text/plain", restart ? "restart" : "applied");
+    }else{
         server.send(201);
-        if(upload_file) upload_file.close();
-        //If the settings file was uploaded, restart the ESP
-        if(upload.filename == "settings.txt"){
-            _offline();
-            ESP.restart();
-        } 
     }
+}
+
+/*  (private)handle_upload_status: Send the bytes of an interrupted upload that were saved, so it can be
+        carried on from there by POSTing the rest to /upload with that offset
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void handle_upload_status(){
+    if(!server.hasArg("name")){
+        server.send(400, "text/plain", "400: No Name");
+        return;
+    }
+    uint32_t offset = 0;
+    File part = LittleFS.open(upload_target(server.arg("name")) + UPLOAD_SUFFIX, "r");
+    if(part){
+        offset = part.size();
+        part.close();
+    }
+
+    server.send(200, "application/json", "{\"offset\":" + String(offset) + "}");
+}
+
+/*  (private)handle_update_upload: Write an uploading firmware image to flash, as it arrives. The image
+        can be gzip-compressed, in which case the bootloader decompresses it when it installs it.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void handle_update_upload(){
+    //Holds current upload
+    HTTPUpload& upload = server.upload();
+    //If the upload is starting, check the password, take the tag machine offline and start the update
+    if(upload.status == UPLOAD_FILE_START){
+        update_error = 0;
+        if(update_password.length() && server.arg("password") != update_password){
+            update_error = 401;
+            return;
+        }
+        //Without the image's MD5, a damaged upload could be installed, so it isn't started
+        if(server.arg("md5").length() != 32){
+            update_error = 400;
+            return;
+        }
+
+        //Nothing else can run properly once the update starts, so the tag machine restarts however it ends
+        www_pack.close();
+        _offline();
+        update_started = true;
+        WiFiUDP::stopAll();
+
+        //The image's size isn't known until it has all arrived, so leave room for the largest one that fits
+        uint32_t space = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
+        if(!Update.begin(space, U_FLASH) || !Update.setMD5(server.arg("md5").c_str())){
+            update_error = 500;
+        }
+    //If the upload is in progress, write the buffer to flash
+    }else if(upload.status == UPLOAD_FILE_WRITE && update_started && !update_error){
+        if(Update.write(upload.buf, upload.currentSize) != upload.currentSize) update_error = 500;
+    //If the upload is over, check the image and its MD5 and set it to be installed
+    }else if(upload.status == UPLOAD_FILE_END && update_started && !update_error){
+        if(!Update.end(true)) update_error = 500;
+    //If the upload ended early, don't install what there is of it
+    }else if(upload.status == UPLOAD_FILE_ABORTED && update_started){
+        Update.end(false);
+        request_restart();
+    }
+}
+
+/*  (private)handle_update_done: Tell the browser how the firmware update went, and restart
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void handle_update_done(){
+    if(update_error == 401){
+        server.send(401, "text/plain", "401: Wrong Password");
+        return;
+    }
+    if(update_error == 400){
+        server.send(400, "text/plain", "400: No MD5");
+        return;
+    }
+    if(!update_started){
+        server.send(400, "text/plain", "400: No Firmware");
+        return;
+    }
+
+    //The restart installs the new firmware if the update worked, or starts the old one again if it didn't
+    request_restart();
+    if(update_error || Update.hasError()){
+        server.send(500, "text/plain", "500: Update Failed (error " + String(Update.getError()) + ")");
+    }else{
+        server.send(200, "text/plain", "Updated");
+    }
+}
+
+/*  (private)merge_byte: Add a byte of an uploading contacts file to the current line,
+        and merge the line once it's complete
+        c: Byte
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void merge_byte(char c){
+    if(c == '\n'){
+        //Lines too long to hold a contact are skipped
+        if(!merge_line_overflow){
+            merge_line[merge_line_length] = '\0';
+            merge_added += _contacts->import_line(merge_line, merge_format);
+        }
+        merge_line_length = 0;
+        merge_line_overflow = false;
+        return;
+    }
+
+    if(merge_line_length < sizeof(merge_line) - 1){
+        merge_line[merge_line_length++] = c;
+    }else{
+        merge_line_overflow = true;
+    }
+}
 
-    // String upload_status = String(upload.status);
-    // websockets_server.sendTXT(websockets_client, upload_status);
+/*  (private)handle_contacts_merge_upload: Merges an uploading contacts file into the
+        contacts a line at a time, without saving the file
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void handle_contacts_merge_upload(){
+    if(!_contacts) return;
+
+    //Holds current upload
+    HTTPUpload& upload = server.upload();
+    //If the upload is starting, work out the format and start the merge
+    if(upload.status == UPLOAD_FILE_START){
+        merge_format = upload.filename.endsWith(".csv") ? IMPORT_CSV : IMPORT_JSON_LINES;
+        merge_line_length = 0;
+        merge_line_overflow = false;
+        merge_added = 0;
+        merge_success = _contacts->import_begin(true);
+    //If the upload is in progress, merge each complete line
+    }else if(upload.status == UPLOAD_FILE_WRITE && merge_success){
+        for(size_t i = 0; i < upload.currentSize; i++){
+            merge_byte(upload.buf[i]);
+        }
+    //If the upload is over, merge the last line and finish
+    }else if(upload.status == UPLOAD_FILE_END && merge_success){
+        merge_byte('\n');
+        merge_success = _contacts->import_end();
+    }else if(upload.status == UPLOAD_FILE_ABORTED){
+        _contacts->import_abort();
+        merge_success = false;
+    }
+}
+
+/*  (private)handle_contacts_merge: Reply once a contacts file has been merged
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void handle_contacts_merge(){
+    if(merge_success){
+        server.send(200, "text/plain", String(merge_added) + " contacts merged");
+    }else{
+        server.send(500, "text/plain", "500: Merge Failed");
+    }
 }
 
 /*  begin: Start the web interface
@@ -574,115 +1515,118 @@ void handle_file_upload(){
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 bool Web_Interface::begin(){
 
-    //When the settings file is requested or posted, call the corresponding function
-    server.on("/settings_data", HTTP_POST, handle_settings_post);
-    server.on("/settings_data", HTTP_GET, handle_settings_get);
+    //When the settings are requested or changed, call the corresponding function
+    server.on("/api/settings", HTTP_GET, handle_settings_api_get);
+    server.on("/api/settings", HTTP_PATCH, handle_settings_api_patch);
+    server.on(settings_path, HTTP_GET, handle_settings_export);
     server.on("/nav", HTTP_GET, handle_nav);
-    //When a POST is requested from /upload, send status 200 to initiate upload and call handle_file_upload function repeatedly
-    server.on("/upload", HTTP_POST, [](){ server.send(200); }, handle_file_upload );
+    server.on("/contacts.txt", HTTP_GET, handle_contacts_export);
+    server.on("/contacts.csv", HTTP_GET, handle_contacts_export);
+    //When a POST is requested from /contacts/merge, merge the uploading file into the contacts as it arrives
+    server.on("/contacts/merge", HTTP_POST, handle_contacts_merge, handle_contacts_merge_upload);
+    //Contacts a page at a time, and one contact at a time
+    server.on("/api/contacts", HTTP_GET, handle_contacts_api_get);
+    server.on("/api/contacts", HTTP_PUT, handle_contacts_api_put);
+    server.on("/api/contacts", HTTP_DELETE, handle_contacts_api_delete);
+    //Messages received since a time, or after an ID
+    server.on("/api/messages", HTTP_GET, handle_messages_api_get);
+    server.on("/metrics", HTTP_GET, handle_metrics);
+    //When a POST is requested from /upload, call handle_file_upload repeatedly as it uploads, then handle_file_upload_done
+    server.on("/upload", HTTP_POST, handle_file_upload_done, handle_file_upload);
+    server.on("/upload", HTTP_GET, handle_upload_status);
+    //When firmware is POSTed to /update, write it to flash as it uploads and restart to install it
+    server.on("/update", HTTP_POST, handle_update_done, handle_update_upload);
 
 
     //If any other file is requested, send it if it exists or send a generic 404 if it doesn't exist
     server.onNotFound([](){
+        //LittleFS is closed while the firmware updates
+        if(update_started){
+            server.send(503, "text/plain", "503: Updating");
+            return;
+        }
         if(!handle_file_read(server.uri())){
             server.send(404, "text/plain", "404: Not Found");
         }
     });
 
+    //Remember where every file in the pack and under /www is, and keep the header browsers send to check if a file has changed
+    load_www_files();
+    const char* headers[] = {"If-None-Match"};
+    server.collectHeaders(headers, 1);
+
     server.begin(); //Start the server
 
-    /* if(console_page){
+    if(console_page){
         //If a websockets message comes in, call this function
         websockets_server.onEvent(websockets_event);
         websockets_server.begin(); //Start the websockets server
-        //If a console.txt file exists, delete it to start with a clean console upon init
+        //Older firmware kept the console in flash
         if(LittleFS.exists("/www/console.txt")) LittleFS.remove("/www/console.txt"); 
-    } */
+    }
 
     //If the settings file is good, return true. Otherwise, return false. 
-    if(check_settings_file() || !settings_page){
+    if(check_settings_file(false) || !settings_page){
         return true;
     }
     return false;
 }
 
-/*  handle: Check for incoming requests to the server and to the websockets server
+/*  handle: Check for incoming requests to the server and to the websockets server, and restart if a
+        restart has been requested
+    read_only: If true, only GET and HEAD requests are answered and no restart happens. The rest wait
+        for a call that isn't read-only. Use while something else is busy with the storage, like the
+        printer mid-print. Only the async server can hold requests, so the others ignore this.
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-void Web_Interface::handle(){
+void Web_Interface::handle(bool read_only){
+#ifdef WEB_INTERFACE_ASYNC
+    server.handleClient(read_only);
+#else
     server.handleClient();
-    // if(console_page) websockets_server.loop();
-}
+#endif
 
-/*  console_print: Print to the web console
-        output: Text to print
-~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-/* void Web_Interface::console_print(String output){
+    //Restart once the browser has had time to get its response
+    if(!read_only && restart_requested && millis() - restart_requested > RESTART_DELAY){
+        _offline();
+        ESP.restart();
+    }
     if(console_page){
-        //If there is an active websockets connection, send the text to the client
-        if(websockets_client != -1){
-            websockets_server.sendTXT(websockets_client, output);
-        }
-
-        //Open/create the console.txt file in append mode
-        File console = LittleFS.open("/www/console.txt", "a");
+        websockets_server.loop();
 
-        //If the console file is over 10kb, delete it and create a new one. 
-        if(console.size() > 10000){
-            console.close();
-            LittleFS.remove("/www/console.txt");
-            console = LittleFS.open("/www/console.txt", "w");
+        //Send the console text printed since the last batch to every browser
+        if(console_sent != console_written && millis() - console_sent_millis >= CONSOLE_BATCH_INTERVAL){
+            if(websockets_server.connectedClients()) console_send(-1, console_sent, console_written);
+            console_sent = console_written;
+            console_sent_millis = millis();
         }
-
-        //output the current string to the end of the file
-        console.print(output); 
-        //Close the file
-        console.close();
     }
-} */
+}
 
-/*  load_setting: 
-    RETURNS the specified setting
+/*  console_print: Print to the web console. The text is kept in RAM and sent to the browsers with the next batch.
+        output: Text to print
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-String Web_Interface::load_setting(String setting){
-    //Open the file for reading
-    File file = LittleFS.open(settings_path, "r");
-    //Set aside enough memory for a JSON document
-    DynamicJsonDocument doc(file.size() * 2);
-
-    //Parse JSON from file
-    DeserializationError error = deserializeJson(doc, file);
-    //Close the file
-    file.close();
-    //If there is an error, return a blank response
-    if(error){
-        return "";
-    } 
+void Web_Interface::console_print(String output){
+    if(!console_page) return;
 
-    //Store whether the settings category exists or not
-    bool advanced = doc.containsKey("advanced");
-
-    //This array holds the settings for the current category
-    JsonArray settings;
-    //Cycle through each setting category
-    for(int i = 0; i < doc.size(); i++){
-        //Load the correct category for the current loop
-        if(i == 0){
-            settings = doc["general"];
-        }else if(advanced && i == 1){
-            settings = doc["advanced"];
-        }else{
-            settings = doc["wifi"];
-        }
-        //For each setting...
-        for(int i = 0; i < settings.size(); i++){
-            //If the current setting is the one specified, return its value
-            if(settings[i]["id"] == setting){
-                return settings[i]["val"];
-            }
-        }
+    for(unsigned i = 0; i < output.length(); i++){
+        console_buffer[console_written++ % CONSOLE_BUFFER] = output[i];
     }
+}
 
-    //If nothin has been returned so far, return an empty string
-    return "";     
+/*  setting: Get a setting read from the settings file by begin()
+        id: Setting id from settings_schema
+    RETURNS the setting's value
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+const setting_value& Web_Interface::setting(setting_id id){
+    return settings_values[id];
+}
 
-}
\ No newline at end of file
+/*  load_setting: 
+        setting: Setting id as text
+    RETURNS the specified setting as text, or a blank string if there is no such setting
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+String Web_Interface::load_setting(String setting){
+    uint8_t index = find_setting(setting.c_str());
+    if(index == SETTING_COUNT) return "";
+    return settings_values[index].text;
+}
@@ -1,11 +1,33 @@
 #include "Arduino.h"
 #include "ESP8266WebServer.h" //Web Server Library
-// #include "WebSocketsServer.h" //WebSockets Server Library
+#ifdef WEB_INTERFACE_ASYNC
+#include "Async_Web_Server.h" //Web server that serves several clients at once
+#endif
+#include "WebSocketsServer.h" //WebSockets Server Library
 #include "LittleFS.h" //LittleFS Library
+#include "MD5Builder.h" //For checking uploads
+#include "Updater.h" //Firmware updates through /update
+#include "WiFiUdp.h" //To stop UDP while the firmware updates
 #include "ArduinoJson.h" //Arduino JavaScript Object Notation Library
+#include "Persistent_Storage.h" //Key:value storage for the contacts page
+#include "Message_Journal.h" //Journal of received messages
+#include "Flash_Stats.h" //Flash write accounting
+#include "Device_Stats.h" //Heap, loop, message, printer and network counters
+#include "Settings_Schema.h" //Settings generated from settings_def.txt
+
+//The value of a setting, read once by begin() and converted to each type it's used as
+struct setting_value{
+    String text; //Value as text, or "" if it has no value
+    long number; //Value as a number, or 0 if it isn't a number
+    bool on; //True if the value is true
+};
 
 //Callback function type (no args)
 typedef void (*void_function_pointer)();
+//Callback function type (uploaded filename)
+typedef void (*upload_function_pointer)(String);
+//Callback function type (true for each setting_id that changed), returns false if a restart is needed to apply them
+typedef bool (*settings_function_pointer)(const bool*);
 
 class Web_Interface{
     public:
@@ -14,13 +36,21 @@ class Web_Interface{
     
         void 
             set_callback(void_function_pointer offline),
-            handle();
-            // console_print(String output);
+            set_upload_callback(upload_function_pointer uploaded),
+            set_settings_callback(settings_function_pointer applied),
+            set_contacts(Persistent_Storage* contacts),
+            set_messages(Message_Journal* messages),
+            set_update_password(String password),
+            handle(bool read_only = false),
+            console_print(String output);
 
         bool
             begin();
 
         String
             load_setting(String setting);
+
+        const setting_value&
+            setting(setting_id id);
         
 };
\ No newline at end of file
@@ -234,6 +234,32 @@ bool WiFi_Manager::add_network(String SSID, String password){
   return true;
 }
 
+/*  clear_networks: Remove every network from the list of networks, so a new list can be added
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void WiFi_Manager::clear_networks(){
+  for (int i = 0; i < networks; i++){
+      SSID_list[i] = "";
+      password_list[i] = "";
+  }
+  networks = 0;
+}
+
+/*  networks_changed: Call after changing the list of networks. If the network in use is no longer in the
+        list with the same password, or a connection is still being looked for, scan again for known networks
+        without blocking. A running hotspot is left alone.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void WiFi_Manager::networks_changed(){
+  if(status == WM_HOTSPOT) return;
+
+  if(status == WM_CONNECTED){
+      for (int i = 0; i < networks; i++){
+          if(SSID_list[i] == WiFi.SSID() && password_list[i] == WiFi.psk()) return;
+      }
+  }
+
+  scan();
+}
+
 String WiFi_Manager::get_IP(){
     return WiFi.localIP().toString();
 }
@@ -22,7 +22,9 @@ class WiFi_Manager{
         
         void 
             config(uint32_t),
-            set_callbacks(void_function_pointer, void_function_pointer, void_function_pointer);
+            set_callbacks(void_function_pointer, void_function_pointer, void_function_pointer),
+            clear_networks(),
+            networks_changed();
             
         bool 
             begin(),
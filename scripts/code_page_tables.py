@@ -0,0 +1,115 @@
+# Generates lib/Code_Page/Code_Page_Tables.h, the tables Code_Page.cpp uses to print UTF-8 text in
+# the thermal printer's code pages: the code point of each character in each code page, sorted so they can
+# be searched, and an ASCII stand-in for characters that aren't in the selected code page.
+#
+# The tables only change when a code page is added, so this isn't run before every build. Run it by hand with:
+#   python scripts/code_page_tables.py
+#
+# Created by Silviu Toderita in 2020.
+
+import os
+import unicodedata
+
+project_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+out_path = os.path.join(project_dir, "lib", "Code_Page", "Code_Page_Tables.h")
+
+# (ESC t number, Python codec, name, character printed for anything that can't be)
+CODE_PAGES = [
+    (0, "cp437", "PC437", 0xB2),
+    (2, "cp850", "PC850", 0xB2),
+    (16, "cp1252", "WPC1252", ord("?")),
+]
+
+# Stand-ins that can't be worked out by removing accents
+TRANSLITERATIONS = {
+    0x00A0: " ", 0x00A1: "!", 0x00A2: "c", 0x00A3: "L", 0x00A5: "Y", 0x00A6: "|", 0x00A7: "S",
+    0x00A8: "\"", 0x00A9: "C", 0x00AB: "<<", 0x00AC: "-", 0x00AD: "-", 0x00AE: "R", 0x00AF: "-",
+    0x00B0: "o", 0x00B1: "+-", 0x00B4: "'", 0x00B5: "u", 0x00B6: "P", 0x00B7: ".", 0x00B8: ",",
+    0x00BB: ">>", 0x00BF: "?", 0x00C6: "AE", 0x00D0: "D", 0x00D7: "x", 0x00D8: "O", 0x00DE: "TH",
+    0x00DF: "ss", 0x00E6: "ae", 0x00F0: "d", 0x00F7: "/", 0x00F8: "o", 0x00FE: "th", 0x0110: "D", 0x0111: "d", 0x0126: "H", 0x0127: "h", 0x0131: "i",
+    0x0132: "IJ", 0x0133: "ij", 0x0138: "k", 0x0141: "L", 0x0142: "l", 0x014A: "N", 0x014B: "n",
+    0x0152: "OE", 0x0153: "oe", 0x0166: "T", 0x0167: "t", 0x0192: "f",
+    0x2010: "-", 0x2011: "-", 0x2012: "-", 0x2013: "-", 0x2014: "-", 0x2015: "-",
+    0x2018: "'", 0x2019: "'", 0x201A: ",", 0x201B: "'", 0x201C: "\"", 0x201D: "\"", 0x201E: ",,",
+    0x201F: "\"", 0x2020: "+", 0x2022: "*", 0x2026: "...", 0x2030: "%", 0x2032: "'", 0x2033: "\"",
+    0x2039: "<", 0x203A: ">", 0x20AC: "EUR", 0x2122: "TM", 0x2212: "-",
+}
+
+
+def utf8_length(code_point):
+    return len(chr(code_point).encode("utf-8"))
+
+
+def transliteration(code_point):
+    """ASCII stand-in for a character, or None if there isn't one."""
+    if code_point in TRANSLITERATIONS:
+        return TRANSLITERATIONS[code_point]
+    # Latin letters with accents become the letter without them
+    base = "".join(c for c in unicodedata.normalize("NFKD", chr(code_point)) if not unicodedata.combining(c))
+    if base.strip() and all(32 <= ord(c) < 127 for c in base):
+        return base
+    return None
+
+
+def c_char(text):
+    out = ""
+    for char in text:
+        out += "\\" + char if char in "\\\"" else char
+    return out
+
+
+lines = [
+    "// Generated by scripts/code_page_tables.py, don't edit by hand",
+    "#pragma once",
+    "",
+    '#include "Code_Page.h"',
+    "",
+]
+
+for number, codec, name, unknown in CODE_PAGES:
+    entries = []
+    for byte in range(0x80, 0x100):
+        try:
+            char = bytes([byte]).decode(codec)
+        except UnicodeDecodeError:
+            continue
+        entries.append((ord(char), byte))
+    entries.sort()
+    lines.append("//%s (ESC t %d): code point of each character from 0x80 to 0xFF, in code point order" % (name, number))
+    lines.append("static constexpr code_page_entry %s_TABLE[] PROGMEM = {" % name)
+    for i in range(0, len(entries), 6):
+        lines.append("    " + " ".join("{0x%04X, 0x%02X}," % entry for entry in entries[i:i + 6]))
+    lines.append("};")
+    lines.append("static_assert(entries_sorted(%s_TABLE, sizeof(%s_TABLE) / sizeof(code_page_entry)), \"%s table is out of order\");" % (name, name, name))
+    lines.append("")
+
+# Stand-ins for everything from Latin-1 to Latin Extended-B, and for the punctuation above
+stand_ins = []
+for code_point in list(range(0xA0, 0x250)) + sorted(c for c in TRANSLITERATIONS if c >= 0x250):
+    text = transliteration(code_point)
+    if text is None:
+        continue
+    assert len(text) <= min(utf8_length(code_point), 3), hex(code_point)
+    stand_ins.append((code_point, text))
+
+lines.append("//ASCII stand-ins for characters that aren't in the selected code page, in code point order. None is")
+lines.append("//longer than the character in UTF-8, so text can be converted in place.")
+lines.append("static constexpr transliteration TRANSLITERATIONS[] PROGMEM = {")
+for i in range(0, len(stand_ins), 6):
+    lines.append("    " + " ".join("{0x%04X, \"%s\"}," % (code_point, c_char(text)) for code_point, text in stand_ins[i:i + 6]))
+lines.append("};")
+lines.append("static_assert(transliterations_sorted(TRANSLITERATIONS, sizeof(TRANSLITERATIONS) / sizeof(transliteration)), \"Stand-ins are out of order\");")
+lines.append("static_assert(transliterations_fit(TRANSLITERATIONS, sizeof(TRANSLITERATIONS) / sizeof(transliteration)), \"A stand-in is longer than its character\");")
+lines.append("")
+
+lines.append("//Every supported code page")
+lines.append("static constexpr code_page CODE_PAGES[] = {")
+for number, codec, name, unknown in CODE_PAGES:
+    lines.append("    {%d, %s_TABLE, sizeof(%s_TABLE) / sizeof(code_page_entry), 0x%02X}," % (number, name, name, unknown))
+lines.append("};")
+lines.append("")
+
+with open(out_path, "w", newline="\n") as out:
+    out.write("\n".join(lines))
+
+print("Code_Page_Tables.h: %d code pages, %d stand-ins" % (len(CODE_PAGES), len(stand_ins)))
@@ -0,0 +1,154 @@
+# Generates lib/Web_Interface/Settings_Schema.h and Settings_Schema.cpp from data/settings_def.txt, so the
+# ids, types, names, defaults and options of the settings are compiled into the firmware and only their
+# values are kept in /settings.txt.
+#
+# Runs before every build from extra_scripts in platformio.ini, or by hand with:
+#   python scripts/settings_schema.py
+#
+# Created by Silviu Toderita in 2020.
+
+import json
+import os
+import re
+
+CATEGORIES = ["general", "advanced", "wifi"]
+TYPES = ["text", "num", "pass", "bool", "multi"]
+
+try:
+    Import("env")
+    project_dir = env.subst("$PROJECT_DIR")
+except NameError:
+    project_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+def_path = os.path.join(project_dir, "data", "settings_def.txt")
+out_dir = os.path.join(project_dir, "lib", "Web_Interface")
+
+
+def c_string(value):
+    """Quote text as a C string literal, with anything outside printable ASCII as octal escapes."""
+    out = '"'
+    for byte in value.encode("utf-8"):
+        char = chr(byte)
+        if char in '"\\':
+            out += "\\" + char
+        elif 32 <= byte < 127:
+            out += char
+        else:
+            out += "\\%03o" % byte
+    return out + '"'
+
+
+def value_text(value):
+    """Convert a JSON value to the text the web interface would post back for it."""
+    if value is None:
+        return ""
+    if isinstance(value, bool):
+        return "true" if value else "false"
+    return str(value)
+
+
+def load_settings():
+    with open(def_path, encoding="utf-8") as file:
+        categories = json.load(file)
+
+    settings = []
+    ids = set()
+    for category in categories:
+        if category not in CATEGORIES:
+            raise ValueError("settings_def.txt: unknown category \"%s\"" % category)
+
+    # Settings are listed in the order of the categories, which is the order they're shown in
+    for category in CATEGORIES:
+        for setting in categories.get(category, []):
+            id = setting["id"]
+            if not re.match(r"^[A-Za-z_][A-Za-z0-9_]*$", id) or id in ids:
+                raise ValueError("settings_def.txt: bad or repeated id \"%s\"" % id)
+            if setting["type"] not in TYPES:
+                raise ValueError("settings_def.txt: unknown type \"%s\" for \"%s\"" % (setting["type"], id))
+            ids.add(id)
+            settings.append({
+                "id": id,
+                "enum": "SETTING_" + id.upper(),
+                "name": setting.get("name", id),
+                "desc": setting.get("desc", ""),
+                "val": value_text(setting.get("val")),
+                "opt": ",".join(value_text(option) for option in setting.get("opt", [])),
+                "category": "SETTING_" + category.upper(),
+                "type": "SETTING_" + setting["type"].upper(),
+                "req": "true" if setting.get("req", False) else "false",
+            })
+    return settings
+
+
+def header(settings):
+    lines = [
+        "//Generated from data/settings_def.txt by scripts/settings_schema.py, edit settings_def.txt instead of this file",
+        "#pragma once",
+        "",
+        "#include \"Arduino.h\"",
+        "",
+        "//Setting categories, in the order they're shown",
+    ]
+    lines += ["#define SETTING_%s %d" % (category.upper(), i) for i, category in enumerate(CATEGORIES)]
+    lines += ["#define SETTING_CATEGORIES %d" % len(CATEGORIES), "", "//Setting types"]
+    lines += ["#define SETTING_%s %d" % (type.upper(), i) for i, type in enumerate(TYPES)]
+    lines += [
+        "",
+        "//Index of each setting in settings_schema",
+        "enum setting_id : uint8_t{",
+    ]
+    lines += ["    %s," % setting["enum"] for setting in settings]
+    lines += [
+        "    SETTING_COUNT",
+        "};",
+        "",
+        "//A setting as defined in settings_def.txt. The strings are in flash, so read them with the _P functions.",
+        "struct setting_def{",
+        "    const char* id;",
+        "    const char* name;",
+        "    const char* desc; //Help text, or \"\"",
+        "    const char* val; //Default value as text, or \"\"",
+        "    const char* opt; //Options of a SETTING_MULTI setting, separated by commas",
+        "    uint8_t category;",
+        "    uint8_t type;",
+        "    bool req; //True if the setting can't be blank",
+        "};",
+        "",
+        "//Every setting, in flash. Copy an entry to RAM with memcpy_P() before reading it.",
+        "extern const setting_def settings_schema[SETTING_COUNT];",
+        "",
+    ]
+    return "\n".join(lines)
+
+
+def source(settings):
+    lines = [
+        "//Generated from data/settings_def.txt by scripts/settings_schema.py, edit settings_def.txt instead of this file",
+        "#include \"Settings_Schema.h\"",
+        "",
+    ]
+    for i, setting in enumerate(settings):
+        for field in ["id", "name", "desc", "val", "opt"]:
+            lines.append("static const char setting_%d_%s[] PROGMEM = %s;" % (i, field, c_string(setting[field])))
+    lines += ["", "const setting_def settings_schema[SETTING_COUNT] PROGMEM = {"]
+    for i, setting in enumerate(settings):
+        lines.append("    {setting_%d_id, setting_%d_name, setting_%d_desc, setting_%d_val, setting_%d_opt, %s, %s, %s}, //%s"
+            % (i, i, i, i, i, setting["category"], setting["type"], setting["req"], setting["enum"]))
+    lines += ["};", ""]
+    return "\n".join(lines)
+
+
+def write_if_changed(path, text):
+    """Only touch the file if it changes, so the firmware isn't rebuilt for nothing."""
+    if os.path.exists(path):
+        with open(path, encoding="utf-8") as file:
+            if file.read() == text:
+                return
+    with open(path, "w", encoding="utf-8", newline="\n") as file:
+        file.write(text)
+    print("settings_schema.py: wrote " + os.path.relpath(path, project_dir))
+
+
+settings = load_settings()
+write_if_changed(os.path.join(out_dir, "Settings_Schema.h"), header(settings))
+write_if_changed(os.path.join(out_dir, "Settings_Schema.cpp"), source(settings))
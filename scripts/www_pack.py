@@ -0,0 +1,129 @@
+# Packs the web interface in web/ into data/www.pack, one read-only file that the firmware serves straight
+# from, so a page doesn't cost a LittleFS lookup and open for every file it uses.
+#
+# Files that the pages link to are renamed with a hash of their contents (/lib/bs.css becomes
+# /lib/bs.1a2b3c4d.css) and the links in the pages are changed to match, so browsers can keep them forever
+# and only fetch them again when they change.
+#
+# Pack layout (little-endian):
+#   header: magic "TAGP", number of files (2 bytes), reserved (2 bytes)
+#   index: for each file, path (48 bytes, NUL padded), offset (4 bytes), size (4 bytes), hash (4 bytes),
+#       flags (1 byte, PACK_GZ = 1, PACK_IMMUTABLE = 2), reserved (3 bytes)
+#   data: the contents of each file, at its offset from the start of the pack
+#
+# Runs before every build from extra_scripts in platformio.ini, or by hand with:
+#   python scripts/www_pack.py
+#
+# Created by Silviu Toderita in 2020.
+
+import hashlib
+import os
+import posixpath
+import re
+import struct
+
+MAGIC = b"TAGP"
+PATH_LENGTH = 48
+PACK_GZ = 1
+PACK_IMMUTABLE = 2
+
+try:
+    Import("env")
+    project_dir = env.subst("$PROJECT_DIR")
+except NameError:
+    project_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+web_dir = os.path.join(project_dir, "web")
+pack_path = os.path.join(project_dir, "data", "www.pack")
+
+LINK = re.compile(r"""((?:src|href)\s*=\s*)(["'])([^"']+)\2""")
+
+
+def file_hash(content):
+    return hashlib.sha256(content).hexdigest()[:8]
+
+
+def read_files():
+    """Read every file under web/, keyed by the path it's requested as (without .gz)."""
+    files = {}
+    for folder, _, names in os.walk(web_dir):
+        for name in sorted(names):
+            full_path = os.path.join(folder, name)
+            path = "/" + os.path.relpath(full_path, web_dir).replace(os.sep, "/")
+            gz = path.endswith(".gz")
+            if gz:
+                path = path[:-3]
+            # If both the compressed and uncompressed file exist, the compressed one is served
+            if path in files and not gz:
+                continue
+            with open(full_path, "rb") as file:
+                files[path] = {"content": file.read(), "gz": gz}
+    return files
+
+
+def hashed_path(path, content):
+    folder, name = posixpath.split(path)
+    base, extension = posixpath.splitext(name)
+    return posixpath.join(folder, "%s.%s%s" % (base, file_hash(content), extension))
+
+
+def link_assets(files):
+    """Rename the files the pages link to, and change the links to match."""
+    renamed = {}
+    for path, file in files.items():
+        if not path.endswith(".html") or file["gz"]:
+            continue
+        folder = posixpath.dirname(path)
+
+        def replace(match):
+            link = match.group(3)
+            if re.match(r"^[a-z]+:|^//|^#", link):
+                return match.group(0)
+            target = link if link.startswith("/") else posixpath.normpath(posixpath.join(folder, link))
+            if target not in files or target.endswith(".html"):
+                return match.group(0)
+            renamed[target] = hashed_path(target, files[target]["content"])
+            return match.group(1) + match.group(2) + renamed[target] + match.group(2)
+
+        file["content"] = LINK.sub(replace, file["content"].decode("utf-8")).encode("utf-8")
+
+    packed = {}
+    for path, file in files.items():
+        flags = PACK_GZ if file["gz"] else 0
+        if path in renamed:
+            path = renamed[path]
+            flags |= PACK_IMMUTABLE
+        packed[path] = (file["content"], flags)
+    return packed
+
+
+def build_pack(packed):
+    paths = sorted(packed)
+    index_size = 8 + len(paths) * (PATH_LENGTH + 16)
+    header = MAGIC + struct.pack("<HH", len(paths), 0)
+    index = b""
+    data = b""
+    for path in paths:
+        content, flags = packed[path]
+        encoded = path.encode("utf-8")
+        if len(encoded) >= PATH_LENGTH:
+            raise ValueError("www_pack.py: path too long for the pack: " + path)
+        index += encoded.ljust(PATH_LENGTH, b"\0")
+        index += struct.pack("<III", index_size + len(data), len(content), int(file_hash(content), 16))
+        index += struct.pack("<B3x", flags)
+        data += content
+    return header + index + data
+
+
+def write_if_changed(path, content):
+    """Only touch the pack if it changes, so the filesystem image isn't rebuilt for nothing."""
+    if os.path.exists(path):
+        with open(path, "rb") as file:
+            if file.read() == content:
+                return
+    with open(path, "wb") as file:
+        file.write(content)
+    print("www_pack.py: wrote %s (%d bytes)" % (os.path.relpath(path, project_dir), len(content)))
+
+
+write_if_changed(pack_path, build_pack(link_assets(read_files())))
@@ -24,6 +24,10 @@ var config = JSON.parse(fs.readFileSync('config.json'));
 var MQTT_broker_username = config.MQTT_broker_username;
 var MQTT_broker_password = config.MQTT_broker_password;
 var www_root_folder = config.www_root_folder;
+//Also publish messages in the v1 text format, for TAG Machines that haven't been updated yet
+var publish_v1 = config.publish_v1 !== false;
+//Most media files the TAG Machine reads in a message (MESSAGE_MEDIA_MAX in the firmware)
+var media_max = 10;
 var emoji = require('node-emoji');
 var getUrls = require('get-urls');
 var QRCode = require('qrcode');
@@ -166,49 +170,84 @@ function save_image(URL) {
 
 }
 
-/*  publish_MQTT_message: Publish a message to the MQTT server
-        data: Data to publish in the message
+/*  encode_message_v2: Encode a message in the binary v2 format the TAG Machine reads. Every number is
+        little-endian:
+            0   magic (0xFA)
+            1   version (2)
+            2   time (4 bytes, UNIX UTC)
+            6   id length
+            7   from length
+            8   body length (2 bytes)
+            10  media count
+            11  media numbers (1 byte each, 0 for an unsupported attachment)
+            then the id, from and body, one after the other
+        data: Data to encode in the message
+        media: Array of media numbers, of which only the first media_max are sent
+    RETURNS Buffer holding the message
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-async function publish_MQTT_message(data) {
-    //This variable will store any image numbers in this message
-    var media;
-    //If there are no images, send 0
-    if (data.image_count == 0) {
-        media = '0';
-        //If there are images...
-    } else {
-        //For each image...
-        for (var i = 0; i < data.image_count; i++) {
-
-            let res = data.media[i];
-            if (res.indexOf("http") == 0) {
-                res = request('GET', data.media[i]).url;
-            }
+function encode_message_v2(data, media) {
+    //Text fields are cut off if they're too long for their length, and so is the list of media
+    media = media.slice(0, media_max);
+    var id = Buffer.from(String(data.id)).subarray(0, 255);
+    var from = Buffer.from(String(data.from)).subarray(0, 255);
+    var body = Buffer.from(emoji.unemojify(data.body)).subarray(0, 65535);
+
+    var header = Buffer.alloc(11 + media.length);
+    header.writeUInt8(0xFA, 0);
+    header.writeUInt8(2, 1);
+    header.writeUInt32LE(data.time, 2);
+    header.writeUInt8(id.length, 6);
+    header.writeUInt8(from.length, 7);
+    header.writeUInt16LE(body.length, 8);
+    header.writeUInt8(media.length, 10);
+    for (var i = 0; i < media.length; i++) {
+        header.writeUInt8(media[i], 11 + i);
+    }
 
-            //Store the image number after the image is processed
-            var current_image = String(await save_image(res));
+    return Buffer.concat([header, id, from, body]);
+}
 
-            //Add the image number to the media var
-            if (media) {
-                media = media + current_image;
-            } else {
-                media = current_image;
-            }
+/*  encode_message_v1: Encode a message in the text v1 format read by older TAG Machine firmware
+        data: Data to encode in the message
+        media: Array of media numbers
+    RETURNS String holding the message
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+function encode_message_v1(data, media) {
+    //If there are no images, send 0, and send NS for each unsupported attachment
+    var media_text = media.length ? media.map(number => number == 0 ? 'NS' : String(number)).join(',') : '0';
+    return `id:${data.id}\nfrom:${data.from}\nbody:${emoji.unemojify(data.body)}\nmedia:${media_text}\ntime:${data.time}`;
+}
 
-            //If it's not the last image, add a comma to media string
-            if (i != data.image_count - 1) {
-                media = media + ',';
-            }
+/*  publish_MQTT_message: Publish a message to the MQTT server, as v2 on smsin2-<number> and, unless
+        publish_v1 is false in config.json, as v1 on smsin-<number> for older TAG Machines
+        data: Data to publish in the message
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+async function publish_MQTT_message(data) {
+    //This array will store the image number of each image in this message, 0 if it isn't supported
+    var media = [];
+    //For each image...
+    for (var i = 0; i < data.image_count; i++) {
+
+        let res = data.media[i];
+        if (res.indexOf("http") == 0) {
+            res = request('GET', data.media[i]).url;
         }
 
+        //Store the image number after the image is processed
+        var current_image = await save_image(res);
+        media.push(current_image == "NS" ? 0 : current_image);
     }
 
-    //Form the MQTT message
-    mqtt_message = `id:${data.id}\nfrom:${data.from}\nbody:${emoji.unemojify(data.body)}\nmedia:${media}\ntime:${data.time}`;
+    //Form and publish the MQTT messages
+    var mqtt_message = encode_message_v2(data, media);
+    mqtt_client.publish(`smsin2-${data.to}`, mqtt_message, { qos: 1 });
+    console.log(`Published MQTT Message!\nTopic: smsin2-${data.to} \nSize: ${mqtt_message.length} bytes\n----------------`);
 
-    //Publish the MQTT message
-    mqtt_client.publish(`smsin-${data.to}`, mqtt_message, { qos: 1 });
-    console.log(`Published MQTT Message!\nTopic: smsin-${data.to} \nMessage:\n----\n${mqtt_message}\n----------------`);
+    if (publish_v1) {
+        var mqtt_message_v1 = encode_message_v1(data, media);
+        mqtt_client.publish(`smsin-${data.to}`, mqtt_message_v1, { qos: 1 });
+        console.log(`Published MQTT Message!\nTopic: smsin-${data.to} \nMessage:\n----\n${mqtt_message_v1}\n----------------`);
+    }
 }
 
 //Do this if a POST request is received to /sms
@@ -234,7 +273,8 @@ app.post('/', (req, res) => {
 
     var URLs = Array.from(getUrls(req.body.Body));
 
-    for (var i = 0; i < URLs.length; i++) {
+    //QR codes for links are added after the attachments, as long as there's room for them
+    for (var i = 0; i < URLs.length && image_num < media_max; i++) {
         var path = www_root_folder + "qr/" + i + ".png";
         (async () => {
             await QRCode.toFile(path, URLs[i]);
@@ -9,6 +9,9 @@
 
 #include "Arduino.h"
 #include "Persistent_Storage.h"
+#include "Message_Journal.h"
+#include "Message_Parser.h"
+#include "Device_Stats.h"
 
 // Network Libraries
 #include "ArduinoOTA.h"
@@ -22,6 +25,7 @@
 #include "Twilio.h"
 
 Persistent_Storage contacts("contacts");
+Message_Journal journal("journal");
 WiFi_Manager WiFi_manager;
 Web_Interface web_interface;
 WTA_Clock WTA_clock;
@@ -30,7 +34,7 @@ PubSubClient MQTT_client(ESP_client);
 Twilio twilio;
 Thermal_Printer printer(false);
 
-String last_message_ID;                // Twilio ID of the last message received
+char last_message_ID[40] = "";        // Twilio ID of the last message received
 bool MQTT_connected = false;           // Holds status of MQTT connection, true if MQTT has connected after Wi-Fi connection
 bool WiFi_connection_failed = false;   // True if the Wi-Fi Connection has failed once, false if it has not failed since last successful connect
 bool WiFi_connection_success = false;  // True if the Wi-Fi Connection has succeeded at least once
@@ -51,6 +55,12 @@ bool LED_on = false;
 
 bool printDisconnectMessages = true;
 
+// Set when saved settings are applied, and acted on at the start of the next loop so nothing is cut off part way
+bool restart_printer = false;  // Start the printer again with its new settings
+bool reconnect_MQTT = false;   // Reconnect to the MQTT broker with the new bridge URL or phone number
+bool reconnect_WiFi = false;   // Look for the new list of Wi-Fi networks
+bool is_offline = false;       // True once the TAG Machine has gone offline to restart or update
+
 /*  format_NA_phone_numbers: Format phone numbers as (XXX) XXX - XXXX if they are from North America
         input: raw number
     RETURNS formatted number
@@ -66,13 +76,25 @@ String format_NA_phone_numbers(String input) {
     return input;
 }
 
+/*  console_log: Print a line to the web console, with the time if it's known
+        text: Line to print, in UTF-8
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void console_log(String text) {
+    if (WTA_clock.status()) text = WTA_clock.get_timestamp() + " " + text;
+    web_interface.console_print(text + "\n");
+}
+
 /*  process_message: Process and print an incoming message
-        time: UNIX UTC time at time message received by server
+        time: UNIX UTC time the message was received by the server
         from_number: Phone number the message is from, with + removed
         message: Message body
-        media: Media files (if any), separated by ","
+        media: Number of each media file, or MEDIA_UNSUPPORTED
+        media_count: Number of media files
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-void process_message(String time, String from_number, String message, String media) {
+void process_message(uint32_t time, const String& from_number, const String& message, const uint8_t* media, uint8_t media_count) {
+    // The message itself isn't logged, only who it's from and its size
+    console_log("Message from " + from_number + ": " + String(message.length()) + " characters, media: " + String(media_count));
+
     // If the message is "_photo", change photo_mode to true so that the photo is printed by itself
     bool photo_mode = false;
     if (message == "_photo") {
@@ -84,40 +106,47 @@ void process_message(String time, String from_number, String message, String med
 
     // If send_replies is on...
     if (send_replies) {
+        // Name requests that expired before this message was received are ignored
+        uint32_t received = time;
+        contacts.set_time(received);
+
         // If the message is "_name", reply with a name update message
         if (message == "_name") {
+            console_log("Name change requested by " + from_number);
             // If the reply was successfully sent...
             if (twilio.send_message(from_number, phone_number, "Please reply with a new name within 24hrs to add it to the contact list.")) {
-                // Store the timestamp when the request was sent out
-                contacts.set(from_number, "_REQ" + time);
+                // Store the name request until it expires
+                contacts.set_pending(from_number, received + PENDING_TTL);
             }
 
             // Exit function before printing
             return;
         }
 
-        // Get the name from the phone book
-        name = contacts.get(from_number);
+        // Get the name and kind of contact from the phone book
+        uint8_t kind;
+        name = contacts.get(from_number.c_str(), &kind);
 
         // If the TAG machine should request a name, this will be true
         bool request_name = false;
 
-        // If the number is not in the phone-book...
-        if (name == "") {
+        // If the number is not in the phone-book, or a name request expired...
+        if (kind == CONTACT_NONE) {
             request_name = true;
-            // If a name was requested already and the reply message isn't blank...
-        } else if (name.substring(0, 4) == "_REQ") {
-            // If the request is less than 24 hours old...
-            if (time.toInt() <= name.substring(4).toInt() + 86400 && message != "") {
+            // If a name was requested less than 24 hours ago...
+        } else if (kind == CONTACT_PENDING) {
+            // If the reply message isn't blank...
+            if (message != "") {
                 // Store the name in the phone book
                 contacts.set(from_number, message);
+                console_log("Name saved for " + from_number);
                 // Reply with a success message
                 twilio.send_message(from_number, phone_number, "Thanks " + message + ", your name has been added to the contact list. To change your name, reply with \"_name\".");
 
                 // exit the function before printing
                 return;
 
-                // If the request is more than 24 hours old...
+                // If the reply message is blank...
             } else {
                 request_name = true;
             }
@@ -127,8 +156,8 @@ void process_message(String time, String from_number, String message, String med
         if (request_name) {
             // Send a message asking the sender to reply with a name. If the reply is successful...
             if (twilio.send_message(from_number, phone_number, "Thanks for messaging " + owner_name + "'s Fax Machine! Reply with your name within 24hrs to add it to the contact list.")) {
-                // Store the timestamp when the request was sent out
-                contacts.set(from_number, "_REQ" + time);
+                // Store the name request until it expires
+                contacts.set_pending(from_number, received + PENDING_TTL);
             }
             // Use the phone number as the name for this message
             name = from_number;
@@ -142,76 +171,26 @@ void process_message(String time, String from_number, String message, String med
         printer.print_bitmap_file(file, 1);
         file.close();
 
-        printer.print_status(WTA_clock.get_date_time(time.toInt()), 0);     // Convert Twilio's date/time to a long timestamp and print it
+        printer.print_status(WTA_clock.get_date_time(time), 0);             // Convert Twilio's date/time to a long timestamp and print it
         printer.print_status("From: " + format_NA_phone_numbers(name), 1);  // Print who the message is from
         printer.print_message(message, 1);                                  // Print the message
     }
 
-    // If there are any photos
-    if (media != "0") {
-        // Parse media string
-        uint8_t media_count = 1;    // The number of media files in this message
-        String media_filename[10];  // The filename of each media file
-        for (uint8_t i = 0; i < media.length(); i++) {
-            // Every time there is a comma, increment the media_count by 1
-            if (media.charAt(i) == ',') {
-                media_count++;
-                // Append the current character to the current media_filename
-            } else {
-                media_filename[media_count - 1] += media.charAt(i);
-            }
-        }
-
-        // For every media object...
-        for (uint8_t i = 0; i < media_count; i++) {
-            // If it's an unsupported attachment, print that out and reply to the sender
-            if (media_filename[i] == "NS") {
-                printer.print_message("<UNSUPPORTED ATTACHMENT>", 1);
-                if (send_replies) twilio.send_message(from_number, phone_number, "Sorry, but your message contained media in a format that's not supported by the TAG Machine. Only .jpg, .png, and .gif images are supported.");
-                // Otherwise, print that particular media file
-            } else {
-                printer.print_bitmap_http("http://" + bridge_URL + "/img/" + media_filename[i] + ".dat", 1);
-            }
+    // For every media object...
+    for (uint8_t i = 0; i < media_count; i++) {
+        // If it's an unsupported attachment, print that out and reply to the sender
+        if (media[i] == MEDIA_UNSUPPORTED) {
+            printer.print_message("<UNSUPPORTED ATTACHMENT>", 1);
+            if (send_replies) twilio.send_message(from_number, phone_number, "Sorry, but your message contained media in a format that's not supported by the TAG Machine. Only .jpg, .png, and .gif images are supported.");
+            // Otherwise, print that particular media file
+        } else {
+            printer.print_bitmap_http("http://" + bridge_URL + "/img/" + String(media[i]) + ".dat", 1);
         }
     }
 
     // Print a 4px line
     if (!photo_mode) printer.print_line(4, 4);
-}
-
-/*  remove_emojis: Removes any UTF-8 characters from a string which are not US-ASCII (includes all emojis)
-        input: String to process
-    RETURNS Processed string
-~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-String remove_emojis(String input) {
-    // Define the character to use to replace non ASCII charactes
-    const char blank_char = 178;
-    // This string will hold the output
-    String output = "";
-
-    // Go through each character in the input
-    for (int i = 0; i < input.length(); i++) {
-        // Pull the current character
-        char current_char = input.charAt(i);
-        // If the character is a single-byte UTF-8 character, copy it to the output
-        if (current_char < 192) {
-            output += String(current_char);
-            // If the character is a 2 byte UTF-8 character, replace it with the blank character and skip 1 byte
-        } else if (current_char >= 192 && current_char < 224) {
-            output += blank_char;
-            i++;
-            // If the character is a 3 byte UTF-8 character, replace it with the blank character and skip 2 bytes
-        } else if (current_char >= 224 && current_char < 240) {
-            output += blank_char;
-            i = i + 2;
-            // If the character is a 4 byte UTF-8 character, replace it with the blank character and skip 3 bytes
-        } else {
-            output += blank_char;
-            i = i + 3;
-        }
-    }
-
-    return output;
+    device_stats.record_message_printed();
 }
 
 /*  new_message: Called when a new message is received via MQTT
@@ -220,23 +199,33 @@ String remove_emojis(String input) {
         length: Length of byte array
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void new_message(char* topic, byte* payload, unsigned int length) {
-    // Put payload into String
-    String message;
-    for (unsigned int i = 0; i < length; i++) {
-        message += (char)payload[i];
+    // Find each field in the payload without copying it, v1 (text) and v2 (binary) messages are both understood
+    message_fields message;
+    if (!parse_message(payload, length, &message)) {
+        console_log("Message from the server couldn't be read");
+        return;
     }
 
-    // Parse message
-    String id = message.substring(message.indexOf("id:") + 3, message.indexOf("\nfrom:"));
-    String from_number = message.substring(message.indexOf("from:") + 5, message.indexOf("\nbody:"));
-    String body = message.substring(message.indexOf("body:") + 5, message.indexOf("\nmedia:"));
-    String media = message.substring(message.indexOf("media:") + 6, message.indexOf("\ntime:"));
-    String time = message.substring(message.indexOf("time:") + 5, message.length());
-
     // Sometimes duplicates come in, so always save ID of last message so it isn't processed twice
-    if (id != last_message_ID) {
-        process_message(time, from_number, remove_emojis(body), media);
-        last_message_ID = id;
+    if (!message.id.length || !field_equals(message.id, last_message_ID)) {
+        device_stats.record_message_received();
+        String from_number = field_to_string(message.from);
+
+        // The journal keeps the media as text, the way v1 messages send it
+        String media = message.media_count ? "" : "0";
+        for (uint8_t i = 0; i < message.media_count; i++) {
+            if (i) media += ',';
+            media += message.media[i] == MEDIA_UNSUPPORTED ? String("NS") : String(message.media[i]);
+        }
+
+        // Keep the message before printing it, so it isn't lost if printing fails. The printer converts it from UTF-8.
+        String body = field_to_string(message.body);
+        journal.append(message.time, from_number, body, media);
+        process_message(message.time, from_number, body, message.media, message.media_count);
+        // Twilio IDs are 34 characters, anything longer is cut off
+        uint16_t id_length = message.id.length < sizeof(last_message_ID) - 1 ? message.id.length : sizeof(last_message_ID) - 1;
+        if (id_length) memcpy(last_message_ID, message.id.data, id_length);
+        last_message_ID[id_length] = 0;
     }
 }
 
@@ -251,8 +240,12 @@ bool connect_to_MQTT(bool verbose = true) {
         // Attempt to connect to the MQTT server with clean-session turned off
         if (MQTT_client.connect(phone_number.c_str(), NULL, NULL, "fax", 0, false, "disconnect", false)) {
             // If successful, subscribe to the topic for the phone number at a QoS of 1 (!!! More security required)
-            String topic = "smsin-" + phone_number;
+            // The bridge sends v2 messages on smsin2-, and v1 messages for older firmware on smsin-
+            String topic = "smsin2-" + phone_number;
             MQTT_client.subscribe(topic.c_str(), 1);
+            // The session may still hold the v1 topic from older firmware, so each message would arrive twice
+            topic = "smsin-" + phone_number;
+            MQTT_client.unsubscribe(topic.c_str());
 
             // If MQTT hasn't yet connected...
             if (!MQTT_connected && verbose) {
@@ -270,6 +263,8 @@ bool connect_to_MQTT(bool verbose = true) {
             }
 
             // MQTT has now connected
+            console_log("Connected to message server " + bridge_URL);
+            device_stats.record_MQTT_connect();
             MQTT_connected = true;
             return true;
         }
@@ -307,6 +302,7 @@ void connection_failed() {
 /*  connected: Called when WiFi_manager confirms that an IP address has been assigned
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void connected() {
+    console_log("Wi-Fi connected to " + WiFi_manager.get_SSID() + ", web interface at http://" + WiFi_manager.get_IP());
     if (!WiFi_connection_success || printDisconnectMessages) {
         // Print the current Wi-Fi Network
         printer.print_status("WiFi Connected: " + WiFi_manager.get_SSID(), 0);
@@ -333,6 +329,7 @@ void connected() {
 /*  disconnected: Called when WiFi_manager confirms that connection to the network has been lost
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void disconnected() {
+    console_log("Lost Wi-Fi connection");
     if (printDisconnectMessages) {
         // If available, print the time
         if (WTA_clock.status()) printer.print_status(WTA_clock.get_timestamp(), 0);
@@ -363,65 +360,111 @@ void create_hotspot() {
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void load_settings() {
     // Load variables
-    phone_number = web_interface.load_setting("phone_number");
-    owner_name = web_interface.load_setting("owner_name");
-    bridge_URL = web_interface.load_setting("bridge_URL");
+    phone_number = web_interface.setting(SETTING_PHONE_NUMBER).text;
+    owner_name = web_interface.setting(SETTING_OWNER_NAME).text;
+    bridge_URL = web_interface.setting(SETTING_BRIDGE_URL).text;
     if (bridge_URL.startsWith("http://")) bridge_URL = bridge_URL.substring(7);
     if (bridge_URL.startsWith("https://")) bridge_URL = bridge_URL.substring(8);
-    OTA_password = web_interface.load_setting("OTA_password");
-    button_pin = web_interface.load_setting("button_pin").toInt();
-    LED_pin = web_interface.load_setting("LED_pin").toInt();
-
-    // Load send_replies and check if value is true or false
-    String send_replies_string = web_interface.load_setting("send_replies");
-    if (send_replies_string == "true") {
-        send_replies = true;
-    } else {
-        send_replies = false;
-    }
-
-    // Load img_photos and check if value is true or false
-    String img_photos_string = web_interface.load_setting("img_photos");
-    bool img_photos;
-    if (img_photos_string == "true") {
-        img_photos = true;
-    } else {
-        img_photos = false;
-    }
+    OTA_password = web_interface.setting(SETTING_OTA_PASSWORD).text;
+    button_pin = web_interface.setting(SETTING_BUTTON_PIN).number;
+    LED_pin = web_interface.setting(SETTING_LED_PIN).number;
 
-    // Set up printer and WiFi Manager
-    printer.config(web_interface.load_setting("printer_baud").toInt(), web_interface.load_setting("printer_DTR_pin").toInt(), img_photos);
-    printer.set_printing_parameters(web_interface.load_setting("printer_heating_dots").toInt(), web_interface.load_setting("printer_heating_time").toInt(), web_interface.load_setting("printer_heating_interval").toInt());
+    // Load send_replies
+    send_replies = web_interface.setting(SETTING_SEND_REPLIES).on;
 
     // Set up Twilio
-    String twilio_SID = web_interface.load_setting("Twilio_account_SID");
-    String twilio_auth = web_interface.load_setting("Twilio_auth_token");
+    const String& twilio_SID = web_interface.setting(SETTING_TWILIO_ACCOUNT_SID).text;
+    const String& twilio_auth = web_interface.setting(SETTING_TWILIO_AUTH_TOKEN).text;
     if (twilio_SID == "" || twilio_auth == "") send_replies = false;
-    if (send_replies) twilio.config(web_interface.load_setting("Twilio_account_SID"), web_interface.load_setting("Twilio_auth_token"));
+    if (send_replies) twilio.config(twilio_SID, twilio_auth);
 
     // Set up WiFi
-    hotspot_SSID = web_interface.load_setting("hotspot_SSID");
-    hotspot_password = web_interface.load_setting("hotspot_password");
-    WiFi_manager.add_network(web_interface.load_setting("wifi_SSID_1"), web_interface.load_setting("wifi_password_1"));
-    WiFi_manager.add_network(web_interface.load_setting("wifi_SSID_2"), web_interface.load_setting("wifi_password_2"));
-    WiFi_manager.add_network(web_interface.load_setting("wifi_SSID_3"), web_interface.load_setting("wifi_password_3"));
+    hotspot_SSID = web_interface.setting(SETTING_HOTSPOT_SSID).text;
+    hotspot_password = web_interface.setting(SETTING_HOTSPOT_PASSWORD).text;
+    WiFi_manager.add_network(web_interface.setting(SETTING_WIFI_SSID_1).text, web_interface.setting(SETTING_WIFI_PASSWORD_1).text);
+    WiFi_manager.add_network(web_interface.setting(SETTING_WIFI_SSID_2).text, web_interface.setting(SETTING_WIFI_PASSWORD_2).text);
+    WiFi_manager.add_network(web_interface.setting(SETTING_WIFI_SSID_3).text, web_interface.setting(SETTING_WIFI_PASSWORD_3).text);
+}
+
+/*  start_printer: Configure and start the printer and set its printing parameters from the settings. Never
+        called while a message is printing, since it changes the baud rate and DTR pin.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void start_printer() {
+    printer.config(web_interface.setting(SETTING_PRINTER_BAUD).number, web_interface.setting(SETTING_PRINTER_DTR_PIN).number, web_interface.setting(SETTING_IMG_PHOTOS).on);
+    printer.set_code_page(web_interface.setting(SETTING_PRINTER_CODE_PAGE).number);
+    printer.begin();
+    printer.set_printing_parameters(web_interface.setting(SETTING_PRINTER_HEATING_DOTS).number, web_interface.setting(SETTING_PRINTER_HEATING_TIME).number, web_interface.setting(SETTING_PRINTER_HEATING_INTERVAL).number);
+}
+
+/*  apply_settings: Apply settings saved through the web interface without restarting
+        changed: True for each setting_id that changed
+    RETURNS True if they have been applied, false if the TAG Machine has to restart
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool apply_settings(const bool* changed) {
+    // The OTA updater only takes a password before it starts
+    if (changed[SETTING_OTA_PASSWORD]) return false;
+    console_log("Settings changed, applying them without restarting");
+
+    // Load the settings again, with a new list of Wi-Fi networks
+    WiFi_manager.clear_networks();
+    load_settings();
+
+    // PubSubClient keeps a pointer to the server name, which load_settings() has replaced
+    MQTT_client.setServer(bridge_URL.c_str(), 1883);
+
+    if (changed[SETTING_BUTTON_PIN]) pinMode(button_pin, INPUT_PULLUP);
+    if (changed[SETTING_LED_PIN]) pinMode(LED_pin, OUTPUT);
+
+    // Anything that could interrupt a message being printed, including the printer's configuration, waits for the next loop
+    if (changed[SETTING_PRINTER_BAUD] || changed[SETTING_PRINTER_DTR_PIN] || changed[SETTING_IMG_PHOTOS] || changed[SETTING_PRINTER_HEATING_DOTS] ||
+        changed[SETTING_PRINTER_HEATING_TIME] || changed[SETTING_PRINTER_HEATING_INTERVAL] || changed[SETTING_PRINTER_CODE_PAGE]) restart_printer = true;
+    if (changed[SETTING_BRIDGE_URL] || changed[SETTING_PHONE_NUMBER]) reconnect_MQTT = true;
+    if (changed[SETTING_WIFI_SSID_1] || changed[SETTING_WIFI_PASSWORD_1] || changed[SETTING_WIFI_SSID_2] ||
+        changed[SETTING_WIFI_PASSWORD_2] || changed[SETTING_WIFI_SSID_3] || changed[SETTING_WIFI_PASSWORD_3]) reconnect_WiFi = true;
+
+    return true;
 }
 
 /*  offline: Take LittleFS and printer offline ahead of restart, to avoid file system corruption and garbage printer output
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void offline() {
+    // Leave messages with the message server until after the restart, rather than lose them
+    is_offline = true;
+    MQTT_client.disconnect();
+    // Close the contacts log
+    contacts.end();
+    // Close the message journal
+    journal.end();
     // Disable LittleFS
     LittleFS.end();
     // Disable the printer so there is no garbage output
     printer.offline();
 }
 
+/*  printer_idle: Called while the printer is busy, so the web interface keeps answering while a message prints.
+        Only read-only requests are answered then. Uploads, updates and changes wait for loop(), so nothing
+        closes the storage or goes offline in the middle of a print.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void printer_idle() {
+    web_interface.handle(true);
+}
+
+/*  file_uploaded: Called when a file has been uploaded through the web interface
+        filename: Name of the uploaded file
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void file_uploaded(String filename) {
+    // If a contacts file was uploaded, replace the contacts with it
+    if (filename == "contacts.txt" || filename == "/contacts.txt") contacts.import_json("/contacts.txt");
+}
+
 /*  init_OTA: Initialize basic functions of the TAG Machine
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void init_OTA() {
     // Start the OTA updater using the device_password as the password
     ArduinoOTA.setHostname("tagmachine");
     ArduinoOTA.setPassword(OTA_password.c_str());
+    // Firmware uploaded through the web interface needs the same password
+    web_interface.set_update_password(OTA_password);
     // When an OTA update starts...
     ArduinoOTA.onStart([]() {
         // Take the printer offline
@@ -473,6 +516,9 @@ void bootloader(bool web_interface_on) {
         if (button_pressed && millis() > button_time + 5000) {
             LittleFS.remove("/settings.txt");
             LittleFS.remove("/contacts.txt");
+            LittleFS.remove("/contacts.log");
+            LittleFS.remove("/contacts.tbl");
+            journal.clear();
             offline();
             ESP.restart();
         }
@@ -493,6 +539,7 @@ void bootloader(bool web_interface_on) {
     ####  SETUP  ####
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void setup() {
+    device_stats.record_boot_start();
     pinMode(D0, OUTPUT);
     digitalWrite(LED_pin, HIGH);
     // Start the button to listen for bootloader mode
@@ -506,21 +553,37 @@ void setup() {
 
     // Start the web interface, returns true if the settings file is valid and false if not
     bool settings_valid = web_interface.begin();
+    device_stats.record_boot_step();
 
     // Set the callback function for taking the printer offline before restarting due to settings update
     web_interface.set_callback(offline);
-
-    // If the settings are valid, load them
+    // Set the callback function for keeping the contacts in sync with uploaded files
+    web_interface.set_upload_callback(file_uploaded);
+    // Serve the contacts for exporting
+    web_interface.set_contacts(&contacts);
+    // Serve the messages received
+    web_interface.set_messages(&journal);
+    // Hold contact changes in RAM and write them together, they are written before every restart by offline()
+    contacts.set_write_back(true);
+
+    // If the settings are valid, load them and apply any saved later without restarting
     if (settings_valid) {
         load_settings();
         init_OTA();
+        web_interface.set_settings_callback(apply_settings);
+        device_stats.record_boot_step();
         // If the settings file is invalid, start the bootloader with the web interface running
     } else {
         bootloader(true);
     }
 
     // Initialize the printer with the callback function for printing to the console
-    printer.begin();
+    start_printer();
+    device_stats.record_boot_step();
+#ifdef WEB_INTERFACE_ASYNC
+    // Only the event-driven web server can be run safely while printing
+    printer.set_idle_callback(printer_idle);
+#endif
 
     // Set the callback functions for the Wi-Fi Manager
     WiFi_manager.set_callbacks(connected, disconnected, connection_failed);
@@ -529,6 +592,7 @@ void setup() {
     File file = LittleFS.open("/logo.dat", "r");
     printer.print_bitmap_file(file, 2);
     file.close();
+    device_stats.record_boot_step();
 
     MQTT_client.setServer(bridge_URL.c_str(), 1883);
     // Set callback for incoming message from MQTT
@@ -537,12 +601,36 @@ void setup() {
 
     // Start the Wi-Fi
     begin_WiFi();
+    // Note how long setup took and the lowest free heap along the way, for /metrics
+    device_stats.record_boot_done();
 }
 
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
     ####  LOOP  ####
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void loop() {
+    // Count how long the last loop took, for /metrics
+    device_stats.record_loop();
+
+    // Let the contacts storage compact itself while idle
+    contacts.handle();
+
+    // Act on settings applied since the last loop
+    if (restart_printer) {
+        restart_printer = false;
+        start_printer();
+    }
+    if (reconnect_MQTT) {
+        reconnect_MQTT = false;
+        // Print that messages can be received again once it has reconnected
+        MQTT_connected = false;
+        MQTT_client.disconnect();
+    }
+    if (reconnect_WiFi) {
+        reconnect_WiFi = false;
+        WiFi_manager.networks_changed();
+    }
+
     // Handle the WiFiManager every loop and pull the status
     switch (WiFi_manager.handle()) {
         case WM_IDLE:             // No active connection
@@ -563,7 +651,7 @@ void loop() {
             if (MQTT_client.connected()) {
                 MQTT_client.loop();
                 // If the MQTT client is not connected...
-            } else {
+            } else if (!is_offline) {
                 // Attempt to connect to MQTT
                 connect_to_MQTT(printDisconnectMessages);
             }
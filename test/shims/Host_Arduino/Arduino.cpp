@@ -0,0 +1,145 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    The parts of the Arduino core the libraries use, for the host tests in the
+    native environment (pio test -e native).
+
+    millis() and micros() count from the start of the test, unless a test sets
+    the time itself with host_set_millis() so it can run a month in seconds.
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include "Arduino.h"
+#include <chrono>
+#include <ctype.h>
+#include <stdarg.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static bool fixed_millis = false; //True once a test has set the time
+static unsigned long current_millis = 0; //Time set by the test
+
+unsigned long micros(){
+    static auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+unsigned long millis(){
+    return fixed_millis ? current_millis : micros() / 1000;
+}
+
+/*  host_set_millis: Set the time returned by millis() from now on
+        ms: Time
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void host_set_millis(unsigned long ms){
+    fixed_millis = true;
+    current_millis = ms;
+}
+
+void yield(){}
+
+void delay(unsigned long ms){
+    if(fixed_millis) current_millis += ms;
+}
+
+String::String(unsigned long number, unsigned char base){
+    char buffer[sizeof(number) * 8 + 1];
+    char* c = buffer + sizeof(buffer) - 1;
+    *c = '\0';
+    do{
+        uint8_t digit = number % base;
+        *--c = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        number /= base;
+    }while(number);
+    value = c;
+}
+
+bool String::equalsIgnoreCase(const String& text) const {
+    if(value.size() != text.value.size()) return false;
+    for(size_t i = 0; i < value.size(); i++){
+        if(tolower((uint8_t)value[i]) != tolower((uint8_t)text.value[i])) return false;
+    }
+    return true;
+}
+
+void String::trim(){
+    size_t first = value.find_first_not_of(" \t\r\n");
+    size_t last = value.find_last_not_of(" \t\r\n");
+    value = first == std::string::npos ? std::string() : value.substr(first, last - first + 1);
+}
+
+void String::toLowerCase(){
+    for(char& c : value) c = tolower((uint8_t)c);
+}
+
+String operator+(const String& a, const String& b){
+    String result(a);
+    result += b;
+    return result;
+}
+
+String operator+(const String& a, const char* b){
+    String result(a);
+    result += b;
+    return result;
+}
+
+String operator+(const char* a, const String& b){
+    String result(a);
+    result += b;
+    return result;
+}
+
+String operator+(const String& a, char b){
+    String result(a);
+    result += b;
+    return result;
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size){
+    size_t written = 0;
+    while(size-- && write(*buffer++)) written++;
+    return written;
+}
+
+size_t Print::print(long number, int base){
+    if(number < 0 && base == 10) return print('-') + print((unsigned long)-number, base);
+    return print((unsigned long)number, base);
+}
+
+size_t Print::print(unsigned long number, int base){
+    return print(String(number, base));
+}
+
+size_t Print::print(long long number, int base){
+    if(number < 0 && base == 10) return print('-') + print((unsigned long long)-number, base);
+    return print((unsigned long long)number, base);
+}
+
+size_t Print::print(unsigned long long number, int base){
+    return print(String((unsigned long)number, base));
+}
+
+size_t Print::print(double number, int digits){
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, number);
+    return print(buffer);
+}
+
+size_t Print::printf(const char* format, ...){
+    char buffer[512];
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(buffer, sizeof(buffer), format, arguments);
+    va_end(arguments);
+    return print(buffer);
+}
+
+size_t Stream::read(uint8_t* buffer, size_t size){
+    size_t count = 0;
+    int c;
+    while(count < size && (c = read()) >= 0) buffer[count++] = c;
+    return count;
+}
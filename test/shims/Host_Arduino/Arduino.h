@@ -0,0 +1,161 @@
+#pragma once
+
+//Stands in for the parts of the Arduino core the libraries use, so they can be built and tested on a computer
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <type_traits>
+
+typedef uint8_t byte;
+
+//Flash is ordinary memory here
+#define PROGMEM
+#define PSTR(text) (text)
+#define F(text) (text)
+#define FPSTR(pointer) (pointer)
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define pgm_read_dword(address) (*(const uint32_t*)(address))
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+unsigned long
+    millis(),
+    micros();
+
+void
+    yield(),
+    delay(unsigned long ms),
+    host_set_millis(unsigned long ms);
+
+template<class A, class B> typename std::common_type<A, B>::type min(A a, B b){ return a < b ? a : b; }
+template<class A, class B> typename std::common_type<A, B>::type max(A a, B b){ return a > b ? a : b; }
+
+//Arduino String, held in a std::string
+class String{
+    public:
+        String(){}
+        String(const char* text){ if(text) value = text; }
+        String(const std::string& text) : value(text){}
+        explicit String(char c) : value(1, c){}
+        explicit String(int number) : value(std::to_string(number)){}
+        explicit String(unsigned int number) : value(std::to_string(number)){}
+        explicit String(long number) : value(std::to_string(number)){}
+        explicit String(unsigned long number) : value(std::to_string(number)){}
+        explicit String(long long number) : value(std::to_string(number)){}
+        explicit String(unsigned long long number) : value(std::to_string(number)){}
+        String(unsigned long number, unsigned char base);
+
+        unsigned int length() const { return value.size(); }
+        const char* c_str() const { return value.c_str(); }
+        char* begin(){ return &value[0]; }
+        bool reserve(unsigned int size){ value.reserve(size); return true; }
+
+        bool concat(const char* text, unsigned int length){ value.append(text, length); return true; }
+        bool concat(const String& text){ value += text.value; return true; }
+        bool concat(char c){ value += c; return true; }
+
+        String substring(unsigned int from) const { return from < value.size() ? value.substr(from) : std::string(); }
+        String substring(unsigned int from, unsigned int to) const { return from < to && from < value.size() ? value.substr(from, to - from) : std::string(); }
+        int indexOf(char c, unsigned int from = 0) const { return found(value.find(c, from)); }
+        int indexOf(const String& text, unsigned int from = 0) const { return found(value.find(text.value, from)); }
+        int lastIndexOf(char c) const { return found(value.rfind(c)); }
+        bool startsWith(const String& text) const { return value.compare(0, text.value.size(), text.value) == 0; }
+        bool endsWith(const String& text) const { return value.size() >= text.value.size() && value.compare(value.size() - text.value.size(), text.value.size(), text.value) == 0; }
+        bool equalsIgnoreCase(const String& text) const;
+        char charAt(unsigned int i) const { return i < value.size() ? value[i] : 0; }
+        long toInt() const { return atol(value.c_str()); }
+
+        void remove(unsigned int from){ if(from < value.size()) value.resize(from); }
+        void remove(unsigned int from, unsigned int count){ if(from < value.size()) value.erase(from, count); }
+        void trim();
+        void toLowerCase();
+
+        char operator[](unsigned int i) const { return value[i]; }
+        char& operator[](unsigned int i){ return value[i]; }
+        String& operator+=(const String& text){ value += text.value; return *this; }
+        String& operator+=(const char* text){ value += text; return *this; }
+        String& operator+=(char c){ value += c; return *this; }
+        bool operator==(const String& text) const { return value == text.value; }
+        bool operator==(const char* text) const { return value == text; }
+        bool operator!=(const String& text) const { return value != text.value; }
+        bool operator!=(const char* text) const { return value != text; }
+        bool operator<(const String& text) const { return value < text.value; }
+
+    private:
+        static int found(size_t position){ return position == std::string::npos ? -1 : (int)position; }
+        std::string value;
+};
+
+String
+    operator+(const String& a, const String& b),
+    operator+(const String& a, const char* b),
+    operator+(const char* a, const String& b),
+    operator+(const String& a, char b);
+
+//Base of everything that can be printed to
+class Print{
+    public:
+        virtual ~Print(){}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size);
+        size_t write(const char* text){ return write((const uint8_t*)text, strlen(text)); }
+        size_t write(const char* buffer, size_t size){ return write((const uint8_t*)buffer, size); }
+        virtual int availableForWrite(){ return 0; }
+        virtual void flush(){}
+
+        size_t print(const char* text){ return write(text); }
+        size_t print(const String& text){ return write(text.c_str(), text.length()); }
+        size_t print(char c){ return write((uint8_t)c); }
+        size_t print(int number, int base = 10){ return print((long)number, base); }
+        size_t print(unsigned int number, int base = 10){ return print((unsigned long)number, base); }
+        size_t print(long number, int base = 10);
+        size_t print(unsigned long number, int base = 10);
+        size_t print(long long number, int base = 10);
+        size_t print(unsigned long long number, int base = 10);
+        size_t print(double number, int digits = 2);
+        size_t println(){ return write("\r\n"); }
+        template<class T> size_t println(const T& value){ return print(value) + println(); }
+        size_t printf(const char* format, ...);
+};
+
+//Base of everything that can be read from
+class Stream : public Print{
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        virtual size_t read(uint8_t* buffer, size_t size);
+        size_t readBytes(uint8_t* buffer, size_t size){ return read(buffer, size); }
+        size_t readBytes(char* buffer, size_t size){ return read((uint8_t*)buffer, size); }
+        void setTimeout(unsigned long){}
+};
+
+//Prints to stdout
+class HardwareSerial : public Stream{
+    public:
+        void begin(unsigned long){}
+        size_t write(uint8_t c){ return fputc(c, stdout) == EOF ? 0 : 1; }
+        using Print::write;
+        int available(){ return 0; }
+        int read(){ return -1; }
+        int peek(){ return -1; }
+};
+
+extern HardwareSerial Serial;
+
+//Heap figures, which are fixed here
+class EspClass{
+    public:
+        uint32_t getFreeHeap(){ return 40000; }
+        uint32_t getMaxFreeBlockSize(){ return 30000; }
+        uint8_t getHeapFragmentation(){ return 0; }
+        uint32_t getChipId(){ return 0; }
+};
+
+extern EspClass ESP;
@@ -0,0 +1,38 @@
+#pragma once
+
+//Stands in for the types of the ESP8266 web server that Async_Web_Server uses. The server itself isn't here.
+
+#include "ESP8266WiFi.h"
+#include "FS.h"
+#include <functional>
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+#define HTTP_UPLOAD_BUFLEN 2048
+
+enum HTTPMethod{
+    HTTP_ANY,
+    HTTP_GET,
+    HTTP_HEAD,
+    HTTP_POST,
+    HTTP_PUT,
+    HTTP_PATCH,
+    HTTP_DELETE,
+    HTTP_OPTIONS
+};
+
+enum HTTPUploadStatus{
+    UPLOAD_FILE_START,
+    UPLOAD_FILE_WRITE,
+    UPLOAD_FILE_END,
+    UPLOAD_FILE_ABORTED
+};
+
+struct HTTPUpload{
+    HTTPUploadStatus status;
+    String filename;
+    String name;
+    String type;
+    size_t totalSize;
+    size_t currentSize;
+    uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
@@ -0,0 +1,164 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    WiFi client and server with the connections held in memory, for the host
+    tests in the native environment.
+
+    A test opens a connection with host_connect(), sends the request with
+    host_send(), and reads the response with host_receive(). Like TCP, the
+    server can only write as much as the client has room for (the window),
+    which grows as the client reads, so a client that reads slowly holds
+    the server back.
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include "ESP8266WiFi.h"
+#include <algorithm>
+#include <deque>
+#include <map>
+
+//Window of a new connection, one TCP segment like on the ESP8266
+#define HOST_WINDOW 536
+
+//Both directions of a connection
+struct host_connection{
+    std::deque<uint8_t> request; //Bytes sent by the client, not read by the server yet
+    std::deque<uint8_t> response; //Bytes written by the server, not read by the client yet
+    size_t window = HOST_WINDOW; //Bytes the server can still write
+    bool client_open = true;
+    bool server_open = true;
+};
+
+static std::map<int, host_connection> connections; //Every connection, by ID
+static std::deque<int> waiting; //Connections the server hasn't accepted yet
+static int next_id = 1;
+
+/*  find: Find a connection
+        id: ID of the connection
+    RETURNS The connection, or NULL if there isn't one
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static host_connection* find(int id){
+    auto connection = connections.find(id);
+    return connection == connections.end() ? NULL : &connection->second;
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size){
+    host_connection* connection = find(id);
+    if(!connection || !connection->client_open || !connection->server_open) return 0;
+    if(size > connection->window) size = connection->window;
+    connection->response.insert(connection->response.end(), buffer, buffer + size);
+    connection->window -= size;
+    return size;
+}
+
+int WiFiClient::availableForWrite(){
+    host_connection* connection = find(id);
+    return connection && connection->client_open ? connection->window : 0;
+}
+
+int WiFiClient::available(){
+    host_connection* connection = find(id);
+    return connection ? connection->request.size() : 0;
+}
+
+int WiFiClient::read(){
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::peek(){
+    host_connection* connection = find(id);
+    return connection && !connection->request.empty() ? connection->request.front() : -1;
+}
+
+size_t WiFiClient::read(uint8_t* buffer, size_t size){
+    host_connection* connection = find(id);
+    if(!connection) return 0;
+    if(size > connection->request.size()) size = connection->request.size();
+    std::copy(connection->request.begin(), connection->request.begin() + size, buffer);
+    connection->request.erase(connection->request.begin(), connection->request.begin() + size);
+    return size;
+}
+
+uint8_t WiFiClient::connected(){
+    host_connection* connection = find(id);
+    return connection && connection->client_open && connection->server_open;
+}
+
+void WiFiClient::stop(){
+    host_connection* connection = find(id);
+    if(connection) connection->server_open = false;
+}
+
+bool WiFiServer::hasClient(){
+    return !waiting.empty();
+}
+
+WiFiClient WiFiServer::available(){
+    if(waiting.empty()) return WiFiClient();
+    int id = waiting.front();
+    waiting.pop_front();
+    return WiFiClient(id);
+}
+
+/*  host_connect: Connect a new client to the server
+    RETURNS ID of the connection
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+int host_connect(){
+    int id = next_id++;
+    connections[id];
+    waiting.push_back(id);
+    return id;
+}
+
+/*  host_send: Send bytes from a client to the server
+        id: ID of the connection
+        data: Bytes to send
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void host_send(int id, const String& data){
+    host_connection* connection = find(id);
+    if(connection) connection->request.insert(connection->request.end(), data.c_str(), data.c_str() + data.length());
+}
+
+/*  host_receive: Read the bytes the server wrote to a client, which makes room for more
+        id: ID of the connection
+        data: String the bytes are added to
+        max: Most bytes to read
+    RETURNS Number of bytes read
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+size_t host_receive(int id, String& data, size_t max){
+    host_connection* connection = find(id);
+    if(!connection) return 0;
+    size_t count = min(max, connection->response.size());
+    for(size_t i = 0; i < count; i++) data += (char)connection->response[i];
+    connection->response.erase(connection->response.begin(), connection->response.begin() + count);
+    connection->window += count;
+    return count;
+}
+
+/*  host_disconnect: Disconnect a client, as if it went away
+        id: ID of the connection
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void host_disconnect(int id){
+    host_connection* connection = find(id);
+    if(connection) connection->client_open = false;
+}
+
+/*  host_set_window: Set how many bytes the server can write to a client before it reads them
+        id: ID of the connection
+        bytes: Size of the window
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void host_set_window(int id, size_t bytes){
+    host_connection* connection = find(id);
+    if(connection) connection->window = bytes;
+}
+
+/*  host_server_closed: Check if the server closed a connection
+        id: ID of the connection
+    RETURNS True if the server called stop()
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+bool host_server_closed(int id){
+    host_connection* connection = find(id);
+    return connection && !connection->server_open;
+}
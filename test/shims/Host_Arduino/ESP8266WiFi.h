@@ -0,0 +1,54 @@
+#pragma once
+
+//Stands in for the WiFi client and server with connections held in memory, so the web server can be tested on a computer
+
+#include "Arduino.h"
+
+//Connection to a client. Copies share the same connection, like on the ESP8266.
+class WiFiClient : public Stream{
+    public:
+        WiFiClient(){}
+        WiFiClient(int id) : id(id){}
+
+        size_t write(uint8_t c){ return write(&c, 1); }
+        size_t write(const uint8_t* buffer, size_t size);
+        using Print::write;
+        int availableForWrite();
+        int available();
+        int read();
+        int peek();
+        size_t read(uint8_t* buffer, size_t size);
+        uint8_t connected();
+        void stop();
+        void setNoDelay(bool){}
+        operator bool(){ return connected(); }
+
+    private:
+        int id = 0; //Connection, or 0 if there isn't one
+};
+
+//Accepts the connections made with host_connect()
+class WiFiServer{
+    public:
+        WiFiServer(uint16_t){}
+
+        void begin(){}
+        void setNoDelay(bool){}
+        bool hasClient();
+        WiFiClient available();
+};
+
+//Test helpers
+int
+    host_connect();
+
+void
+    host_send(int id, const String& data),
+    host_disconnect(int id),
+    host_set_window(int id, size_t bytes);
+
+size_t
+    host_receive(int id, String& data, size_t max);
+
+bool
+    host_server_closed(int id);
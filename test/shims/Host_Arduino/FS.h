@@ -0,0 +1,90 @@
+#pragma once
+
+//Stands in for the Arduino file system API with files held in memory, so the libraries can be tested on a computer
+
+#include "Arduino.h"
+#include <memory>
+#include <vector>
+
+enum SeekMode{
+    SeekSet,
+    SeekCur,
+    SeekEnd
+};
+
+struct host_file; //Contents of a file
+struct host_handle; //An open file
+
+//Open file. Copies share the same position, like on the ESP8266.
+class File : public Stream{
+    public:
+        File(){}
+        File(std::shared_ptr<host_handle> handle) : handle(handle){}
+
+        size_t write(uint8_t c){ return write(&c, 1); }
+        size_t write(const uint8_t* buffer, size_t size);
+        using Print::write;
+        int available();
+        int read();
+        int peek();
+        size_t read(uint8_t* buffer, size_t size);
+        bool seek(uint32_t position, SeekMode mode = SeekSet);
+        size_t position() const;
+        size_t size() const;
+        bool truncate(uint32_t size);
+        void flush(){}
+        void close();
+        const char* name() const;
+        const char* fullName() const;
+        bool isDirectory() const { return false; }
+        operator bool() const;
+
+    private:
+        std::shared_ptr<host_handle> handle;
+};
+
+//List of the files and folders in a folder
+class Dir{
+    public:
+        bool next();
+        String fileName();
+        size_t fileSize();
+        time_t fileTime(){ return 0; }
+        bool isDirectory();
+
+        std::vector<String> names; //Names in the folder, folders ending in /
+        std::vector<size_t> sizes; //Size of each file
+        int current = -1; //Position in names
+};
+
+struct FSInfo{
+    size_t totalBytes;
+    size_t usedBytes;
+    size_t blockSize;
+    size_t pageSize;
+    size_t maxOpenFiles;
+    size_t maxPathLength;
+};
+
+//File system held in memory
+class FS{
+    public:
+        bool begin(){ return true; }
+        void end(){}
+        File open(const String& path, const char* mode);
+        bool exists(const String& path);
+        bool remove(const String& path);
+        bool rename(const String& from, const String& to);
+        bool mkdir(const String&){ return true; }
+        Dir openDir(const String& path);
+        bool info(FSInfo& info);
+};
+
+//Test helpers
+void
+    host_file_put(const char* path, const char* data, size_t size),
+    host_file_cut(const char* path, size_t bytes),
+    host_format();
+
+size_t
+    host_file_size(const char* path);
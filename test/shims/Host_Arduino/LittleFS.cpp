@@ -0,0 +1,221 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    LittleFS with the files held in memory, for the host tests in the native
+    environment. Files opened with "a" or "a+" are always written at the end,
+    and files opened with "r" can't be written, like on the ESP8266.
+
+    host_file_put() puts a file in place, host_file_cut() cuts the end off a
+    file as a power cut in the middle of a write would, and host_format()
+    deletes every file.
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include "LittleFS.h"
+#include <map>
+#include <string>
+
+struct host_file{
+    std::vector<uint8_t> data;
+};
+
+struct host_handle{
+    std::shared_ptr<host_file> file;
+    std::string path;
+    size_t position = 0;
+    bool writable = false;
+    bool append = false;
+    bool open = true;
+};
+
+FS LittleFS;
+
+static std::map<std::string, std::shared_ptr<host_file>> files; //Every file, by path
+
+size_t File::write(const uint8_t* buffer, size_t size){
+    if(!*this || !handle->writable) return 0;
+    std::vector<uint8_t>& data = handle->file->data;
+    if(handle->append) handle->position = data.size();
+    if(data.size() < handle->position + size) data.resize(handle->position + size);
+    memcpy(data.data() + handle->position, buffer, size);
+    handle->position += size;
+    return size;
+}
+
+int File::available(){
+    if(!*this || handle->position >= handle->file->data.size()) return 0;
+    return handle->file->data.size() - handle->position;
+}
+
+int File::read(){
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int File::peek(){
+    if(!available()) return -1;
+    return handle->file->data[handle->position];
+}
+
+size_t File::read(uint8_t* buffer, size_t size){
+    size_t count = available();
+    if(count > size) count = size;
+    if(count) memcpy(buffer, handle->file->data.data() + handle->position, count);
+    if(*this) handle->position += count;
+    return count;
+}
+
+bool File::seek(uint32_t position, SeekMode mode){
+    if(!*this) return false;
+    if(mode == SeekCur) position += handle->position;
+    if(mode == SeekEnd) position += handle->file->data.size();
+    if(position > handle->file->data.size()) return false;
+    handle->position = position;
+    return true;
+}
+
+size_t File::position() const {
+    return *this ? handle->position : 0;
+}
+
+size_t File::size() const {
+    return *this ? handle->file->data.size() : 0;
+}
+
+bool File::truncate(uint32_t size){
+    if(!*this || !handle->writable) return false;
+    handle->file->data.resize(size);
+    if(handle->position > size) handle->position = size;
+    return true;
+}
+
+void File::close(){
+    if(handle) handle->open = false;
+}
+
+const char* File::name() const {
+    if(!handle) return "";
+    size_t slash = handle->path.rfind('/');
+    return handle->path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+const char* File::fullName() const {
+    return handle ? handle->path.c_str() : "";
+}
+
+File::operator bool() const {
+    return handle && handle->open;
+}
+
+File FS::open(const String& path, const char* mode){
+    std::string key = path.c_str();
+    bool exists = files.count(key);
+    if(mode[0] == 'r' && !exists) return File();
+    if(mode[0] == 'w' || !exists) files[key] = std::make_shared<host_file>();
+
+    std::shared_ptr<host_handle> handle = std::make_shared<host_handle>();
+    handle->file = files[key];
+    handle->path = key;
+    handle->writable = mode[0] != 'r' || mode[1] == '+';
+    handle->append = mode[0] == 'a';
+    return File(handle);
+}
+
+bool FS::exists(const String& path){
+    return files.count(path.c_str());
+}
+
+bool FS::remove(const String& path){
+    return files.erase(path.c_str());
+}
+
+bool FS::rename(const String& from, const String& to){
+    auto file = files.find(from.c_str());
+    if(file == files.end()) return false;
+    files[to.c_str()] = file->second;
+    files.erase(from.c_str());
+    return true;
+}
+
+Dir FS::openDir(const String& path){
+    std::string folder = path.c_str();
+    if(folder.empty() || folder.back() != '/') folder += '/';
+
+    Dir dir;
+    for(auto& file : files){
+        if(file.first.compare(0, folder.size(), folder) != 0) continue;
+        std::string rest = file.first.substr(folder.size());
+        size_t slash = rest.find('/');
+        if(slash != std::string::npos) rest = rest.substr(0, slash + 1);
+        if(!dir.names.empty() && dir.names.back() == rest.c_str()) continue;
+        dir.names.push_back(rest.c_str());
+        dir.sizes.push_back(slash == std::string::npos ? file.second->data.size() : 0);
+    }
+    return dir;
+}
+
+bool FS::info(FSInfo& info){
+    info.totalBytes = 1024 * 1024 - 4 * 8192;
+    info.usedBytes = 0;
+    for(auto& file : files) info.usedBytes += file.second->data.size();
+    info.blockSize = 8192;
+    info.pageSize = 256;
+    info.maxOpenFiles = 5;
+    info.maxPathLength = 32;
+    return true;
+}
+
+bool Dir::next(){
+    return ++current < (int)names.size();
+}
+
+String Dir::fileName(){
+    String name = names[current];
+    if(name.endsWith("/")) name.remove(name.length() - 1);
+    return name;
+}
+
+size_t Dir::fileSize(){
+    return sizes[current];
+}
+
+bool Dir::isDirectory(){
+    return names[current].endsWith("/");
+}
+
+/*  host_file_put: Create a file, or replace it
+        path: Path of the file
+        data: Contents
+        size: Size in bytes
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void host_file_put(const char* path, const char* data, size_t size){
+    files[path] = std::make_shared<host_file>();
+    files[path]->data.assign(data, data + size);
+}
+
+/*  host_file_cut: Cut the end off a file, as a power cut in the middle of a write would
+        path: Path of the file
+        bytes: Number of bytes to cut off
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void host_file_cut(const char* path, size_t bytes){
+    auto file = files.find(path);
+    if(file == files.end()) return;
+    std::vector<uint8_t>& data = file->second->data;
+    data.resize(data.size() > bytes ? data.size() - bytes : 0);
+}
+
+/*  host_file_size: Get the size of a file
+        path: Path of the file
+    RETURNS Size in bytes, or 0 if it doesn't exist
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+size_t host_file_size(const char* path){
+    auto file = files.find(path);
+    return file == files.end() ? 0 : file->second->data.size();
+}
+
+/*  host_format: Delete every file
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void host_format(){
+    files.clear();
+}
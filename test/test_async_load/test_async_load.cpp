@@ -0,0 +1,300 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    Host load test for Async_Web_Server: a slow client downloads a large file,
+    then a large page printed a piece at a time, while others make small
+    requests over keep-alive, which have to keep being answered within a pass
+    or so. Also covers form posts, chunked responses, HTTP/1.0, and multipart
+    uploads sent in small pieces or cut off.
+
+    Run with: pio test -e native -f test_async_load
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include <unity.h>
+#include <algorithm>
+#include <vector>
+#include "Async_Web_Server.h"
+#include "LittleFS.h"
+
+static Async_Web_Server server(80);
+static String big; //Contents of /big.txt
+static String streamed; //Body printed by /stream
+static String uploaded; //Data received by the upload handler
+static int upload_events[4]; //Number of upload calls with each status
+
+void setUp(){}
+void tearDown(){}
+
+/*  body_start: Find the start of the body of a response
+    RETURNS Position, or -1 if the headers aren't all there yet
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static int body_start(const String& response){
+    int end = response.indexOf("\r\n\r\n");
+    return end < 0 ? -1 : end + 4;
+}
+
+/*  complete: Check if a whole response has been received
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static bool complete(const String& response){
+    int body = body_start(response);
+    if(body < 0) return false;
+    int length = response.indexOf("Content-Length: ");
+    if(length >= 0 && length < body) return response.length() - body >= (unsigned int)atol(response.c_str() + length + 16);
+    int chunked = response.indexOf("chunked");
+    return chunked >= 0 && chunked < body && response.endsWith("0\r\n\r\n");
+}
+
+/*  run: Run the server for a few passes, reading everything it sends to a client
+        id: ID of the connection
+        response: String the response is added to
+        passes: Number of passes
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void run(int id, String& response, int passes){
+    for(int i = 0; i < passes; i++){
+        server.handleClient();
+        host_receive(id, response, 4096);
+    }
+}
+
+/*  dechunk: Join the chunks of a chunked body
+        body: Chunked body
+    RETURNS the body without the chunk sizes
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static String dechunk(const String& body){
+    String joined;
+    unsigned int position = 0;
+    while(position < body.length()){
+        unsigned long size = strtoul(body.c_str() + position, NULL, 16);
+        int line_end = body.indexOf("\r\n", position);
+        if(line_end < 0 || size == 0) break;
+        joined += body.substring(line_end + 2, line_end + 2 + size);
+        position = line_end + 2 + size + 2;
+    }
+    return joined;
+}
+
+/*  slow_download: Download a large response with a client that reads 100 bytes a pass, while three
+        others keep making small requests that have to keep being answered within a pass or so
+        path: Path of the large response
+        expected: Body of the large response
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void slow_download(const char* path, const String& expected){
+    int slow = host_connect();
+    host_send(slow, "GET " + String(path) + " HTTP/1.1\r\nHost: x\r\n\r\n");
+    String slow_response;
+
+    int small[3];
+    String small_response[3];
+    int small_pass[3] = {0, 0, 0}; //Pass when each client sent its request
+    for(int i = 0; i < 3; i++){
+        small[i] = host_connect();
+        host_send(small[i], "GET / HTTP/1.1\r\n\r\n");
+    }
+
+    std::vector<int> latencies; //Passes each small request took
+    int pass = 0;
+    uint32_t start = micros();
+    while(!complete(slow_response) && pass < 100000){
+        server.handleClient();
+        pass++;
+        host_receive(slow, slow_response, 100);
+        for(int i = 0; i < 3; i++){
+            host_receive(small[i], small_response[i], 4096);
+            if(!complete(small_response[i])) continue;
+            TEST_ASSERT_TRUE(small_response[i].indexOf("hello") >= 0);
+            latencies.push_back(pass - small_pass[i]);
+            small_response[i] = "";
+            small_pass[i] = pass;
+            host_send(small[i], "GET / HTTP/1.1\r\n\r\n");
+        }
+    }
+    uint32_t elapsed = micros() - start;
+
+    TEST_ASSERT_TRUE(complete(slow_response));
+    String body = slow_response.substring(body_start(slow_response));
+    bool chunked = slow_response.indexOf("Transfer-Encoding: chunked") >= 0;
+    TEST_ASSERT_TRUE((chunked ? dechunk(body) : body) == expected);
+    std::sort(latencies.begin(), latencies.end());
+    char result[160];
+    snprintf(result, sizeof(result), "%s took %d passes, with %u small requests meanwhile: p50 %d, p99 %d, max %d passes, %.1f us/pass",
+        path, pass, (unsigned int)latencies.size(), latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back(), (double)elapsed / pass);
+    TEST_MESSAGE(result);
+    TEST_ASSERT_GREATER_THAN(100, latencies.size());
+    TEST_ASSERT_LESS_OR_EQUAL(1, latencies[latencies.size() * 99 / 100]);
+    TEST_ASSERT_LESS_OR_EQUAL(4, latencies.back());
+    host_disconnect(slow);
+    for(int i = 0; i < 3; i++) host_disconnect(small[i]);
+    server.handleClient();
+}
+
+void test_slow_download(){
+    slow_download("/big", big);
+}
+
+void test_slow_stream(){
+    //A page printed a piece at a time only prints the next piece once the client has read the last one
+    slow_download("/stream", streamed);
+}
+
+void test_requests(){
+    //A handler that prints more than ASYNC_OUTPUT_MAX waits for the client, so this one gets a wide window
+    int id = host_connect();
+    host_set_window(id, 1 << 20);
+    String response;
+
+    host_send(id, "POST /echo?a=1 HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: 9\r\n\r\nb=two%21x");
+    run(id, response, 10);
+    TEST_ASSERT_TRUE(response.indexOf("1|two!x") >= 0);
+
+    response = "";
+    host_send(id, "GET /chunks HTTP/1.1\r\n\r\n");
+    run(id, response, 50);
+    TEST_ASSERT_TRUE(complete(response));
+    TEST_ASSERT_TRUE(response.indexOf("line 299\n") >= 0);
+
+    //HTTP/1.0 closes the connection after the response
+    response = "";
+    host_send(id, "GET /missing HTTP/1.0\r\n\r\n");
+    run(id, response, 10);
+    TEST_ASSERT_TRUE(response.indexOf("404") >= 0);
+    TEST_ASSERT_TRUE(host_server_closed(id));
+}
+
+/*  upload_body: Make the body of a multipart upload
+        data: Data of the file
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static String upload_body(const String& data){
+    return "--boundXYZ\r\nContent-Disposition: form-data; name=\"f\"; filename=\"a.bin\"\r\n"
+        "Content-Type: application/octet-stream\r\n\r\n" + data + "\r\n--boundXYZ--\r\n";
+}
+
+/*  upload_headers: Make the headers of a multipart upload
+        length: Length of the body
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static String upload_headers(size_t length){
+    return "POST /upload HTTP/1.1\r\nContent-Type: multipart/form-data; boundary=boundXYZ\r\nContent-Length: "
+        + String((unsigned long)length) + "\r\n\r\n";
+}
+
+void test_upload(){
+    //Sent in small pieces, with line breaks, dashes, and the start of the boundary in the data
+    String data;
+    for(int i = 0; i < 10000; i++) data += (char)(i % 7 == 0 ? '\r' : i % 11 == 0 ? '\n' : i % 13 == 0 ? '-' : 'A' + i % 20);
+    data += "\r\n--bound";
+    String body = upload_body(data);
+
+    int id = host_connect();
+    String response;
+    host_send(id, upload_headers(body.length()));
+    for(unsigned int i = 0; i < body.length(); i += 97){
+        host_send(id, body.substring(i, i + 97));
+        run(id, response, 1);
+    }
+    run(id, response, 10);
+
+    TEST_ASSERT_TRUE(uploaded == data);
+    TEST_ASSERT_EQUAL(1, upload_events[UPLOAD_FILE_START]);
+    TEST_ASSERT_EQUAL(1, upload_events[UPLOAD_FILE_END]);
+    TEST_ASSERT_EQUAL(0, upload_events[UPLOAD_FILE_ABORTED]);
+    TEST_ASSERT_TRUE(response.indexOf("200 OK") >= 0);
+}
+
+void test_upload_cut_off(){
+    //A client that goes away in the middle of an upload aborts it
+    String body = upload_body(String(std::string(10000, 'A')));
+    int id = host_connect();
+    host_send(id, upload_headers(body.length()) + body.substring(0, 3000));
+    for(int i = 0; i < 10; i++) server.handleClient();
+    host_disconnect(id);
+    server.handleClient();
+    TEST_ASSERT_EQUAL(1, upload_events[UPLOAD_FILE_ABORTED]);
+}
+
+void test_read_only(){
+    //While read-only, GET requests are answered, and everything else waits unread, even in the middle of an upload
+    String body = upload_body(String(std::string(5000, 'B')));
+    int uploader = host_connect();
+    String upload_response;
+    host_send(uploader, upload_headers(body.length()) + body.substring(0, 1000));
+    run(uploader, upload_response, 5);
+    uploaded = "";
+    int started = upload_events[UPLOAD_FILE_START];
+    int ended = upload_events[UPLOAD_FILE_END];
+
+    int poster = host_connect();
+    int getter = host_connect();
+    String post_response, get_response;
+    host_send(uploader, body.substring(1000));
+    host_send(poster, "POST /echo?a=1 HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: 5\r\n\r\nb=two");
+    host_send(getter, "GET / HTTP/1.1\r\n\r\n");
+    for(int i = 0; i < 20; i++){
+        server.handleClient(true);
+        host_receive(uploader, upload_response, 4096);
+        host_receive(poster, post_response, 4096);
+        host_receive(getter, get_response, 4096);
+    }
+    TEST_ASSERT_TRUE(get_response.indexOf("hello") >= 0);
+    TEST_ASSERT_EQUAL(0, post_response.length());
+    TEST_ASSERT_EQUAL(0, upload_response.length());
+    TEST_ASSERT_EQUAL(0, uploaded.length());
+    TEST_ASSERT_FALSE(host_server_closed(poster));
+
+    //Once the pass isn't read-only, they carry on where they stopped
+    run(poster, post_response, 10);
+    run(uploader, upload_response, 10);
+    TEST_ASSERT_TRUE(post_response.indexOf("1|two") >= 0);
+    TEST_ASSERT_TRUE(upload_response.indexOf("200 OK") >= 0);
+    TEST_ASSERT_EQUAL(started, upload_events[UPLOAD_FILE_START]);
+    TEST_ASSERT_EQUAL(ended + 1, upload_events[UPLOAD_FILE_END]);
+}
+
+int main(){
+    for(int i = 0; i < 60000; i++) big += (char)('a' + i % 26);
+    host_file_put("/big.txt", big.c_str(), big.length());
+    for(int i = 0; i < 3000; i++) streamed += "line " + String(i) + "\n";
+
+    server.on("/", [](){
+        server.send(200, "text/plain", "hello");
+    });
+    server.on("/echo", HTTP_POST, [](){
+        server.send(200, "text/plain", server.arg("a") + "|" + server.arg("b"));
+    });
+    server.on("/big", [](){
+        File file = LittleFS.open("/big.txt", "r");
+        server.streamFile(file, "text/plain");
+        file.close();
+    });
+    server.on("/chunks", [](){
+        server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        server.send(200, "text/plain", "");
+        for(int i = 0; i < 300; i++) server.sendContent("line " + String(i) + "\n");
+    });
+    server.on("/stream", [](){
+        int next = 0; //Line printed at the start of the next piece
+        server.streamContent(200, "text/plain", [next](Print& output) mutable{
+            for(int end = next + 20; next < end && next < 3000; next++) output.printf("line %d\n", next);
+            return next < 3000;
+        });
+    });
+    server.on("/upload", HTTP_POST, [](){
+        server.send(200, "text/plain", "ok");
+    }, [](){
+        HTTPUpload& upload = server.upload();
+        upload_events[upload.status]++;
+        if(upload.status == UPLOAD_FILE_WRITE) uploaded.concat((const char*)upload.buf, upload.currentSize);
+    });
+    const char* header_keys[] = {"If-None-Match"};
+    server.collectHeaders(header_keys, 1);
+    server.begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_slow_download);
+    RUN_TEST(test_slow_stream);
+    RUN_TEST(test_requests);
+    RUN_TEST(test_upload);
+    RUN_TEST(test_upload_cut_off);
+    RUN_TEST(test_read_only);
+    return UNITY_END();
+}
@@ -0,0 +1,176 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    Host tests for Code_Page: every entry of every code page table and every
+    stand-in, text that isn't valid UTF-8, and the throughput of
+    transcode_utf8().
+
+    Run with: pio test -e native -f test_code_page
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include <unity.h>
+#include "Code_Page.h"
+#include "Code_Page_Tables.h"
+
+static char text[64]; //Text being converted
+
+void setUp(){}
+void tearDown(){}
+
+/*  encode: Put a code point into text in UTF-8
+        code_point: Code point
+    RETURNS Length in bytes
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static uint16_t encode(uint32_t code_point){
+    if(code_point < 0x80){
+        text[0] = code_point;
+        return 1;
+    }
+    if(code_point < 0x800){
+        text[0] = 0xC0 | code_point >> 6;
+        text[1] = 0x80 | (code_point & 0x3F);
+        return 2;
+    }
+    if(code_point < 0x10000){
+        text[0] = 0xE0 | code_point >> 12;
+        text[1] = 0x80 | ((code_point >> 6) & 0x3F);
+        text[2] = 0x80 | (code_point & 0x3F);
+        return 3;
+    }
+    text[0] = 0xF0 | code_point >> 18;
+    text[1] = 0x80 | ((code_point >> 12) & 0x3F);
+    text[2] = 0x80 | ((code_point >> 6) & 0x3F);
+    text[3] = 0x80 | (code_point & 0x3F);
+    return 4;
+}
+
+/*  convert: Convert some text and check the result
+        input: UTF-8 text, NULL terminated
+        expected: Text the printer should get, NULL terminated
+        number: Code page
+    RETURNS True if it matches, false if not
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static bool convert(const char* input, const char* expected, uint8_t number){
+    uint16_t length = strlen(input);
+    memcpy(text, input, length);
+    uint16_t converted = transcode_utf8(text, length, number);
+    return converted == strlen(expected) && memcmp(text, expected, converted) == 0;
+}
+
+/*  in_table: Check if a code page prints a character itself
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static bool in_table(const code_page& page, uint16_t code_point){
+    for(uint8_t i = 0; i < page.count; i++){
+        if(page.table[i].code_point == code_point) return true;
+    }
+    return false;
+}
+
+void test_every_table_entry(){
+    for(const code_page& page : CODE_PAGES){
+        for(uint8_t i = 0; i < page.count; i++){
+            uint16_t length = encode(page.table[i].code_point);
+            TEST_ASSERT_EQUAL_UINT(1, transcode_utf8(text, length, page.number));
+            TEST_ASSERT_EQUAL_HEX8(page.table[i].byte, text[0]);
+        }
+    }
+}
+
+void test_every_stand_in(){
+    //A stand-in is only used when the code page doesn't have the character
+    for(const code_page& page : CODE_PAGES){
+        for(const transliteration& stand_in : TRANSLITERATIONS){
+            uint16_t length = encode(stand_in.code_point);
+            uint16_t converted = transcode_utf8(text, length, page.number);
+            if(in_table(page, stand_in.code_point)){
+                TEST_ASSERT_EQUAL_UINT(1, converted);
+                TEST_ASSERT_TRUE((uint8_t)text[0] >= 0x80);
+            }else{
+                TEST_ASSERT_EQUAL_UINT(strlen(stand_in.text), converted);
+                TEST_ASSERT_EQUAL_MEMORY(stand_in.text, text, converted);
+            }
+        }
+    }
+}
+
+void test_unknown_characters(){
+    for(const code_page& page : CODE_PAGES){
+        const char unknown[2] = {(char)page.unknown, '\0'};
+        uint16_t length = encode(0x1F600); //Emoji
+        TEST_ASSERT_EQUAL_UINT(1, transcode_utf8(text, length, page.number));
+        TEST_ASSERT_EQUAL_HEX8(page.unknown, text[0]);
+        length = encode(0x4E2D); //CJK
+        TEST_ASSERT_EQUAL_UINT(1, transcode_utf8(text, length, page.number));
+        TEST_ASSERT_EQUAL_HEX8(page.unknown, text[0]);
+        TEST_ASSERT_TRUE(convert("plain ascii\n", "plain ascii\n", page.number));
+        TEST_ASSERT_TRUE(convert("\xF4\x90\x80\x80", unknown, page.number)); //Past U+10FFFF
+    }
+}
+
+void test_invalid_utf8(){
+    //Each broken sequence becomes one unknown character (0xB2 in PC437), and the byte that broke it is kept
+    TEST_ASSERT_TRUE(convert("\xC3", "\xB2", CODE_PAGE_PC437)); //Cut off by the end of the text
+    TEST_ASSERT_TRUE(convert("a\xE2\x80", "a\xB2", CODE_PAGE_PC437));
+    TEST_ASSERT_TRUE(convert("\xE2\x80" "b", "\xB2" "b", CODE_PAGE_PC437));
+    TEST_ASSERT_TRUE(convert("\x80\xBF", "\xB2\xB2", CODE_PAGE_PC437)); //Stray continuation bytes
+    TEST_ASSERT_TRUE(convert("\xC0\xAF", "\xB2\xB2", CODE_PAGE_PC437)); //Lead byte that can't be valid
+    TEST_ASSERT_TRUE(convert("\xE0\x80\xAF", "\xB2", CODE_PAGE_PC437)); //Overlong
+    TEST_ASSERT_TRUE(convert("\xED\xA0\x80", "\xB2", CODE_PAGE_PC437)); //Surrogate
+}
+
+void test_messages(){
+    TEST_ASSERT_TRUE(convert("caf\xC3\xA9", "caf\x82", CODE_PAGE_PC437));
+    TEST_ASSERT_TRUE(convert("\xE2\x80\x9CHi\xE2\x80\x9D \xE2\x80\xA6 \xE2\x82\xAC" "5", "\"Hi\" ... EUR5", CODE_PAGE_PC437));
+    TEST_ASSERT_TRUE(convert("\xE2\x82\xAC", "\x80", CODE_PAGE_WPC1252));
+    TEST_ASSERT_TRUE(convert("\xC5\x81\xC3\xB3" "d\xC5\xBA", "L\xA2" "dz", CODE_PAGE_PC437));
+
+    //Code pages that aren't supported are printed as PC437
+    TEST_ASSERT_TRUE(convert("\xC3\xA9", "\x82", 99));
+    TEST_ASSERT_TRUE(code_page_supported(CODE_PAGE_WPC1252));
+    TEST_ASSERT_FALSE(code_page_supported(1));
+}
+
+/*  throughput: Measure how fast a buffer is converted, best of several runs
+        input: Text
+        length: Length of the text
+    RETURNS MB/s
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static double throughput(const char* input, uint16_t length){
+    char* buffer = (char*)malloc(length);
+    uint32_t best = UINT32_MAX;
+    for(uint8_t run = 0; run < 200; run++){
+        memcpy(buffer, input, length);
+        uint32_t start = micros();
+        transcode_utf8(buffer, length, CODE_PAGE_PC850);
+        uint32_t elapsed = micros() - start;
+        if(elapsed < best) best = elapsed;
+    }
+    free(buffer);
+    return length / (best ? best : 1.0);
+}
+
+void test_benchmark(){
+    const char* sentence = "Bonjour \xC3\xA0 tous, \xC3\xA7" "a va? \xE2\x80\x9CTr\xC3\xA8s bien\xE2\x80\x9D \xF0\x9F\x98\x80 ";
+    String mixed;
+    while(mixed.length() < 60000) mixed += sentence;
+    String ascii;
+    while(ascii.length() < 60000) ascii += "The quick brown fox jumps over the lazy dog. ";
+
+    char result[96];
+    snprintf(result, sizeof(result), "transcode_utf8: %.0f MB/s mixed text, %.0f MB/s ASCII",
+        throughput(mixed.c_str(), mixed.length()), throughput(ascii.c_str(), ascii.length()));
+    TEST_MESSAGE(result);
+}
+
+int main(){
+    UNITY_BEGIN();
+    RUN_TEST(test_every_table_entry);
+    RUN_TEST(test_every_stand_in);
+    RUN_TEST(test_unknown_characters);
+    RUN_TEST(test_invalid_utf8);
+    RUN_TEST(test_messages);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,145 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    Host tests for Flash_Stats, and a benchmark that replays a month of
+    messages against Persistent_Storage to see how much flash they wear. The
+    result is compared with rewriting the whole contacts file on every change,
+    as older firmware did.
+
+    Run with: pio test -e native -f test_flash_wear
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include <unity.h>
+#include <random>
+#include <string>
+#include "Flash_Stats.h"
+#include "Persistent_Storage.h"
+
+//Counts everything printed to it, and keeps it if asked to
+struct Capture : public Print{
+    std::string text;
+    size_t length = 0;
+    bool keep = true;
+    size_t write(uint8_t c){ if(keep) text += (char)c; length++; return 1; }
+    using Print::write;
+};
+
+void setUp(){
+    host_format();
+    host_set_millis(0);
+}
+
+void tearDown(){}
+
+void test_blocks(){
+    Flash_Stats stats;
+    stats.record(FLASH_SETTINGS, "/settings.txt", 0, 100);
+    stats.record(FLASH_SETTINGS, "/settings.txt", 4000, 200); //Crosses into the next block
+    stats.record(FLASH_UPLOAD, "/www/index.html", 0, 8193);
+    stats.record(FLASH_UPLOAD, "/www/empty.txt", 0, 0);
+    TEST_ASSERT_EQUAL_UINT32(300, stats.get_bytes(FLASH_SETTINGS));
+    TEST_ASSERT_EQUAL_UINT32(3, stats.get_blocks(FLASH_SETTINGS));
+    TEST_ASSERT_EQUAL_UINT32(8193, stats.get_bytes(FLASH_UPLOAD));
+    TEST_ASSERT_EQUAL_UINT32(3, stats.get_blocks(FLASH_UPLOAD));
+    TEST_ASSERT_EQUAL_UINT32(0, stats.get_bytes(FLASH_SUBSYSTEMS));
+
+    //Once FLASH_FILES files are tracked, the rest are added up under "*"
+    char path[32];
+    for(int i = 0; i < FLASH_FILES + 5; i++){
+        snprintf(path, sizeof(path), "/file%d", i);
+        stats.record(FLASH_UPLOAD, path, 0, 10);
+    }
+    Capture metrics;
+    stats.print_metrics(metrics);
+    TEST_ASSERT_TRUE(metrics.text.find("flash_written_bytes_total{subsystem=\"upload\"} 8363\n") != std::string::npos);
+    TEST_ASSERT_TRUE(metrics.text.find("flash_file_written_bytes_total{path=\"/settings.txt\",subsystem=\"settings\"} 300\n") != std::string::npos);
+    TEST_ASSERT_TRUE(metrics.text.find("flash_file_written_bytes_total{path=\"*\",subsystem=\"upload\"} 80\n") != std::string::npos);
+}
+
+void test_rate(){
+    Flash_Stats stats;
+    stats.record(FLASH_CONTACTS, "/contacts.log", 0, 1000);
+    TEST_ASSERT_EQUAL_UINT32(60000, stats.get_bytes_per_hour()); //Less than an hour since boot, so it's scaled up
+    host_set_millis(30 * 60000);
+    stats.record(FLASH_CONTACTS, "/contacts.log", 1000, 1000);
+    TEST_ASSERT_EQUAL_UINT32(2000 * 60 / 31, stats.get_bytes_per_hour());
+    host_set_millis(85 * 60000); //Only the second write is still in the last hour
+    TEST_ASSERT_EQUAL_UINT32(1000, stats.get_bytes_per_hour());
+    TEST_ASSERT_EQUAL_UINT32(1, stats.get_blocks_per_hour());
+    host_set_millis(200 * 60000);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.get_bytes_per_hour());
+    Capture metrics;
+    stats.print_metrics(metrics);
+    TEST_ASSERT_TRUE(metrics.text.find("flash_estimated_lifetime_days +Inf\n") != std::string::npos);
+}
+
+void test_month(){
+    //40 messages a day from 400 senders. A new sender gets a name request, which is answered half the time.
+    //Settings are saved once a week.
+    Persistent_Storage contacts("contacts");
+    contacts.set_write_back(true);
+    std::mt19937 random(42);
+    uint32_t start = 1700000000;
+    uint64_t whole_file = 0; //Bytes older firmware would have written, rewriting the file on every change
+    Capture file;
+    file.keep = false;
+    int messages = 0;
+
+    for(int day = 0; day < 30; day++){
+        for(int message = 0; message < 40; message++){
+            uint32_t now = start + day * 86400 + message * 2000;
+            host_set_millis((uint64_t)(now - start) * 1000 % 0xFFFFFFFFUL);
+            contacts.set_time(now);
+            std::string sender = std::to_string(16040000000ULL + random() % 400);
+            uint8_t kind;
+            contacts.get(sender.c_str(), &kind);
+            bool changed = true;
+            if(kind == CONTACT_NONE) contacts.set_pending(sender.c_str(), now + PENDING_TTL);
+            else if(kind == CONTACT_PENDING && random() % 2) contacts.set(sender.c_str(), ("Name " + sender.substr(7)).c_str());
+            else changed = false;
+            if(changed){
+                file.length = 0;
+                contacts.export_json(file);
+                whole_file += file.length;
+            }
+            messages++;
+            for(int i = 0; i < 20; i++){
+                delay(1000);
+                contacts.handle();
+            }
+        }
+        if(day % 7 == 0){
+            std::string settings(3000, 'x');
+            File settings_file = LittleFS.open("/settings.txt", "w");
+            size_t written = settings_file.write((const uint8_t*)settings.data(), settings.size());
+            settings_file.close();
+            flash_stats.record(FLASH_SETTINGS, "/settings.txt", 0, written);
+        }
+    }
+    contacts.end();
+
+    Capture metrics;
+    flash_stats.print_metrics(metrics);
+    printf("%s", metrics.text.c_str());
+    storage_stats stats = contacts.get_stats();
+    char result[160];
+    snprintf(result, sizeof(result), "%d messages: contacts wrote %lu bytes in %lu blocks with %lu compactions, rewriting the file would have been %llu bytes",
+        messages, (unsigned long)flash_stats.get_bytes(FLASH_CONTACTS), (unsigned long)flash_stats.get_blocks(FLASH_CONTACTS),
+        (unsigned long)stats.compactions, (unsigned long long)whole_file);
+    TEST_MESSAGE(result);
+
+    TEST_ASSERT_EQUAL_UINT32(stats.flash_bytes, flash_stats.get_bytes(FLASH_CONTACTS));
+    TEST_ASSERT_EQUAL_UINT32(5 * 3000, flash_stats.get_bytes(FLASH_SETTINGS));
+    TEST_ASSERT_LESS_THAN(whole_file / 5, flash_stats.get_bytes(FLASH_CONTACTS));
+    TEST_ASSERT_TRUE(metrics.text.find("flash_estimated_lifetime_days") != std::string::npos);
+}
+
+int main(){
+    UNITY_BEGIN();
+    RUN_TEST(test_blocks);
+    RUN_TEST(test_rate);
+    RUN_TEST(test_month);
+    return UNITY_END();
+}
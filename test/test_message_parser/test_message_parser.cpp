@@ -0,0 +1,247 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    Host tests for Message_Parser: v1 and v2 messages, missing fields, bodies
+    with lines that look like fields, messages cut short, and a benchmark
+    against the String parser new_message() used before.
+
+    Run with: pio test -e native -f test_message_parser
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include <unity.h>
+#include "Message_Parser.h"
+
+//A v2 message as encoded by encode_message_v2() in TAG_Bridge.js, with 3 media files (3, unsupported, 17)
+static const uint8_t BRIDGE_V2[] = {
+    0xFA, 0x02, 0x7B, 0x10, 0x5E, 0x5F, 0x06, 0x0B, 0x15, 0x00, 0x03, 0x03, 0x00, 0x11,
+    'S', 'M', '0', '1', '2', '3',
+    '1', '6', '0', '4', '5', '5', '5', '1', '2', '3', '4',
+    'h', 0xC3, 0xA9, 'l', 'l', 'o', '\n', 'f', 'r', 'o', 'm', ':', 'x', '\n', 'm', 'e', 'd', 'i', 'a', ':', '9'
+};
+
+static message_fields fields;
+
+void setUp(){}
+void tearDown(){}
+
+/*  parse: Parse a message held in a string
+        text: Message, NULL terminated
+    RETURNS The result of parse_message()
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static bool parse(const char* text){
+    return parse_message((const uint8_t*)text, strlen(text), &fields);
+}
+
+/*  equals: Check a field against some text, where NULL means the field is missing
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static bool equals(const field_view& field, const char* text){
+    if(!text) return field.data == NULL && field.length == 0;
+    return field.data && field_equals(field, text);
+}
+
+/*  encode_v2: Build a v2 message the same way the bridge does
+        buffer: Holds the message
+    RETURNS Length of the message
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static uint16_t encode_v2(uint8_t* buffer, const char* id, const char* from, const char* body, const uint8_t* media, uint8_t media_count, uint32_t time){
+    uint8_t id_length = strlen(id);
+    uint8_t from_length = strlen(from);
+    uint16_t body_length = strlen(body);
+    buffer[0] = MESSAGE_V2_MAGIC;
+    buffer[1] = MESSAGE_V2_VERSION;
+    memcpy(buffer + 2, &time, 4);
+    buffer[6] = id_length;
+    buffer[7] = from_length;
+    memcpy(buffer + 8, &body_length, 2);
+    buffer[10] = media_count;
+    if(media_count) memcpy(buffer + MESSAGE_V2_HEADER, media, media_count);
+    uint8_t* text = buffer + MESSAGE_V2_HEADER + media_count;
+    memcpy(text, id, id_length);
+    memcpy(text + id_length, from, from_length);
+    memcpy(text + id_length + from_length, body, body_length);
+    return MESSAGE_V2_HEADER + media_count + id_length + from_length + body_length;
+}
+
+void test_fields(){
+    TEST_ASSERT_TRUE(parse("id:SM123\nfrom:16045551234\nbody:Hello there\nmedia:0\ntime:1600000000"));
+    TEST_ASSERT_TRUE(equals(fields.id, "SM123"));
+    TEST_ASSERT_TRUE(equals(fields.from, "16045551234"));
+    TEST_ASSERT_TRUE(equals(fields.body, "Hello there"));
+    TEST_ASSERT_EQUAL_UINT(0, fields.media_count);
+    TEST_ASSERT_EQUAL_UINT32(1600000000, fields.time);
+}
+
+void test_media(){
+    TEST_ASSERT_TRUE(parse("id:1\nfrom:2\nbody:hi\nmedia:3,NS,17\ntime:3"));
+    TEST_ASSERT_EQUAL_UINT(3, fields.media_count);
+    TEST_ASSERT_EQUAL_UINT8(3, fields.media[0]);
+    TEST_ASSERT_EQUAL_UINT8(MEDIA_UNSUPPORTED, fields.media[1]);
+    TEST_ASSERT_EQUAL_UINT8(17, fields.media[2]);
+
+    //Only the first MESSAGE_MEDIA_MAX are kept
+    TEST_ASSERT_TRUE(parse("id:1\nfrom:2\nbody:hi\nmedia:1,2,3,4,5,6,7,8,9,10,11,12\ntime:3"));
+    TEST_ASSERT_EQUAL_UINT(MESSAGE_MEDIA_MAX, fields.media_count);
+    TEST_ASSERT_EQUAL_UINT8(10, fields.media[9]);
+}
+
+void test_body_with_fields(){
+    //Lines in the body that look like fields are part of the body, the last media and time lines count
+    TEST_ASSERT_TRUE(parse("id:SM1\nfrom:1\nbody:a\nfrom:2\nid:x\nmedia:4\ntime:5\nb\nmedia:6,7\ntime:7"));
+    TEST_ASSERT_TRUE(equals(fields.id, "SM1"));
+    TEST_ASSERT_TRUE(equals(fields.from, "1"));
+    TEST_ASSERT_TRUE(equals(fields.body, "a\nfrom:2\nid:x\nmedia:4\ntime:5\nb"));
+    TEST_ASSERT_EQUAL_UINT(2, fields.media_count);
+    TEST_ASSERT_EQUAL_UINT8(6, fields.media[0]);
+    TEST_ASSERT_EQUAL_UINT32(7, fields.time);
+}
+
+void test_bodies(){
+    TEST_ASSERT_TRUE(parse("id:1\nfrom:2\nbody:\nmedia:0\ntime:3"));
+    TEST_ASSERT_TRUE(equals(fields.body, ""));
+    TEST_ASSERT_TRUE(parse("id:1\nfrom:2\nbody:x\n\ny\nmedia:0\ntime:3"));
+    TEST_ASSERT_TRUE(equals(fields.body, "x\n\ny"));
+    TEST_ASSERT_TRUE(parse("id:1\nfrom:2\nbody:hi\n"));
+    TEST_ASSERT_TRUE(equals(fields.body, "hi\n"));
+}
+
+void test_missing_fields(){
+    TEST_ASSERT_TRUE(parse("id:1\nbody:hi\ntime:3"));
+    TEST_ASSERT_TRUE(equals(fields.from, NULL));
+    TEST_ASSERT_TRUE(equals(fields.body, "hi"));
+    TEST_ASSERT_EQUAL_UINT(0, fields.media_count);
+    TEST_ASSERT_EQUAL_UINT32(3, fields.time);
+
+    TEST_ASSERT_TRUE(parse("id:1\nfrom:2\nbody:hi"));
+    TEST_ASSERT_TRUE(equals(fields.body, "hi"));
+    TEST_ASSERT_EQUAL_UINT32(0, fields.time);
+
+    TEST_ASSERT_TRUE(parse("from:2"));
+    TEST_ASSERT_TRUE(equals(fields.id, NULL));
+    TEST_ASSERT_TRUE(equals(fields.body, NULL));
+    TEST_ASSERT_TRUE(equals(fields.from, "2"));
+
+    TEST_ASSERT_TRUE(parse(""));
+    TEST_ASSERT_TRUE(equals(fields.id, NULL));
+    TEST_ASSERT_TRUE(parse("garbage\nid"));
+    TEST_ASSERT_TRUE(equals(fields.id, NULL));
+}
+
+void test_v2_from_bridge(){
+    TEST_ASSERT_TRUE(parse_message(BRIDGE_V2, sizeof(BRIDGE_V2), &fields));
+    TEST_ASSERT_TRUE(equals(fields.id, "SM0123"));
+    TEST_ASSERT_TRUE(equals(fields.from, "16045551234"));
+    TEST_ASSERT_TRUE(equals(fields.body, "h\xC3\xA9llo\nfrom:x\nmedia:9"));
+    TEST_ASSERT_EQUAL_UINT32(1600000123, fields.time);
+    TEST_ASSERT_EQUAL_UINT(3, fields.media_count);
+    TEST_ASSERT_EQUAL_UINT8(3, fields.media[0]);
+    TEST_ASSERT_EQUAL_UINT8(MEDIA_UNSUPPORTED, fields.media[1]);
+    TEST_ASSERT_EQUAL_UINT8(17, fields.media[2]);
+}
+
+void test_v2_cut_short(){
+    //Every message that's cut short is rejected rather than read past its end
+    for(uint16_t length = 1; length < sizeof(BRIDGE_V2); length++){
+        TEST_ASSERT_FALSE(parse_message(BRIDGE_V2, length, &fields));
+    }
+
+    //So is a later version
+    uint8_t later[sizeof(BRIDGE_V2)];
+    memcpy(later, BRIDGE_V2, sizeof(later));
+    later[1] = MESSAGE_V2_VERSION + 1;
+    TEST_ASSERT_FALSE(parse_message(later, sizeof(later), &fields));
+}
+
+void test_v2_too_many_media(){
+    //The first MESSAGE_MEDIA_MAX media files are kept, and the text is still found after the rest
+    uint8_t media[13] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13};
+    uint8_t buffer[128];
+    uint16_t length = encode_v2(buffer, "SM9", "1604", "Lots of photos", media, sizeof(media), 42);
+    TEST_ASSERT_TRUE(parse_message(buffer, length, &fields));
+    TEST_ASSERT_EQUAL_UINT(MESSAGE_MEDIA_MAX, fields.media_count);
+    TEST_ASSERT_EQUAL_UINT8(10, fields.media[9]);
+    TEST_ASSERT_TRUE(equals(fields.id, "SM9"));
+    TEST_ASSERT_TRUE(equals(fields.from, "1604"));
+    TEST_ASSERT_TRUE(equals(fields.body, "Lots of photos"));
+    TEST_ASSERT_EQUAL_UINT32(42, fields.time);
+}
+
+void test_v2_empty_fields(){
+    uint8_t buffer[64];
+    uint16_t length = encode_v2(buffer, "", "", "", NULL, 0, 0);
+    TEST_ASSERT_TRUE(parse_message(buffer, length, &fields));
+    TEST_ASSERT_TRUE(equals(fields.id, NULL));
+    TEST_ASSERT_TRUE(equals(fields.from, NULL));
+    TEST_ASSERT_TRUE(equals(fields.body, ""));
+}
+
+void test_field_helpers(){
+    TEST_ASSERT_TRUE(parse("id:SM123\nfrom:16045551234\nbody:x\nmedia:0\ntime:1600000000x"));
+    TEST_ASSERT_TRUE(field_equals(fields.id, "SM123"));
+    TEST_ASSERT_FALSE(field_equals(fields.id, "SM12"));
+    TEST_ASSERT_EQUAL_UINT32(1600000000, fields.time);
+    TEST_ASSERT_EQUAL_STRING("16045551234", field_to_string(fields.from).c_str());
+    field_view missing = {NULL, 0};
+    TEST_ASSERT_EQUAL_STRING("", field_to_string(missing).c_str());
+    TEST_ASSERT_EQUAL_UINT32(0, field_to_uint(missing));
+}
+
+/*  old_parse: The parser new_message() used before, which copies the payload into Strings
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static size_t old_parse(const uint8_t* payload, unsigned int length){
+    String message;
+    for(unsigned int i = 0; i < length; i++){
+        message += (char)payload[i];
+    }
+
+    String id = message.substring(message.indexOf("id:") + 3, message.indexOf("\nfrom:"));
+    String from_number = message.substring(message.indexOf("from:") + 5, message.indexOf("\nbody:"));
+    String body = message.substring(message.indexOf("body:") + 5, message.indexOf("\nmedia:"));
+    String media = message.substring(message.indexOf("media:") + 6, message.indexOf("\ntime:"));
+    String time = message.substring(message.indexOf("time:") + 5, message.length());
+    return id.length() + from_number.length() + body.length() + media.length() + time.length();
+}
+
+void test_benchmark(){
+    char body[301];
+    for(uint16_t i = 0; i < 300; i++) body[i] = i % 40 ? 'x' : '\n';
+    body[300] = '\0';
+    String message = String("id:SM0123456789abcdef0123456789abcdef\nfrom:16045551234\nbody:") + body + "\nmedia:0\ntime:1600000000";
+    const uint8_t* payload = (const uint8_t*)message.c_str();
+    const uint32_t runs = 100000;
+    volatile size_t sink = 0;
+
+    uint32_t start = micros();
+    for(uint32_t i = 0; i < runs; i++) sink += old_parse(payload, message.length());
+    uint32_t old_micros = micros() - start;
+
+    start = micros();
+    for(uint32_t i = 0; i < runs; i++){
+        parse_message(payload, message.length(), &fields);
+        sink += fields.body.length;
+    }
+    uint32_t new_micros = micros() - start;
+
+    char result[96];
+    snprintf(result, sizeof(result), "String parser %.0f ns/message, parse_message %.0f ns/message",
+        old_micros * 1000.0 / runs, new_micros * 1000.0 / runs);
+    TEST_MESSAGE(result);
+    TEST_ASSERT_LESS_THAN(old_micros, new_micros);
+}
+
+int main(){
+    UNITY_BEGIN();
+    RUN_TEST(test_fields);
+    RUN_TEST(test_media);
+    RUN_TEST(test_body_with_fields);
+    RUN_TEST(test_bodies);
+    RUN_TEST(test_missing_fields);
+    RUN_TEST(test_v2_from_bridge);
+    RUN_TEST(test_v2_cut_short);
+    RUN_TEST(test_v2_too_many_media);
+    RUN_TEST(test_v2_empty_fields);
+    RUN_TEST(test_field_helpers);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
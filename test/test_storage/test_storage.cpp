@@ -0,0 +1,381 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    Host tests for Persistent_Storage: importing 100, 1000 and 10000 contacts
+    from the old JSON file and looking each one up, with the time, flash
+    writes and heap each takes, random changes checked against a map, a write
+    cut off by a power cut, name requests expiring, empty files, changes made
+    during an import, merging an import into the contacts, an import with
+    more sorted runs than are merged at a time, and exports printed a piece at
+    a time while the contacts change.
+
+    Run with: pio test -e native -f test_storage
+
+    Created by Silviu Toderita in 2020.
+    silviu.toderita@gmail.com
+    silviutoderita.com
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include <unity.h>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "Persistent_Storage.h"
+
+//Collects everything printed to it
+struct Capture : public Print{
+    std::string text;
+    size_t write(uint8_t c){ text += (char)c; return 1; }
+    using Print::write;
+};
+
+void setUp(){
+    host_format();
+}
+
+void tearDown(){}
+
+/*  count_entries: Count the contacts in a JSON export
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static size_t count_entries(const std::string& json){
+    return std::count(json.begin(), json.end(), ':');
+}
+
+/*  import_legacy: Import contacts from the JSON file of older firmware and look each one up
+        count: Number of contacts
+        sorted: True if the file is in number order
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void import_legacy(int count, bool sorted){
+    host_format();
+    std::vector<uint64_t> numbers;
+    for(int i = 0; i < count; i++) numbers.push_back(16040000000ULL + i * 7);
+    if(!sorted) std::shuffle(numbers.begin(), numbers.end(), std::mt19937(count));
+
+    //Every fifth contact is a name request, names have escapes, and the first number appears again at the end
+    std::string json = "{";
+    for(int i = 0; i < count; i++){
+        if(i) json += ",";
+        json += "\"" + std::to_string(numbers[i]) + "\":";
+        if(i % 5 == 0) json += "\"_REQ1900000000\"";
+        else json += "\"Name \\\"q\\\" \\u00e9" + std::to_string(numbers[i] % 1000) + "\"";
+    }
+    json += ", \"bad\": 12, \"" + std::to_string(numbers[0]) + "\":\"Dup\"}";
+    host_file_put("/contacts.txt", json.data(), json.size());
+
+    Persistent_Storage contacts("contacts");
+    uint8_t kind;
+    uint32_t start = micros();
+    contacts.get("1", &kind);
+    uint32_t imported = micros();
+    TEST_ASSERT_FALSE(LittleFS.exists("/contacts.txt"));
+    storage_stats import_stats = contacts.get_stats();
+
+    TEST_ASSERT_EQUAL_STRING("Dup", contacts.get(std::to_string(numbers[0]).c_str(), &kind));
+    for(int i = 1; i < count; i++){
+        const char* name = contacts.get(std::to_string(numbers[i]).c_str(), &kind);
+        if(i % 5 == 0){
+            TEST_ASSERT_EQUAL(CONTACT_PENDING, kind);
+        }else{
+            std::string expected = "Name \"q\" \xC3\xA9" + std::to_string(numbers[i] % 1000);
+            TEST_ASSERT_EQUAL_STRING(expected.c_str(), name);
+        }
+    }
+    uint32_t looked_up = micros();
+    storage_stats lookup_stats = contacts.get_stats();
+
+    char result[160];
+    snprintf(result, sizeof(result), "%d contacts, %s: import %.1f ms, %u bytes written, peak heap %u bytes; lookup %.2f us, heap %u bytes",
+        count, sorted ? "sorted" : "shuffled", (imported - start) / 1000.0, import_stats.flash_bytes, import_stats.max_heap_bytes,
+        (double)(looked_up - imported) / count, lookup_stats.heap_bytes);
+    TEST_MESSAGE(result);
+
+    //Lookups only use the page index, and the import only adds one chunk to it
+    uint32_t page_index = (count + 31) / 32 * sizeof(uint64_t);
+    TEST_ASSERT_EQUAL_UINT32(page_index, lookup_stats.heap_bytes);
+    TEST_ASSERT_EQUAL_UINT32(import_stats.max_heap_bytes, lookup_stats.max_heap_bytes);
+    TEST_ASSERT_LESS_OR_EQUAL(page_index + 6 * 1024, import_stats.max_heap_bytes);
+
+    //Each contact is written a fixed number of times however the file is ordered
+    TEST_ASSERT_LESS_OR_EQUAL(3 * host_file_size("/contacts.tbl"), import_stats.flash_bytes);
+    contacts.end();
+    TEST_ASSERT_EQUAL_UINT32(0, contacts.get_stats().heap_bytes);
+}
+
+void test_import_100(){
+    import_legacy(100, false);
+    import_legacy(100, true);
+}
+
+void test_import_1000(){
+    import_legacy(1000, false);
+    import_legacy(1000, true);
+}
+
+void test_import_10000(){
+    import_legacy(10000, false);
+    import_legacy(10000, true);
+}
+
+void test_random_changes(){
+    std::map<std::string, std::string> expected; //Every contact that should be stored
+    {
+        Persistent_Storage contacts("contacts");
+        contacts.set_write_back(true);
+        std::mt19937 random(1);
+        for(int i = 0; i < 3000; i++){
+            std::string number = std::to_string(16040000000ULL + random() % 500);
+            int operation = random() % 10;
+            if(operation < 6){
+                std::string name = random() % 3 == 0 ? "_REQ" + std::to_string(1600000000 + random() % 1000) : "Name" + std::to_string(random() % 1000);
+                TEST_ASSERT_TRUE(contacts.set(number.c_str(), name.c_str()));
+                expected[number] = name;
+            }else if(operation < 8){
+                TEST_ASSERT_TRUE(contacts.remove(number.c_str()));
+                expected.erase(number);
+            }else{
+                //Name requests are stored, but get() only returns names
+                std::string name = expected.count(number) && expected[number].compare(0, 4, "_REQ") ? expected[number] : "";
+                TEST_ASSERT_EQUAL_STRING(name.c_str(), contacts.get(number.c_str()));
+            }
+            if(i % 7 == 0) contacts.handle();
+        }
+        storage_stats stats = contacts.get_stats();
+        char result[128];
+        snprintf(result, sizeof(result), "%u writes: %u bytes, %u bytes written, %u compactions, %u flushes, %u coalesced",
+            stats.writes, stats.logical_bytes, stats.flash_bytes, stats.compactions, stats.flushes, stats.coalesced);
+        TEST_MESSAGE(result);
+        contacts.end();
+        TEST_ASSERT_EQUAL_UINT32(0, contacts.get_stats().heap_bytes);
+    }
+
+    //A power cut in the middle of the last write loses only that write
+    {
+        Persistent_Storage contacts("contacts");
+        contacts.set("19999999999", "Torn");
+        contacts.end();
+        host_file_cut("/contacts.log", 3);
+    }
+
+    Persistent_Storage contacts("contacts");
+    size_t pending = 0;
+    for(auto& contact : expected){
+        bool request = contact.second.compare(0, 4, "_REQ") == 0;
+        if(request) pending++;
+        TEST_ASSERT_EQUAL_STRING(request ? "" : contact.second.c_str(), contacts.get(contact.first.c_str()));
+    }
+    TEST_ASSERT_EQUAL_STRING("", contacts.get("19999999999"));
+    Capture all;
+    TEST_ASSERT_TRUE(contacts.export_json(all));
+    TEST_ASSERT_EQUAL_UINT(expected.size(), count_entries(all.text));
+
+    TEST_ASSERT_FALSE(contacts.set("abc", "x"));
+    TEST_ASSERT_FALSE(contacts.set("0123", "x"));
+
+    //Name requests expire once the time is known
+    uint8_t kind;
+    contacts.set_pending("15550000001", 2000000000);
+    contacts.get("15550000001", &kind);
+    TEST_ASSERT_EQUAL(CONTACT_PENDING, kind);
+    contacts.set_time(2000000001);
+    contacts.get("15550000001", &kind);
+    TEST_ASSERT_EQUAL(CONTACT_NONE, kind);
+    Capture names;
+    TEST_ASSERT_TRUE(contacts.export_json(names));
+    TEST_ASSERT_EQUAL_UINT(expected.size() - pending, count_entries(names.text));
+    contacts.end();
+}
+
+void test_empty_files(){
+    //An empty table or old JSON file holds no contacts, and mustn't stop the storage from loading
+    host_file_put("/contacts.tbl", "", 0);
+    host_file_put("/contacts.txt", "", 0);
+    Persistent_Storage contacts("contacts");
+    TEST_ASSERT_EQUAL_STRING("", contacts.get("16045551234"));
+    TEST_ASSERT_FALSE(LittleFS.exists("/contacts.txt"));
+    TEST_ASSERT_TRUE(contacts.set("16045551234", "Ada"));
+    TEST_ASSERT_EQUAL_STRING("Ada", contacts.get("16045551234"));
+    contacts.end();
+    TEST_ASSERT_EQUAL_STRING("Ada", contacts.get("16045551234"));
+    contacts.end();
+}
+
+/*  set_during_import: Replace the contacts while others are set, enough to fill the overlay
+        write_back: True if changes are held in RAM before being written to flash
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void set_during_import(bool write_back){
+    host_format();
+    Persistent_Storage contacts("contacts");
+    contacts.set_write_back(write_back);
+    contacts.set("15550000001", "Old");
+    contacts.set("15550000002", "Gone");
+
+    char line[64];
+    TEST_ASSERT_TRUE(contacts.import_begin(false));
+    for(int i = 0; i < 500; i++){
+        snprintf(line, sizeof(line), "1604555%04d,Imported %d", i, i);
+        TEST_ASSERT_EQUAL_UINT(1, contacts.import_line(line, IMPORT_CSV));
+        if(i == 100) TEST_ASSERT_TRUE(contacts.set("16045550005", "Set during"));
+        if(i == 200) TEST_ASSERT_TRUE(contacts.set("15550000001", "Kept"));
+    }
+
+    //Once the overlay and the changes held in RAM are full, set() fails until the import is done
+    int stored = 0;
+    for(int i = 0; i < 400; i++){
+        if(contacts.set(std::to_string(17000000000ULL + i).c_str(), "X")) stored++;
+        contacts.handle();
+    }
+    TEST_ASSERT_TRUE(contacts.import_end());
+    contacts.flush();
+
+    for(int reload = 0; reload < 2; reload++){
+        if(reload){
+            contacts.end();
+            for(int i = 0; i < 50; i++) contacts.handle();
+        }
+        TEST_ASSERT_EQUAL_STRING("Set during", contacts.get("16045550005"));
+        TEST_ASSERT_EQUAL_STRING("Imported 6", contacts.get("16045550006"));
+        TEST_ASSERT_EQUAL_STRING("Imported 499", contacts.get("16045550499"));
+        TEST_ASSERT_EQUAL_STRING("Kept", contacts.get("15550000001"));
+        TEST_ASSERT_EQUAL_STRING("", contacts.get("15550000002"));
+        for(int i = 0; i < stored; i++) TEST_ASSERT_EQUAL_STRING("X", contacts.get(std::to_string(17000000000ULL + i).c_str()));
+    }
+    contacts.end();
+}
+
+void test_set_during_import(){
+    set_during_import(false);
+    set_during_import(true);
+}
+
+void test_merge_import(){
+    Persistent_Storage contacts("contacts");
+    char line[64];
+    TEST_ASSERT_TRUE(contacts.import_begin(false));
+    for(int i = 0; i < 300; i++){
+        snprintf(line, sizeof(line), "1604555%04d,Base %d", i, i);
+        TEST_ASSERT_EQUAL_UINT(1, contacts.import_line(line, IMPORT_CSV));
+    }
+    TEST_ASSERT_TRUE(contacts.import_end());
+    TEST_ASSERT_EQUAL_STRING("Base 5", contacts.get("16045550005"));
+    contacts.set("16045550010", "Before");
+
+    //A merge keeps the contacts that aren't in the import
+    TEST_ASSERT_TRUE(contacts.import_begin(true));
+    for(int i = 0; i < 300; i += 3){
+        snprintf(line, sizeof(line), "{\"1604555%04d\":\"Merged %d\"}", i, i);
+        TEST_ASSERT_EQUAL_UINT(1, contacts.import_line(line, IMPORT_JSON_LINES));
+    }
+    for(int i = 0; i < 200; i++){
+        snprintf(line, sizeof(line), "1778555%04d,New %d", i, i);
+        TEST_ASSERT_EQUAL_UINT(1, contacts.import_line(line, IMPORT_CSV));
+    }
+    TEST_ASSERT_TRUE(contacts.import_end());
+
+    for(int reload = 0; reload < 2; reload++){
+        if(reload) contacts.end();
+        TEST_ASSERT_EQUAL_STRING("Merged 3", contacts.get("16045550003"));
+        TEST_ASSERT_EQUAL_STRING("Base 4", contacts.get("16045550004"));
+        TEST_ASSERT_EQUAL_STRING("Before", contacts.get("16045550010"));
+        TEST_ASSERT_EQUAL_STRING("New 100", contacts.get("17785550100"));
+        TEST_ASSERT_EQUAL_STRING("New 199", contacts.get("17785550199"));
+    }
+    contacts.end();
+}
+
+void test_import_runs(){
+    Persistent_Storage contacts("contacts");
+    char line[64];
+    TEST_ASSERT_TRUE(contacts.import_begin(false));
+    for(int i = 0; i < 1000; i++){
+        snprintf(line, sizeof(line), "1604%07d,Base %d", i * 20 + 1, i);
+        TEST_ASSERT_EQUAL_UINT(1, contacts.import_line(line, IMPORT_CSV));
+    }
+    TEST_ASSERT_TRUE(contacts.import_end());
+
+    //Enough shuffled contacts for more runs than are merged at a time, each number twice so the later one wins
+    std::vector<int> numbers;
+    for(int i = 0; i < 10000; i++) numbers.push_back(i * 2);
+    std::vector<int> order = numbers;
+    order.insert(order.end(), numbers.begin(), numbers.end());
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+    std::map<int, int> last;
+    TEST_ASSERT_TRUE(contacts.import_begin(true));
+    for(size_t i = 0; i < order.size(); i++){
+        snprintf(line, sizeof(line), "1604%07d,Run %d", order[i], (int)i);
+        TEST_ASSERT_EQUAL_UINT(1, contacts.import_line(line, IMPORT_CSV));
+        last[order[i]] = i;
+    }
+    TEST_ASSERT_TRUE(contacts.import_end());
+
+    for(int reload = 0; reload < 2; reload++){
+        if(reload) contacts.end();
+        for(int i = 0; i < 20000; i++){
+            snprintf(line, sizeof(line), "1604%07d", i);
+            std::string expected;
+            if(i % 2 == 0) expected = "Run " + std::to_string(last[i]);
+            else if(i % 20 == 1) expected = "Base " + std::to_string(i / 20);
+            TEST_ASSERT_EQUAL_STRING(expected.c_str(), contacts.get(line));
+        }
+    }
+    TEST_ASSERT_FALSE(LittleFS.exists("/contacts.run"));
+    TEST_ASSERT_FALSE(LittleFS.exists("/contacts.mrg"));
+    contacts.end();
+}
+
+void test_export_pieces(){
+    Persistent_Storage contacts("contacts");
+    char line[64];
+    TEST_ASSERT_TRUE(contacts.import_begin(false));
+    for(int i = 0; i < 300; i++){
+        snprintf(line, sizeof(line), "1604555%04d,%s %d", i * 2, i % 3 ? "Ann" : "Bob", i);
+        TEST_ASSERT_EQUAL_UINT(1, contacts.import_line(line, IMPORT_CSV));
+    }
+    TEST_ASSERT_TRUE(contacts.import_end());
+    contacts.set("16045550001", "Changed before");
+
+    //Printed 7 contacts at a time, each export matches the one printed all at once
+    Capture whole[3];
+    Capture pieces[3];
+    TEST_ASSERT_TRUE(contacts.export_json(whole[0]));
+    TEST_ASSERT_TRUE(contacts.export_csv(whole[1]));
+    TEST_ASSERT_TRUE(contacts.export_page(whole[2], 40, 30, "bob"));
+    export_position position[3] = {{0, 0, false}, {0, 0, false}, {0, 0, false}};
+    while(contacts.export_json(pieces[0], &position[0], 7));
+    while(contacts.export_csv(pieces[1], &position[1], 7));
+    while(contacts.export_page(pieces[2], &position[2], 7, 40, 30, "bob"));
+    for(int i = 0; i < 3; i++) TEST_ASSERT_EQUAL_STRING(whole[i].text.c_str(), pieces[i].text.c_str());
+    TEST_ASSERT_EQUAL_UINT(301, count_entries(pieces[0].text));
+    TEST_ASSERT_EQUAL_UINT32(100, position[2].count);
+
+    //Changes between pieces show up if the export hasn't got to them yet, even after a compaction
+    Capture changed;
+    export_position changing = {0, 0, false};
+    for(int piece = 0; contacts.export_json(changed, &changing, 7); piece++){
+        if(piece == 10){
+            contacts.set("16045550003", "Too late");
+            contacts.set("16045550501", "In time");
+            contacts.remove("16045550500");
+            for(int i = 0; i < 100; i++) contacts.set(std::to_string(17780000000ULL + i).c_str(), "New");
+        }
+    }
+    TEST_ASSERT_TRUE(changed.text.find("Too late") == std::string::npos);
+    TEST_ASSERT_TRUE(changed.text.find("In time") != std::string::npos);
+    TEST_ASSERT_TRUE(changed.text.find("16045550500") == std::string::npos);
+    TEST_ASSERT_EQUAL_UINT(301 + 100, count_entries(changed.text));
+    TEST_ASSERT_GREATER_THAN(0, contacts.get_stats().compactions);
+    contacts.end();
+}
+
+int main(){
+    UNITY_BEGIN();
+    RUN_TEST(test_import_100);
+    RUN_TEST(test_import_1000);
+    RUN_TEST(test_import_10000);
+    RUN_TEST(test_random_changes);
+    RUN_TEST(test_empty_files);
+    RUN_TEST(test_set_during_import);
+    RUN_TEST(test_merge_import);
+    RUN_TEST(test_import_runs);
+    RUN_TEST(test_export_pieces);
+    return UNITY_END();
+}
@@ -0,0 +1,105 @@
+//Upload a file to the TAG Machine with its CRC32, so a file that arrives damaged is thrown away instead of
+//replacing the one that's there. If the connection drops, the upload carries on from what was saved.
+//Returns a jQuery promise that's resolved with the response text.
+var upload_attempts = 3;
+
+//Work out the CRC32 of an ArrayBuffer (the one used by zip and PNG)
+function crc32(buffer){
+    var bytes = new Uint8Array(buffer);
+    var crc = 0xFFFFFFFF;
+    for(var i = 0; i < bytes.length; i++){
+        crc ^= bytes[i];
+        for(var bit = 0; bit < 8; bit++) crc = (crc >>> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ((crc ^ 0xFFFFFFFF) >>> 0).toString(16);
+}
+
+//Work out the MD5 of an ArrayBuffer, as 32 hex digits
+function md5(buffer){
+    var bytes = new Uint8Array(buffer);
+    //The message is padded with 0x80, zeros and its length in bits, to a multiple of 64 bytes
+    var words = new Uint32Array(((bytes.length + 8 >>> 6) + 1) * 16);
+    for(var i = 0; i < bytes.length; i++) words[i >> 2] |= bytes[i] << (i % 4 * 8);
+    words[bytes.length >> 2] |= 0x80 << (bytes.length % 4 * 8);
+    words[words.length - 2] = bytes.length << 3;
+    words[words.length - 1] = Math.floor(bytes.length / 0x20000000);
+
+    var shifts = [7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21];
+    var constants = [];
+    for(var i = 0; i < 64; i++) constants[i] = Math.floor(Math.abs(Math.sin(i + 1)) * 0x100000000) | 0;
+
+    var state = [0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476];
+    for(var block = 0; block < words.length; block += 16){
+        var a = state[0], b = state[1], c = state[2], d = state[3];
+        for(var i = 0; i < 64; i++){
+            var f, g;
+            if(i < 16){
+                f = (b & c) | (~b & d);
+                g = i;
+            }else if(i < 32){
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) % 16;
+            }else if(i < 48){
+                f = b ^ c ^ d;
+                g = (3 * i + 5) % 16;
+            }else{
+                f = c ^ (b | ~d);
+                g = 7 * i % 16;
+            }
+            var sum = (a + f + constants[i] + words[block + g]) | 0;
+            var shift = shifts[(i >> 4) * 4 + i % 4];
+            a = d;
+            d = c;
+            c = b;
+            b = (b + ((sum << shift) | (sum >>> (32 - shift)))) | 0;
+        }
+        state[0] = (state[0] + a) | 0;
+        state[1] = (state[1] + b) | 0;
+        state[2] = (state[2] + c) | 0;
+        state[3] = (state[3] + d) | 0;
+    }
+
+    //The digest is the state's bytes, lowest first
+    var hex = "";
+    for(var i = 0; i < 16; i++) hex += ("0" + ((state[i >> 2] >>> (i % 4 * 8)) & 0xFF).toString(16)).slice(-2);
+    return hex;
+}
+
+function upload_file(file){
+    var result = $.Deferred();
+    var reader = new FileReader();
+
+    reader.onload = function(){
+        var crc = crc32(reader.result);
+
+        //POST the file from offset, and if the connection drops, ask how much was saved and try again from there
+        function send(offset, attempt){
+            var fd = new FormData();
+            fd.append('file', file.slice(offset), file.name);
+
+            $.ajax({
+                url: '/upload?offset=' + offset + '&crc32=' + crc,
+                type: 'POST',
+                data: fd,
+                processData: false,
+                contentType: false
+            }).done(function(data){
+                result.resolve(data);
+            }).fail(function(xhr){
+                if(xhr.status != 0 || attempt >= upload_attempts) return result.reject(xhr);
+                $.getJSON('/upload', {name: file.name}).done(function(status){
+                    send(Math.min(status.offset, file.size), attempt + 1);
+                }).fail(function(){
+                    send(0, attempt + 1);
+                });
+            });
+        }
+        send(0, 1);
+    };
+    reader.onerror = function(){
+        result.reject();
+    };
+    reader.readAsArrayBuffer(file);
+
+    return result.promise();
+}